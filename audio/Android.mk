@@ -20,7 +20,9 @@ LOCAL_MODULE := audio.primary.$(TARGET_BOOTLOADER_BOARD_NAME)
 LOCAL_MODULE_PATH := $(TARGET_OUT_SHARED_LIBRARIES)/hw
 LOCAL_MODULE_TAGS := optional
 
-LOCAL_SRC_FILES := audio_hw.c ril_interface.c
+LOCAL_SRC_FILES := audio_hw.c ril_interface.c route_cache.c audio_ring.c \
+	preproc_pipeline.c echo_delay.c capture_hub.c codec_eq.c audio_stats.c \
+	gain_ramp.c voice_gate.c
 
 LOCAL_C_INCLUDES += \
 	external/tinyalsa/include \
@@ -29,5 +31,9 @@ LOCAL_C_INCLUDES += \
 	$(call include-path-for, audio-effects)
 
 LOCAL_SHARED_LIBRARIES := liblog libcutils libtinyalsa libaudioutils libdl libexpat
+LOCAL_STATIC_LIBRARIES := libthreadpolicy
 
 include $(BUILD_SHARED_LIBRARY)
+
+# the host tests under tests/ stay out of the device build
+include $(LOCAL_PATH)/effects/Android.mk
@@ -21,12 +21,17 @@
 #define LOG_TAG "audio_hw_primary"
 #define LOG_NDEBUG 0
 
+#include <dlfcn.h>
 #include <errno.h>
 #include <pthread.h>
+#include <stdatomic.h>
 #include <stdint.h>
 #include <sys/time.h>
 #include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
 #include <expat.h>
+#include <limits.h>
 
 #include <cutils/log.h>
 #include <cutils/str_parms.h>
@@ -34,9 +39,11 @@
 
 #include <hardware/hardware.h>
 #include <system/audio.h>
+#include <system/thread_defs.h>
 #include <hardware/audio.h>
 
 #include <tinyalsa/asoundlib.h>
+#include <thread_policy.h>
 #include <audio_utils/resampler.h>
 #include <audio_utils/echo_reference.h>
 #include <hardware/audio_effect.h>
@@ -44,6 +51,16 @@
 
 #include "audio_hw.h"
 #include "ril_interface.h"
+#include "route_cache.h"
+#include "audio_ring.h"
+#include "preproc_pipeline.h"
+#include "echo_delay.h"
+#include "capture_hub.h"
+#include "codec_eq.h"
+#include "codec_fx.h"
+#include "audio_stats.h"
+#include "gain_ramp.h"
+#include "voice_gate.h"
 
 struct pcm_config pcm_config_mm = {
     .channels = 2,
@@ -63,6 +80,15 @@ struct pcm_config pcm_config_tones = {
     .avail_min = 0,
 };
 
+/* rate and channels are set from the stream config */
+struct pcm_config pcm_config_hdmi = {
+    .channels = 2,
+    .rate = HDMI_DEFAULT_SAMPLING_RATE,
+    .period_size = HDMI_PERIOD_SIZE,
+    .period_count = HDMI_PERIOD_COUNT,
+    .format = PCM_FORMAT_S16_LE,
+};
+
 struct pcm_config pcm_config_capture = {
     .channels = 2,
     .rate = DEFAULT_IN_SAMPLING_RATE,
@@ -88,6 +114,13 @@ struct m0_audio_device {
     struct m0_dev_cfg *dev_cfgs;
     int num_dev_cfgs;
     struct mixer *mixer;
+    struct mixer_shadow *mixer_shadow;
+    struct route_cache route_cache;
+    struct mixer_txn_write *txn_pending;    /* writes of the open transaction, in order */
+    unsigned int txn_num_pending;
+    unsigned int txn_max_pending;
+    unsigned int txn_path;
+    int txn_depth;
     audio_mode_t mode;
     int active_out_device;
     int out_device;
@@ -99,23 +132,51 @@ struct m0_audio_device {
     struct pcm *pcm_bt_ul;
     int in_call;
     float voice_volume;
-    struct m0_stream_in *active_input;
+    struct m0_stream_in *active_input;     /* last started, owns the capture route */
+    struct capture_hub capture_hub;         /* PORT_CAPTURE shared by all inputs */
     struct m0_stream_out *outputs[OUTPUT_TOTAL];
     bool mic_mute;
+    float master_volume;
+    bool master_mute;
     struct echo_reference_itfe *echo_reference;
+    struct m0_stream_out *echo_reference_out;   /* output feeding echo_reference */
     bool bluetooth_nrec;
     bool bluetooth_wb;
     int wb_amr;
     bool screen_off;
 
+    /* effects run by the codec EQ and DRC, applied on top of the tuning
+     * the configuration left in the codec, see set_eq_filter() */
+    struct codec_eq_params eq;
+    struct codec_eq_regs eq_base;
+    bool eq_base_valid;
+    /* codec effects library, optional, see codec_fx.h */
+    void *fx_lib;
+    codec_fx_start_output_t fx_start_output;
+    codec_fx_stop_output_t fx_stop_output;
+
+    /* snapshot of screen_off, active_input and mode for the output write
+     * path, which must not take the hw device mutex. Only updated with the
+     * hw device mutex held, see adev_publish_state() */
+    atomic_uint state;
+
+    /* closes the PCM of outputs left in warm standby, see do_output_warm_standby() */
+    pthread_t standby_thread;
+    pthread_cond_t standby_cond;    /* waited on with the hw device mutex */
+    bool standby_thread_exit;
+    int standby_grace_ms;
+
     /* RIL */
     struct ril_handle ril;
+
+    struct audio_stats_dev stats;
 };
 
 struct m0_stream_out {
     struct audio_stream_out stream;
 
     pthread_mutex_t lock;       /* see note below on mutex acquisition order */
+    pthread_mutex_t pre_lock;   /* acquire before lock to avoid DOS by playback thread */
     struct pcm_config config[PCM_TOTAL];
     struct pcm *pcm[PCM_TOTAL];
     struct resampler_itfe *resampler;
@@ -125,8 +186,33 @@ struct m0_stream_out {
     struct echo_reference_itfe *echo_reference;
     int write_threshold;
     bool use_long_periods;
+    audio_io_handle_t handle;
+    int type;                   /* OUTPUT_*, index in adev->outputs[] */
     audio_channel_mask_t channel_mask;
-    audio_channel_mask_t sup_channel_masks[3];
+    /* 0 terminated, reported by out_get_parameters() */
+    audio_channel_mask_t sup_channel_masks[ARRAY_SIZE(out_channels_name_to_enum_table) + 1];
+    uint32_t sup_sample_rates[ARRAY_SIZE(hdmi_sample_rates) + 1];
+
+    /* frames at stream rate accepted by the driver since the stream was
+     * opened, and the last position reported, both survive standby */
+    uint64_t written;
+    uint64_t presented;
+    int64_t presented_ns;       /* timestamp last reported, CLOCK_MONOTONIC */
+    uint64_t written_at_start;  /* written when the stream last left standby */
+    uint64_t underrun_check_from;   /* see out_check_underrun() */
+
+    /* in standby with the PCM still open until warm_deadline (CLOCK_MONOTONIC).
+     * Both are written with the hw device and stream mutexes held, either
+     * one is enough to read them */
+    bool warm_standby;
+    struct timespec warm_deadline;
+
+    /* master volume and mute, applied at the driver rate */
+    struct gain_ramp gain;
+    int16_t *gain_buf;
+    size_t gain_buf_size;
+
+    struct audio_stats_out stats;
 
     struct m0_audio_device *dev;
 };
@@ -150,7 +236,6 @@ struct m0_stream_in {
 
     pthread_mutex_t lock;       /* see note below on mutex acquisition order */
     struct pcm_config config;
-    struct pcm *pcm;
     int device;
     struct resampler_itfe *resampler;
     struct resampler_buffer_provider buf_provider;
@@ -159,28 +244,59 @@ struct m0_stream_in {
     int source;
     struct echo_reference_itfe *echo_reference;
     bool need_echo_reference;
+    struct echo_delay echo_delay;
 
-    int16_t *read_buf;
-    size_t read_buf_size;
+    /* all the buffers below are carved from arena, see in_alloc_arena() */
+    int16_t *arena;
+
+    int16_t *read_buf;              /* one driver period */
     size_t read_buf_frames;
 
-    int16_t *proc_buf_in;
+    /* preprocessing input and echo reference staging, effects are fed with
+     * the contiguous spans of these rings so leftovers are never moved */
+    struct audio_ring proc_ring;
+    int16_t *proc_ring_buf;
     int16_t *proc_buf_out;
-    size_t proc_buf_size;
-    size_t proc_buf_frames;
+    size_t proc_buf_size;           /* frames processed per pass, one HAL buffer */
+    size_t proc_ring_frames;        /* capacity of proc and ref rings, a power of two */
+
+    struct audio_ring ref_ring;
+    int16_t *ref_ring_buf;
 
-    int16_t *ref_buf;
-    size_t ref_buf_size;
-    size_t ref_buf_frames;
+    /* the effects of preprocessors[] chained with their own output queues */
+    struct preproc_pipeline preproc;
+    int16_t *preproc_buf;
 
     int read_status;
 
+    /* AUDIO_SOURCE_VOICE_* captured during a call, 0 otherwise */
+    int voice_tap;
+
+    /* frames fed by adev->capture_hub while the stream is active */
+    struct capture_hub_client capture;
+    atomic_llong position_ns;       /* timestamp last reported, CLOCK_MONOTONIC */
+    int16_t *capture_ring_buf;
+
+    /* hotword capture at the stream rate, see in_configure_capture() */
+    bool low_power;
+    struct voice_gate gate;         /* only used by the capture thread */
+    atomic_bool speech;             /* gate state for the reader */
+    int16_t *preroll_buf;           /* capture ring while low_power, if any */
+    size_t preroll_frames;
+    struct m0_stream_in *active_next;   /* next in the adev->active_input list */
+
     int num_preprocessors;
     struct effect_info_s preprocessors[MAX_PREPROCESSORS];
 
     bool aux_channels_changed;
     uint32_t main_channels;
     uint32_t aux_channels;
+
+    /* mic mute, applied to the frames returned by in_read() */
+    struct gain_ramp mute;
+
+    struct audio_stats_in stats;
+
     struct m0_audio_device *dev;
 };
 
@@ -197,8 +313,45 @@ struct m0_dev_cfg {
 /**
  * NOTE: when multiple mutexes have to be acquired, always respect the following order:
  *        hw device > in stream > out stream
+ *
+ * The out stream mutex is always acquired with lock_output_stream(): the
+ * write path holds it for a whole blocking write and takes it again right
+ * after, which would otherwise starve routing and standby requests.
  */
 
+static void lock_output_stream(struct m0_stream_out *out)
+{
+    pthread_mutex_lock(&out->pre_lock);
+    pthread_mutex_lock(&out->lock);
+    pthread_mutex_unlock(&out->pre_lock);
+}
+
+#define ADEV_STATE_SCREEN_OFF     (1 << 0)
+#define ADEV_STATE_ACTIVE_INPUT   (1 << 1)
+#define ADEV_STATE_VOICE_COMM_IN  (1 << 2)
+#define ADEV_STATE_MODE_SHIFT     8
+
+/* must be called with hw device mutex locked */
+static void adev_publish_state(struct m0_audio_device *adev)
+{
+    unsigned int state = (unsigned int)adev->mode << ADEV_STATE_MODE_SHIFT;
+
+    if (adev->screen_off)
+        state |= ADEV_STATE_SCREEN_OFF;
+    if (adev->active_input) {
+        state |= ADEV_STATE_ACTIVE_INPUT;
+        if (adev->active_input->source == AUDIO_SOURCE_VOICE_COMMUNICATION)
+            state |= ADEV_STATE_VOICE_COMM_IN;
+    }
+
+    atomic_store_explicit(&adev->state, state, memory_order_release);
+}
+
+static unsigned int adev_get_state(struct m0_audio_device *adev)
+{
+    return atomic_load_explicit(&adev->state, memory_order_acquire);
+}
+
 static void select_output_device(struct m0_audio_device *adev);
 static void select_input_device(struct m0_audio_device *adev);
 static void set_noise_supression(struct m0_audio_device *adev, int enable);
@@ -207,153 +360,357 @@ static int do_input_standby(struct m0_stream_in *in);
 static int do_output_standby(struct m0_stream_out *out);
 static void in_update_aux_channels(struct m0_stream_in *in, effect_handle_t effect);
 
-/* The enable flag when 0 makes the assumption that enums are disabled by
- * "Off" and integers/booleans by 0 */
-static int set_bigroute_by_array(struct mixer *mixer, struct route_setting *route,
-                              int enable)
+/* Resolve a route entry to its mixer control and to the raw value written
+ * when the route is enabled or disabled. This is done once per entry so that
+ * route changes do not have to look controls up by name. */
+static int route_compile(struct m0_audio_device *adev, struct route_setting *r)
 {
+    unsigned int i, num_ctls;
     struct mixer_ctl *ctl;
-    unsigned int i, j, ret;
+    const char *name;
 
-    /* Go through the route array and set each value */
-    i = 0;
-    while (route[i].ctl_name) {
-        ctl = mixer_get_ctl_by_name(mixer, route[i].ctl_name);
-        if (!ctl) {
-        ALOGE("Unknown control '%s'\n", route[i].ctl_name);
+    if (r->compiled)
+        return 0;
+
+    num_ctls = mixer_get_num_ctls(adev->mixer);
+    for (i = 0; i < num_ctls; i++) {
+        name = mixer_ctl_get_name(mixer_get_ctl(adev->mixer, i));
+        if (name && strcmp(name, r->ctl_name) == 0)
+            break;
+    }
+    if (i == num_ctls) {
+        ALOGE("Unknown control '%s'\n", r->ctl_name);
+        return -EINVAL;
+    }
+
+    ctl = mixer_get_ctl(adev->mixer, i);
+    r->ctl_id = i;
+    r->on_value = r->intval;
+    r->off_value = 0;
+
+    if (r->strval) {
+        unsigned int num_enums = mixer_ctl_get_num_enums(ctl);
+        int on = -1;
+        int off = -1;
+
+        for (i = 0; i < num_enums; i++) {
+            const char *str = mixer_ctl_get_enum_string(ctl, i);
+            if (strcmp(str, r->strval) == 0)
+                on = i;
+            if (strcmp(str, "Off") == 0)
+                off = i;
+        }
+        if (on < 0) {
+            ALOGE("Unknown value '%s' for '%s'\n", r->strval, r->ctl_name);
             return -EINVAL;
         }
+        r->on_value = on;
+        r->off_value = off;
+    }
 
-        if (route[i].strval) {
-            if (enable) {
-                ret = mixer_ctl_set_enum_by_string(ctl, route[i].strval);
-                if (ret != 0) {
-                    ALOGE("Failed to set '%s' to '%s'\n", route[i].ctl_name, route[i].strval);
-                } else {
-                    ALOGV("Set '%s' to '%s'\n", route[i].ctl_name, route[i].strval);
-                }
-            } else {
-                ret = mixer_ctl_set_enum_by_string(ctl, "Off");
-                if (ret != 0) {
-                    ALOGE("Failed to set '%s' to '%s'\n", route[i].ctl_name, route[i].strval);
-                } else {
-                    ALOGV("Set '%s' to '%s'\n", route[i].ctl_name, "Off");
-                }
-            }
-        } else {
-            /* This ensures multiple (i.e. stereo) values are set jointly */
-            for (j = 0; j < mixer_ctl_get_num_values(ctl); j++) {
-                if (enable) {
-                    ret = mixer_ctl_set_value(ctl, j, route[i].intval);
-                    if (ret != 0) {
-                        ALOGE("Failed to set '%s' to '%d'\n", route[i].ctl_name, route[i].intval);
-                    } else {
-                        ALOGV("Set '%s' to '%d'\n", route[i].ctl_name, route[i].intval);
-                    }
-                } else {
-                    ret = mixer_ctl_set_value(ctl, j, 0);
-                    if (ret != 0) {
-                        ALOGE("Failed to set '%s' to '%d'\n", route[i].ctl_name, route[i].intval);
-                    } else {
-                        ALOGV("Set '%s' to '%d'\n", route[i].ctl_name, 0);
-                    }
-                }
+    r->compiled = true;
+    return 0;
+}
+
+/* Mixer transactions: while a transaction is open, route writes are queued
+ * in order and written when the outermost transaction is committed, each
+ * with a single element write for all of the control values.
+ * The writes of one path are all kept, as paths may toggle a control on
+ * purpose (see "Work around core issue" in tiny_hw.xml). A write replaces
+ * the writes of earlier paths to the same control and is done at its own
+ * place in the sequence, as if the earlier ones had been written and
+ * immediately overwritten. */
+static void mixer_txn_begin(struct m0_audio_device *adev)
+{
+    adev->txn_depth++;
+}
+
+/* Start a new path: the writes queued from now on replace those queued
+ * before to the same controls, see above */
+static void mixer_txn_path(struct m0_audio_device *adev)
+{
+    if (++adev->txn_path == 0)
+        adev->txn_path = 1;
+}
+
+/* Write all values of a control with a single element write where tinyalsa
+ * allows it: mixer_ctl_set_value() reads the whole element back before every
+ * single-value write. */
+static int mixer_ctl_write(struct mixer_ctl *ctl, int value)
+{
+    unsigned int num_values = mixer_ctl_get_num_values(ctl);
+    long values[MIXER_TXN_MAX_VALUES];
+    unsigned int j;
+    int ret = 0;
+
+    switch (mixer_ctl_get_type(ctl)) {
+    case MIXER_CTL_TYPE_ENUM:
+        return mixer_ctl_set_enum_by_string(ctl, mixer_ctl_get_enum_string(ctl, value));
+    case MIXER_CTL_TYPE_BOOL:
+    case MIXER_CTL_TYPE_INT:
+        if (num_values <= MIXER_TXN_MAX_VALUES) {
+            for (j = 0; j < num_values; j++)
+                values[j] = value;
+            return mixer_ctl_set_array(ctl, values, num_values);
+        }
+        break;
+    default:
+        break;
+    }
+
+    /* This ensures multiple (i.e. stereo) values are set jointly */
+    for (j = 0; j < num_values && ret == 0; j++)
+        ret = mixer_ctl_set_value(ctl, j, value);
+    return ret;
+}
+
+static void mixer_txn_flush(struct m0_audio_device *adev)
+{
+    struct mixer_txn_write *w;
+    struct mixer_shadow *shadow;
+    struct mixer_ctl *ctl;
+    unsigned int i;
+    int ret;
+
+    for (i = 0; i < adev->txn_num_pending; i++) {
+        w = &adev->txn_pending[i];
+        if (w->replaced)
+            continue;
+
+        shadow = &adev->mixer_shadow[w->ctl_id];
+        shadow->pending = false;
+
+        if (shadow->valid && shadow->value == w->value)
+            continue;
+
+        ctl = mixer_get_ctl(adev->mixer, w->ctl_id);
+        ret = mixer_ctl_write(ctl, w->value);
+        if (ret != 0) {
+            ALOGE("Failed to set '%s' to %d\n", mixer_ctl_get_name(ctl), w->value);
+            shadow->valid = false;
+            continue;
+        }
+        ALOGV("Set '%s' to %d\n", mixer_ctl_get_name(ctl), w->value);
+
+        shadow->valid = true;
+        shadow->value = w->value;
+    }
+    adev->txn_num_pending = 0;
+}
+
+static void mixer_txn_commit(struct m0_audio_device *adev)
+{
+    if (--adev->txn_depth == 0)
+        mixer_txn_flush(adev);
+}
+
+/* The shadow only holds while the HAL is the sole writer of the codec. The
+ * modem firmware reprograms it on mode changes, and tools or other clients
+ * may write it while the HAL is idle: forget what was written then, the
+ * next routes are written in full.
+ * Must be called with hw device mutex locked, outside of transactions */
+static void mixer_shadow_invalidate(struct m0_audio_device *adev)
+{
+    unsigned int i, num_ctls = mixer_get_num_ctls(adev->mixer);
+
+    for (i = 0; i < num_ctls; i++)
+        adev->mixer_shadow[i].valid = false;
+}
+
+/* Queue a value for a compiled route entry, skipping it if the control
+ * already holds (or is about to hold) it.
+ * Returns 1 if the control will be written, 0 if it was skipped. */
+static int route_queue_value(struct m0_audio_device *adev, struct route_setting *r,
+                             int value)
+{
+    struct mixer_shadow *shadow = &adev->mixer_shadow[r->ctl_id];
+    struct mixer_txn_write *w;
+    unsigned int i;
+
+    if (shadow->pending) {
+        if (shadow->pending_value == value)
+            return 0;
+        if (shadow->pending_path != adev->txn_path) {
+            for (i = 0; i < adev->txn_num_pending; i++) {
+                if (adev->txn_pending[i].ctl_id == r->ctl_id)
+                    adev->txn_pending[i].replaced = true;
             }
         }
-        i++;
+    } else if (shadow->valid && shadow->value == value) {
+        return 0;
     }
 
-    return 0;
+    /* a path toggling many controls may fill the queue */
+    if (adev->txn_num_pending == adev->txn_max_pending)
+        mixer_txn_flush(adev);
+
+    w = &adev->txn_pending[adev->txn_num_pending++];
+    w->ctl_id = r->ctl_id;
+    w->value = value;
+    w->replaced = false;
+
+    shadow->pending = true;
+    shadow->pending_value = value;
+    shadow->pending_path = adev->txn_path;
+
+    if (adev->txn_depth == 0)
+        mixer_txn_flush(adev);
+
+    return 1;
+}
+
+/* Queue a route entry with its enabled or disabled value.
+ * Returns 1 if the control will be written, 0 if it was skipped. */
+static int route_apply_setting(struct m0_audio_device *adev, struct route_setting *r,
+                               int enable)
+{
+    if (route_compile(adev, r) != 0)
+        return -EINVAL;
+
+    if (!enable && r->off_value < 0) {
+        ALOGE("Failed to set '%s' to '%s'\n", r->ctl_name, "Off");
+        return 0;
+    }
+
+    return route_queue_value(adev, r, enable ? r->on_value : r->off_value);
 }
 
 /* The enable flag when 0 makes the assumption that enums are disabled by
  * "Off" and integers/booleans by 0 */
-static int set_route_by_array(struct mixer *mixer, struct route_setting *route,
+static int set_bigroute_by_array(struct m0_audio_device *adev, struct route_setting *route,
+                              int enable)
+{
+    unsigned int i;
+
+    mixer_txn_path(adev);
+
+    /* Go through the route array and set each value */
+    for (i = 0; route[i].ctl_name; i++) {
+        if (route_apply_setting(adev, &route[i], enable) == -EINVAL)
+            return -EINVAL;
+    }
+
+    return 0;
+}
+
+static int set_route_by_array(struct m0_audio_device *adev, struct route_setting *route,
                   unsigned int len)
 {
-    struct mixer_ctl *ctl;
-    unsigned int i, j, ret;
+    unsigned int i;
+    int ret;
+    int written = 0;
+
+    mixer_txn_path(adev);
 
     /* Go through the route array and set each value */
     for (i = 0; i < len; i++) {
-        ctl = mixer_get_ctl_by_name(mixer, route[i].ctl_name);
-        if (!ctl) {
-        ALOGE("Unknown control '%s'\n", route[i].ctl_name);
+        ret = route_apply_setting(adev, &route[i], 1);
+        if (ret == -EINVAL)
             return -EINVAL;
-        }
+        if (ret > 0)
+            written++;
+    }
 
-        if (route[i].strval) {
-        ret = mixer_ctl_set_enum_by_string(ctl, route[i].strval);
-        if (ret != 0) {
-        ALOGE("Failed to set '%s' to '%s'\n",
-             route[i].ctl_name, route[i].strval);
-        } else {
-        ALOGV("Set '%s' to '%s'\n",
-             route[i].ctl_name, route[i].strval);
-        }
+    return written;
+}
 
-        } else {
-            /* This ensures multiple (i.e. stereo) values are set jointly */
-            for (j = 0; j < mixer_ctl_get_num_values(ctl); j++) {
-        ret = mixer_ctl_set_value(ctl, j, route[i].intval);
-        if (ret != 0) {
-            ALOGE("Failed to set '%s'.%d to %d\n",
-             route[i].ctl_name, j, route[i].intval);
-        } else {
-            ALOGV("Set '%s'.%d to %d\n",
-             route[i].ctl_name, j, route[i].intval);
-        }
-        }
-        }
-    }
+/* PCM timestamps are taken on CLOCK_REALTIME to keep playback and capture
+ * consistent for echo reference, the HAL position APIs use CLOCK_MONOTONIC */
+static int64_t realtime_to_monotonic_ns(const struct timespec *ts)
+{
+    struct timespec now_rt, now_mono;
 
-    return 0;
+    clock_gettime(CLOCK_REALTIME, &now_rt);
+    clock_gettime(CLOCK_MONOTONIC, &now_mono);
+
+    return (int64_t)ts->tv_sec * 1000000000LL + ts->tv_nsec -
+            ((int64_t)now_rt.tv_sec * 1000000000LL + now_rt.tv_nsec) +
+            ((int64_t)now_mono.tv_sec * 1000000000LL + now_mono.tv_nsec);
+}
+
+static int64_t elapsed_us(const struct timespec *start)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)(now.tv_sec - start->tv_sec) * 1000000 +
+            (now.tv_nsec - start->tv_nsec) / 1000;
 }
 
 /* Must be called with lock */
 void select_devices(struct m0_audio_device *adev)
 {
-    int i;
+    struct m0_dev_cfg *cfg;
+    struct timespec start;
+    int64_t elapsed;
+    int i, ret, mask, old_mask;
+    int on_writes = 0, off_writes = 0;
+
     if (adev->active_out_device == adev->out_device && adev->active_in_device == adev->in_device)
     return;
 
     ALOGV("Changing output device %x => %x\n", adev->active_out_device, adev->out_device);
     ALOGV("Changing input device %x => %x\n", adev->active_in_device, adev->in_device);
 
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    mixer_txn_begin(adev);
+
     /* Turn on new devices first so we don't glitch due to powerdown... */
-    for (i = 0; i < adev->num_dev_cfgs; i++)
-    if ((adev->out_device & adev->dev_cfgs[i].mask) &&
-        !(adev->active_out_device & adev->dev_cfgs[i].mask) &&
-        !(adev->dev_cfgs[i].mask & AUDIO_DEVICE_BIT_IN))
-        set_route_by_array(adev->mixer, adev->dev_cfgs[i].on,
-                   adev->dev_cfgs[i].on_len);
-
-    for (i = 0; i < adev->num_dev_cfgs; i++)
-    if ((adev->in_device & adev->dev_cfgs[i].mask) &&
-        !(adev->active_in_device & adev->dev_cfgs[i].mask) &&
-        (adev->dev_cfgs[i].mask & AUDIO_DEVICE_BIT_IN))
-        set_route_by_array(adev->mixer, adev->dev_cfgs[i].on,
-                   adev->dev_cfgs[i].on_len);
+    for (i = 0; i < adev->num_dev_cfgs; i++) {
+        cfg = &adev->dev_cfgs[i];
+        if (cfg->mask & AUDIO_DEVICE_BIT_IN) {
+            mask = adev->in_device;
+            old_mask = adev->active_in_device;
+        } else {
+            mask = adev->out_device;
+            old_mask = adev->active_out_device;
+        }
+        if ((mask & cfg->mask) && !(old_mask & cfg->mask)) {
+            ret = set_route_by_array(adev, cfg->on, cfg->on_len);
+            if (ret > 0)
+                on_writes += ret;
+        }
+    }
 
     /* ...then disable old ones. */
-    for (i = 0; i < adev->num_dev_cfgs; i++)
-    if (!(adev->out_device & adev->dev_cfgs[i].mask) &&
-        (adev->active_out_device & adev->dev_cfgs[i].mask) &&
-        !(adev->dev_cfgs[i].mask & AUDIO_DEVICE_BIT_IN))
-        set_route_by_array(adev->mixer, adev->dev_cfgs[i].off,
-                   adev->dev_cfgs[i].off_len);
-
-    for (i = 0; i < adev->num_dev_cfgs; i++)
-    if (!(adev->in_device & adev->dev_cfgs[i].mask) &&
-        (adev->active_in_device & adev->dev_cfgs[i].mask) &&
-        (adev->dev_cfgs[i].mask & AUDIO_DEVICE_BIT_IN))
-        set_route_by_array(adev->mixer, adev->dev_cfgs[i].off,
-                   adev->dev_cfgs[i].off_len);
+    for (i = 0; i < adev->num_dev_cfgs; i++) {
+        cfg = &adev->dev_cfgs[i];
+        if (cfg->mask & AUDIO_DEVICE_BIT_IN) {
+            mask = adev->in_device;
+            old_mask = adev->active_in_device;
+        } else {
+            mask = adev->out_device;
+            old_mask = adev->active_out_device;
+        }
+        if (!(mask & cfg->mask) && (old_mask & cfg->mask)) {
+            ret = set_route_by_array(adev, cfg->off, cfg->off_len);
+            if (ret > 0)
+                off_writes += ret;
+        }
+    }
+
+    mixer_txn_commit(adev);
+
+    elapsed = elapsed_us(&start);
+    audio_stats_hist_record(&adev->stats.route, elapsed);
+    ALOGV("%s: %x/%x => %x/%x took %lld us (%d on, %d off controls changed)", __func__,
+          adev->active_out_device, adev->active_in_device, adev->out_device, adev->in_device,
+          (long long)elapsed, on_writes, off_writes);
 
     adev->active_out_device = adev->out_device;
     adev->active_in_device = adev->in_device;
 }
 
+/* rate of the modem and bluetooth PCMs for the current call */
+static unsigned int get_call_pcm_rate(struct m0_audio_device *adev)
+{
+    if (adev->out_device & AUDIO_DEVICE_OUT_ALL_SCO) {
+       /* use amr-nb for bluetooth */
+       return adev->bluetooth_wb ? VX_WB_SAMPLING_RATE : VX_NB_SAMPLING_RATE;
+    }
+    return adev->wb_amr ? VX_WB_SAMPLING_RATE : VX_NB_SAMPLING_RATE;
+}
+
 static int start_call(struct m0_audio_device *adev)
 {
     ALOGV("Opening modem PCMs");
@@ -361,12 +718,7 @@ static int start_call(struct m0_audio_device *adev)
 
     bt_on = adev->out_device & AUDIO_DEVICE_OUT_ALL_SCO;
 
-    if (bt_on) {
-       /* use amr-nb for bluetooth */
-       pcm_config_vx.rate = adev->bluetooth_wb ? VX_WB_SAMPLING_RATE : VX_NB_SAMPLING_RATE;
-    } else {
-       pcm_config_vx.rate = adev->wb_amr ? VX_WB_SAMPLING_RATE : VX_NB_SAMPLING_RATE;
-    }
+    pcm_config_vx.rate = get_call_pcm_rate(adev);
 
     /* Open modem PCM channels */
     if (adev->pcm_modem_dl == NULL) {
@@ -471,8 +823,135 @@ static void end_call(struct m0_audio_device *adev)
     adev->pcm_bt_ul = NULL;
 }
 
+#define EQ_CTL_EQ_SWITCH  CODEC_EQ_BANDS
+#define EQ_CTL_DRC_SWITCH (CODEC_EQ_BANDS + 1)
+
+/* value the configuration left in a codec EQ control */
+static int get_eq_base_value(struct m0_audio_device *adev, struct route_setting *r,
+                             int def)
+{
+    if (route_compile(adev, r) != 0)
+        return def;
+    if (adev->mixer_shadow[r->ctl_id].valid)
+        return adev->mixer_shadow[r->ctl_id].value;
+    return mixer_ctl_get_value(mixer_get_ctl(adev->mixer, r->ctl_id), 0);
+}
+
+/* Run the offloaded equalizer, bass boost and loudness effects on the codec
+ * EQ and DRC of AIF1DAC1. They come from the effects of the deep buffer
+ * output, but AIF1DAC1 carries all playback so the other outputs get them
+ * too while they play. Nothing is written until an effect is enabled so the
+ * configuration tuning stays untouched.
+ * Must be called with the hw device mutex locked. */
 static void set_eq_filter(struct m0_audio_device *adev)
 {
+    struct codec_eq_regs regs;
+    int i;
+
+    if (!adev->eq_base_valid) {
+        if (!codec_eq_active(&adev->eq))
+            return;
+
+        for (i = 0; i < CODEC_EQ_BANDS; i++)
+            adev->eq_base.band[i] = get_eq_base_value(adev, &codec_eq_ctls[i],
+                                                      CODEC_EQ_GAIN_0DB);
+        adev->eq_base.eq_switch = get_eq_base_value(adev, &codec_eq_ctls[EQ_CTL_EQ_SWITCH], 0);
+        adev->eq_base.drc_switch = get_eq_base_value(adev, &codec_eq_ctls[EQ_CTL_DRC_SWITCH], 0);
+        adev->eq_base_valid = true;
+    }
+
+    codec_eq_map(&adev->eq, &adev->eq_base, &regs);
+
+    mixer_txn_begin(adev);
+    mixer_txn_path(adev);
+    for (i = 0; i < CODEC_EQ_BANDS; i++) {
+        if (codec_eq_ctls[i].compiled)
+            route_queue_value(adev, &codec_eq_ctls[i], regs.band[i]);
+    }
+    if (codec_eq_ctls[EQ_CTL_EQ_SWITCH].compiled)
+        route_queue_value(adev, &codec_eq_ctls[EQ_CTL_EQ_SWITCH], regs.eq_switch);
+    if (codec_eq_ctls[EQ_CTL_DRC_SWITCH].compiled)
+        route_queue_value(adev, &codec_eq_ctls[EQ_CTL_DRC_SWITCH], regs.drc_switch);
+    mixer_txn_commit(adev);
+}
+
+/* Must be called with the hw device mutex locked */
+static void set_master_gain(struct m0_audio_device *adev)
+{
+    float gain = adev->master_mute ? 0.0f : adev->master_volume;
+    struct m0_stream_out *out;
+    int i;
+
+    for (i = 0; i < OUTPUT_TOTAL; i++) {
+        out = adev->outputs[i];
+        if (out == NULL)
+            continue;
+        lock_output_stream(out);
+        gain_ramp_set(&out->gain, gain);
+        pthread_mutex_unlock(&out->lock);
+    }
+}
+
+/* Reopen a DL/UL PCM pair at the current pcm_config_vx rate. Both PCMs are
+ * closed and restarted back to back so the gap is only the PCM setup time. */
+static int reopen_call_pcm_pair(const char *name, unsigned int port,
+                                struct pcm **dl, struct pcm **ul)
+{
+    struct timespec start;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    pcm_stop(*dl);
+    pcm_stop(*ul);
+    pcm_close(*dl);
+    pcm_close(*ul);
+
+    *dl = pcm_open(CARD_DEFAULT, port, PCM_OUT, &pcm_config_vx);
+    *ul = pcm_open(CARD_DEFAULT, port, PCM_IN, &pcm_config_vx);
+    if (!pcm_is_ready(*dl) || !pcm_is_ready(*ul)) {
+        ALOGE("%s: cannot reopen %s PCMs: %s / %s", __func__, name,
+              pcm_get_error(*dl), pcm_get_error(*ul));
+        pcm_close(*dl);
+        pcm_close(*ul);
+        *dl = NULL;
+        *ul = NULL;
+        return -ENOMEM;
+    }
+
+    pcm_start(*dl);
+    pcm_start(*ul);
+
+    ALOGI("%s: %s PCMs at %u Hz, audio gap %lld us", __func__, name, pcm_config_vx.rate,
+          (long long)elapsed_us(&start));
+    return 0;
+}
+
+/* Follow a voice codec rate change during a call. Only the PCMs running at
+ * the wrong rate are reopened and the mixer routes are left alone, they do
+ * not depend on the rate.
+ * Must be called with the hw device mutex locked. */
+static void update_call_pcm_rate(struct m0_audio_device *adev)
+{
+    unsigned int rate = get_call_pcm_rate(adev);
+    int ret = 0;
+
+    if (rate == pcm_config_vx.rate)
+        return;
+
+    pcm_config_vx.rate = rate;
+
+    if (adev->pcm_modem_dl && adev->pcm_modem_ul)
+        ret = reopen_call_pcm_pair("modem", PORT_MODEM,
+                                   &adev->pcm_modem_dl, &adev->pcm_modem_ul);
+    if (ret == 0 && adev->pcm_bt_dl && adev->pcm_bt_ul)
+        ret = reopen_call_pcm_pair("bluetooth", PORT_BT,
+                                   &adev->pcm_bt_dl, &adev->pcm_bt_ul);
+
+    if (ret != 0) {
+        /* fall back to a full restart of the call audio */
+        end_call(adev);
+        start_call(adev);
+    }
 }
 
 void audio_set_wb_amr_callback(void *data, int enable)
@@ -484,11 +963,8 @@ void audio_set_wb_amr_callback(void *data, int enable)
         adev->wb_amr = enable;
 
         /* reopen the modem PCMs at the new rate */
-        if (adev->in_call) {
-            end_call(adev);
-            select_output_device(adev);
-            start_call(adev);
-        }
+        if (adev->in_call)
+            update_call_pcm_rate(adev);
     }
     pthread_mutex_unlock(&adev->lock);
 }
@@ -542,12 +1018,12 @@ static void force_all_standby(struct m0_audio_device *adev)
     if (adev->outputs[OUTPUT_LOW_LATENCY] != NULL &&
             !adev->outputs[OUTPUT_LOW_LATENCY]->standby) {
         out = adev->outputs[OUTPUT_LOW_LATENCY];
-        pthread_mutex_lock(&out->lock);
+        lock_output_stream(out);
         do_output_standby(out);
         pthread_mutex_unlock(&out->lock);
     }
 
-    if (adev->active_input) {
+    while (adev->active_input) {
         in = adev->active_input;
         pthread_mutex_lock(&in->lock);
         do_input_standby(in);
@@ -557,9 +1033,15 @@ static void force_all_standby(struct m0_audio_device *adev)
 
 static void select_mode(struct m0_audio_device *adev)
 {
+    struct timespec start;
+
+    audio_stats_inc(&adev->stats.mode_changes);
+    mixer_shadow_invalidate(adev);
+
     if (adev->mode == AUDIO_MODE_IN_CALL) {
         ALOGE("Entering IN_CALL state, in_call=%d", adev->in_call);
         if (!adev->in_call) {
+            clock_gettime(CLOCK_MONOTONIC, &start);
             force_all_standby(adev);
             /* force earpiece route for in call state if speaker is the
             only currently selected route. This prevents having to tear
@@ -578,6 +1060,7 @@ static void select_mode(struct m0_audio_device *adev)
                 adev->out_device &= ~AUDIO_DEVICE_OUT_SPEAKER;
             select_output_device(adev);
             start_call(adev);
+            audio_stats_hist_record(&adev->stats.call_start, elapsed_us(&start));
             ril_set_call_clock_sync(&adev->ril, SOUND_CLOCK_START);
             adev_set_voice_volume(&adev->hw_device, adev->voice_volume);
             adev->in_call = 1;
@@ -591,20 +1074,22 @@ static void select_mode(struct m0_audio_device *adev)
             end_call(adev);
             force_all_standby(adev);
 
+            mixer_txn_begin(adev);
             ALOGD("%s: set voicecall route: voicecall_default_disable", __func__);
-            set_bigroute_by_array(adev->mixer, voicecall_default_disable, 1);
+            set_bigroute_by_array(adev, voicecall_default_disable, 1);
             ALOGD("%s: set voicecall route: default_input_disable", __func__);
-            set_bigroute_by_array(adev->mixer, default_input_disable, 1);
+            set_bigroute_by_array(adev, default_input_disable, 1);
             set_noise_supression(adev, 0);
             ALOGD("%s: set voicecall route: headset_input_disable", __func__);
-            set_bigroute_by_array(adev->mixer, headset_input_disable, 1);
+            set_bigroute_by_array(adev, headset_input_disable, 1);
             ALOGD("%s: set voicecall route: bt_disable", __func__);
-            set_bigroute_by_array(adev->mixer, bt_disable, 1);
+            set_bigroute_by_array(adev, bt_disable, 1);
 
             select_output_device(adev);
             //Force Input Standby
             adev->in_device = AUDIO_DEVICE_NONE;
             select_input_device(adev);
+            mixer_txn_commit(adev);
         }
     }
 }
@@ -657,6 +1142,8 @@ static void select_output_device(struct m0_audio_device *adev)
             break;
     }
 
+    mixer_txn_begin(adev);
+
     select_devices(adev);
 
     set_eq_filter(adev);
@@ -665,41 +1152,45 @@ static void select_output_device(struct m0_audio_device *adev)
 
         if (headset_on || headphone_on || speaker_on || earpiece_on) {
             ALOGD("%s: set voicecall route: voicecall_default", __func__);
-            set_bigroute_by_array(adev->mixer, voicecall_default, 1);
+            set_bigroute_by_array(adev, voicecall_default, 1);
         } else {
             ALOGD("%s: set voicecall route: voicecall_default_disable", __func__);
-            set_bigroute_by_array(adev->mixer, voicecall_default_disable, 1);
+            set_bigroute_by_array(adev, voicecall_default_disable, 1);
         }
 
         if (speaker_on || earpiece_on || headphone_on) {
             ALOGD("%s: set voicecall route: default_input", __func__);
-            set_bigroute_by_array(adev->mixer, default_input, 1);
+            set_bigroute_by_array(adev, default_input, 1);
             set_noise_supression(adev, 1);
         } else {
             ALOGD("%s: set voicecall route: default_input_disable", __func__);
-            set_bigroute_by_array(adev->mixer, default_input_disable, 1);
+            set_bigroute_by_array(adev, default_input_disable, 1);
             set_noise_supression(adev, 0);
         }
 
         if (headset_on) {
             ALOGD("%s: set voicecall route: headset_input", __func__);
-            set_bigroute_by_array(adev->mixer, headset_input, 1);
+            set_bigroute_by_array(adev, headset_input, 1);
         } else {
             ALOGD("%s: set voicecall route: headset_input_disable", __func__);
-            set_bigroute_by_array(adev->mixer, headset_input_disable, 1);
+            set_bigroute_by_array(adev, headset_input_disable, 1);
         }
 
         if (bt_on) {
             ALOGD("%s: set voicecall route: bt_input", __func__);
-            set_bigroute_by_array(adev->mixer, bt_input, 1);
+            set_bigroute_by_array(adev, bt_input, 1);
             ALOGD("%s: set voicecall route: bt_output", __func__);
-            set_bigroute_by_array(adev->mixer, bt_output, 1);
+            set_bigroute_by_array(adev, bt_output, 1);
         } else {
             ALOGD("%s: set voicecall route: bt_disable", __func__);
-            set_bigroute_by_array(adev->mixer, bt_disable, 1);
+            set_bigroute_by_array(adev, bt_disable, 1);
         }
-        set_incall_device(adev);
     }
+
+    mixer_txn_commit(adev);
+
+    if (adev->mode == AUDIO_MODE_IN_CALL)
+        set_incall_device(adev);
 }
 
 static void select_input_device(struct m0_audio_device *adev)
@@ -734,12 +1225,12 @@ static void set_noise_supression(struct m0_audio_device *adev, int enable)
         // Enable Noise suppression for builtin microphone
         ALOGE("%s: enabling two mic control", __func__);
         ril_set_two_mic_control(&adev->ril, AUDIENCE, TWO_MIC_SOLUTION_ON);
-        set_bigroute_by_array(adev->mixer, noise_suppression, 1);
+        set_bigroute_by_array(adev, noise_suppression, 1);
     } else {
         // Disable Noise suppression for builtin microphone
         ALOGE("%s: disabling two mic control", __func__);
         ril_set_two_mic_control(&adev->ril, AUDIENCE, TWO_MIC_SOLUTION_OFF);
-        set_bigroute_by_array(adev->mixer, noise_suppression_disable, 1);
+        set_bigroute_by_array(adev, noise_suppression_disable, 1);
     }
 }
 
@@ -790,7 +1281,7 @@ static int start_output_stream_low_latency(struct m0_stream_out *out)
         if (out->buffer == NULL)
             out->buffer = malloc(out->buffer_frames * audio_stream_out_frame_size(&out->stream.common));
 
-        if (adev->echo_reference != NULL)
+        if (adev->echo_reference != NULL && adev->echo_reference_out == out)
             out->echo_reference = adev->echo_reference;
         out->resampler->reset(out->resampler);
 
@@ -801,6 +1292,7 @@ static int start_output_stream_low_latency(struct m0_stream_out *out)
 }
 
 /* must be called with hw device and output stream mutexes locked */
+/* returns 1 if the stream was restarted from warm standby, 0 if the PCM was opened */
 static int start_output_stream_deep_buffer(struct m0_stream_out *out)
 {
     struct m0_audio_device *adev = out->dev;
@@ -809,6 +1301,20 @@ static int start_output_stream_deep_buffer(struct m0_stream_out *out)
         select_output_device(adev);
     }
 
+    /* leaving warm standby: the PCM is still open and only needs to be prepared */
+    if (out->warm_standby) {
+        out->warm_standby = false;
+        if (pcm_prepare(out->pcm[PCM_NORMAL]) == 0) {
+            if (adev->echo_reference != NULL && adev->echo_reference_out == out)
+                out->echo_reference = adev->echo_reference;
+            return 1;
+        }
+        ALOGW("%s: cannot prepare pcm_out driver: %s, reopening", __func__,
+              pcm_get_error(out->pcm[PCM_NORMAL]));
+        pcm_close(out->pcm[PCM_NORMAL]);
+        out->pcm[PCM_NORMAL] = NULL;
+    }
+
     out->write_threshold = PLAYBACK_DEEP_BUFFER_LONG_PERIOD_COUNT * DEEP_BUFFER_LONG_PERIOD_SIZE;
     out->use_long_periods = true;
 
@@ -826,19 +1332,86 @@ static int start_output_stream_deep_buffer(struct m0_stream_out *out)
     if (out->buffer == NULL)
         out->buffer = malloc(PLAYBACK_DEEP_BUFFER_LONG_PERIOD_COUNT * DEEP_BUFFER_LONG_PERIOD_SIZE);
 
+    if (adev->echo_reference != NULL && adev->echo_reference_out == out)
+        out->echo_reference = adev->echo_reference;
+
     return 0;
 }
 
-static int check_input_parameters(uint32_t sample_rate, audio_format_t format, int channel_count)
+/* The HDMI PCM is on its own card, it does not depend on the codec routes.
+ * Must be called with hw device and output stream mutexes locked */
+static int start_output_stream_hdmi(struct m0_stream_out *out)
 {
-    if (format != AUDIO_FORMAT_PCM_16_BIT)
-        return -EINVAL;
+    out->pcm[PCM_HDMI] = pcm_open(CARD_HDMI, PORT_HDMI, PCM_OUT, &out->config[PCM_HDMI]);
+    if (!pcm_is_ready(out->pcm[PCM_HDMI])) {
+        ALOGE("%s: cannot open pcm_out driver: %s", __func__, pcm_get_error(out->pcm[PCM_HDMI]));
+        pcm_close(out->pcm[PCM_HDMI]);
+        out->pcm[PCM_HDMI] = NULL;
+        return -ENOMEM;
+    }
+    return 0;
+}
 
-    if ((channel_count < 1) || (channel_count > 2))
+/* Fill the channel masks and rates of the direct HDMI output from what the
+ * HDMI PCM accepts, which reflects the EDID of the sink. Returns -ENODEV if
+ * there is no HDMI PCM, e.g. no sink is plugged in. */
+static int out_read_hdmi_caps(struct m0_stream_out *out)
+{
+    struct pcm_params *params;
+    unsigned int max_channels, min_rate, max_rate;
+    size_t i, n;
+
+    params = pcm_params_get(CARD_HDMI, PORT_HDMI, PCM_OUT);
+    if (params == NULL)
+        return -ENODEV;
+    max_channels = pcm_params_get_max(params, PCM_PARAM_CHANNELS);
+    min_rate = pcm_params_get_min(params, PCM_PARAM_RATE);
+    max_rate = pcm_params_get_max(params, PCM_PARAM_RATE);
+    pcm_params_free(params);
+
+    for (i = 0, n = 0; i < ARRAY_SIZE(out_channels_name_to_enum_table); i++) {
+        if (audio_channel_count_from_out_mask(out_channels_name_to_enum_table[i].value) <=
+                max_channels)
+            out->sup_channel_masks[n++] = out_channels_name_to_enum_table[i].value;
+    }
+    out->sup_channel_masks[n] = 0;
+
+    for (i = 0, n = 0; i < ARRAY_SIZE(hdmi_sample_rates); i++) {
+        if (hdmi_sample_rates[i] >= min_rate && hdmi_sample_rates[i] <= max_rate)
+            out->sup_sample_rates[n++] = hdmi_sample_rates[i];
+    }
+    out->sup_sample_rates[n] = 0;
+
+    ALOGV("%s: up to %u channels, %u to %u Hz", __func__, max_channels, min_rate, max_rate);
+
+    if (out->sup_channel_masks[0] == 0 || out->sup_sample_rates[0] == 0)
         return -EINVAL;
+    return 0;
+}
 
-    switch(sample_rate) {
-    case 8000:
+static bool out_hdmi_supports(struct m0_stream_out *out, audio_channel_mask_t channel_mask,
+                              uint32_t sample_rate)
+{
+    bool mask_ok = false, rate_ok = false;
+    int i;
+
+    for (i = 0; out->sup_channel_masks[i] != 0; i++)
+        mask_ok |= out->sup_channel_masks[i] == channel_mask;
+    for (i = 0; out->sup_sample_rates[i] != 0; i++)
+        rate_ok |= out->sup_sample_rates[i] == sample_rate;
+    return mask_ok && rate_ok;
+}
+
+static int check_input_parameters(uint32_t sample_rate, audio_format_t format, int channel_count)
+{
+    if (format != AUDIO_FORMAT_PCM_16_BIT)
+        return -EINVAL;
+
+    if ((channel_count < 1) || (channel_count > 2))
+        return -EINVAL;
+
+    switch(sample_rate) {
+    case 8000:
     case 11025:
     case 16000:
     case 22050:
@@ -874,7 +1447,7 @@ static size_t get_input_buffer_size(uint32_t sample_rate, audio_format_t format,
 static void add_echo_reference(struct m0_stream_out *out,
                                struct echo_reference_itfe *reference)
 {
-    pthread_mutex_lock(&out->lock);
+    lock_output_stream(out);
     out->echo_reference = reference;
     pthread_mutex_unlock(&out->lock);
 }
@@ -882,7 +1455,7 @@ static void add_echo_reference(struct m0_stream_out *out,
 static void remove_echo_reference(struct m0_stream_out *out,
                                   struct echo_reference_itfe *reference)
 {
-    pthread_mutex_lock(&out->lock);
+    lock_output_stream(out);
     if (out->echo_reference == reference) {
         /* stop writing to echo reference */
         reference->write(reference, NULL);
@@ -896,31 +1469,48 @@ static void put_echo_reference(struct m0_audio_device *adev,
 {
     if (adev->echo_reference != NULL &&
             reference == adev->echo_reference) {
-        /* echo reference is taken from the low latency output stream used
-         * for voice use cases */
-        if (adev->outputs[OUTPUT_LOW_LATENCY] != NULL &&
-                !adev->outputs[OUTPUT_LOW_LATENCY]->standby)
-            remove_echo_reference(adev->outputs[OUTPUT_LOW_LATENCY], reference);
+        if (adev->echo_reference_out != NULL &&
+                !adev->echo_reference_out->standby)
+            remove_echo_reference(adev->echo_reference_out, reference);
         release_echo_reference(reference);
         adev->echo_reference = NULL;
+        adev->echo_reference_out = NULL;
     }
 }
 
+/* The echo reference is taken from the low latency output stream used for
+ * voice use cases when it is running, otherwise from the deep buffer output
+ * which is the one carrying all playback when no low latency stream is open */
+static struct m0_stream_out *get_echo_reference_output(struct m0_audio_device *adev)
+{
+    if (adev->outputs[OUTPUT_LOW_LATENCY] != NULL &&
+            !adev->outputs[OUTPUT_LOW_LATENCY]->standby)
+        return adev->outputs[OUTPUT_LOW_LATENCY];
+    if (adev->outputs[OUTPUT_DEEP_BUF] != NULL &&
+            !adev->outputs[OUTPUT_DEEP_BUF]->standby)
+        return adev->outputs[OUTPUT_DEEP_BUF];
+    return NULL;
+}
+
 static struct echo_reference_itfe *get_echo_reference(struct m0_audio_device *adev,
                                                audio_format_t format,
                                                uint32_t channel_count,
                                                uint32_t sampling_rate)
 {
+    struct m0_stream_out *out;
+
     put_echo_reference(adev, adev->echo_reference);
-    /* echo reference is taken from the low latency output stream used
-     * for voice use cases */
-    if (adev->outputs[OUTPUT_LOW_LATENCY] != NULL &&
-            !adev->outputs[OUTPUT_LOW_LATENCY]->standby) {
-        struct audio_stream *stream =
-                &adev->outputs[OUTPUT_LOW_LATENCY]->stream.common;
+
+    out = get_echo_reference_output(adev);
+    if (out != NULL) {
+        struct audio_stream *stream = &out->stream.common;
         uint32_t wr_channel_count = popcount(stream->get_channels(stream));
         uint32_t wr_sampling_rate = stream->get_sample_rate(stream);
 
+        /* the deep buffer output feeds the reference after resampling */
+        if (out == adev->outputs[OUTPUT_DEEP_BUF])
+            wr_sampling_rate = out->config[PCM_NORMAL].rate;
+
         int status = create_echo_reference(AUDIO_FORMAT_PCM_16_BIT,
                                            channel_count,
                                            sampling_rate,
@@ -928,9 +1518,10 @@ static struct echo_reference_itfe *get_echo_reference(struct m0_audio_device *ad
                                            wr_channel_count,
                                            wr_sampling_rate,
                                            &adev->echo_reference);
-        if (status == 0)
-            add_echo_reference(adev->outputs[OUTPUT_LOW_LATENCY],
-                               adev->echo_reference);
+        if (status == 0) {
+            adev->echo_reference_out = out;
+            add_echo_reference(out, adev->echo_reference);
+        }
     }
     return adev->echo_reference;
 }
@@ -939,7 +1530,7 @@ static int get_playback_delay(struct m0_stream_out *out,
                        size_t frames,
                        struct echo_reference_buffer *buffer)
 {
-    size_t kernel_frames;
+    unsigned int kernel_frames;
     int status;
     int primary_pcm = 0;
 
@@ -963,7 +1554,7 @@ static int get_playback_delay(struct m0_stream_out *out,
      * Add the duration of current frame as we want the render time of the last
      * sample being written. */
     buffer->delay_ns = (long)(((int64_t)(kernel_frames + frames)* 1000000000)/
-                            MM_FULL_POWER_SAMPLING_RATE);
+                            out->config[primary_pcm].rate);
 
     return 0;
 }
@@ -973,6 +1564,13 @@ static uint32_t out_get_sample_rate(const struct audio_stream *stream)
     return DEFAULT_OUT_SAMPLING_RATE;
 }
 
+static uint32_t out_get_sample_rate_hdmi(const struct audio_stream *stream)
+{
+    struct m0_stream_out *out = (struct m0_stream_out *)stream;
+
+    return out->config[PCM_HDMI].rate;
+}
+
 static int out_set_sample_rate(struct audio_stream *stream, uint32_t rate)
 {
     return 0;
@@ -1005,6 +1603,12 @@ static size_t out_get_buffer_size_deep_buffer(const struct audio_stream *stream)
     return size * audio_stream_out_frame_size((struct audio_stream *)stream);
 }
 
+/* one period, always a multiple of 16 frames */
+static size_t out_get_buffer_size_hdmi(const struct audio_stream *stream)
+{
+    return HDMI_PERIOD_SIZE * audio_stream_out_frame_size((struct audio_stream *)stream);
+}
+
 static audio_channel_mask_t out_get_channels(const struct audio_stream *stream)
 {
     struct m0_stream_out *out = (struct m0_stream_out *)stream;
@@ -1023,14 +1627,31 @@ static int out_set_format(struct audio_stream *stream, audio_format_t format)
 }
 
 /* must be called with hw device and output stream mutexes locked */
+static bool all_outputs_standby(struct m0_audio_device *adev)
+{
+    int i;
+
+    for (i = 0; i < OUTPUT_TOTAL; i++) {
+        if (adev->outputs[i] != NULL && !adev->outputs[i]->standby)
+            return false;
+    }
+    return true;
+}
+
 static int do_output_standby(struct m0_stream_out *out)
 {
     struct m0_audio_device *adev = out->dev;
     int i;
-    bool all_outputs_in_standby = true;
 
-    if (!out->standby) {
-        out->standby = 1;
+    if (!out->standby || out->warm_standby) {
+        if (!out->standby) {
+            out->standby = 1;
+            audio_stats_inc(&out->stats.standby);
+            /* whatever was still queued in the driver is gone, keep the
+             * position continuous for the next start */
+            out->presented = out->written;
+        }
+        out->warm_standby = false;
 
         for (i = 0; i < PCM_TOTAL; i++) {
             if (out->pcm[i]) {
@@ -1039,20 +1660,13 @@ static int do_output_standby(struct m0_stream_out *out)
             }
         }
 
-        for (i = 0; i < OUTPUT_TOTAL; i++) {
-            if (adev->outputs[i] != NULL && !adev->outputs[i]->standby) {
-                all_outputs_in_standby = false;
-                break;
-            }
-        }
-
         /* force standby on low latency output stream so that it can reuse HDMI driver if
          * necessary when restarted */
         if (out == adev->outputs[OUTPUT_HDMI]) {
             if (adev->outputs[OUTPUT_LOW_LATENCY] != NULL &&
                     !adev->outputs[OUTPUT_LOW_LATENCY]->standby) {
                 struct m0_stream_out *ll_out = adev->outputs[OUTPUT_LOW_LATENCY];
-                pthread_mutex_lock(&ll_out->lock);
+                lock_output_stream(ll_out);
                 do_output_standby(ll_out);
                 pthread_mutex_unlock(&ll_out->lock);
             }
@@ -1063,25 +1677,176 @@ static int do_output_standby(struct m0_stream_out *out)
             out->echo_reference->write(out->echo_reference, NULL);
             out->echo_reference = NULL;
         }
+
+        if (all_outputs_standby(adev) && !adev->active_input)
+            mixer_shadow_invalidate(adev);
+    }
+    return 0;
+}
+
+/* Put the deep buffer output in standby but keep its PCM, and the route,
+ * for the grace period: the standby thread closes it if the stream has not
+ * been restarted by then. Other outputs go to standby right away.
+ * Must be called with hw device and output stream mutexes locked */
+static int do_output_warm_standby(struct m0_stream_out *out)
+{
+    struct m0_audio_device *adev = out->dev;
+
+    if (out->standby)
+        return 0;
+    if (adev->standby_grace_ms <= 0 || out != adev->outputs[OUTPUT_DEEP_BUF] ||
+            out->pcm[PCM_NORMAL] == NULL)
+        return do_output_standby(out);
+
+    out->standby = 1;
+    audio_stats_inc(&out->stats.standby);
+    out->presented = out->written;
+    pcm_stop(out->pcm[PCM_NORMAL]);
+
+    /* stop writing to echo reference */
+    if (out->echo_reference != NULL) {
+        out->echo_reference->write(out->echo_reference, NULL);
+        out->echo_reference = NULL;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &out->warm_deadline);
+    out->warm_deadline.tv_sec += adev->standby_grace_ms / 1000;
+    out->warm_deadline.tv_nsec += (adev->standby_grace_ms % 1000) * 1000000;
+    if (out->warm_deadline.tv_nsec >= 1000000000) {
+        out->warm_deadline.tv_sec++;
+        out->warm_deadline.tv_nsec -= 1000000000;
     }
+    out->warm_standby = true;
+    pthread_cond_signal(&adev->standby_cond);
+
     return 0;
 }
 
+static bool timespec_before(const struct timespec *a, const struct timespec *b)
+{
+    return a->tv_sec < b->tv_sec || (a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+}
+
+/* runs with the hw device mutex held, like the stream threads it competes with */
+static const struct thread_policy standby_thread_policy = {
+    .name = "audio_standby",
+    .sched_policy = SCHED_OTHER,
+    .nice = ANDROID_PRIORITY_AUDIO,
+    .avoid_cpu0 = false,
+};
+
+/* Closes the PCM of the deep buffer output once its warm standby grace
+ * period has expired. Only that output goes to warm standby, and the hw
+ * device mutex is enough to check it: the stream mutex, which a write in
+ * the driver may hold for a long time, is only taken to close the PCM. */
+static void *adev_standby_thread(void *context)
+{
+    struct m0_audio_device *adev = (struct m0_audio_device *)context;
+    struct m0_stream_out *out;
+    struct thread_latency latency;
+    struct timespec now, next;
+    bool pending;
+
+    thread_latency_init(&latency, &standby_thread_policy);
+
+    pthread_mutex_lock(&adev->lock);
+    while (!adev->standby_thread_exit) {
+        pending = false;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+
+        out = adev->outputs[OUTPUT_DEEP_BUF];
+        if (out != NULL && out->warm_standby) {
+            if (!timespec_before(&now, &out->warm_deadline)) {
+                ALOGV("%s: closing deep buffer output after grace period", __func__);
+                lock_output_stream(out);
+                do_output_standby(out);
+                pthread_mutex_unlock(&out->lock);
+            } else {
+                next = out->warm_deadline;
+                pending = true;
+            }
+        }
+
+        if (pending) {
+            if (pthread_cond_timedwait(&adev->standby_cond, &adev->lock, &next) == ETIMEDOUT) {
+                clock_gettime(CLOCK_MONOTONIC, &now);
+                thread_latency_record(&latency, (int64_t)(now.tv_sec - next.tv_sec) * 1000000 +
+                                                    (now.tv_nsec - next.tv_nsec) / 1000);
+            }
+        } else
+            pthread_cond_wait(&adev->standby_cond, &adev->lock);
+    }
+    pthread_mutex_unlock(&adev->lock);
+
+    return NULL;
+}
+
 static int out_standby(struct audio_stream *stream)
 {
     struct m0_stream_out *out = (struct m0_stream_out *)stream;
     int status;
 
     pthread_mutex_lock(&out->dev->lock);
-    pthread_mutex_lock(&out->lock);
-    status = do_output_standby(out);
+    lock_output_stream(out);
+    status = do_output_warm_standby(out);
     pthread_mutex_unlock(&out->lock);
     pthread_mutex_unlock(&out->dev->lock);
     return status;
 }
 
+static const char * const output_names[OUTPUT_TOTAL] = {
+    [OUTPUT_DEEP_BUF] = "deep buffer",
+    [OUTPUT_LOW_LATENCY] = "low latency",
+    [OUTPUT_HDMI] = "hdmi",
+};
+
+/* The dump functions give up on a mutex they cannot take quickly so that
+ * dumpsys still works when a stream is stuck in the driver, the stats are
+ * atomic and always printed. */
+static bool dump_trylock(pthread_mutex_t *lock)
+{
+    int i;
+
+    for (i = 0; i < DUMP_LOCK_RETRIES; i++) {
+        if (pthread_mutex_trylock(lock) == 0)
+            return true;
+        usleep(DUMP_LOCK_RETRY_US);
+    }
+    return false;
+}
+
+/* like lock_output_stream(), the pre lock keeps a writer from taking the
+ * stream back between two writes */
+static bool dump_lock_output_stream(struct m0_stream_out *out)
+{
+    bool locked;
+
+    if (!dump_trylock(&out->pre_lock))
+        return false;
+    locked = dump_trylock(&out->lock);
+    pthread_mutex_unlock(&out->pre_lock);
+    return locked;
+}
+
 static int out_dump(const struct audio_stream *stream, int fd)
 {
+    struct m0_stream_out *out = (struct m0_stream_out *)stream;
+    const char *state;
+    uint64_t written, presented;
+
+    dprintf(fd, "    Output stream %p (%s):\n", out, output_names[out->type]);
+    if (dump_lock_output_stream(out)) {
+        state = !out->standby ? "active" : out->warm_standby ? "warm standby" : "standby";
+        written = out->written;
+        presented = out->presented;
+        pthread_mutex_unlock(&out->lock);
+
+        dprintf(fd, "      state: %s, written: %llu, presented: %llu\n", state,
+                (unsigned long long)written, (unsigned long long)presented);
+    } else {
+        dprintf(fd, "      stream busy, state not shown\n");
+    }
+    audio_stats_out_dump(&out->stats, fd);
     return 0;
 }
 
@@ -1102,7 +1867,7 @@ static int out_set_parameters(struct audio_stream *stream, const char *kvpairs)
     if (ret >= 0) {
         val = atoi(value);
         pthread_mutex_lock(&adev->lock);
-        pthread_mutex_lock(&out->lock);
+        lock_output_stream(out);
         if (((adev->out_device) != val) && (val != 0)) {
             /* this is needed only when changing device on low latency output
              * as other output streams are not used for voice use cases nor
@@ -1154,6 +1919,13 @@ static int out_set_parameters(struct audio_stream *stream, const char *kvpairs)
         pthread_mutex_unlock(&adev->lock);
     }
 
+    if (codec_eq_has_parameters(parms)) {
+        pthread_mutex_lock(&adev->lock);
+        if (codec_eq_set_parameters(&adev->eq, parms) > 0)
+            set_eq_filter(adev);
+        pthread_mutex_unlock(&adev->lock);
+    }
+
     str_parms_destroy(parms);
     return ret;
 }
@@ -1169,6 +1941,7 @@ static char * out_get_parameters(const struct audio_stream *stream, const char *
     size_t i, j;
     int ret;
     bool first = true;
+    bool replied = false;
 
     ret = str_parms_get_str(query, AUDIO_PARAMETER_STREAM_SUP_CHANNELS, value, sizeof(value));
     if (ret >= 0) {
@@ -1188,10 +1961,25 @@ static char * out_get_parameters(const struct audio_stream *stream, const char *
             i++;
         }
         str_parms_add_str(reply, AUDIO_PARAMETER_STREAM_SUP_CHANNELS, value);
+        replied = true;
+    }
+
+    ret = str_parms_get_str(query, AUDIO_PARAMETER_STREAM_SUP_SAMPLING_RATES, value,
+                            sizeof(value));
+    if (ret >= 0) {
+        value[0] = '\0';
+        for (i = 0; out->sup_sample_rates[i] != 0; i++) {
+            snprintf(value + strlen(value), sizeof(value) - strlen(value), "%s%u",
+                     i == 0 ? "" : "|", out->sup_sample_rates[i]);
+        }
+        str_parms_add_str(reply, AUDIO_PARAMETER_STREAM_SUP_SAMPLING_RATES, value);
+        replied = true;
+    }
+
+    if (replied)
         str = strdup(str_parms_to_str(reply));
-    } else {
+    else
         str = strdup(keys);
-    }
     str_parms_destroy(query);
     str_parms_destroy(reply);
     return str;
@@ -1214,12 +2002,64 @@ static uint32_t out_get_latency_deep_buffer(const struct audio_stream_out *strea
                     pcm_config_mm.rate;
 }
 
+static uint32_t out_get_latency_hdmi(const struct audio_stream_out *stream)
+{
+    struct m0_stream_out *out = (struct m0_stream_out *)stream;
+
+    return (HDMI_PERIOD_SIZE * HDMI_PERIOD_COUNT * 1000) / out->config[PCM_HDMI].rate;
+}
+
 static int out_set_volume(struct audio_stream_out *stream, float left,
                           float right)
 {
     return -ENOSYS;
 }
 
+/* Count an underrun if the driver buffer of pcm drained since the previous
+ * write. The driver only starts once enough frames are queued and stops when
+ * it underruns, so the check waits for a full buffer to be written after
+ * leaving standby or after the previous underrun.
+ * Must be called with the output stream mutex locked. */
+static void out_check_underrun(struct m0_stream_out *out, struct pcm *pcm)
+{
+    unsigned int avail;
+    struct timespec ts;
+    size_t buffer_size = pcm_get_buffer_size(pcm);
+
+    if (out->written < out->underrun_check_from + buffer_size)
+        return;
+
+    /* there is no timestamp while the driver is stopped */
+    if (pcm_get_htimestamp(pcm, &avail, &ts) != 0 || avail >= buffer_size) {
+        audio_stats_inc(&out->stats.underruns);
+        out->underrun_check_from = out->written;
+    }
+}
+
+/* Apply the master gain to frames about to be written. Returns buf if the
+ * gain is unity or buf belongs to the stream, which is then updated in
+ * place, else a copy: the caller's buffer is never modified. The copy holds
+ * one stream buffer, *frames is cut down to that and the caller then makes
+ * a partial write, completed by the next one.
+ * Must be called with the output stream mutex locked. */
+static const void *out_apply_gain(struct m0_stream_out *out, const void *buf, size_t *frames)
+{
+    size_t max_frames = out->gain_buf_size / (out->gain.channels * sizeof(int16_t));
+
+    if (gain_ramp_is_unity(&out->gain))
+        return buf;
+
+    if (buf == out->buffer) {
+        gain_ramp_apply(&out->gain, (int16_t *)out->buffer, buf, *frames);
+        return buf;
+    }
+
+    if (*frames > max_frames)
+        *frames = max_frames;
+    gain_ramp_apply(&out->gain, out->gain_buf, buf, *frames);
+    return out->gain_buf;
+}
+
 static ssize_t out_write_low_latency(struct audio_stream_out *stream, const void* buffer,
                          size_t bytes)
 {
@@ -1231,27 +2071,40 @@ static ssize_t out_write_low_latency(struct audio_stream_out *stream, const void
     size_t out_frames = in_frames;
     bool force_input_standby = false;
     struct m0_stream_in *in;
+    struct timespec start;
     int i;
 
-    /* acquiring hw device mutex systematically is useful if a low priority thread is waiting
-     * on the output stream mutex - e.g. executing select_mode() while holding the hw device
-     * mutex
-     */
-    pthread_mutex_lock(&adev->lock);
-    pthread_mutex_lock(&out->lock);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    /* the hw device mutex is only needed to leave standby: routing may take a
+     * long time and must not delay writes once the stream is running */
+    lock_output_stream(out);
     if (out->standby) {
-        ret = start_output_stream_low_latency(out);
-        if (ret != 0) {
-            pthread_mutex_unlock(&adev->lock);
-            goto exit;
+        pthread_mutex_unlock(&out->lock);
+        pthread_mutex_lock(&adev->lock);
+        lock_output_stream(out);
+        if (out->standby) {
+            ret = start_output_stream_low_latency(out);
+            if (ret != 0) {
+                pthread_mutex_unlock(&adev->lock);
+                goto exit;
+            }
+            out->standby = 0;
+            out->written_at_start = out->written;
+            out->underrun_check_from = out->written;
+            audio_stats_inc(&out->stats.cold_starts);
+            audio_stats_hist_record(&out->stats.start, elapsed_us(&start));
+            /* a change in output device may change the microphone selection */
+            if (adev_get_state(adev) & ADEV_STATE_VOICE_COMM_IN)
+                force_input_standby = true;
         }
-        out->standby = 0;
-        /* a change in output device may change the microphone selection */
-        if (adev->active_input &&
-                adev->active_input->source == AUDIO_SOURCE_VOICE_COMMUNICATION)
-            force_input_standby = true;
+        pthread_mutex_unlock(&adev->lock);
     }
-    pthread_mutex_unlock(&adev->lock);
+
+    /* PCMs may run at different rates, the gain is applied once before
+     * resampling which is linear */
+    buffer = out_apply_gain(out, buffer, &in_frames);
+    bytes = in_frames * frame_size;
 
     for (i = 0; i < PCM_TOTAL; i++) {
         /* only use resampler if required */
@@ -1262,6 +2115,7 @@ static ssize_t out_write_low_latency(struct audio_stream_out *stream, const void
                                                 &in_frames,
                                                 (int16_t *)out->buffer,
                                                 &out_frames);
+            audio_stats_add(&out->stats.resampled_frames, in_frames);
             break;
         }
     }
@@ -1275,6 +2129,13 @@ static ssize_t out_write_low_latency(struct audio_stream_out *stream, const void
         out->echo_reference->write(out->echo_reference, &b);
     }
 
+    for (i = 0; i < PCM_TOTAL; i++) {
+        if (out->pcm[i]) {
+            out_check_underrun(out, out->pcm[i]);
+            break;
+        }
+    }
+
     /* Write to all active PCMs */
     for (i = 0; i < PCM_TOTAL; i++) {
         if (out->pcm[i]) {
@@ -1289,8 +2150,15 @@ static ssize_t out_write_low_latency(struct audio_stream_out *stream, const void
                 break;
         }
     }
+    if (ret == 0) {
+        out->written += bytes / frame_size;
+        audio_stats_add(&out->stats.frames, bytes / frame_size);
+    }
 
 exit:
+    if (ret != 0)
+        audio_stats_inc(&out->stats.write_errors);
+    audio_stats_hist_record(&out->stats.write, elapsed_us(&start));
     pthread_mutex_unlock(&out->lock);
 
     if (ret != 0) {
@@ -1322,25 +2190,41 @@ static ssize_t out_write_deep_buffer(struct audio_stream_out *stream, const void
     size_t in_frames = bytes / frame_size;
     size_t out_frames;
     bool use_long_periods;
+    unsigned int state;
     int kernel_frames;
     void *buf;
+    struct timespec start;
 
-    /* acquiring hw device mutex systematically is useful if a low priority thread is waiting
-     * on the output stream mutex - e.g. executing select_mode() while holding the hw device
-     * mutex
-     */
-    pthread_mutex_lock(&adev->lock);
-    pthread_mutex_lock(&out->lock);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    /* the hw device mutex is only needed to leave standby: routing may take a
+     * long time and must not delay writes once the stream is running */
+    lock_output_stream(out);
     if (out->standby) {
-        ret = start_output_stream_deep_buffer(out);
-        if (ret != 0) {
-            pthread_mutex_unlock(&adev->lock);
-            goto exit;
+        pthread_mutex_unlock(&out->lock);
+        pthread_mutex_lock(&adev->lock);
+        lock_output_stream(out);
+        if (out->standby) {
+            int64_t start_us;
+
+            ret = start_output_stream_deep_buffer(out);
+            if (ret < 0) {
+                pthread_mutex_unlock(&adev->lock);
+                goto exit;
+            }
+            out->standby = 0;
+            out->written_at_start = out->written;
+            out->underrun_check_from = out->written;
+            start_us = elapsed_us(&start);
+            audio_stats_hist_record(&out->stats.start, start_us);
+            audio_stats_inc(ret > 0 ? &out->stats.warm_starts : &out->stats.cold_starts);
+            ALOGV("%s: %s start in %lld us", __func__, ret > 0 ? "warm" : "cold",
+                  (long long)start_us);
         }
-        out->standby = 0;
+        pthread_mutex_unlock(&adev->lock);
     }
-    use_long_periods = adev->screen_off && !adev->active_input;
-    pthread_mutex_unlock(&adev->lock);
+    state = adev_get_state(adev);
+    use_long_periods = (state & ADEV_STATE_SCREEN_OFF) && !(state & ADEV_STATE_ACTIVE_INPUT);
 
     if (use_long_periods != out->use_long_periods) {
         size_t period_size;
@@ -1366,11 +2250,19 @@ static ssize_t out_write_deep_buffer(struct audio_stream_out *stream, const void
                                             &in_frames,
                                             (int16_t *)out->buffer,
                                             &out_frames);
+        audio_stats_add(&out->stats.resampled_frames, in_frames);
         buf = (void *)out->buffer;
     } else {
         out_frames = in_frames;
         buf = (void *)buffer;
     }
+    buf = (void *)out_apply_gain(out, buf, &out_frames);
+    if (buf != out->buffer) {
+        in_frames = out_frames;
+        bytes = in_frames * frame_size;
+    }
+
+    out_check_underrun(out, out->pcm[PCM_NORMAL]);
 
     /* do not allow more than out->write_threshold frames in kernel pcm driver buffer */
     do {
@@ -1391,9 +2283,27 @@ static ssize_t out_write_deep_buffer(struct audio_stream_out *stream, const void
         }
     } while (kernel_frames > out->write_threshold);
 
+    /* frames go to the echo reference at the driver rate, the delay is the
+     * mmap buffer fill level plus the frames about to be written */
+    if (out->echo_reference != NULL) {
+        struct echo_reference_buffer b;
+        b.raw = buf;
+        b.frame_count = out_frames;
+
+        get_playback_delay(out, out_frames, &b);
+        out->echo_reference->write(out->echo_reference, &b);
+    }
+
     ret = pcm_mmap_write(out->pcm[PCM_NORMAL], buf, out_frames * frame_size);
+    if (ret == 0) {
+        out->written += bytes / frame_size;
+        audio_stats_add(&out->stats.frames, bytes / frame_size);
+    }
 
 exit:
+    if (ret != 0)
+        audio_stats_inc(&out->stats.write_errors);
+    audio_stats_hist_record(&out->stats.write, elapsed_us(&start));
     pthread_mutex_unlock(&out->lock);
 
     if (ret != 0) {
@@ -1404,10 +2314,141 @@ exit:
     return bytes;
 }
 
+/* Multichannel PCM goes to the sink as is: no resampling, no downmix and no
+ * echo reference, which only follows the codec outputs. */
+static ssize_t out_write_hdmi(struct audio_stream_out *stream, const void* buffer,
+                              size_t bytes)
+{
+    int ret;
+    struct m0_stream_out *out = (struct m0_stream_out *)stream;
+    struct m0_audio_device *adev = out->dev;
+    size_t frame_size = audio_stream_out_frame_size(&out->stream.common);
+    size_t frames;
+    struct timespec start;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    lock_output_stream(out);
+    if (out->standby) {
+        pthread_mutex_unlock(&out->lock);
+        pthread_mutex_lock(&adev->lock);
+        lock_output_stream(out);
+        if (out->standby) {
+            ret = start_output_stream_hdmi(out);
+            if (ret != 0) {
+                pthread_mutex_unlock(&adev->lock);
+                goto exit;
+            }
+            out->standby = 0;
+            out->written_at_start = out->written;
+            out->underrun_check_from = out->written;
+            audio_stats_inc(&out->stats.cold_starts);
+            audio_stats_hist_record(&out->stats.start, elapsed_us(&start));
+        }
+        pthread_mutex_unlock(&adev->lock);
+    }
+
+    out_check_underrun(out, out->pcm[PCM_HDMI]);
+
+    frames = bytes / frame_size;
+    buffer = out_apply_gain(out, buffer, &frames);
+    bytes = frames * frame_size;
+    ret = PCM_WRITE(out->pcm[PCM_HDMI], (void *)buffer, bytes);
+    if (ret == 0) {
+        out->written += bytes / frame_size;
+        audio_stats_add(&out->stats.frames, bytes / frame_size);
+    }
+
+exit:
+    if (ret != 0)
+        audio_stats_inc(&out->stats.write_errors);
+    audio_stats_hist_record(&out->stats.write, elapsed_us(&start));
+    pthread_mutex_unlock(&out->lock);
+
+    if (ret != 0) {
+        usleep(bytes * 1000000 / frame_size / out_get_sample_rate_hdmi(&stream->common));
+    }
+
+    return bytes;
+}
+
+/* Position of the frame being presented at the stream rate, derived from the
+ * frames written and the driver buffer fill level. The fill level is read
+ * from the first active PCM, if the driver underran it is empty.
+ * Must be called with the output stream mutex locked. */
+static int out_get_presented_frames(struct m0_stream_out *out, uint64_t *frames,
+                                    struct timespec *timestamp)
+{
+    unsigned int avail;
+    size_t buffer_size;
+    uint64_t queued;
+    int primary_pcm = 0;
+
+    if (out->standby)
+        return -ENODATA;
+
+    while ((primary_pcm < PCM_TOTAL) && !out->pcm[primary_pcm])
+        primary_pcm++;
+    if (primary_pcm == PCM_TOTAL)
+        return -ENODATA;
+
+    if (pcm_get_htimestamp(out->pcm[primary_pcm], &avail, timestamp) < 0)
+        return -ENODATA;
+
+    buffer_size = pcm_get_buffer_size(out->pcm[primary_pcm]);
+    queued = avail < buffer_size ? buffer_size - avail : 0;
+    queued = (queued * out->stream.common.get_sample_rate(&out->stream.common)) /
+            out->config[primary_pcm].rate;
+
+    /* never go backwards, e.g. when the resampler holds back a few frames */
+    if (out->written > queued && out->written - queued > out->presented)
+        out->presented = out->written - queued;
+
+    *frames = out->presented;
+    return 0;
+}
+
 static int out_get_render_position(const struct audio_stream_out *stream,
                                    uint32_t *dsp_frames)
 {
-    return -EINVAL;
+    struct m0_stream_out *out = (struct m0_stream_out *)stream;
+    struct timespec timestamp;
+    uint64_t frames;
+    int ret;
+
+    lock_output_stream(out);
+    ret = out_get_presented_frames(out, &frames, &timestamp);
+    if (ret == 0)
+        *dsp_frames = (uint32_t)(frames > out->written_at_start ?
+                                        frames - out->written_at_start : 0);
+    pthread_mutex_unlock(&out->lock);
+
+    return ret;
+}
+
+static int out_get_presentation_position(const struct audio_stream_out *stream,
+                                         uint64_t *frames, struct timespec *timestamp)
+{
+    struct m0_stream_out *out = (struct m0_stream_out *)stream;
+    struct timespec ts;
+    int64_t ns;
+    int ret;
+
+    lock_output_stream(out);
+    ret = out_get_presented_frames(out, frames, &ts);
+    if (ret == 0) {
+        /* the conversion jitters by a few ns, which must not take the
+         * timestamp back while the position stands still */
+        ns = realtime_to_monotonic_ns(&ts);
+        if (ns < out->presented_ns)
+            ns = out->presented_ns;
+        out->presented_ns = ns;
+        timestamp->tv_sec = ns / 1000000000LL;
+        timestamp->tv_nsec = ns % 1000000000LL;
+    }
+    pthread_mutex_unlock(&out->lock);
+
+    return ret;
 }
 
 static int out_add_audio_effect(const struct audio_stream *stream, effect_handle_t effect)
@@ -1422,17 +2463,224 @@ static int out_remove_audio_effect(const struct audio_stream *stream, effect_han
 
 /** audio_stream_in implementation **/
 
+/* Turn a period captured with voice_rec_input (uplink left, downlink right)
+ * into what the voice source asked for, in place */
+static void in_voice_tap_process(struct m0_stream_in *in, int16_t *buf, size_t frames)
+{
+    int32_t mix;
+
+    switch (in->voice_tap) {
+    case AUDIO_SOURCE_VOICE_UPLINK:
+        for (; frames > 0; frames--, buf += 2)
+            buf[1] = buf[0];
+        break;
+    case AUDIO_SOURCE_VOICE_DOWNLINK:
+        for (; frames > 0; frames--, buf += 2)
+            buf[0] = buf[1];
+        break;
+    case AUDIO_SOURCE_VOICE_CALL:
+        for (; frames > 0; frames--, buf += 2) {
+            mix = ((int32_t)buf[0] + buf[1]) >> 1;
+            buf[0] = buf[1] = (int16_t)mix;
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+/* must be called with hw device and input stream mutexes locked */
+static void in_voice_tap_stop(struct m0_stream_in *in)
+{
+    struct m0_audio_device *adev = in->dev;
+
+    struct m0_stream_in *other;
+
+    if (!in->voice_tap)
+        return;
+    in->voice_tap = 0;
+
+    /* the route is shared by all the inputs tapping the call */
+    for (other = adev->active_input; other != NULL; other = other->active_next) {
+        if (other != in && other->voice_tap)
+            return;
+    }
+
+    mixer_txn_begin(adev);
+    set_bigroute_by_array(adev, voice_rec_input_disable, 1);
+    mixer_txn_commit(adev);
+}
+
+/* called by the capture hub thread for each period queued to the stream */
+static void in_capture_process(void *context, int16_t *buf, size_t frames)
+{
+    struct m0_stream_in *in = (struct m0_stream_in *)context;
+
+    if (in->voice_tap)
+        in_voice_tap_process(in, buf, frames);
+}
+
+/* called by the capture hub thread for each period queued to a low power
+ * input, the reader is only woken up once the gate opens */
+static bool in_capture_wake(void *context, const int16_t *buf, size_t frames)
+{
+    struct m0_stream_in *in = (struct m0_stream_in *)context;
+    bool speech = voice_gate_process(&in->gate, buf, frames);
+
+    atomic_store_explicit(&in->speech, speech, memory_order_relaxed);
+    return speech;
+}
+
+/* a low power input is captured at its own rate */
+static bool in_resampling(const struct m0_stream_in *in)
+{
+    return in->resampler != NULL && in->config.rate != in->requested_rate;
+}
+
+/* Copy frames captured by the hub to buffer, waiting for them if needed.
+ * Returns 0 or a negative error if capture failed. */
+static int in_capture_read(struct m0_stream_in *in, int16_t *buffer, size_t frames)
+{
+    return capture_hub_read(&in->capture, buffer, frames, CAPTURE_READ_TIMEOUT_S);
+}
+
+/* must be called with hw device mutex locked */
+static void remove_active_input(struct m0_audio_device *adev, struct m0_stream_in *in)
+{
+    struct m0_stream_in **p;
+
+    for (p = &adev->active_input; *p != NULL; p = &(*p)->active_next) {
+        if (*p == in) {
+            *p = in->active_next;
+            break;
+        }
+    }
+    in->active_next = NULL;
+    adev_publish_state(adev);
+}
+
+/* must be called with the input stream mutex locked */
+static void in_update_preproc_pipeline(struct m0_stream_in *in)
+{
+    effect_handle_t effects[MAX_PREPROCESSORS];
+    int i;
+
+    for (i = 0; i < in->num_preprocessors; i++)
+        effects[i] = in->preprocessors[i].effect_itfe;
+    preproc_pipeline_set_effects(&in->preproc, effects, in->num_preprocessors);
+}
+
+static int do_input_standby(struct m0_stream_in *in);
+
+/* Set up the capture ring and the hub configuration of an input about to
+ * start. A hotword input finding the microphone unused opens it at its own
+ * rate with long periods, keeps the last HOTWORD_PREROLL_MS in its ring and
+ * only wakes up its reader on speech. Any other input takes the microphone
+ * back at the default configuration: hotword inputs holding it in low power
+ * are put in standby and restart as regular inputs.
+ * Must be called with hw device and input stream mutexes locked */
+static int in_configure_capture(struct m0_stream_in *in)
+{
+    struct m0_audio_device *adev = in->dev;
+    struct capture_hub *hub = &adev->capture_hub;
+    struct pcm_config config = pcm_config_capture;
+    struct m0_stream_in *other, *next;
+    int ret;
+
+    /* only inputs at a rate the microphone can run at have a pre-roll ring */
+    in->low_power = in->source == AUDIO_SOURCE_HOTWORD && hub->num_clients == 0 &&
+                    in->preroll_buf != NULL;
+
+    if (in->low_power) {
+        config.rate = in->requested_rate;
+        config.period_size = config.rate * HOTWORD_PERIOD_MS / 1000;
+        config.period_count = HOTWORD_PERIOD_COUNT;
+    } else if (hub->num_clients != 0 && !capture_hub_config_equal(&hub->config, &config)) {
+        /* in is already listed, but still in standby */
+        for (other = adev->active_input; other != NULL; other = next) {
+            next = other->active_next;
+            if (other != in && other->low_power) {
+                pthread_mutex_lock(&other->lock);
+                do_input_standby(other);
+                pthread_mutex_unlock(&other->lock);
+            }
+        }
+    }
+
+    if (!capture_hub_config_equal(&hub->config, &config)) {
+        ret = capture_hub_set_config(hub, &config);
+        if (ret != 0)
+            return ret;
+    }
+
+    in->config.rate = config.rate;
+    in->config.period_size = config.period_size;
+    in->config.period_count = config.period_count;
+
+    if (in->low_power) {
+        voice_gate_init(&in->gate, config.rate, in->config.channels);
+        atomic_store_explicit(&in->speech, false, memory_order_relaxed);
+        in->capture.wake = in_capture_wake;
+        audio_ring_init(&in->capture.ring, in->preroll_buf, in->preroll_frames,
+                        in->config.channels);
+    } else {
+        in->capture.wake = NULL;
+        audio_ring_init(&in->capture.ring, in->capture_ring_buf, CAPTURE_RING_FRAMES,
+                        in->config.channels);
+    }
+
+    ALOGV("%s: %s capture at %u Hz", __func__, in->low_power ? "low power" : "regular",
+          config.rate);
+    return 0;
+}
+
+/* A voice source tapping the call switches AIF1ADC1R to the downlink on the
+ * capture PCM every input shares: a regular input would record the call,
+ * and a tap started under a regular input would take its microphone away.
+ * The input starting last is refused instead, its reads return silence
+ * until the others have stopped.
+ * Must be called with hw device and input stream mutexes locked */
+static bool in_voice_tap_conflict(struct m0_stream_in *in, bool tap)
+{
+    struct m0_stream_in *other;
+
+    for (other = in->dev->active_input; other != NULL; other = other->active_next) {
+        if (other != in && (other->voice_tap != 0) != tap)
+            return true;
+    }
+    return false;
+}
+
 /* must be called with hw device and input stream mutexes locked */
 static int start_input_stream(struct m0_stream_in *in)
 {
     int ret = 0;
     struct m0_audio_device *adev = in->dev;
+    bool tap = adev->mode == AUDIO_MODE_IN_CALL &&
+               (in->source == AUDIO_SOURCE_VOICE_UPLINK ||
+                in->source == AUDIO_SOURCE_VOICE_DOWNLINK ||
+                in->source == AUDIO_SOURCE_VOICE_CALL) && in->config.channels == 2;
+
+    if (in_voice_tap_conflict(in, tap)) {
+        ALOGW("%s: %s input refused while %s inputs are active", __func__,
+              tap ? "voice call" : "regular", tap ? "regular" : "voice call");
+        return -EBUSY;
+    }
 
+    /* the last input started owns the capture route, the PCM is shared */
+    in->active_next = adev->active_input;
     adev->active_input = in;
+    adev_publish_state(adev);
 
     if (adev->mode != AUDIO_MODE_IN_CALL) {
         adev->in_device = in->device;
         select_input_device(adev);
+    } else if (tap) {
+        /* tap the call on the AP capture interface, the modem path is untouched */
+        mixer_txn_begin(adev);
+        set_bigroute_by_array(adev, voice_rec_input, 1);
+        mixer_txn_commit(adev);
+        in->voice_tap = in->source;
     }
 
     if (in->aux_channels_changed)
@@ -1444,7 +2692,7 @@ static int start_input_stream(struct m0_stream_in *in)
             /* release and recreate the resampler with the new number of channel of the input */
             release_resampler(in->resampler);
             in->resampler = NULL;
-            ret = create_resampler(in->config.rate,
+            ret = create_resampler(pcm_config_capture.rate,
                                in->requested_rate,
                                in->config.channels,
                                RESAMPLER_QUALITY_DEFAULT,
@@ -1456,28 +2704,47 @@ static int start_input_stream(struct m0_stream_in *in)
                 __func__, in->main_channels, in->aux_channels, in->config.channels);
     }
 
-    if (in->need_echo_reference && in->echo_reference == NULL)
-        in->echo_reference = get_echo_reference(adev,
-                                        AUDIO_FORMAT_PCM_16_BIT,
-                                        popcount(in->main_channels),
-                                        in->requested_rate);
+    if (in->need_echo_reference && in->echo_reference == NULL) {
+        /* there is a single echo reference, the first input asking for it keeps it */
+        if (adev->echo_reference != NULL)
+            ALOGW("%s: echo reference in use by another input", __func__);
+        else
+            in->echo_reference = get_echo_reference(adev,
+                                            AUDIO_FORMAT_PCM_16_BIT,
+                                            popcount(in->main_channels),
+                                            in->requested_rate);
+    }
 
     /* this assumes routing is done previously */
-    in->pcm = pcm_open(CARD_DEFAULT, PORT_CAPTURE, PCM_IN, &in->config);
-    if (!pcm_is_ready(in->pcm)) {
-        ALOGE("cannot open pcm_in driver: %s", pcm_get_error(in->pcm));
-        pcm_close(in->pcm);
-        adev->active_input = NULL;
-        return -ENOMEM;
+    if (in->config.channels > CAPTURE_MAX_CHANNELS) {
+        ret = -EINVAL;
+    } else {
+        ret = in_configure_capture(in);
+        if (ret == 0)
+            ret = capture_hub_attach(&adev->capture_hub, &in->capture);
+    }
+    if (ret != 0) {
+        ALOGE("%s: cannot start capture: %d", __func__, ret);
+        in->low_power = false;
+        in_voice_tap_stop(in);
+        remove_active_input(adev, in);
+        return ret;
     }
 
-    /* force read and proc buf reallocation case of frame size or channel count change */
+    /* drop frames buffered before standby, the buffers themselves are sized
+     * for the maximum channel count and do not depend on the configuration */
     in->read_buf_frames = 0;
-    in->read_buf_size = 0;
-    in->proc_buf_frames = 0;
-    in->proc_buf_size = 0;
+    audio_ring_init(&in->proc_ring, in->proc_ring_buf, in->proc_ring_frames,
+                    in->config.channels);
+    audio_ring_init(&in->ref_ring, in->ref_ring_buf, in->proc_ring_frames,
+                    in->config.channels);
+    /* the echo path is re-established with the new capture PCM */
+    echo_delay_reset(&in->echo_delay);
+    preproc_pipeline_init(&in->preproc, in->preproc_buf, in->proc_buf_size,
+                          in->config.channels);
+    in_update_preproc_pipeline(in);
     /* if no supported sample rate is available, use the resampler */
-    if (in->resampler) {
+    if (in_resampling(in)) {
         in->resampler->reset(in->resampler);
     }
     return 0;
@@ -1527,12 +2794,16 @@ static int do_input_standby(struct m0_stream_in *in)
     struct m0_audio_device *adev = in->dev;
 
     if (!in->standby) {
-        pcm_close(in->pcm);
-        in->pcm = NULL;
+        capture_hub_detach(&adev->capture_hub, &in->capture);
 
-        adev->active_input = 0;
+        in_voice_tap_stop(in);
+        remove_active_input(adev, in);
+        /* the route follows the input started last among those still active */
         if (adev->mode != AUDIO_MODE_IN_CALL) {
-            adev->in_device = AUDIO_DEVICE_NONE;
+            if (adev->active_input)
+                adev->in_device = adev->active_input->device;
+            else
+                adev->in_device = AUDIO_DEVICE_NONE;
             select_input_device(adev);
         }
 
@@ -1543,7 +2814,12 @@ static int do_input_standby(struct m0_stream_in *in)
             in->echo_reference = NULL;
         }
 
+        in->low_power = false;
         in->standby = 1;
+        audio_stats_inc(&in->stats.standby);
+
+        if (!adev->active_input && all_outputs_standby(adev))
+            mixer_shadow_invalidate(adev);
     }
     return 0;
 }
@@ -1563,6 +2839,33 @@ static int in_standby(struct audio_stream *stream)
 
 static int in_dump(const struct audio_stream *stream, int fd)
 {
+    struct m0_stream_in *in = (struct m0_stream_in *)stream;
+    int standby, source, device, num_preprocessors;
+    unsigned int rate;
+    bool low_power;
+
+    dprintf(fd, "    Input stream %p:\n", in);
+    if (dump_trylock(&in->lock)) {
+        standby = in->standby;
+        source = in->source;
+        device = in->device;
+        rate = in->config.rate;
+        low_power = in->low_power;
+        num_preprocessors = in->num_preprocessors;
+        pthread_mutex_unlock(&in->lock);
+
+        dprintf(fd, "      state: %s, source: %d, device: %#x, rate: %u (driver %u)\n",
+                standby ? "standby" : "active", source, device, in->requested_rate, rate);
+        if (low_power)
+            dprintf(fd, "      low power hotword capture, speech: %s\n",
+                    atomic_load_explicit(&in->speech, memory_order_relaxed) ? "yes" : "no");
+        dprintf(fd, "      preprocessors: %d\n", num_preprocessors);
+    } else {
+        dprintf(fd, "      stream busy, state not shown\n");
+    }
+    dprintf(fd, "      capture overruns: %u\n",
+            atomic_load_explicit(&in->capture.overruns, memory_order_relaxed));
+    audio_stats_in_dump(&in->stats, fd);
     return 0;
 }
 
@@ -1588,6 +2891,8 @@ static int in_set_parameters(struct audio_stream *stream, const char *kvpairs)
         if ((in->source != val) && (val != 0)) {
             in->source = val;
             do_standby = true;
+            if (adev->active_input == in)
+                adev_publish_state(adev);
         }
     }
 
@@ -1629,14 +2934,14 @@ static void get_capture_delay(struct m0_stream_in *in,
 {
 
     /* read frames available in kernel driver buffer */
-    size_t kernel_frames;
+    unsigned int kernel_frames;
     struct timespec tstamp;
     long buf_delay;
     long rsmp_delay;
     long kernel_delay;
     long delay_ns;
 
-    if (pcm_get_htimestamp(in->pcm, &kernel_frames, &tstamp) < 0) {
+    if (capture_hub_get_htimestamp(&in->dev->capture_hub, &kernel_frames, &tstamp) < 0) {
         buffer->time_stamp.tv_sec  = 0;
         buffer->time_stamp.tv_nsec = 0;
         buffer->delay_ns           = 0;
@@ -1649,13 +2954,16 @@ static void get_capture_delay(struct m0_stream_in *in,
      * in current buffer */
     /* frames in in->buffer are at driver sampling rate while frames in in->proc_buf are
      * at requested sampling rate */
-    buf_delay = (long)(((int64_t)(in->read_buf_frames) * 1000000000) / in->config.rate +
-                       ((int64_t)(in->proc_buf_frames) * 1000000000) /
+    buf_delay = (long)(((int64_t)(in->read_buf_frames +
+                                  audio_ring_avail(&in->capture.ring)) * 1000000000) /
+                                      in->config.rate +
+                       ((int64_t)(audio_ring_avail(&in->proc_ring) +
+                                  preproc_pipeline_queued(&in->preproc)) * 1000000000) /
                            in->requested_rate);
 
     /* add delay introduced by resampler */
     rsmp_delay = 0;
-    if (in->resampler) {
+    if (in_resampling(in)) {
         rsmp_delay = in->resampler->delay_ns(in->resampler);
     }
 
@@ -1667,41 +2975,42 @@ static void get_capture_delay(struct m0_stream_in *in,
     buffer->delay_ns   = delay_ns;
     ALOGV("%s: time_stamp = [%ld].[%ld], delay_ns: [%d],"
          " kernel_delay:[%ld], buf_delay:[%ld], rsmp_delay:[%ld], kernel_frames:[%d], "
-         "in->read_buf_frames:[%d], in->proc_buf_frames:[%d], frames:[%d]",
+         "in->read_buf_frames:[%zu], proc frames:[%zu], frames:[%zu]",
          __func__, buffer->time_stamp.tv_sec , buffer->time_stamp.tv_nsec, buffer->delay_ns,
          kernel_delay, buf_delay, rsmp_delay, kernel_frames,
-         in->read_buf_frames, in->proc_buf_frames, frames);
+         in->read_buf_frames, audio_ring_avail(&in->proc_ring), frames);
 
 }
 
+/* returns the measured echo path delay or -1 if no measurement was made */
 static int32_t update_echo_reference(struct m0_stream_in *in, size_t frames)
 {
     struct echo_reference_buffer b;
-    b.delay_ns = 0;
-
-    ALOGV("%s: frames = [%d], in->ref_frames_in = [%d],  "
-          "b.frame_count = [%d]",
-         __func__, frames, in->ref_buf_frames, frames - in->ref_buf_frames);
-    if (in->ref_buf_frames < frames) {
-        if (in->ref_buf_size < frames) {
-            in->ref_buf_size = frames;
-            in->ref_buf = (int16_t *)realloc(in->ref_buf, pcm_frames_to_bytes(in->pcm, frames));
-            ALOG_ASSERT((in->ref_buf != NULL),
-                        "%s failed to reallocate ref_buf", __func__);
-            ALOGV("%s: ref_buf %p extended to %d bytes",
-                      __func__, in->ref_buf, pcm_frames_to_bytes(in->pcm, frames));
-        }
-        b.frame_count = frames - in->ref_buf_frames;
-        b.raw = (void *)(in->ref_buf + in->ref_buf_frames * in->config.channels);
+    size_t ref_frames = audio_ring_avail(&in->ref_ring);
+    size_t span;
+    int16_t *dst;
+    b.delay_ns = -1;
+
+    ALOGV("%s: frames = [%zu], ref frames = [%zu],  "
+          "b.frame_count = [%zu]",
+         __func__, frames, ref_frames, frames - ref_frames);
+    if (ref_frames < frames) {
+        /* read what fits before the end of the ring, the rest comes next pass */
+        span = audio_ring_write_span(&in->ref_ring, &dst);
+        b.frame_count = frames - ref_frames;
+        if (b.frame_count > span)
+            b.frame_count = span;
+        b.raw = (void *)dst;
 
         get_capture_delay(in, frames, &b);
 
-        if (in->echo_reference->read(in->echo_reference, &b) == 0)
+        if (in->echo_reference->read(in->echo_reference, &b) != 0)
+            b.delay_ns = -1;
+        else
         {
-            in->ref_buf_frames += b.frame_count;
-            ALOGD("%s: in->ref_buf_frames:[%d], "
-                    "in->ref_buf_size:[%d], frames:[%d], b.frame_count:[%d]",
-                 __func__, in->ref_buf_frames, in->ref_buf_size, frames, b.frame_count);
+            audio_ring_produce(&in->ref_ring, b.frame_count);
+            ALOGV("%s: ref frames:[%zu], frames:[%zu], b.frame_count:[%zu]",
+                 __func__, audio_ring_avail(&in->ref_ring), frames, b.frame_count);
         }
     } else
         ALOGW("%s: NOT enough frames to read ref buffer", __func__);
@@ -1744,16 +3053,27 @@ static int set_preprocessor_echo_delay(effect_handle_t handle,
 static void push_echo_reference(struct m0_stream_in *in, size_t frames)
 {
     /* read frames from echo reference buffer and update echo delay
-     * in->ref_buf_frames is updated with frames available in in->ref_buf */
-    int32_t delay_us = update_echo_reference(in, frames)/1000;
+     * in->ref_ring is updated with frames available for reverse processing */
+    int32_t delay_ns = update_echo_reference(in, frames);
+    bool update_delay = false;
+    struct timespec now;
     int i;
     audio_buffer_t buf;
+    int16_t *src;
+    size_t span = audio_ring_read_span(&in->ref_ring, &src);
 
-    if (in->ref_buf_frames < frames)
-        frames = in->ref_buf_frames;
+    if (span < frames)
+        frames = span;
+
+    /* only pay for a parameter round trip when the estimate really moved */
+    if (delay_ns >= 0) {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        update_delay = echo_delay_update(&in->echo_delay, delay_ns / 1000,
+                                         (int64_t)now.tv_sec * 1000000000LL + now.tv_nsec);
+    }
 
     buf.frameCount = frames;
-    buf.raw = in->ref_buf;
+    buf.s16 = src;
 
     for (i = 0; i < in->num_preprocessors; i++) {
         if ((*in->preprocessors[i].effect_itfe)->process_reverse == NULL)
@@ -1762,15 +3082,12 @@ static void push_echo_reference(struct m0_stream_in *in, size_t frames)
         (*in->preprocessors[i].effect_itfe)->process_reverse(in->preprocessors[i].effect_itfe,
                                                &buf,
                                                NULL);
-        set_preprocessor_echo_delay(in->preprocessors[i].effect_itfe, delay_us);
+        if (update_delay)
+            set_preprocessor_echo_delay(in->preprocessors[i].effect_itfe,
+                                        echo_delay_get(&in->echo_delay));
     }
 
-    in->ref_buf_frames -= buf.frameCount;
-    if (in->ref_buf_frames) {
-        memcpy(in->ref_buf,
-               in->ref_buf + buf.frameCount * in->config.channels,
-               in->ref_buf_frames * in->config.channels * sizeof(int16_t));
-    }
+    audio_ring_consume(&in->ref_ring, buf.frameCount);
 }
 
 static int get_next_buffer(struct resampler_buffer_provider *buffer_provider,
@@ -1784,7 +3101,7 @@ static int get_next_buffer(struct resampler_buffer_provider *buffer_provider,
     in = (struct m0_stream_in *)((char *)buffer_provider -
                                    offsetof(struct m0_stream_in, buf_provider));
 
-    if (in->pcm == NULL) {
+    if (in->standby) {
         buffer->raw = NULL;
         buffer->frame_count = 0;
         in->read_status = -ENODEV;
@@ -1792,20 +3109,10 @@ static int get_next_buffer(struct resampler_buffer_provider *buffer_provider,
     }
 
     if (in->read_buf_frames == 0) {
-        size_t size_in_bytes = pcm_frames_to_bytes(in->pcm, in->config.period_size);
-        if (in->read_buf_size < in->config.period_size) {
-            in->read_buf_size = in->config.period_size;
-            in->read_buf = (int16_t *) realloc(in->read_buf, size_in_bytes);
-            ALOG_ASSERT((in->read_buf != NULL),
-                        "%s failed to reallocate read_buf", __func__);
-            ALOGV("%s: read_buf %p extended to %d bytes",
-                  __func__, in->read_buf, size_in_bytes);
-        }
-
-        in->read_status = pcm_read(in->pcm, (void*)in->read_buf, size_in_bytes);
+        in->read_status = in_capture_read(in, in->read_buf, in->config.period_size);
 
         if (in->read_status != 0) {
-            ALOGE("%s: pcm_read error %d", __func__, in->read_status);
+            ALOGE("%s: capture error %d", __func__, in->read_status);
             buffer->raw = NULL;
             buffer->frame_count = 0;
             return in->read_status;
@@ -1840,14 +3147,15 @@ static void release_buffer(struct resampler_buffer_provider *buffer_provider,
  * if necessary and output the number of frames requested to the buffer specified */
 static ssize_t read_frames(struct m0_stream_in *in, void *buffer, ssize_t frames)
 {
+    size_t frame_size = in->config.channels * sizeof(int16_t);
     ssize_t frames_wr = 0;
 
     while (frames_wr < frames) {
         size_t frames_rd = frames - frames_wr;
-        if (in->resampler != NULL) {
+        if (in_resampling(in)) {
             in->resampler->resample_from_provider(in->resampler,
                                                   (int16_t *)((char *)buffer +
-                                                      pcm_frames_to_bytes(in->pcm ,frames_wr)),
+                                                      frames_wr * frame_size),
                                                   &frames_rd);
 
         } else {
@@ -1857,10 +3165,9 @@ static ssize_t read_frames(struct m0_stream_in *in, void *buffer, ssize_t frames
             };
             get_next_buffer(&in->buf_provider, &buf);
             if (buf.raw != NULL) {
-                memcpy((char *)buffer +
-                            pcm_frames_to_bytes(in->pcm, frames_wr),
+                memcpy((char *)buffer + frames_wr * frame_size,
                         buf.raw,
-                        pcm_frames_to_bytes(in->pcm, buf.frame_count));
+                        buf.frame_count * frame_size);
                 frames_rd = buf.frame_count;
             }
             release_buffer(&in->buf_provider, &buf);
@@ -1886,6 +3193,26 @@ static ssize_t process_frames(struct m0_stream_in *in, void* buffer, ssize_t fra
     int i;
     bool has_aux_channels = (~in->main_channels & in->aux_channels);
     void *proc_buf_out;
+    size_t proc_frames;
+    ssize_t frames_rd;
+    int ret;
+
+    /* the processing buffers hold one HAL buffer, split larger requests */
+    if ((size_t)frames > in->proc_buf_size) {
+        size_t frame_size = popcount(in->main_channels) * sizeof(int16_t);
+        ssize_t chunk, ret;
+
+        while (frames_wr < frames) {
+            chunk = frames - frames_wr;
+            if ((size_t)chunk > in->proc_buf_size)
+                chunk = in->proc_buf_size;
+            ret = process_frames(in, (char *)buffer + frames_wr * frame_size, chunk);
+            if (ret < 0)
+                return ret;
+            frames_wr += ret;
+        }
+        return frames_wr;
+    }
 
     if (has_aux_channels)
         proc_buf_out = in->proc_buf_out;
@@ -1896,67 +3223,45 @@ static ssize_t process_frames(struct m0_stream_in *in, void* buffer, ssize_t fra
      * as the number of channels, no changes is required in case aux_channels are present */
     while (frames_wr < frames) {
         /* first reload enough frames at the end of process input buffer */
-        if (in->proc_buf_frames < (size_t)frames) {
-            ssize_t frames_rd;
-
-            if (in->proc_buf_size < (size_t)frames) {
-                size_t size_in_bytes = pcm_frames_to_bytes(in->pcm, frames);
-
-                in->proc_buf_size = (size_t)frames;
-                in->proc_buf_in = (int16_t *)realloc(in->proc_buf_in, size_in_bytes);
-                ALOG_ASSERT((in->proc_buf_in != NULL),
-                            "%s failed to reallocate proc_buf_in", __func__);
-                if (has_aux_channels) {
-                    in->proc_buf_out = (int16_t *)realloc(in->proc_buf_out, size_in_bytes);
-                    ALOG_ASSERT((in->proc_buf_out != NULL),
-                                "%s failed to reallocate proc_buf_out", __func__);
-                    proc_buf_out = in->proc_buf_out;
-                }
-                ALOGV("process_frames(): proc_buf_in %p extended to %d bytes",
-                     in->proc_buf_in, size_in_bytes);
-            }
-            frames_rd = read_frames(in,
-                                    in->proc_buf_in +
-                                        in->proc_buf_frames * in->config.channels,
-                                    frames - in->proc_buf_frames);
-            if (frames_rd < 0) {
-                frames_wr = frames_rd;
+        proc_frames = audio_ring_avail(&in->proc_ring);
+        frames_rd = 0;
+        while (proc_frames < (size_t)frames) {
+            int16_t *dst;
+            size_t span = audio_ring_write_span(&in->proc_ring, &dst);
+
+            if (span > frames - proc_frames)
+                span = frames - proc_frames;
+            frames_rd = read_frames(in, dst, span);
+            if (frames_rd < 0)
                 break;
-            }
-            in->proc_buf_frames += frames_rd;
+            audio_ring_produce(&in->proc_ring, frames_rd);
+            proc_frames += frames_rd;
+        }
+        if (frames_rd < 0) {
+            frames_wr = frames_rd;
+            break;
         }
 
         if (in->echo_reference != NULL)
-            push_echo_reference(in, in->proc_buf_frames);
+            push_echo_reference(in, proc_frames);
 
          /* in_buf.frameCount and out_buf.frameCount indicate respectively
-          * the maximum number of frames to be consumed and produced by process() */
-        in_buf.frameCount = in->proc_buf_frames;
-        in_buf.s16 = in->proc_buf_in;
+          * the maximum number of frames to be consumed and produced by process().
+          * The input is the contiguous part of the ring, the effects keep any
+          * incomplete processing block internally */
+        in_buf.frameCount = audio_ring_read_span(&in->proc_ring, &in_buf.s16);
         out_buf.frameCount = frames - frames_wr;
         out_buf.s16 = (int16_t *)proc_buf_out + frames_wr * in->config.channels;
 
-        /* FIXME: this works because of current pre processing library implementation that
-         * does the actual process only when the last enabled effect process is called.
-         * The generic solution is to have an output buffer for each effect and pass it as
-         * input to the next.
-         */
-        for (i = 0; i < in->num_preprocessors; i++) {
-            (*in->preprocessors[i].effect_itfe)->process(in->preprocessors[i].effect_itfe,
-                                               &in_buf,
-                                               &out_buf);
+        ret = preproc_pipeline_process(&in->preproc, &in_buf, &out_buf);
+        if (ret != 0) {
+            frames_wr = ret;
+            break;
         }
 
         /* process() has updated the number of frames consumed and produced in
-         * in_buf.frameCount and out_buf.frameCount respectively
-         * move remaining frames to the beginning of in->proc_buf_in */
-        in->proc_buf_frames -= in_buf.frameCount;
-
-        if (in->proc_buf_frames) {
-            memcpy(in->proc_buf_in,
-                   in->proc_buf_in + in_buf.frameCount * in->config.channels,
-                   in->proc_buf_frames * in->config.channels * sizeof(int16_t));
-        }
+         * in_buf.frameCount and out_buf.frameCount respectively */
+        audio_ring_consume(&in->proc_ring, in_buf.frameCount);
 
         /* if not enough frames were passed to process(), read more and retry. */
         if (out_buf.frameCount == 0) {
@@ -2003,6 +3308,31 @@ static ssize_t process_frames(struct m0_stream_in *in, void* buffer, ssize_t fra
     return frames_wr;
 }
 
+/* A low power input returns silence until its gate hears speech, then the
+ * pre-roll followed by live frames until the gate closes and all of it was
+ * read. The stream mutex is released meanwhile so that standby and routing
+ * changes are not held up by silence, and the wait lasts at most the
+ * duration of the buffer so that the client can stop the stream. Returns
+ * -ETIMEDOUT while the gate is still closed.
+ * Must be called with the input stream mutex locked */
+static int in_wait_speech(struct m0_stream_in *in, size_t frames)
+{
+    int ret;
+
+    if (!atomic_load_explicit(&in->speech, memory_order_relaxed))
+        capture_hub_client_gate(&in->capture);
+
+    pthread_mutex_unlock(&in->lock);
+    ret = capture_hub_wait_wake(&in->capture,
+                                (unsigned int)((frames * 1000000) / in->requested_rate));
+    pthread_mutex_lock(&in->lock);
+
+    /* put in standby while waiting, the next read restarts the capture */
+    if (ret == 0 && in->standby)
+        ret = -ENODEV;
+    return ret;
+}
+
 static ssize_t in_read(struct audio_stream_in *stream, void* buffer,
                        size_t bytes)
 {
@@ -2010,6 +3340,9 @@ static ssize_t in_read(struct audio_stream_in *stream, void* buffer,
     struct m0_stream_in *in = (struct m0_stream_in *)stream;
     struct m0_audio_device *adev = in->dev;
     size_t frames_rq = bytes / audio_stream_in_frame_size(&stream->common);
+    struct timespec start;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
 
     /* acquiring hw device mutex systematically is useful if a low priority thread is waiting
      * on the input stream mutex - e.g. executing select_mode() while holding the hw device
@@ -2017,30 +3350,56 @@ static ssize_t in_read(struct audio_stream_in *stream, void* buffer,
      */
     pthread_mutex_lock(&adev->lock);
     pthread_mutex_lock(&in->lock);
+    gain_ramp_set(&in->mute, adev->mic_mute ? 0.0f : 1.0f);
     if (in->standby) {
         ret = start_input_stream(in);
-        if (ret == 0)
+        if (ret == 0) {
             in->standby = 0;
+            audio_stats_inc(&in->stats.starts);
+            audio_stats_hist_record(&in->stats.start, elapsed_us(&start));
+        }
     }
     pthread_mutex_unlock(&adev->lock);
 
+    if (ret == 0 && in->low_power) {
+        ret = in_wait_speech(in, frames_rq);
+        if (ret == -ETIMEDOUT) {
+            memset(buffer, 0, bytes);
+            pthread_mutex_unlock(&in->lock);
+            return bytes;
+        }
+    }
+
     if (ret < 0)
         goto exit;
 
     if (in->num_preprocessors != 0)
         ret = process_frames(in, buffer, frames_rq);
-    else if (in->resampler != NULL)
+    else if (in_resampling(in))
         ret = read_frames(in, buffer, frames_rq);
     else
-        ret = pcm_read(in->pcm, buffer, bytes);
+        ret = in_capture_read(in, buffer, frames_rq);
 
     if (ret > 0)
         ret = 0;
 
-    if (ret == 0 && adev->mic_mute)
-        memset(buffer, 0, bytes);
+    if (ret == 0) {
+        audio_stats_add(&in->stats.frames, frames_rq);
+        if (in_resampling(in))
+            audio_stats_add(&in->stats.resampled_frames, frames_rq);
+    }
+
+    if (ret == 0 && !gain_ramp_is_unity(&in->mute))
+        gain_ramp_apply(&in->mute, buffer, buffer, frames_rq);
 
 exit:
+    if (ret < 0) {
+        /* nothing or part of the buffer was read, the client gets silence */
+        memset(buffer, 0, bytes);
+        audio_stats_inc(&in->stats.read_errors);
+    }
+    audio_stats_hist_record(&in->stats.read, elapsed_us(&start));
+
     if (ret < 0)
         usleep(bytes * 1000000 / audio_stream_in_frame_size(&stream->common) /
                in_get_sample_rate(&stream->common));
@@ -2051,6 +3410,40 @@ exit:
 
 static uint32_t in_get_input_frames_lost(struct audio_stream_in *stream)
 {
+    struct m0_stream_in *in = (struct m0_stream_in *)stream;
+    uint64_t lost = capture_hub_client_frames_lost(&in->capture);
+
+    audio_stats_add(&in->stats.frames_lost, lost);
+
+    /* frames are lost at driver rate, report them at the requested rate */
+    return (uint32_t)((lost * in->requested_rate) / in->config.rate);
+}
+
+static int in_get_capture_position(const struct audio_stream_in *stream,
+                                   int64_t *frames, int64_t *time)
+{
+    struct m0_stream_in *in = (struct m0_stream_in *)stream;
+    struct timespec ts;
+    uint64_t hw_frames;
+    long long ns, last;
+    int ret;
+
+    ret = capture_hub_client_get_position(&in->capture, &hw_frames, &ts);
+    if (ret != 0)
+        return ret;
+
+    *frames = (int64_t)((hw_frames * in->requested_rate) / in->config.rate);
+
+    /* the conversion jitters by a few ns, which must not take the timestamp
+     * back while the position stands still. The stream mutex is not taken,
+     * it is held by in_read() while it waits for data */
+    ns = realtime_to_monotonic_ns(&ts);
+    last = atomic_load_explicit(&in->position_ns, memory_order_relaxed);
+    while (ns > last && !atomic_compare_exchange_weak_explicit(&in->position_ns, &last, ns,
+                                                               memory_order_relaxed,
+                                                               memory_order_relaxed))
+        ;
+    *time = ns > last ? ns : last;
     return 0;
 }
 
@@ -2355,6 +3748,7 @@ static int in_add_audio_effect(const struct audio_stream *stream,
     in_read_audio_effect_channel_configs(in, &in->preprocessors[in->num_preprocessors]);
 
     in->num_preprocessors++;
+    in_update_preproc_pipeline(in);
 
     /* check compatibility between main channel supported and possible auxiliary channels */
     in_update_aux_channels(in, effect);
@@ -2413,6 +3807,7 @@ static int in_remove_audio_effect(const struct audio_stream *stream,
     in->preprocessors[in->num_preprocessors].num_channel_configs = 0;
     in->preprocessors[in->num_preprocessors].effect_itfe = NULL;
     in->preprocessors[in->num_preprocessors].channel_configs = NULL;
+    in_update_preproc_pipeline(in);
 
     /* check compatibility between main channel supported and possible auxiliary channels */
     in_update_aux_channels(in, NULL);
@@ -2454,27 +3849,68 @@ static int adev_open_output_stream(struct audio_hw_device *dev,
         return -ENOMEM;
 
     out->sup_channel_masks[0] = AUDIO_CHANNEL_OUT_STEREO;
+    out->sup_sample_rates[0] = DEFAULT_OUT_SAMPLING_RATE;
     out->channel_mask = AUDIO_CHANNEL_OUT_STEREO;
 
-    if (ladev->outputs[OUTPUT_DEEP_BUF] != NULL) {
-        ret = -ENOSYS;
-        goto err_open;
+    /* opened for the direct AUX_DIGITAL profile of audio_policy.conf, whose
+     * channel_masks and sampling_rates must be "dynamic" */
+    if ((flags & AUDIO_OUTPUT_FLAG_DIRECT) && (devices & AUDIO_DEVICE_OUT_AUX_DIGITAL)) {
+        if (ladev->outputs[OUTPUT_HDMI] != NULL) {
+            ret = -ENOSYS;
+            goto err_open;
+        }
+        ret = out_read_hdmi_caps(out);
+        if (ret != 0)
+            goto err_open;
+
+        /* an empty config asks for the default, the policy manager then
+         * reads the profile with out_get_parameters() */
+        if (config->channel_mask == 0)
+            config->channel_mask = AUDIO_CHANNEL_OUT_STEREO;
+        if (config->sample_rate == 0)
+            config->sample_rate = HDMI_DEFAULT_SAMPLING_RATE;
+        if (config->format == AUDIO_FORMAT_DEFAULT)
+            config->format = AUDIO_FORMAT_PCM_16_BIT;
+        if (config->format != AUDIO_FORMAT_PCM_16_BIT ||
+                !out_hdmi_supports(out, config->channel_mask, config->sample_rate)) {
+            /* suggest a config the sink accepts */
+            config->format = AUDIO_FORMAT_PCM_16_BIT;
+            config->channel_mask = out->sup_channel_masks[0];
+            if (!out_hdmi_supports(out, config->channel_mask, config->sample_rate))
+                config->sample_rate = out->sup_sample_rates[0];
+            ret = -EINVAL;
+            goto err_open;
+        }
+
+        output_type = OUTPUT_HDMI;
+        out->channel_mask = config->channel_mask;
+        out->config[PCM_HDMI] = pcm_config_hdmi;
+        out->config[PCM_HDMI].channels = popcount(config->channel_mask);
+        out->config[PCM_HDMI].rate = config->sample_rate;
+        out->stream.common.get_buffer_size = out_get_buffer_size_hdmi;
+        out->stream.common.get_sample_rate = out_get_sample_rate_hdmi;
+        out->stream.get_latency = out_get_latency_hdmi;
+        out->stream.write = out_write_hdmi;
+    } else {
+        if (ladev->outputs[OUTPUT_DEEP_BUF] != NULL) {
+            ret = -ENOSYS;
+            goto err_open;
+        }
+        output_type = OUTPUT_DEEP_BUF;
+        out->stream.common.get_buffer_size = out_get_buffer_size_deep_buffer;
+        out->stream.common.get_sample_rate = out_get_sample_rate;
+        out->stream.get_latency = out_get_latency_deep_buffer;
+        out->stream.write = out_write_deep_buffer;
+
+        ret = create_resampler(DEFAULT_OUT_SAMPLING_RATE,
+                               MM_FULL_POWER_SAMPLING_RATE,
+                               2,
+                               RESAMPLER_QUALITY_DEFAULT,
+                               NULL,
+                               &out->resampler);
+        if (ret != 0)
+            goto err_open;
     }
-    output_type = OUTPUT_DEEP_BUF;
-    out->channel_mask = AUDIO_CHANNEL_OUT_STEREO;
-    out->stream.common.get_buffer_size = out_get_buffer_size_deep_buffer;
-    out->stream.common.get_sample_rate = out_get_sample_rate;
-    out->stream.get_latency = out_get_latency_deep_buffer;
-    out->stream.write = out_write_deep_buffer;
-
-    ret = create_resampler(DEFAULT_OUT_SAMPLING_RATE,
-                           MM_FULL_POWER_SAMPLING_RATE,
-                           2,
-                           RESAMPLER_QUALITY_DEFAULT,
-                           NULL,
-                           &out->resampler);
-    if (ret != 0)
-        goto err_open;
 
     out->stream.common.set_sample_rate = out_set_sample_rate;
     out->stream.common.get_channels = out_get_channels;
@@ -2488,6 +3924,7 @@ static int adev_open_output_stream(struct audio_hw_device *dev,
     out->stream.common.remove_audio_effect = out_remove_audio_effect;
     out->stream.set_volume = out_set_volume;
     out->stream.get_render_position = out_get_render_position;
+    out->stream.get_presentation_position = out_get_presentation_position;
 
     out->dev = ladev;
     out->standby = 1;
@@ -2503,11 +3940,34 @@ static int adev_open_output_stream(struct audio_hw_device *dev,
     config->channel_mask = out->stream.common.get_channels(&out->stream.common);
     config->sample_rate = out->stream.common.get_sample_rate(&out->stream.common);
 
+    /* allocated once, out_apply_gain() runs on the write path */
+    out->gain_buf_size = out->stream.common.get_buffer_size(&out->stream.common);
+    out->gain_buf = malloc(out->gain_buf_size);
+    if (out->gain_buf == NULL) {
+        ret = -ENOMEM;
+        goto err_gain_buf;
+    }
+
+    pthread_mutex_lock(&ladev->lock);
+    gain_ramp_init(&out->gain, popcount(out->channel_mask),
+                   config->sample_rate * GAIN_RAMP_MS / 1000,
+                   ladev->master_mute ? 0.0f : ladev->master_volume);
     *stream_out = &out->stream;
+    out->type = output_type;
     ladev->outputs[output_type] = out;
+    pthread_mutex_unlock(&ladev->lock);
+
+    /* the codec EQ is fed by the effects of the deep buffer output, the
+     * one music plays on */
+    out->handle = handle;
+    if (output_type == OUTPUT_DEEP_BUF && ladev->fx_start_output)
+        ladev->fx_start_output(handle, &out->stream.common);
 
     return 0;
 
+err_gain_buf:
+    if (out->resampler)
+        release_resampler(out->resampler);
 err_open:
     free(out);
     return ret;
@@ -2520,16 +3980,27 @@ static void adev_close_output_stream(struct audio_hw_device *dev,
     struct m0_stream_out *out = (struct m0_stream_out *)stream;
     int i;
 
-    out_standby(&stream->common);
+    if (ladev->fx_stop_output)
+        ladev->fx_stop_output(out->handle);
+
+    pthread_mutex_lock(&ladev->lock);
+    lock_output_stream(out);
+    do_output_standby(out);
+    pthread_mutex_unlock(&out->lock);
     for (i = 0; i < OUTPUT_TOTAL; i++) {
         if (ladev->outputs[i] == out) {
             ladev->outputs[i] = NULL;
             break;
         }
     }
+    /* the echo reference stopped with the stream, it is released by the input */
+    if (ladev->echo_reference_out == out)
+        ladev->echo_reference_out = NULL;
+    pthread_mutex_unlock(&ladev->lock);
 
     if (out->buffer)
         free(out->buffer);
+    free(out->gain_buf);
     if (out->resampler)
         release_resampler(out->resampler);
     free(stream);
@@ -2539,10 +4010,8 @@ static void adev_set_voice_session_bt_wideband(struct m0_audio_device *adev, boo
 {
     adev->bluetooth_wb = enable;
 
-    if (adev->mode == AUDIO_MODE_IN_CALL) {
-        end_call(adev);
-        start_call(adev);
-    }
+    if (adev->mode == AUDIO_MODE_IN_CALL)
+        update_call_pcm_rate(adev);
 }
 
 static int adev_set_parameters(struct audio_hw_device *dev, const char *kvpairs)
@@ -2564,18 +4033,23 @@ static int adev_set_parameters(struct audio_hw_device *dev, const char *kvpairs)
 
     ret = str_parms_get_str(parms, AUDIO_PARAMETER_KEY_BT_SCO_WB, value, sizeof(value));
     if (ret >= 0) {
+        pthread_mutex_lock(&adev->lock);
         if (strcmp(value, AUDIO_PARAMETER_VALUE_ON) == 0)
             adev_set_voice_session_bt_wideband(adev, true);
         else
             adev_set_voice_session_bt_wideband(adev, false);
+        pthread_mutex_unlock(&adev->lock);
     }
 
     ret = str_parms_get_str(parms, "screen_off", value, sizeof(value));
     if (ret >= 0) {
+        pthread_mutex_lock(&adev->lock);
         if (strcmp(value, AUDIO_PARAMETER_VALUE_ON) == 0)
             adev->screen_off = false;
         else
             adev->screen_off = true;
+        adev_publish_state(adev);
+        pthread_mutex_unlock(&adev->lock);
     }
 
     str_parms_destroy(parms);
@@ -2605,9 +4079,56 @@ static int adev_set_voice_volume(struct audio_hw_device *dev, float volume)
     return 0;
 }
 
+/* AudioFlinger leaves master volume and mute to the HAL when the getters
+ * succeed, the gain is then applied once per output buffer instead of once
+ * per track */
 static int adev_set_master_volume(struct audio_hw_device *dev, float volume)
 {
-    return -ENOSYS;
+    struct m0_audio_device *adev = (struct m0_audio_device *)dev;
+
+    if (volume < 0.0f || volume > 1.0f)
+        return -EINVAL;
+
+    pthread_mutex_lock(&adev->lock);
+    adev->master_volume = volume;
+    set_master_gain(adev);
+    pthread_mutex_unlock(&adev->lock);
+
+    return 0;
+}
+
+static int adev_get_master_volume(struct audio_hw_device *dev, float *volume)
+{
+    struct m0_audio_device *adev = (struct m0_audio_device *)dev;
+
+    pthread_mutex_lock(&adev->lock);
+    *volume = adev->master_volume;
+    pthread_mutex_unlock(&adev->lock);
+
+    return 0;
+}
+
+static int adev_set_master_mute(struct audio_hw_device *dev, bool muted)
+{
+    struct m0_audio_device *adev = (struct m0_audio_device *)dev;
+
+    pthread_mutex_lock(&adev->lock);
+    adev->master_mute = muted;
+    set_master_gain(adev);
+    pthread_mutex_unlock(&adev->lock);
+
+    return 0;
+}
+
+static int adev_get_master_mute(struct audio_hw_device *dev, bool *muted)
+{
+    struct m0_audio_device *adev = (struct m0_audio_device *)dev;
+
+    pthread_mutex_lock(&adev->lock);
+    *muted = adev->master_mute;
+    pthread_mutex_unlock(&adev->lock);
+
+    return 0;
 }
 
 static int adev_set_mode(struct audio_hw_device *dev, audio_mode_t mode)
@@ -2617,6 +4138,7 @@ static int adev_set_mode(struct audio_hw_device *dev, audio_mode_t mode)
     pthread_mutex_lock(&adev->lock);
     if (adev->mode != mode) {
         adev->mode = mode;
+        adev_publish_state(adev);
         select_mode(adev);
     }
     pthread_mutex_unlock(&adev->lock);
@@ -2656,6 +4178,63 @@ static size_t adev_get_input_buffer_size(const struct audio_hw_device *dev,
     return get_input_buffer_size(config->sample_rate, config->format, channel_count);
 }
 
+/*
+ * Allocate every buffer used on the capture path in one block so that
+ * in_read() never has to call into the heap. Processing buffers hold one
+ * HAL buffer at the requested rate and all buffers are sized for
+ * CAPTURE_MAX_CHANNELS so that enabling aux channels needs no reallocation.
+ * Inputs at a voice rate also get the pre-roll ring of the low power hotword
+ * capture, the source is only known once the stream is started.
+ */
+static int in_alloc_arena(struct m0_stream_in *in)
+{
+    size_t proc_frames = get_input_buffer_size(in->requested_rate, AUDIO_FORMAT_PCM_16_BIT, 1) /
+                                sizeof(int16_t);
+    size_t ring_samples = CAPTURE_RING_FRAMES * CAPTURE_MAX_CHANNELS;
+    size_t period_samples = CAPTURE_PERIOD_SIZE * CAPTURE_MAX_CHANNELS;
+    size_t ring_frames = audio_ring_round_frames(proc_frames);
+    size_t proc_samples = ring_frames * CAPTURE_MAX_CHANNELS;
+    size_t preproc_samples = preproc_pipeline_storage_size(proc_frames, CAPTURE_MAX_CHANNELS) /
+                                    sizeof(int16_t);
+    size_t preroll_frames = 0;
+    size_t total_samples;
+    int16_t *p;
+
+    if (in->requested_rate == VX_NB_SAMPLING_RATE || in->requested_rate == VX_WB_SAMPLING_RATE)
+        preroll_frames = audio_ring_round_frames(in->requested_rate * HOTWORD_PREROLL_MS / 1000);
+
+    /* capture ring, read_buf, proc ring, proc out, ref ring, preprocessing
+     * queues and pre-roll ring */
+    total_samples = ring_samples + period_samples + 3 * proc_samples + preproc_samples +
+                    preroll_frames * CAPTURE_MAX_CHANNELS;
+    in->arena = malloc(total_samples * sizeof(int16_t));
+    if (!in->arena)
+        return -ENOMEM;
+
+    p = in->arena;
+    in->capture_ring_buf = p;
+    p += ring_samples;
+    in->read_buf = p;
+    p += period_samples;
+    in->proc_ring_buf = p;
+    p += proc_samples;
+    in->proc_buf_out = p;
+    p += proc_samples;
+    in->ref_ring_buf = p;
+    p += proc_samples;
+    in->preproc_buf = p;
+    p += preproc_samples;
+    in->preroll_buf = preroll_frames ? p : NULL;
+    in->preroll_frames = preroll_frames;
+    in->proc_buf_size = proc_frames;
+    in->proc_ring_frames = ring_frames;
+    preproc_pipeline_init(&in->preproc, in->preproc_buf, proc_frames, CAPTURE_MAX_CHANNELS);
+
+    ALOGV("%s: %zu bytes, %zu processing frames, %zu pre-roll frames", __func__,
+          total_samples * sizeof(int16_t), proc_frames, preroll_frames);
+    return 0;
+}
+
 static int adev_open_input_stream(struct audio_hw_device *dev,
                                   audio_io_handle_t handle,
                                   audio_devices_t devices,
@@ -2698,6 +4277,7 @@ static int adev_open_input_stream(struct audio_hw_device *dev,
     in->stream.set_gain = in_set_gain;
     in->stream.read = in_read;
     in->stream.get_input_frames_lost = in_get_input_frames_lost;
+    in->stream.get_capture_position = in_get_capture_position;
 
     in->requested_rate = config->sample_rate;
 
@@ -2725,6 +4305,17 @@ static int adev_open_input_stream(struct audio_hw_device *dev,
         }
     }
 
+    ret = in_alloc_arena(in);
+    if (ret != 0)
+        goto err;
+    capture_hub_client_init(&in->capture, in->capture_ring_buf, CAPTURE_RING_FRAMES,
+                            in->config.channels);
+    in->capture.process = in_capture_process;
+    in->capture.context = in;
+    gain_ramp_init(&in->mute, popcount(in->main_channels),
+                   in->requested_rate * GAIN_RAMP_MS / 1000,
+                   ladev->mic_mute ? 0.0f : 1.0f);
+
     in->dev = ladev;
     in->standby = 1;
     in->device = devices & ~AUDIO_DEVICE_BIT_IN;
@@ -2736,6 +4327,7 @@ err:
     if (in->resampler)
         release_resampler(in->resampler);
 
+    free(in->arena);
     free(in);
     return ret;
 }
@@ -2752,34 +4344,130 @@ static void adev_close_input_stream(struct audio_hw_device *dev,
         free(in->preprocessors[i].channel_configs);
     }
 
-    free(in->read_buf);
     if (in->resampler) {
         release_resampler(in->resampler);
     }
-    if (in->proc_buf_in)
-        free(in->proc_buf_in);
-    if (in->proc_buf_out)
-        free(in->proc_buf_out);
-    if (in->ref_buf)
-        free(in->ref_buf);
+    capture_hub_client_release(&in->capture);
+    free(in->arena);
 
     free(stream);
     return;
 }
 
+/* Streams are only listed if the hw device mutex can be taken quickly: it
+ * keeps them from being closed meanwhile but may be held for a long time
+ * by a routing change. */
 static int adev_dump(const audio_hw_device_t *device, int fd)
 {
+    struct m0_audio_device *adev = (struct m0_audio_device *)device;
+    struct m0_stream_in *in;
+    bool locked;
+    int i;
+
+    locked = dump_trylock(&adev->lock);
+
+    dprintf(fd, "  Primary audio HAL:\n");
+    dprintf(fd, "    mode: %d, in call: %d, devices: out %#x in %#x\n", adev->mode,
+            adev->in_call, adev->out_device, adev->in_device);
+    dprintf(fd, "    capture clients: %u\n", adev->capture_hub.num_clients);
+    audio_stats_dev_dump(&adev->stats, fd);
+    ril_dump(&adev->ril, fd);
+
+    if (!locked) {
+        dprintf(fd, "    hw device busy, streams not listed\n");
+        return 0;
+    }
+
+    for (i = 0; i < OUTPUT_TOTAL; i++) {
+        if (adev->outputs[i] != NULL)
+            out_dump(&adev->outputs[i]->stream.common, fd);
+    }
+    for (in = adev->active_input; in != NULL; in = in->active_next)
+        in_dump(&in->stream.common, fd);
+
+    pthread_mutex_unlock(&adev->lock);
     return 0;
 }
 
+/* Without the codec effects library the codec EQ is only driven through
+ * the CODEC_EQ_PARAM_* output parameters */
+static void adev_load_fx_lib(struct m0_audio_device *adev)
+{
+    adev->fx_lib = dlopen(CODEC_FX_LIBRARY_PATH, RTLD_NOW);
+    if (!adev->fx_lib) {
+        ALOGV("%s: no codec effects library: %s", __func__, dlerror());
+        return;
+    }
+
+    adev->fx_start_output = (codec_fx_start_output_t)dlsym(adev->fx_lib,
+                                                           CODEC_FX_START_OUTPUT_SYM);
+    adev->fx_stop_output = (codec_fx_stop_output_t)dlsym(adev->fx_lib,
+                                                         CODEC_FX_STOP_OUTPUT_SYM);
+    if (!adev->fx_start_output || !adev->fx_stop_output) {
+        ALOGE("%s: cannot get symbols from '%s'", __func__, CODEC_FX_LIBRARY_PATH);
+        dlclose(adev->fx_lib);
+        adev->fx_lib = NULL;
+        adev->fx_start_output = NULL;
+        adev->fx_stop_output = NULL;
+    }
+}
+
+static void free_route(struct route_setting *route, unsigned int len)
+{
+    unsigned int i;
+
+    for (i = 0; i < len; i++) {
+        free(route[i].ctl_name);
+        free(route[i].strval);
+    }
+    free(route);
+}
+
+/* The paths of the device configs belong to the route cache when it was
+ * loaded, to the configs when they were parsed from the XML file */
+static void adev_free_dev_cfgs(struct m0_audio_device *adev)
+{
+    int i;
+
+    if (!adev->route_cache.map) {
+        for (i = 0; i < adev->num_dev_cfgs; i++) {
+            free_route(adev->dev_cfgs[i].on, adev->dev_cfgs[i].on_len);
+            free_route(adev->dev_cfgs[i].off, adev->dev_cfgs[i].off_len);
+        }
+    }
+    free(adev->dev_cfgs);
+    adev->dev_cfgs = NULL;
+    adev->num_dev_cfgs = 0;
+}
+
 static int adev_close(hw_device_t *device)
 {
     struct m0_audio_device *adev = (struct m0_audio_device *)device;
+    bool standby_thread_running;
 
-    /* RIL */
+    pthread_mutex_lock(&adev->lock);
+    standby_thread_running = !adev->standby_thread_exit;
+    adev->standby_thread_exit = true;
+    pthread_cond_signal(&adev->standby_cond);
+    pthread_mutex_unlock(&adev->lock);
+    if (standby_thread_running)
+        pthread_join(adev->standby_thread, NULL);
+    pthread_cond_destroy(&adev->standby_cond);
+
+    capture_hub_release(&adev->capture_hub);
+
+    /* RIL, no callback can come once the worker is gone */
     ril_close(&adev->ril);
+    ril_register_set_wb_amr_callback(NULL, NULL);
+
+    if (adev->fx_lib)
+        dlclose(adev->fx_lib);
 
     mixer_close(adev->mixer);
+    free(adev->mixer_shadow);
+    free(adev->txn_pending);
+    adev_free_dev_cfgs(adev);
+    route_cache_release(&adev->route_cache);
     free(device);
     return 0;
 }
@@ -2791,6 +4479,10 @@ struct config_parse_state {
 
     struct route_setting *path;
     unsigned int path_len;
+
+    /* every path in document order, used to build the route cache */
+    struct route_cache_path *paths;
+    unsigned int num_paths;
 };
 
 static const struct {
@@ -2891,8 +4583,8 @@ static void adev_config_start(void *data, const XML_Char *elem,
         return;
     }
 
+    memset(&r[s->path_len], 0, sizeof(*r));
     r[s->path_len].ctl_name = strdup(name);
-    r[s->path_len].strval = NULL;
 
     /* This can be fooled but it'll do */
     r[s->path_len].intval = atoi(val);
@@ -2904,10 +4596,29 @@ static void adev_config_start(void *data, const XML_Char *elem,
     }
 }
 
+static void adev_config_add_path(struct config_parse_state *s, int type)
+{
+    struct route_cache_path *paths;
+
+    paths = realloc(s->paths, (s->num_paths + 1) * sizeof(*paths));
+    if (!paths) {
+        ALOGE("Unable to record path for the route cache\n");
+        return;
+    }
+
+    paths[s->num_paths].type = type;
+    paths[s->num_paths].device = s->dev ? s->dev - s->adev->dev_cfgs : -1;
+    paths[s->num_paths].mask = s->dev ? s->dev->mask : 0;
+    paths[s->num_paths].settings = s->path;
+    paths[s->num_paths].len = s->path_len;
+
+    s->paths = paths;
+    s->num_paths++;
+}
+
 static void adev_config_end(void *data, const XML_Char *name)
 {
     struct config_parse_state *s = data;
-    unsigned int i;
 
     if (strcmp(name, "path") == 0) {
     if (!s->path_len)
@@ -2916,14 +4627,10 @@ static void adev_config_end(void *data, const XML_Char *name)
     if (!s->dev) {
         ALOGV("Applying %d element default route\n", s->path_len);
 
-        set_route_by_array(s->adev->mixer, s->path, s->path_len);
-
-        for (i = 0; i < s->path_len; i++) {
-        free(s->path[i].ctl_name);
-        free(s->path[i].strval);
-        }
+        set_route_by_array(s->adev, s->path, s->path_len);
 
-        free(s->path);
+        /* freed once the route cache has been written */
+        adev_config_add_path(s, ROUTE_CACHE_PATH_DEFAULT);
 
         /* Refactor! */
     } else if (s->on) {
@@ -2931,14 +4638,17 @@ static void adev_config_end(void *data, const XML_Char *name)
         s->dev->on = s->path;
         s->dev->on_len = s->path_len;
 
+        adev_config_add_path(s, ROUTE_CACHE_PATH_ON);
     } else {
         ALOGV("%d element off sequence\n", s->path_len);
 
         /* Apply it, we'll reenable anything that's wanted later */
-        set_route_by_array(s->adev->mixer, s->path, s->path_len);
+        set_route_by_array(s->adev, s->path, s->path_len);
 
         s->dev->off = s->path;
         s->dev->off_len = s->path_len;
+
+        adev_config_add_path(s, ROUTE_CACHE_PATH_OFF);
     }
 
     s->path_len = 0;
@@ -2949,20 +4659,16 @@ static void adev_config_end(void *data, const XML_Char *name)
     }
 }
 
-static int adev_config_parse(struct m0_audio_device *adev)
+static int adev_config_parse_xml(struct m0_audio_device *adev, const char *file,
+                                 struct config_parse_state *s)
 {
-    struct config_parse_state s;
     FILE *f;
     XML_Parser p;
-    char property[PROPERTY_VALUE_MAX];
-    char file[80];
+    char buf[4096];
     int ret = 0;
     bool eof = false;
     int len;
 
-    property_get("ro.product.device", property, "tiny_hw");
-    snprintf(file, sizeof(file), "/system/etc/sound/%s", property);
-
     ALOGV("Reading configuration from %s\n", file);
     f = fopen(file, "r");
     if (!f) {
@@ -2977,14 +4683,12 @@ static int adev_config_parse(struct m0_audio_device *adev)
     goto out;
     }
 
-    memset(&s, 0, sizeof(s));
-    s.adev = adev;
-    XML_SetUserData(p, &s);
+    XML_SetUserData(p, s);
 
     XML_SetElementHandler(p, adev_config_start, adev_config_end);
 
     while (!eof) {
-    len = fread(file, 1, sizeof(file), f);
+    len = fread(buf, 1, sizeof(buf), f);
     if (ferror(f)) {
         ALOGE("I/O error reading config\n");
         ret = -EIO;
@@ -2992,7 +4696,7 @@ static int adev_config_parse(struct m0_audio_device *adev)
     }
     eof = feof(f);
 
-    if (XML_Parse(p, file, len, eof) == XML_STATUS_ERROR) {
+    if (XML_Parse(p, buf, len, eof) == XML_STATUS_ERROR) {
         ALOGE("Parse error at line %u:\n%s\n",
          (unsigned int)XML_GetCurrentLineNumber(p),
          XML_ErrorString(XML_GetErrorCode(p)));
@@ -3009,15 +4713,115 @@ static int adev_config_parse(struct m0_audio_device *adev)
     return ret;
 }
 
+/* Rebuild the device configs from a route cache, applying the default and
+ * off paths in the same order the XML parser would have. */
+static int adev_config_load_cache(struct m0_audio_device *adev, struct route_cache *cache)
+{
+    struct route_cache_path *path;
+    int num_dev_cfgs = 0;
+    unsigned int i;
+
+    for (i = 0; i < cache->num_paths; i++) {
+        if (cache->paths[i].device >= num_dev_cfgs)
+            num_dev_cfgs = cache->paths[i].device + 1;
+    }
+
+    if (num_dev_cfgs) {
+        adev->dev_cfgs = calloc(num_dev_cfgs, sizeof(*adev->dev_cfgs));
+        if (!adev->dev_cfgs)
+            return -ENOMEM;
+        adev->num_dev_cfgs = num_dev_cfgs;
+    }
+
+    for (i = 0; i < cache->num_paths; i++) {
+        path = &cache->paths[i];
+
+        if (path->type != ROUTE_CACHE_PATH_DEFAULT && path->device < 0)
+            continue;
+
+        switch (path->type) {
+        case ROUTE_CACHE_PATH_DEFAULT:
+            set_route_by_array(adev, path->settings, path->len);
+            break;
+        case ROUTE_CACHE_PATH_ON:
+            adev->dev_cfgs[path->device].mask = path->mask;
+            adev->dev_cfgs[path->device].on = path->settings;
+            adev->dev_cfgs[path->device].on_len = path->len;
+            break;
+        case ROUTE_CACHE_PATH_OFF:
+            set_route_by_array(adev, path->settings, path->len);
+            adev->dev_cfgs[path->device].mask = path->mask;
+            adev->dev_cfgs[path->device].off = path->settings;
+            adev->dev_cfgs[path->device].off_len = path->len;
+            break;
+        }
+    }
+
+    return 0;
+}
+
+static int adev_config_parse(struct m0_audio_device *adev)
+{
+    struct config_parse_state s;
+    struct route_cache_key key;
+    char property[PROPERTY_VALUE_MAX];
+    char file[PATH_MAX];
+    char cache_file[PATH_MAX];
+    bool have_key;
+    unsigned int i, j;
+    int ret;
+
+    property_get(PRODUCT_DEVICE_PROPERTY, property, "tiny_hw");
+    snprintf(file, sizeof(file), "%s/%s", AUDIO_CONFIG_DIR, property);
+    snprintf(cache_file, sizeof(cache_file), "%s/route_cache_%s.bin",
+             ROUTE_CACHE_DIR, property);
+
+    have_key = route_cache_get_key(file, &key) == 0;
+    if (have_key &&
+            route_cache_load(cache_file, &key, adev->mixer, &adev->route_cache) == 0) {
+        ALOGV("Using cached configuration from %s\n", cache_file);
+        ret = adev_config_load_cache(adev, &adev->route_cache);
+        if (ret == 0)
+            return 0;
+        route_cache_release(&adev->route_cache);
+    }
+
+    memset(&s, 0, sizeof(s));
+    s.adev = adev;
+    ret = adev_config_parse_xml(adev, file, &s);
+
+    if (ret == 0 && have_key) {
+        /* resolve every control now so the cache holds control ids */
+        for (i = 0; i < s.num_paths; i++)
+            for (j = 0; j < s.paths[i].len; j++)
+                route_compile(adev, &s.paths[i].settings[j]);
+
+        if (route_cache_store(cache_file, &key, adev->mixer, s.paths, s.num_paths) != 0)
+            ALOGW("Unable to write route cache %s\n", cache_file);
+    }
+
+    for (i = 0; i < s.num_paths; i++) {
+        if (s.paths[i].type == ROUTE_CACHE_PATH_DEFAULT)
+            free_route(s.paths[i].settings, s.paths[i].len);
+    }
+    free(s.paths);
+
+    return ret;
+}
+
 static int adev_open(const hw_module_t* module, const char* name,
                      hw_device_t** device)
 {
     struct m0_audio_device *adev;
+    pthread_condattr_t attr;
+    struct timespec start;
     int ret;
 
     if (strcmp(name, AUDIO_HARDWARE_INTERFACE) != 0)
         return -EINVAL;
 
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
     adev = calloc(1, sizeof(struct m0_audio_device));
     if (!adev)
         return -ENOMEM;
@@ -3030,6 +4834,9 @@ static int adev_open(const hw_module_t* module, const char* name,
     adev->hw_device.init_check = adev_init_check;
     adev->hw_device.set_voice_volume = adev_set_voice_volume;
     adev->hw_device.set_master_volume = adev_set_master_volume;
+    adev->hw_device.get_master_volume = adev_get_master_volume;
+    adev->hw_device.set_master_mute = adev_set_master_mute;
+    adev->hw_device.get_master_mute = adev_get_master_mute;
     adev->hw_device.set_mode = adev_set_mode;
     adev->hw_device.set_mic_mute = adev_set_mic_mute;
     adev->hw_device.get_mic_mute = adev_get_mic_mute;
@@ -3049,13 +4856,31 @@ static int adev_open(const hw_module_t* module, const char* name,
         return -EINVAL;
     }
 
+    adev->mixer_shadow = calloc(mixer_get_num_ctls(adev->mixer), sizeof(struct mixer_shadow));
+    /* room for every control written twice before the queue is flushed */
+    adev->txn_max_pending = mixer_get_num_ctls(adev->mixer) * 2;
+    adev->txn_pending = calloc(adev->txn_max_pending, sizeof(struct mixer_txn_write));
+    adev->txn_path = 1;
+    if (!adev->mixer_shadow || !adev->txn_pending) {
+        ret = -ENOMEM;
+        goto err_mixer;
+    }
+
+    mixer_txn_begin(adev);
     ret = adev_config_parse(adev);
+    mixer_txn_commit(adev);
     if (ret != 0)
-        goto err_mixer;
+        goto err_config;
+
+    ret = capture_hub_init(&adev->capture_hub, CARD_DEFAULT, PORT_CAPTURE,
+                           &pcm_config_capture);
+    if (ret != 0)
+        goto err_config;
 
     /* Set the default route before the PCM stream is opened */
     pthread_mutex_lock(&adev->lock);
     adev->mode = AUDIO_MODE_NORMAL;
+    adev_publish_state(adev);
     adev->out_device = AUDIO_DEVICE_OUT_SPEAKER;
     adev->in_device = AUDIO_DEVICE_NONE;
     select_devices(adev);
@@ -3065,27 +4890,53 @@ static int adev_open(const hw_module_t* module, const char* name,
     adev->pcm_bt_dl = NULL;
     adev->pcm_bt_ul = NULL;
     adev->voice_volume = 1.0f;
+    adev->master_volume = 1.0f;
     adev->bluetooth_nrec = true;
     adev->wb_amr = 0;
 
-    /* RIL */
-    ril_open(&adev->ril);
-    pthread_mutex_unlock(&adev->lock);
+    /* RIL, the worker reports the wideband AMR state as soon as it connects */
     if (property_get_bool("audio.force_wideband", false)) {
         adev->wb_amr = true;
     } else {
         /* register callback for wideband AMR setting */
         ril_register_set_wb_amr_callback(audio_set_wb_amr_callback, (void *)adev);
     }
+    ril_open(&adev->ril);
+    pthread_mutex_unlock(&adev->lock);
+
+    adev_load_fx_lib(adev);
+
+    adev->standby_grace_ms = property_get_int32(STANDBY_GRACE_PROPERTY,
+                                                STANDBY_GRACE_DEFAULT_MS);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&adev->standby_cond, &attr);
+    pthread_condattr_destroy(&attr);
+    ret = thread_policy_create(&adev->standby_thread, &standby_thread_policy,
+                               adev_standby_thread, adev);
+    if (ret != 0) {
+        /* without the thread nothing would close a warm PCM */
+        ALOGE("%s: cannot create standby thread: %d", __func__, ret);
+        adev->standby_grace_ms = 0;
+        adev->standby_thread_exit = true;
+    }
 
     *device = &adev->hw_device.common;
 
+    ALOGI("%s: opened in %lld us (route cache %s)", __func__, (long long)elapsed_us(&start),
+          adev->route_cache.map ? "hit" : "miss");
+
     return 0;
 
+err_config:
+    adev_free_dev_cfgs(adev);
+    route_cache_release(&adev->route_cache);
 err_mixer:
+    free(adev->txn_pending);
+    free(adev->mixer_shadow);
     mixer_close(adev->mixer);
-err:
-    return -EINVAL;
+    free(adev);
+    return ret;
 }
 
 static struct hw_module_methods_t hal_module_methods = {
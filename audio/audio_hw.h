@@ -18,6 +18,8 @@
  * limitations under the License.
  */
 
+#include "audio_route.h"
+
 /* ALSA cards for WM1811 */
 #define CARD_DEFAULT  0
 
@@ -26,6 +28,10 @@
 #define PORT_BT       2
 #define PORT_CAPTURE  3
 
+/* HDMI/MHL sink, only used by the direct output */
+#define CARD_HDMI     1
+#define PORT_HDMI     0
+
 #define PCM_WRITE pcm_write
 
 #define PLAYBACK_PERIOD_SIZE  880
@@ -35,8 +41,23 @@
 #define CAPTURE_PERIOD_SIZE   1024
 #define CAPTURE_PERIOD_COUNT  4
 
+/* frames buffered between the capture thread and in_read(), a power of two */
+#define CAPTURE_RING_FRAMES   (CAPTURE_PERIOD_SIZE * CAPTURE_PERIOD_COUNT * 2)
+/* the capture buffers are sized for at most this many channels */
+#define CAPTURE_MAX_CHANNELS  2
+/* give up waiting for captured frames after this many seconds */
+#define CAPTURE_READ_TIMEOUT_S 1
+
 #define SHORT_PERIOD_SIZE 192
 
+/* direct HDMI output, the rate and channel count come from the sink */
+#define HDMI_PERIOD_SIZE      1024
+#define HDMI_PERIOD_COUNT     4
+#define HDMI_DEFAULT_SAMPLING_RATE 48000
+
+/* master volume and mute changes are ramped over this long */
+#define GAIN_RAMP_MS          20
+
 //
 // deep buffer
 //
@@ -64,10 +85,38 @@
 /* sampling rate when using VX port for wide band */
 #define VX_WB_SAMPLING_RATE 16000
 
+/* a hotword input finding the microphone unused opens it at its own rate
+ * (VX_NB_SAMPLING_RATE or VX_WB_SAMPLING_RATE) with long periods, which must
+ * not exceed CAPTURE_PERIOD_SIZE frames, and keeps this much pre-roll */
+#define HOTWORD_PERIOD_MS       64
+#define HOTWORD_PERIOD_COUNT    4
+#define HOTWORD_PREROLL_MS      2000
+
+/* an output put in standby keeps its PCM open this long, in ms, so that a
+ * sound following a short silence does not pay for the PCM open. 0 closes
+ * the PCM right away */
+#define STANDBY_GRACE_PROPERTY  "audio.standby_grace_ms"
+#define STANDBY_GRACE_DEFAULT_MS 2000
+
+/* adev_dump() gives up listing the streams after waiting this long for the
+ * hw device mutex */
+#define DUMP_LOCK_RETRIES   10
+#define DUMP_LOCK_RETRY_US  10000
+
 /* product-specific defines */
 #define PRODUCT_DEVICE_PROPERTY "ro.product.device"
 #define PRODUCT_NAME_PROPERTY   "ro.product.name"
 
+/* the mixer paths are read from AUDIO_CONFIG_DIR/<PRODUCT_DEVICE_PROPERTY>,
+ * the host build keeps them and the route cache in a scratch directory */
+#ifdef AUDIO_HW_HOST
+const char *audio_hw_host_dir(void);
+#define AUDIO_CONFIG_DIR        audio_hw_host_dir()
+#define ROUTE_CACHE_DIR         audio_hw_host_dir()
+#else
+#define AUDIO_CONFIG_DIR        "/system/etc/sound"
+#endif
+
 #define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
 
 #define STRING_TO_ENUM(string) { #string, string }
@@ -83,6 +132,11 @@ const struct string_to_enum out_channels_name_to_enum_table[] = {
     STRING_TO_ENUM(AUDIO_CHANNEL_OUT_7POINT1),
 };
 
+/* rates offered to the HDMI sink, if within the range of the HDMI PCM */
+const uint32_t hdmi_sample_rates[] = {
+    32000, 44100, 48000, 88200, 96000, 176400, 192000,
+};
+
 enum pcm_type {
     PCM_NORMAL = 0,
     PCM_SPDIF,
@@ -97,13 +151,6 @@ enum output_type {
     OUTPUT_TOTAL
 };
 
-struct route_setting
-{
-    char *ctl_name;
-    int intval;
-    char *strval;
-};
-
 struct route_setting voicecall_default[] = {
     { .ctl_name = "DAC1L Mixer AIF1.1 Switch", .intval = 1, },
     { .ctl_name = "DAC1R Mixer AIF1.1 Switch", .intval = 1, },
@@ -230,6 +277,22 @@ struct route_setting bt_input[] = {
     { .ctl_name = NULL, },
 };
 
+/* Call recording: the uplink (microphone) is captured on AIF1ADC1 left and
+ * the downlink (AIF2 from the modem) on AIF1ADC1 right */
+struct route_setting voice_rec_input[] = {
+    { .ctl_name = "AIF1ADC1L Mixer ADC/DMIC Switch", .intval = 1, },
+    { .ctl_name = "AIF1ADC1L Mixer AIF2 Switch", .intval = 0, },
+    { .ctl_name = "AIF1ADC1R Mixer ADC/DMIC Switch", .intval = 0, },
+    { .ctl_name = "AIF1ADC1R Mixer AIF2 Switch", .intval = 1, },
+    { .ctl_name = NULL, },
+};
+
+struct route_setting voice_rec_input_disable[] = {
+    { .ctl_name = "AIF1ADC1R Mixer ADC/DMIC Switch", .intval = 1, },
+    { .ctl_name = "AIF1ADC1R Mixer AIF2 Switch", .intval = 0, },
+    { .ctl_name = NULL, },
+};
+
 struct route_setting bt_disable[] = {
     { .ctl_name = "AIF1DAC1 Volume", .intval = 96, },
     { .ctl_name = "AIF1 Boost Volume", .intval = 0, },
@@ -247,3 +310,16 @@ struct route_setting bt_disable[] = {
     { .ctl_name = "AIF1ADC1L Mixer AIF2 Switch", .intval = 0, },
     { .ctl_name = NULL, },
 };
+
+/* codec controls written by set_eq_filter(), bands first then the EQ and
+ * DRC switches, see struct codec_eq_regs */
+struct route_setting codec_eq_ctls[] = {
+    { .ctl_name = "AIF1DAC1 EQ1 Volume", },
+    { .ctl_name = "AIF1DAC1 EQ2 Volume", },
+    { .ctl_name = "AIF1DAC1 EQ3 Volume", },
+    { .ctl_name = "AIF1DAC1 EQ4 Volume", },
+    { .ctl_name = "AIF1DAC1 EQ5 Volume", },
+    { .ctl_name = "AIF1DAC1 EQ Switch", },
+    { .ctl_name = "AIF1DAC1 DRC Switch", },
+    { .ctl_name = NULL, },
+};
@@ -0,0 +1,140 @@
+/*
+ * Copyright (C) 2017 The LineageOS Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <string.h>
+
+#include "audio_ring.h"
+
+size_t audio_ring_round_frames(size_t frames)
+{
+    size_t n = 1;
+
+    while (n < frames)
+        n <<= 1;
+    return n;
+}
+
+int audio_ring_init(struct audio_ring *ring, int16_t *storage, size_t frames,
+                    unsigned int channels)
+{
+    if (!storage || !channels || !frames || (frames & (frames - 1)))
+        return -EINVAL;
+
+    ring->buf = storage;
+    ring->frames = frames;
+    ring->channels = channels;
+    atomic_init(&ring->rd, 0);
+    atomic_init(&ring->wr, 0);
+    return 0;
+}
+
+/* must not be called while the ring is in use by either side */
+void audio_ring_reset(struct audio_ring *ring)
+{
+    atomic_store_explicit(&ring->rd, 0, memory_order_relaxed);
+    atomic_store_explicit(&ring->wr, 0, memory_order_relaxed);
+}
+
+size_t audio_ring_avail(struct audio_ring *ring)
+{
+    size_t wr = atomic_load_explicit(&ring->wr, memory_order_acquire);
+    size_t rd = atomic_load_explicit(&ring->rd, memory_order_relaxed);
+
+    return wr - rd;
+}
+
+size_t audio_ring_space(struct audio_ring *ring)
+{
+    size_t rd = atomic_load_explicit(&ring->rd, memory_order_acquire);
+    size_t wr = atomic_load_explicit(&ring->wr, memory_order_relaxed);
+
+    return ring->frames - (wr - rd);
+}
+
+size_t audio_ring_write_span(struct audio_ring *ring, int16_t **ptr)
+{
+    size_t wr = atomic_load_explicit(&ring->wr, memory_order_relaxed);
+    size_t offset = wr & (ring->frames - 1);
+    size_t space = audio_ring_space(ring);
+    size_t contiguous = ring->frames - offset;
+
+    *ptr = ring->buf + offset * ring->channels;
+    return space < contiguous ? space : contiguous;
+}
+
+void audio_ring_produce(struct audio_ring *ring, size_t frames)
+{
+    size_t wr = atomic_load_explicit(&ring->wr, memory_order_relaxed);
+
+    atomic_store_explicit(&ring->wr, wr + frames, memory_order_release);
+}
+
+size_t audio_ring_read_span(struct audio_ring *ring, int16_t **ptr)
+{
+    size_t rd = atomic_load_explicit(&ring->rd, memory_order_relaxed);
+    size_t offset = rd & (ring->frames - 1);
+    size_t avail = audio_ring_avail(ring);
+    size_t contiguous = ring->frames - offset;
+
+    *ptr = ring->buf + offset * ring->channels;
+    return avail < contiguous ? avail : contiguous;
+}
+
+void audio_ring_consume(struct audio_ring *ring, size_t frames)
+{
+    size_t rd = atomic_load_explicit(&ring->rd, memory_order_relaxed);
+
+    atomic_store_explicit(&ring->rd, rd + frames, memory_order_release);
+}
+
+size_t audio_ring_write(struct audio_ring *ring, const int16_t *src, size_t frames)
+{
+    size_t done = 0;
+
+    while (done < frames) {
+        int16_t *dst;
+        size_t n = audio_ring_write_span(ring, &dst);
+
+        if (n == 0)
+            break;
+        if (n > frames - done)
+            n = frames - done;
+        memcpy(dst, src + done * ring->channels, n * ring->channels * sizeof(int16_t));
+        audio_ring_produce(ring, n);
+        done += n;
+    }
+    return done;
+}
+
+size_t audio_ring_read(struct audio_ring *ring, int16_t *dst, size_t frames)
+{
+    size_t done = 0;
+
+    while (done < frames) {
+        int16_t *src;
+        size_t n = audio_ring_read_span(ring, &src);
+
+        if (n == 0)
+            break;
+        if (n > frames - done)
+            n = frames - done;
+        memcpy(dst + done * ring->channels, src, n * ring->channels * sizeof(int16_t));
+        audio_ring_consume(ring, n);
+        done += n;
+    }
+    return done;
+}
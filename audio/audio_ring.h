@@ -0,0 +1,58 @@
+/*
+ * Copyright (C) 2017 The LineageOS Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef AUDIO_RING_H
+#define AUDIO_RING_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Single producer / single consumer ring of interleaved 16 bit frames.
+ *
+ * The capacity is a power of two and the read and write positions are free
+ * running frame counters, so the ring can be completely filled. The producer
+ * only advances the write position and the consumer only the read position,
+ * which makes it safe to use from two threads without a lock.
+ */
+struct audio_ring {
+    int16_t *buf;
+    size_t frames;          /* capacity in frames, a power of two */
+    unsigned int channels;
+    atomic_size_t rd;
+    atomic_size_t wr;
+};
+
+/* Function prototypes */
+size_t audio_ring_round_frames(size_t frames);
+int audio_ring_init(struct audio_ring *ring, int16_t *storage, size_t frames,
+                    unsigned int channels);
+void audio_ring_reset(struct audio_ring *ring);
+size_t audio_ring_avail(struct audio_ring *ring);
+size_t audio_ring_space(struct audio_ring *ring);
+
+/* copying accessors, return the number of frames transferred */
+size_t audio_ring_write(struct audio_ring *ring, const int16_t *src, size_t frames);
+size_t audio_ring_read(struct audio_ring *ring, int16_t *dst, size_t frames);
+
+/* zero copy accessors: the span functions return the number of contiguous
+ * frames available at *ptr, the caller then commits what it used */
+size_t audio_ring_write_span(struct audio_ring *ring, int16_t **ptr);
+void audio_ring_produce(struct audio_ring *ring, size_t frames);
+size_t audio_ring_read_span(struct audio_ring *ring, int16_t **ptr);
+void audio_ring_consume(struct audio_ring *ring, size_t frames);
+#endif
@@ -0,0 +1,60 @@
+/*
+ * Copyright (C) 2017 The LineageOS Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef AUDIO_ROUTE_H
+#define AUDIO_ROUTE_H
+
+#include <stdbool.h>
+
+struct route_setting
+{
+    char *ctl_name;
+    int intval;
+    char *strval;
+
+    /* resolved on first use by route_compile(). Only the control id is
+     * kept: the static route tables outlive the mixer of a closed device,
+     * and the ids of a card do not change */
+    bool compiled;
+    unsigned int ctl_id;
+    int on_value;
+    int off_value;              /* -1 for an enum without "Off" */
+};
+
+/* maximum number of values of a control written with a single element write */
+#define MIXER_TXN_MAX_VALUES 8
+
+/* last value written to each mixer control, indexed by control id */
+struct mixer_shadow
+{
+    bool valid;
+    int value;
+
+    /* last value queued by the open mixer transaction, and its path */
+    bool pending;
+    int pending_value;
+    unsigned int pending_path;
+};
+
+/* a write queued by the open mixer transaction */
+struct mixer_txn_write
+{
+    unsigned int ctl_id;
+    int value;
+    bool replaced;      /* by a write of a later path, skipped */
+};
+
+#endif
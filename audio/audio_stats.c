@@ -0,0 +1,103 @@
+/*
+ * Copyright (C) 2017 The LineageOS Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+
+#include "audio_stats.h"
+
+#define LOAD(x) atomic_load_explicit(&(x), memory_order_relaxed)
+
+void audio_stats_hist_record(struct audio_stats_hist *hist, int64_t us)
+{
+    unsigned int i = 0;
+    unsigned int max;
+
+    if (us < 0)
+        us = 0;
+    while (i < AUDIO_STATS_HIST_BUCKETS - 1 && us >= (int64_t)AUDIO_STATS_HIST_BASE_US << i)
+        i++;
+
+    atomic_fetch_add_explicit(&hist->buckets[i], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&hist->count, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&hist->sum_us, us, memory_order_relaxed);
+
+    /* there is a single writer, a plain compare is enough */
+    max = us > UINT32_MAX ? UINT32_MAX : (unsigned int)us;
+    if (max > LOAD(hist->max_us))
+        atomic_store_explicit(&hist->max_us, max, memory_order_relaxed);
+}
+
+/* one line with the summary, one with the non empty buckets */
+void audio_stats_hist_dump(const struct audio_stats_hist *hist, int fd, const char *name)
+{
+    unsigned int count = LOAD(hist->count);
+    unsigned int i, n;
+    unsigned int bound;
+
+    if (count == 0) {
+        dprintf(fd, "      %s: none\n", name);
+        return;
+    }
+
+    dprintf(fd, "      %s: %u, avg %llu us, max %u us\n", name, count,
+            LOAD(hist->sum_us) / count, LOAD(hist->max_us));
+    dprintf(fd, "       ");
+    for (i = 0; i < AUDIO_STATS_HIST_BUCKETS; i++) {
+        n = LOAD(hist->buckets[i]);
+        if (n == 0)
+            continue;
+        if (i == AUDIO_STATS_HIST_BUCKETS - 1) {
+            bound = AUDIO_STATS_HIST_BASE_US << (i - 1);
+            dprintf(fd, " >=%ums:%u", bound / 1000, n);
+        } else {
+            bound = AUDIO_STATS_HIST_BASE_US << i;
+            if (bound < 1000)
+                dprintf(fd, " <%uus:%u", bound, n);
+            else
+                dprintf(fd, " <%ums:%u", bound / 1000, n);
+        }
+    }
+    dprintf(fd, "\n");
+}
+
+void audio_stats_out_dump(const struct audio_stats_out *stats, int fd)
+{
+    dprintf(fd, "      frames: %llu (%llu resampled)\n", LOAD(stats->frames),
+            LOAD(stats->resampled_frames));
+    dprintf(fd, "      underruns: %u, write errors: %u\n", LOAD(stats->underruns),
+            LOAD(stats->write_errors));
+    dprintf(fd, "      starts: %u cold, %u warm, standby: %u\n", LOAD(stats->cold_starts),
+            LOAD(stats->warm_starts), LOAD(stats->standby));
+    audio_stats_hist_dump(&stats->write, fd, "write");
+    audio_stats_hist_dump(&stats->start, fd, "start");
+}
+
+void audio_stats_in_dump(const struct audio_stats_in *stats, int fd)
+{
+    dprintf(fd, "      frames: %llu (%llu resampled), lost: %llu\n", LOAD(stats->frames),
+            LOAD(stats->resampled_frames), LOAD(stats->frames_lost));
+    dprintf(fd, "      read errors: %u\n", LOAD(stats->read_errors));
+    dprintf(fd, "      starts: %u, standby: %u\n", LOAD(stats->starts), LOAD(stats->standby));
+    audio_stats_hist_dump(&stats->read, fd, "read");
+    audio_stats_hist_dump(&stats->start, fd, "start");
+}
+
+void audio_stats_dev_dump(const struct audio_stats_dev *stats, int fd)
+{
+    dprintf(fd, "      mode changes: %u\n", LOAD(stats->mode_changes));
+    audio_stats_hist_dump(&stats->route, fd, "route switch");
+    audio_stats_hist_dump(&stats->call_start, fd, "call start");
+}
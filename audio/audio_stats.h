@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2017 The LineageOS Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef AUDIO_STATS_H
+#define AUDIO_STATS_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <time.h>
+
+/*
+ * Performance counters rendered by the dump() entry points.
+ *
+ * Counters are only updated by the thread owning the object they describe,
+ * usually with its mutex held, but dump() reads them without any lock so it
+ * can never be blocked by a stuck stream: every field is a relaxed atomic.
+ * Values are cumulative since the object was created.
+ */
+
+/* bucket i counts durations below AUDIO_STATS_HIST_BASE_US << i, the last
+ * one everything above: 128 us to 65 ms, then >= 65 ms */
+#define AUDIO_STATS_HIST_BUCKETS    11
+#define AUDIO_STATS_HIST_BASE_US    128
+
+struct audio_stats_hist {
+    atomic_uint buckets[AUDIO_STATS_HIST_BUCKETS];
+    atomic_uint count;
+    atomic_ullong sum_us;
+    atomic_uint max_us;
+};
+
+struct audio_stats_out {
+    atomic_uint underruns;      /* writes finding the driver buffer empty */
+    atomic_uint write_errors;
+    atomic_uint cold_starts;    /* standby exits opening the PCM */
+    atomic_uint warm_starts;    /* standby exits reusing the PCM */
+    atomic_uint standby;        /* standby entries */
+    atomic_ullong frames;       /* at the stream rate */
+    atomic_ullong resampled_frames;
+    struct audio_stats_hist write;
+    struct audio_stats_hist start;
+};
+
+struct audio_stats_in {
+    atomic_uint read_errors;
+    atomic_uint starts;
+    atomic_uint standby;
+    atomic_ullong frames;       /* at the stream rate */
+    atomic_ullong resampled_frames;
+    atomic_ullong frames_lost;  /* at the driver rate */
+    struct audio_stats_hist read;
+    struct audio_stats_hist start;
+};
+
+struct audio_stats_dev {
+    atomic_uint mode_changes;
+    struct audio_stats_hist route;      /* select_devices() */
+    struct audio_stats_hist call_start; /* start_call() */
+};
+
+static inline void audio_stats_inc(atomic_uint *counter)
+{
+    atomic_fetch_add_explicit(counter, 1, memory_order_relaxed);
+}
+
+static inline void audio_stats_add(atomic_ullong *counter, unsigned long long n)
+{
+    atomic_fetch_add_explicit(counter, n, memory_order_relaxed);
+}
+
+/* Function prototypes */
+void audio_stats_hist_record(struct audio_stats_hist *hist, int64_t us);
+void audio_stats_hist_dump(const struct audio_stats_hist *hist, int fd, const char *name);
+
+void audio_stats_out_dump(const struct audio_stats_out *stats, int fd);
+void audio_stats_in_dump(const struct audio_stats_in *stats, int fd);
+void audio_stats_dev_dump(const struct audio_stats_dev *stats, int fd);
+#endif
@@ -0,0 +1,449 @@
+/*
+ * Copyright (C) 2017 The LineageOS Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "audio_hw_primary"
+/*#define LOG_NDEBUG 0*/
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <cutils/log.h>
+#include <system/thread_defs.h>
+
+#include "capture_hub.h"
+
+/* the capture thread must keep up with the hardware whatever the load */
+static const struct thread_policy capture_hub_thread_policy = {
+    .name = "audio_capture",
+    .sched_policy = SCHED_FIFO,
+    .rt_priority = 2,
+    .nice = ANDROID_PRIORITY_AUDIO,
+    .avoid_cpu0 = true,
+};
+
+/* queue one period to a client and wake up its reader, called with the hub
+ * lock held */
+static void capture_hub_deliver(struct capture_hub_client *client, const int16_t *buf,
+                                size_t frames, const struct timespec *tstamp,
+                                unsigned int avail)
+{
+    unsigned int channels = client->ring.channels;
+    size_t done = 0;
+    size_t n;
+    int16_t *dst;
+    bool gated = false;
+    bool wake = false;
+
+    if (client->wake != NULL) {
+        pthread_mutex_lock(&client->lock);
+        gated = client->gated;
+        pthread_mutex_unlock(&client->lock);
+
+        /* the reader cannot ungate the client, so it stays away from the
+         * ring and the oldest pre-roll can be dropped */
+        if (gated) {
+            n = audio_ring_space(&client->ring);
+            if (n < frames)
+                audio_ring_consume(&client->ring, frames - n);
+        }
+    }
+
+    while (done < frames) {
+        n = audio_ring_write_span(&client->ring, &dst);
+        if (n == 0)
+            break;
+        if (n > frames - done)
+            n = frames - done;
+        memcpy(dst, buf + done * channels, n * channels * sizeof(int16_t));
+        if (client->process)
+            client->process(client->context, dst, n);
+        audio_ring_produce(&client->ring, n);
+        done += n;
+    }
+
+    /* the reader is late: keep what fits and account for the rest */
+    if (done < frames) {
+        atomic_fetch_add(&client->frames_lost, frames - done);
+        atomic_fetch_add_explicit(&client->overruns, 1, memory_order_relaxed);
+        ALOGW_IF(done == 0, "%s: capture overflow on client %p", __func__, client);
+    }
+
+    if (client->wake != NULL)
+        wake = client->wake(client->context, buf, frames);
+
+    pthread_mutex_lock(&client->lock);
+    client->status = 0;
+    client->frames += frames;
+    if (tstamp != NULL) {
+        client->ts_frames = client->frames + avail;
+        client->ts = *tstamp;
+    }
+    if (gated && wake)
+        client->gated = false;
+    if (!client->gated)
+        pthread_cond_broadcast(&client->cond);
+    pthread_mutex_unlock(&client->lock);
+}
+
+static void capture_hub_signal_error(struct capture_hub_client *client, int status)
+{
+    pthread_mutex_lock(&client->lock);
+    client->status = status;
+    pthread_cond_broadcast(&client->cond);
+    pthread_mutex_unlock(&client->lock);
+}
+
+static void *capture_hub_thread(void *context)
+{
+    struct capture_hub *hub = (struct capture_hub *)context;
+    size_t period = hub->config.period_size;
+    unsigned int bytes = pcm_frames_to_bytes(hub->pcm, period);
+    struct capture_hub_client *client;
+    unsigned int avail = 0;
+    struct timespec ts, now;
+    bool have_ts;
+    int ret;
+
+    thread_latency_init(&hub->latency, &capture_hub_thread_policy);
+
+    while (!atomic_load_explicit(&hub->exit, memory_order_acquire)) {
+        ret = pcm_read(hub->pcm, hub->period_buf, bytes);
+        if (ret != 0) {
+            ALOGE("%s: pcm_read error %d", __func__, ret);
+            pthread_mutex_lock(&hub->lock);
+            for (client = hub->clients; client != NULL; client = client->next)
+                capture_hub_signal_error(client, ret);
+            pthread_mutex_unlock(&hub->lock);
+            usleep(period * 1000000 / hub->config.rate);
+            continue;
+        }
+
+        have_ts = pcm_get_htimestamp(hub->pcm, &avail, &ts) == 0;
+        if (have_ts) {
+            /* ts is when the driver last moved the hardware pointer, which
+             * completed the period pcm_read() was waiting for */
+            clock_gettime(CLOCK_REALTIME, &now);
+            thread_latency_record(&hub->latency,
+                                  (int64_t)(now.tv_sec - ts.tv_sec) * 1000000 +
+                                        (now.tv_nsec - ts.tv_nsec) / 1000);
+        }
+
+        pthread_mutex_lock(&hub->lock);
+        for (client = hub->clients; client != NULL; client = client->next)
+            capture_hub_deliver(client, hub->period_buf, period, have_ts ? &ts : NULL, avail);
+        pthread_mutex_unlock(&hub->lock);
+    }
+
+    return NULL;
+}
+
+static int capture_hub_start(struct capture_hub *hub)
+{
+    int ret;
+
+    hub->pcm = pcm_open(hub->card, hub->device, PCM_IN, &hub->config);
+    if (!pcm_is_ready(hub->pcm)) {
+        ALOGE("%s: cannot open pcm_in driver: %s", __func__, pcm_get_error(hub->pcm));
+        pcm_close(hub->pcm);
+        hub->pcm = NULL;
+        return -ENOMEM;
+    }
+
+    atomic_store(&hub->exit, false);
+    ret = thread_policy_create(&hub->thread, &capture_hub_thread_policy,
+                               capture_hub_thread, hub);
+    if (ret != 0) {
+        ALOGE("%s: cannot create capture thread: %d", __func__, ret);
+        pcm_close(hub->pcm);
+        hub->pcm = NULL;
+        return -ret;
+    }
+    hub->thread_running = true;
+    return 0;
+}
+
+static void capture_hub_stop(struct capture_hub *hub)
+{
+    if (!hub->thread_running)
+        return;
+
+    /* the thread notices the request after at most one period */
+    atomic_store_explicit(&hub->exit, true, memory_order_release);
+    pthread_join(hub->thread, NULL);
+    hub->thread_running = false;
+
+    pcm_close(hub->pcm);
+    hub->pcm = NULL;
+}
+
+int capture_hub_init(struct capture_hub *hub, unsigned int card, unsigned int device,
+                     const struct pcm_config *config)
+{
+    memset(hub, 0, sizeof(*hub));
+    hub->period_buf = malloc(config->period_size * config->channels * sizeof(int16_t));
+    if (!hub->period_buf)
+        return -ENOMEM;
+
+    hub->card = card;
+    hub->device = device;
+    hub->config = *config;
+    pthread_mutex_init(&hub->lock, NULL);
+    return 0;
+}
+
+/* all clients must have been detached */
+void capture_hub_release(struct capture_hub *hub)
+{
+    capture_hub_stop(hub);
+    pthread_mutex_destroy(&hub->lock);
+    free(hub->period_buf);
+    hub->period_buf = NULL;
+}
+
+/* Add a client, opening the PCM if it is the first one. Frames queued to
+ * the client before are dropped. */
+int capture_hub_attach(struct capture_hub *hub, struct capture_hub_client *client)
+{
+    int ret;
+
+    if (client->ring.channels != hub->config.channels)
+        return -EINVAL;
+
+    if (hub->num_clients == 0) {
+        ret = capture_hub_start(hub);
+        if (ret != 0)
+            return ret;
+    }
+
+    audio_ring_reset(&client->ring);
+    atomic_store(&client->frames_lost, 0);
+    pthread_mutex_lock(&client->lock);
+    client->attached = true;
+    client->gated = client->wake != NULL;
+    client->status = 0;
+    client->frames = 0;
+    client->ts_frames = 0;
+    client->ts.tv_sec = 0;
+    client->ts.tv_nsec = 0;
+    pthread_mutex_unlock(&client->lock);
+
+    pthread_mutex_lock(&hub->lock);
+    client->next = hub->clients;
+    hub->clients = client;
+    hub->num_clients++;
+    pthread_mutex_unlock(&hub->lock);
+
+    ALOGV("%s: client %p, %u attached", __func__, client, hub->num_clients);
+    return 0;
+}
+
+/* Remove a client, closing the PCM if it was the last one. A reader waiting
+ * in capture_hub_read() returns -ENODEV. */
+void capture_hub_detach(struct capture_hub *hub, struct capture_hub_client *client)
+{
+    struct capture_hub_client **p;
+    bool found = false;
+
+    pthread_mutex_lock(&hub->lock);
+    for (p = &hub->clients; *p != NULL; p = &(*p)->next) {
+        if (*p == client) {
+            *p = client->next;
+            client->next = NULL;
+            hub->num_clients--;
+            found = true;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&hub->lock);
+
+    if (!found)
+        return;
+
+    if (hub->num_clients == 0)
+        capture_hub_stop(hub);
+
+    pthread_mutex_lock(&client->lock);
+    client->attached = false;
+    pthread_cond_broadcast(&client->cond);
+    pthread_mutex_unlock(&client->lock);
+
+    ALOGV("%s: client %p, %u attached", __func__, client, hub->num_clients);
+}
+
+/* only valid while at least one client is attached */
+int capture_hub_get_htimestamp(struct capture_hub *hub, unsigned int *avail,
+                               struct timespec *tstamp)
+{
+    if (hub->pcm == NULL)
+        return -ENODEV;
+    return pcm_get_htimestamp(hub->pcm, avail, tstamp);
+}
+
+/* Change the PCM configuration, only possible while no client is attached.
+ * The channel count of the clients must follow. */
+int capture_hub_set_config(struct capture_hub *hub, const struct pcm_config *config)
+{
+    int16_t *buf;
+
+    if (hub->num_clients != 0)
+        return -EBUSY;
+
+    if (config->period_size * config->channels >
+            hub->config.period_size * hub->config.channels) {
+        buf = realloc(hub->period_buf,
+                      config->period_size * config->channels * sizeof(int16_t));
+        if (!buf)
+            return -ENOMEM;
+        hub->period_buf = buf;
+    }
+
+    hub->config = *config;
+    return 0;
+}
+
+bool capture_hub_config_equal(const struct pcm_config *a, const struct pcm_config *b)
+{
+    return a->channels == b->channels && a->rate == b->rate &&
+           a->period_size == b->period_size && a->period_count == b->period_count;
+}
+
+int capture_hub_client_init(struct capture_hub_client *client, int16_t *storage,
+                            size_t frames, unsigned int channels)
+{
+    int ret;
+
+    memset(client, 0, sizeof(*client));
+    ret = audio_ring_init(&client->ring, storage, frames, channels);
+    if (ret != 0)
+        return ret;
+
+    atomic_init(&client->frames_lost, 0);
+    atomic_init(&client->overruns, 0);
+    pthread_mutex_init(&client->lock, NULL);
+    pthread_cond_init(&client->cond, NULL);
+    return 0;
+}
+
+/* the client must be detached */
+void capture_hub_client_release(struct capture_hub_client *client)
+{
+    pthread_cond_destroy(&client->cond);
+    pthread_mutex_destroy(&client->lock);
+}
+
+/* Copy frames queued to the client to buffer, waiting for them if needed.
+ * Returns 0 or a negative error if capture failed or the client was detached. */
+int capture_hub_read(struct capture_hub_client *client, int16_t *buffer, size_t frames,
+                     unsigned int timeout_s)
+{
+    size_t done = 0;
+    struct timespec timeout;
+    int status = 0;
+
+    while (done < frames) {
+        done += audio_ring_read(&client->ring, buffer + done * client->ring.channels,
+                                frames - done);
+        if (done == frames)
+            break;
+
+        clock_gettime(CLOCK_REALTIME, &timeout);
+        timeout.tv_sec += timeout_s;
+
+        pthread_mutex_lock(&client->lock);
+        while (audio_ring_avail(&client->ring) == 0 && client->status == 0 &&
+                client->attached && status == 0)
+            status = -pthread_cond_timedwait(&client->cond, &client->lock, &timeout);
+        if (audio_ring_avail(&client->ring) == 0) {
+            if (client->status != 0)
+                status = client->status;
+            else if (!client->attached)
+                status = -ENODEV;
+        } else {
+            status = 0;
+        }
+        pthread_mutex_unlock(&client->lock);
+
+        if (status != 0)
+            return status;
+    }
+
+    return 0;
+}
+
+/* Gate a client again once its reader has drained the ring, the frames
+ * captured from now on are kept as pre-roll. Called by the reader. */
+void capture_hub_client_gate(struct capture_hub_client *client)
+{
+    pthread_mutex_lock(&client->lock);
+    if (client->wake != NULL && audio_ring_avail(&client->ring) == 0)
+        client->gated = true;
+    pthread_mutex_unlock(&client->lock);
+}
+
+/* Wait until a gated client is woken up, for at most timeout_us. Returns 0,
+ * -ETIMEDOUT if the client is still gated or -ENODEV if it was detached
+ * meanwhile. Capture errors do not end the wait as there is nothing to read
+ * anyway. */
+int capture_hub_wait_wake(struct capture_hub_client *client, unsigned int timeout_us)
+{
+    struct timespec timeout;
+    int status = 0;
+
+    clock_gettime(CLOCK_REALTIME, &timeout);
+    timeout.tv_sec += timeout_us / 1000000;
+    timeout.tv_nsec += (timeout_us % 1000000) * 1000;
+    if (timeout.tv_nsec >= 1000000000) {
+        timeout.tv_sec++;
+        timeout.tv_nsec -= 1000000000;
+    }
+
+    pthread_mutex_lock(&client->lock);
+    while (client->gated && client->attached && status == 0)
+        status = -pthread_cond_timedwait(&client->cond, &client->lock, &timeout);
+    if (!client->attached)
+        status = -ENODEV;
+    else if (!client->gated)
+        status = 0;
+    pthread_mutex_unlock(&client->lock);
+
+    return status;
+}
+
+/* frames lost at the hub rate since the previous call */
+uint64_t capture_hub_client_frames_lost(struct capture_hub_client *client)
+{
+    return atomic_exchange(&client->frames_lost, 0);
+}
+
+/* number of frames at the hub rate captured for the client since it was
+ * attached, at tstamp (CLOCK_REALTIME) */
+int capture_hub_client_get_position(struct capture_hub_client *client, uint64_t *frames,
+                                    struct timespec *tstamp)
+{
+    int ret = -ENOSYS;
+
+    pthread_mutex_lock(&client->lock);
+    if (client->attached && client->ts.tv_sec != 0) {
+        *frames = client->ts_frames;
+        *tstamp = client->ts;
+        ret = 0;
+    }
+    pthread_mutex_unlock(&client->lock);
+
+    return ret;
+}
@@ -0,0 +1,114 @@
+/*
+ * Copyright (C) 2017 The LineageOS Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CAPTURE_HUB_H
+#define CAPTURE_HUB_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <tinyalsa/asoundlib.h>
+#include <thread_policy.h>
+
+#include "audio_ring.h"
+
+/*
+ * Shares one capture PCM between several input streams.
+ *
+ * The PCM is opened when the first client attaches and closed when the last
+ * one detaches. A single thread reads it one period at a time and copies
+ * each period to the ring of every attached client, so the hardware is read
+ * once whatever the number of clients. Clients consume their ring at their
+ * own pace with capture_hub_read(): a client that falls behind loses frames
+ * without slowing down the others.
+ *
+ * A client with a wake() callback can be gated: its ring then keeps the most
+ * recent frames as pre-roll, dropping the oldest ones, and its reader is not
+ * woken up until wake() returns true for a period. Only the capture thread
+ * opens the gate and only the reader closes it, the ring is never touched
+ * by the reader while it is gated.
+ */
+struct capture_hub_client {
+    struct audio_ring ring;     /* frames at the hub rate and channel count */
+    atomic_uint frames_lost;    /* since last capture_hub_client_frames_lost() */
+    atomic_uint overruns;       /* periods not queued completely, since init */
+
+    /* optional in place processing of each period queued to this client,
+     * called from the capture thread */
+    void (*process)(void *context, int16_t *buf, size_t frames);
+    /* optional, called from the capture thread with each period as captured */
+    bool (*wake)(void *context, const int16_t *buf, size_t frames);
+    void *context;
+
+    /* only protects the fields below, also used to wake up the reader */
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    bool attached;
+    bool gated;
+    int status;                 /* last capture error, 0 once capture resumed */
+    uint64_t frames;            /* frames delivered or lost since attach */
+    uint64_t ts_frames;         /* frames captured at the hub rate when... */
+    struct timespec ts;         /* ...ts was sampled (CLOCK_REALTIME) */
+
+    struct capture_hub_client *next;
+};
+
+struct capture_hub {
+    unsigned int card;
+    unsigned int device;
+    struct pcm_config config;
+    struct pcm *pcm;
+    int16_t *period_buf;
+
+    pthread_t thread;
+    bool thread_running;
+    atomic_bool exit;
+    struct thread_latency latency;  /* from period end to pcm_read() return */
+
+    /* protects the client list, held by the capture thread while it copies
+     * a period, never while it reads the PCM */
+    pthread_mutex_t lock;
+    struct capture_hub_client *clients;
+    unsigned int num_clients;
+};
+
+/* Function prototypes */
+int capture_hub_init(struct capture_hub *hub, unsigned int card, unsigned int device,
+                     const struct pcm_config *config);
+void capture_hub_release(struct capture_hub *hub);
+
+/* attach and detach must be serialized by the caller */
+int capture_hub_attach(struct capture_hub *hub, struct capture_hub_client *client);
+void capture_hub_detach(struct capture_hub *hub, struct capture_hub_client *client);
+int capture_hub_get_htimestamp(struct capture_hub *hub, unsigned int *avail,
+                               struct timespec *tstamp);
+int capture_hub_set_config(struct capture_hub *hub, const struct pcm_config *config);
+bool capture_hub_config_equal(const struct pcm_config *a, const struct pcm_config *b);
+
+int capture_hub_client_init(struct capture_hub_client *client, int16_t *storage,
+                            size_t frames, unsigned int channels);
+void capture_hub_client_release(struct capture_hub_client *client);
+int capture_hub_read(struct capture_hub_client *client, int16_t *buffer, size_t frames,
+                     unsigned int timeout_s);
+void capture_hub_client_gate(struct capture_hub_client *client);
+int capture_hub_wait_wake(struct capture_hub_client *client, unsigned int timeout_us);
+uint64_t capture_hub_client_frames_lost(struct capture_hub_client *client);
+int capture_hub_client_get_position(struct capture_hub_client *client, uint64_t *frames,
+                                    struct timespec *tstamp);
+#endif
@@ -0,0 +1,182 @@
+/*
+ * Copyright (C) 2017 The LineageOS Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "audio_hw_primary"
+/*#define LOG_NDEBUG 0*/
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <cutils/log.h>
+#include <hardware/audio.h>
+
+#include "codec_eq.h"
+
+static int mb_to_db(int mb)
+{
+    return (mb + (mb >= 0 ? 50 : -50)) / 100;
+}
+
+static int clamp_gain(int gain)
+{
+    if (gain < CODEC_EQ_GAIN_MIN)
+        return CODEC_EQ_GAIN_MIN;
+    if (gain > CODEC_EQ_GAIN_MAX)
+        return CODEC_EQ_GAIN_MAX;
+    return gain;
+}
+
+bool codec_eq_active(const struct codec_eq_params *params)
+{
+    return params->eq_enabled || params->bassboost_enabled || params->loudness_enabled;
+}
+
+static const char * const codec_eq_keys[] = {
+    CODEC_EQ_PARAM_EQ_ENABLE,
+    CODEC_EQ_PARAM_EQ_LEVELS,
+    CODEC_EQ_PARAM_BASSBOOST_ENABLE,
+    CODEC_EQ_PARAM_BASSBOOST_STRENGTH,
+    CODEC_EQ_PARAM_LOUDNESS_ENABLE,
+    CODEC_EQ_PARAM_LOUDNESS_GAIN,
+};
+
+/* whether parms has any of the CODEC_EQ_PARAM_* keys, checked before taking
+ * the locks codec_eq_set_parameters() needs */
+bool codec_eq_has_parameters(struct str_parms *parms)
+{
+    size_t i;
+
+    for (i = 0; i < sizeof(codec_eq_keys) / sizeof(codec_eq_keys[0]); i++) {
+        if (str_parms_has_key(parms, codec_eq_keys[i]))
+            return true;
+    }
+    return false;
+}
+
+static int get_bool(struct str_parms *parms, const char *key, bool *value)
+{
+    char str[8];
+
+    if (str_parms_get_str(parms, key, str, sizeof(str)) < 0)
+        return 0;
+    *value = strcmp(str, AUDIO_PARAMETER_VALUE_ON) == 0;
+    return 1;
+}
+
+/* Update params from the CODEC_EQ_PARAM_* keys of parms.
+ * Returns 1 if any was present, 0 if none, -EINVAL if a value is malformed */
+int codec_eq_set_parameters(struct codec_eq_params *params, struct str_parms *parms)
+{
+    char str[128];
+    char *p, *end;
+    int levels[CODEC_EQ_BANDS];
+    int changed = 0;
+    int val, i;
+
+    changed |= get_bool(parms, CODEC_EQ_PARAM_EQ_ENABLE, &params->eq_enabled);
+    changed |= get_bool(parms, CODEC_EQ_PARAM_BASSBOOST_ENABLE, &params->bassboost_enabled);
+    changed |= get_bool(parms, CODEC_EQ_PARAM_LOUDNESS_ENABLE, &params->loudness_enabled);
+
+    if (str_parms_get_str(parms, CODEC_EQ_PARAM_EQ_LEVELS, str, sizeof(str)) >= 0) {
+        p = str;
+        for (i = 0; i < CODEC_EQ_BANDS; i++) {
+            levels[i] = strtol(p, &end, 10);
+            if (end == p || *end != (i == CODEC_EQ_BANDS - 1 ? '\0' : ',')) {
+                ALOGE("%s: malformed %s: %s", __func__, CODEC_EQ_PARAM_EQ_LEVELS, str);
+                return -EINVAL;
+            }
+            p = end + 1;
+        }
+        memcpy(params->eq_levels_mb, levels, sizeof(levels));
+        changed = 1;
+    }
+
+    if (str_parms_get_int(parms, CODEC_EQ_PARAM_BASSBOOST_STRENGTH, &val) >= 0) {
+        if (val < 0 || val > CODEC_EQ_BASSBOOST_MAX_STRENGTH)
+            return -EINVAL;
+        params->bassboost_strength = val;
+        changed = 1;
+    }
+
+    if (str_parms_get_int(parms, CODEC_EQ_PARAM_LOUDNESS_GAIN, &val) >= 0) {
+        if (val < 0)
+            return -EINVAL;
+        params->loudness_gain_mb = val;
+        changed = 1;
+    }
+
+    return changed;
+}
+
+/* Add every CODEC_EQ_PARAM_* key for params to parms, the reverse of
+ * codec_eq_set_parameters() */
+void codec_eq_get_parameters(const struct codec_eq_params *params, struct str_parms *parms)
+{
+    char str[128];
+    size_t len = 0;
+    int i;
+
+    for (i = 0; i < CODEC_EQ_BANDS; i++)
+        len += snprintf(str + len, sizeof(str) - len, "%s%d", i ? "," : "",
+                        params->eq_levels_mb[i]);
+
+    str_parms_add_str(parms, CODEC_EQ_PARAM_EQ_ENABLE,
+                      params->eq_enabled ? AUDIO_PARAMETER_VALUE_ON : AUDIO_PARAMETER_VALUE_OFF);
+    str_parms_add_str(parms, CODEC_EQ_PARAM_EQ_LEVELS, str);
+    str_parms_add_str(parms, CODEC_EQ_PARAM_BASSBOOST_ENABLE,
+                      params->bassboost_enabled ? AUDIO_PARAMETER_VALUE_ON :
+                                                  AUDIO_PARAMETER_VALUE_OFF);
+    str_parms_add_int(parms, CODEC_EQ_PARAM_BASSBOOST_STRENGTH, params->bassboost_strength);
+    str_parms_add_str(parms, CODEC_EQ_PARAM_LOUDNESS_ENABLE,
+                      params->loudness_enabled ? AUDIO_PARAMETER_VALUE_ON :
+                                                 AUDIO_PARAMETER_VALUE_OFF);
+    str_parms_add_int(parms, CODEC_EQ_PARAM_LOUDNESS_GAIN, params->loudness_gain_mb);
+}
+
+/* Compute the codec controls for params on top of base, the tuning of the
+ * configuration. Bass boost and loudness are folded into the EQ gains, the
+ * DRC keeps the loudness gain from clipping. */
+void codec_eq_map(const struct codec_eq_params *params, const struct codec_eq_regs *base,
+                  struct codec_eq_regs *regs)
+{
+    int gain_db[CODEC_EQ_BANDS] = { 0 };
+    int boost_db, i;
+
+    if (params->eq_enabled) {
+        for (i = 0; i < CODEC_EQ_BANDS; i++)
+            gain_db[i] = mb_to_db(params->eq_levels_mb[i]);
+    }
+
+    if (params->bassboost_enabled) {
+        boost_db = (params->bassboost_strength * CODEC_EQ_BASSBOOST_MAX_DB +
+                    CODEC_EQ_BASSBOOST_MAX_STRENGTH / 2) / CODEC_EQ_BASSBOOST_MAX_STRENGTH;
+        gain_db[0] += boost_db;
+        gain_db[1] += boost_db / 2;
+    }
+
+    if (params->loudness_enabled) {
+        for (i = 0; i < CODEC_EQ_BANDS; i++)
+            gain_db[i] += mb_to_db(params->loudness_gain_mb);
+    }
+
+    for (i = 0; i < CODEC_EQ_BANDS; i++)
+        regs->band[i] = clamp_gain(base->band[i] + gain_db[i]);
+
+    regs->eq_switch = codec_eq_active(params) ? 1 : base->eq_switch;
+    regs->drc_switch = (params->loudness_enabled && params->loudness_gain_mb > 0) ?
+                            1 : base->drc_switch;
+}
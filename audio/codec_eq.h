@@ -0,0 +1,69 @@
+/*
+ * Copyright (C) 2017 The LineageOS Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CODEC_EQ_H
+#define CODEC_EQ_H
+
+#include <stdbool.h>
+
+#include <cutils/str_parms.h>
+
+/* output stream parameters of the effects run by the codec. Levels and
+ * gains are in millibels like the AOSP effect parameters, the bass boost
+ * strength is 0..1000 */
+#define CODEC_EQ_PARAM_EQ_ENABLE        "hw_eq_enable"
+#define CODEC_EQ_PARAM_EQ_LEVELS        "hw_eq_levels"      /* one level per band, comma separated */
+#define CODEC_EQ_PARAM_BASSBOOST_ENABLE "hw_bassboost_enable"
+#define CODEC_EQ_PARAM_BASSBOOST_STRENGTH "hw_bassboost_strength"
+#define CODEC_EQ_PARAM_LOUDNESS_ENABLE  "hw_loudness_enable"
+#define CODEC_EQ_PARAM_LOUDNESS_GAIN    "hw_loudness_gain"
+
+/* AIF1DAC1 5 band EQ, centred at 100 Hz, 300 Hz, 875 Hz, 2.4 kHz and
+ * 6.9 kHz, close enough to the AOSP equalizer bands to map them 1:1 */
+#define CODEC_EQ_BANDS          5
+/* EQ gain controls: 1 dB steps, 0 dB at 12, -12 dB to +12 dB */
+#define CODEC_EQ_GAIN_0DB       12
+#define CODEC_EQ_GAIN_MIN       0
+#define CODEC_EQ_GAIN_MAX       24
+/* bass boost at full strength on the first band, half of it on the second */
+#define CODEC_EQ_BASSBOOST_MAX_DB 9
+#define CODEC_EQ_BASSBOOST_MAX_STRENGTH 1000
+
+/* what the framework asked for */
+struct codec_eq_params {
+    bool eq_enabled;
+    int eq_levels_mb[CODEC_EQ_BANDS];
+    bool bassboost_enabled;
+    int bassboost_strength;
+    bool loudness_enabled;
+    int loudness_gain_mb;
+};
+
+/* values of the codec controls */
+struct codec_eq_regs {
+    int band[CODEC_EQ_BANDS];
+    int eq_switch;
+    int drc_switch;
+};
+
+/* Function prototypes */
+bool codec_eq_active(const struct codec_eq_params *params);
+bool codec_eq_has_parameters(struct str_parms *parms);
+int codec_eq_set_parameters(struct codec_eq_params *params, struct str_parms *parms);
+void codec_eq_get_parameters(const struct codec_eq_params *params, struct str_parms *parms);
+void codec_eq_map(const struct codec_eq_params *params, const struct codec_eq_regs *base,
+                  struct codec_eq_regs *regs);
+#endif
@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2017 The LineageOS Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef CODEC_FX_H
+#define CODEC_FX_H
+
+#include <hardware/audio.h>
+
+/*
+ * libcodecfx: equalizer, bass boost and loudness enhancer effects run by the
+ * codec EQ and DRC instead of in software, see effects/codec_fx.c.
+ *
+ * The framework loads it as an effect library through the audio_effects.conf
+ * in configs/. The HAL loads it too and hands it the output stream whose
+ * effects drive the codec. The library sends the settings of the effects
+ * enabled on that output to the stream as the CODEC_EQ_PARAM_* parameters
+ * of codec_eq.h.
+ */
+
+/* effect_uuid_t of the implementations, for audio_effects.conf */
+#define CODEC_FX_EQUALIZER_UUID \
+    { 0xd8b02fd9, 0xf7d2, 0x448c, 0xad95, { 0xcc, 0x96, 0x57, 0x91, 0xd6, 0x62 } }
+#define CODEC_FX_BASSBOOST_UUID \
+    { 0x98072252, 0xa239, 0x4241, 0x95b6, { 0x9d, 0x38, 0xb4, 0xb8, 0xed, 0x45 } }
+#define CODEC_FX_LOUDNESS_UUID \
+    { 0x1ba75367, 0xd935, 0x439c, 0x8b3a, { 0x21, 0xbf, 0x26, 0x4d, 0xad, 0x7e } }
+
+#ifndef CODEC_FX_LIBRARY_PATH
+#define CODEC_FX_LIBRARY_PATH "/system/lib/soundfx/libcodecfx.so"
+#endif
+
+/* Effects attached to output from now on drive stream, the current ones
+ * are sent right away. Replaces the output given before, if any. Must not
+ * be called with a lock stream->set_parameters() takes. */
+#define CODEC_FX_START_OUTPUT_SYM "codec_fx_hal_start_output"
+typedef int (*codec_fx_start_output_t)(audio_io_handle_t output, struct audio_stream *stream);
+
+/* stream is not used anymore once this returns. Same locking as above */
+#define CODEC_FX_STOP_OUTPUT_SYM "codec_fx_hal_stop_output"
+typedef int (*codec_fx_stop_output_t)(audio_io_handle_t output);
+#endif
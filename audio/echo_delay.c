@@ -0,0 +1,101 @@
+/*
+ * Copyright (C) 2017 The LineageOS Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "audio_hw_primary"
+/*#define LOG_NDEBUG 0*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <cutils/log.h>
+
+#include "echo_delay.h"
+
+void echo_delay_reset(struct echo_delay *ed)
+{
+    memset(ed, 0, sizeof(*ed));
+    ed->pushed_us = -1;
+}
+
+static void echo_delay_restart(struct echo_delay *ed, int32_t delay_us, int64_t now_ns)
+{
+    ed->valid = true;
+    ed->estimate_q8 = (int64_t)delay_us << 8;
+    ed->outliers = 0;
+    ed->window_start_ns = now_ns;
+    ed->window_start_q8 = ed->estimate_q8;
+}
+
+static void echo_delay_update_drift(struct echo_delay *ed, int64_t now_ns)
+{
+    int64_t elapsed_ns = now_ns - ed->window_start_ns;
+    int32_t drift;
+
+    if (elapsed_ns < ECHO_DELAY_DRIFT_WINDOW_NS)
+        return;
+
+    /* us of delay change per second of time is parts per million */
+    drift = (int32_t)((((ed->estimate_q8 - ed->window_start_q8) >> 8) * 1000000000LL) /
+                      elapsed_ns);
+    ed->drift_ppm += (drift - ed->drift_ppm) >> ECHO_DELAY_EWMA_SHIFT;
+    ed->window_start_ns = now_ns;
+    ed->window_start_q8 = ed->estimate_q8;
+
+    ALOGV("%s: delay %d us, drift %d ppm", __func__,
+          (int32_t)(ed->estimate_q8 >> 8), ed->drift_ppm);
+}
+
+/*
+ * Feed one delay measurement. Returns true when the estimate moved by more
+ * than ECHO_DELAY_TOLERANCE_US from the value last returned by
+ * echo_delay_get() since then, i.e. when the AEC should be updated.
+ */
+bool echo_delay_update(struct echo_delay *ed, int32_t delay_us, int64_t now_ns)
+{
+    int64_t sample_q8 = (int64_t)delay_us << 8;
+    int32_t estimate_us;
+
+    ed->num_samples++;
+
+    if (!ed->valid) {
+        echo_delay_restart(ed, delay_us, now_ns);
+    } else if (llabs(sample_q8 - ed->estimate_q8) > ((int64_t)ECHO_DELAY_OUTLIER_US << 8)) {
+        /* a single late period should not move the AEC, a persistent jump
+         * (e.g. after an underrun re-aligned the playback) must */
+        if (++ed->outliers < ECHO_DELAY_OUTLIER_COUNT)
+            return false;
+        ALOGD("%s: echo path changed, %d us -> %d us", __func__,
+              (int32_t)(ed->estimate_q8 >> 8), delay_us);
+        echo_delay_restart(ed, delay_us, now_ns);
+    } else {
+        ed->outliers = 0;
+        ed->estimate_q8 += (sample_q8 - ed->estimate_q8) >> ECHO_DELAY_EWMA_SHIFT;
+        echo_delay_update_drift(ed, now_ns);
+    }
+
+    estimate_us = (int32_t)(ed->estimate_q8 >> 8);
+    if (ed->pushed_us >= 0 && abs(estimate_us - ed->pushed_us) <= ECHO_DELAY_TOLERANCE_US)
+        return false;
+
+    ed->pushed_us = estimate_us;
+    ed->num_pushes++;
+    return true;
+}
+
+int32_t echo_delay_get(const struct echo_delay *ed)
+{
+    return ed->pushed_us < 0 ? 0 : ed->pushed_us;
+}
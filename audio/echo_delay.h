@@ -0,0 +1,61 @@
+/*
+ * Copyright (C) 2017 The LineageOS Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ECHO_DELAY_H
+#define ECHO_DELAY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* the AEC is only told about a new delay when it moved by more than this */
+#define ECHO_DELAY_TOLERANCE_US     2000
+/* a measurement this far from the estimate is treated as an outlier... */
+#define ECHO_DELAY_OUTLIER_US       20000
+/* ...unless this many of them arrive in a row, then the path really changed */
+#define ECHO_DELAY_OUTLIER_COUNT    8
+/* smoothing factor of the estimate is 1 / (1 << ECHO_DELAY_EWMA_SHIFT) */
+#define ECHO_DELAY_EWMA_SHIFT       3
+/* period over which clock drift is measured */
+#define ECHO_DELAY_DRIFT_WINDOW_NS  1000000000LL
+
+/*
+ * Echo path delay estimator.
+ *
+ * Each echo reference read yields a delay measurement between the playback
+ * and capture timestamps. Measurements are noisy because both sides are
+ * sampled at period granularity, and they slowly move because the playback
+ * and capture clocks drift apart. The estimator smooths the measurements,
+ * tracks the drift and reports when the AEC needs to be updated.
+ */
+struct echo_delay {
+    bool valid;
+    int64_t estimate_q8;        /* smoothed delay, us << 8 */
+    int32_t pushed_us;          /* last delay given to the AEC, -1 if none */
+    unsigned int outliers;
+
+    int64_t window_start_ns;
+    int64_t window_start_q8;
+    int32_t drift_ppm;          /* smoothed delay change, us per second */
+
+    uint32_t num_samples;
+    uint32_t num_pushes;
+};
+
+/* Function prototypes */
+void echo_delay_reset(struct echo_delay *ed);
+bool echo_delay_update(struct echo_delay *ed, int32_t delay_us, int64_t now_ns);
+int32_t echo_delay_get(const struct echo_delay *ed);
+#endif
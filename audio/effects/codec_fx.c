@@ -0,0 +1,636 @@
+/*
+ * Copyright (C) 2017 The LineageOS Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "codec_fx"
+/*#define LOG_NDEBUG 0*/
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <cutils/log.h>
+#include <cutils/str_parms.h>
+#include <hardware/audio_effect.h>
+#include <audio_effects/effect_bassboost.h>
+#include <audio_effects/effect_equalizer.h>
+#include <audio_effects/effect_loudnessenhancer.h>
+
+#include "codec_eq.h"
+#include "codec_fx.h"
+
+/*
+ * The effects pass the audio through untouched: their settings go to the
+ * audio HAL, which runs them on the codec EQ and DRC of AIF1DAC1.
+ *
+ * Only the effects of the output the HAL started with
+ * codec_fx_hal_start_output(), the deep buffer output, drive the codec.
+ * The codec applies them to everything mixed into AIF1DAC1, so a stream
+ * played on another output at the same time is equalized too; the effects
+ * attached to the other outputs have no effect at all.
+ *
+ * When several effects of one type are enabled on the output, the most
+ * recently created one is used.
+ */
+
+enum codec_fx_type {
+    CODEC_FX_EQUALIZER,
+    CODEC_FX_BASSBOOST,
+    CODEC_FX_LOUDNESS,
+    CODEC_FX_TOTAL
+};
+
+/* the codec EQ gains go from -12 dB to +12 dB */
+#define EQ_LEVEL_MIN_MB     ((CODEC_EQ_GAIN_MIN - CODEC_EQ_GAIN_0DB) * 100)
+#define EQ_LEVEL_MAX_MB     ((CODEC_EQ_GAIN_MAX - CODEC_EQ_GAIN_0DB) * 100)
+/* no presets, the equalizer is always on custom settings */
+#define EQ_PRESET_CUSTOM    -1
+
+/* low edge, centre and high edge of the codec EQ bands in mHz */
+static const int32_t eq_band_freqs[CODEC_EQ_BANDS][3] = {
+    {       0,   100000,   173000 },
+    {  173000,   300000,   512000 },
+    {  512000,   875000,  1449000 },
+    { 1449000,  2400000,  4069000 },
+    { 4069000,  6900000, 24000000 },
+};
+
+static const effect_descriptor_t codec_fx_descriptors[CODEC_FX_TOTAL] = {
+    [CODEC_FX_EQUALIZER] = {
+        .type = { 0x0bed4300, 0xddd6, 0x11db, 0x8f34, { 0x00, 0x02, 0xa5, 0xd5, 0xc5, 0x1b } },
+        .uuid = CODEC_FX_EQUALIZER_UUID,
+        .apiVersion = EFFECT_CONTROL_API_VERSION,
+        .flags = EFFECT_FLAG_TYPE_INSERT | EFFECT_FLAG_INSERT_LAST,
+        .cpuLoad = 0,
+        .memoryUsage = 0,
+        .name = "Codec Equalizer",
+        .implementor = "The LineageOS Project",
+    },
+    [CODEC_FX_BASSBOOST] = {
+        .type = { 0x0634f220, 0xddd4, 0x11db, 0xa0fc, { 0x00, 0x02, 0xa5, 0xd5, 0xc5, 0x1b } },
+        .uuid = CODEC_FX_BASSBOOST_UUID,
+        .apiVersion = EFFECT_CONTROL_API_VERSION,
+        .flags = EFFECT_FLAG_TYPE_INSERT | EFFECT_FLAG_INSERT_LAST,
+        .cpuLoad = 0,
+        .memoryUsage = 0,
+        .name = "Codec Bass Boost",
+        .implementor = "The LineageOS Project",
+    },
+    [CODEC_FX_LOUDNESS] = {
+        .type = { 0xfe3199be, 0xaed0, 0x413f, 0x87bb, { 0x11, 0x26, 0x0e, 0xb6, 0x3c, 0xf1 } },
+        .uuid = CODEC_FX_LOUDNESS_UUID,
+        .apiVersion = EFFECT_CONTROL_API_VERSION,
+        .flags = EFFECT_FLAG_TYPE_INSERT | EFFECT_FLAG_INSERT_LAST,
+        .cpuLoad = 0,
+        .memoryUsage = 0,
+        .name = "Codec Loudness Enhancer",
+        .implementor = "The LineageOS Project",
+    },
+};
+
+struct codec_fx {
+    const struct effect_interface_s *itfe;  /* must be first, see effect_handle_t */
+    struct codec_fx *next;
+    enum codec_fx_type type;
+    audio_io_handle_t output;
+    bool enabled;
+    effect_config_t config;
+
+    int eq_levels_mb[CODEC_EQ_BANDS];
+    int bassboost_strength;
+    int loudness_gain_mb;
+};
+
+static pthread_mutex_t fx_lock = PTHREAD_MUTEX_INITIALIZER;
+/* newest first */
+static struct codec_fx *fx_list;
+/* the output whose effects drive the codec, see codec_fx_hal_start_output() */
+static audio_io_handle_t fx_output;
+static struct audio_stream *fx_stream;
+
+/* Send the effects of fx_output to the HAL. Must be called with fx_lock held */
+static void codec_fx_update_l(void)
+{
+    struct codec_eq_params params;
+    struct codec_fx *found[CODEC_FX_TOTAL] = { NULL };
+    struct codec_fx *fx;
+    struct str_parms *parms;
+    char *kvpairs;
+
+    if (!fx_stream)
+        return;
+
+    for (fx = fx_list; fx; fx = fx->next) {
+        if (fx->output == fx_output && fx->enabled && !found[fx->type])
+            found[fx->type] = fx;
+    }
+
+    memset(&params, 0, sizeof(params));
+    if (found[CODEC_FX_EQUALIZER]) {
+        params.eq_enabled = true;
+        memcpy(params.eq_levels_mb, found[CODEC_FX_EQUALIZER]->eq_levels_mb,
+               sizeof(params.eq_levels_mb));
+    }
+    if (found[CODEC_FX_BASSBOOST]) {
+        params.bassboost_enabled = true;
+        params.bassboost_strength = found[CODEC_FX_BASSBOOST]->bassboost_strength;
+    }
+    if (found[CODEC_FX_LOUDNESS]) {
+        params.loudness_enabled = true;
+        params.loudness_gain_mb = found[CODEC_FX_LOUDNESS]->loudness_gain_mb;
+    }
+
+    parms = str_parms_create();
+    if (!parms)
+        return;
+    codec_eq_get_parameters(&params, parms);
+    kvpairs = str_parms_to_str(parms);
+    str_parms_destroy(parms);
+    if (!kvpairs)
+        return;
+
+    ALOGV("%s: output %d: %s", __func__, fx_output, kvpairs);
+    fx_stream->set_parameters(fx_stream, kvpairs);
+    free(kvpairs);
+}
+
+static int eq_get_band(uint32_t freq_mhz)
+{
+    int i;
+
+    for (i = 0; i < CODEC_EQ_BANDS - 1; i++) {
+        if (freq_mhz < (uint32_t)eq_band_freqs[i][2])
+            break;
+    }
+    return i;
+}
+
+/* Must be called with fx_lock held */
+static int codec_fx_get_param(struct codec_fx *fx, const int32_t *param, uint32_t psize,
+                              void *value, uint32_t *vsize)
+{
+    int16_t *levels;
+    int band, i;
+
+    if (psize < sizeof(int32_t))
+        return -EINVAL;
+    band = psize >= 2 * sizeof(int32_t) ? param[1] : 0;
+
+    switch (fx->type) {
+    case CODEC_FX_EQUALIZER:
+        switch (param[0]) {
+        case EQ_PARAM_NUM_BANDS:
+        case EQ_PARAM_CUR_PRESET:
+        case EQ_PARAM_GET_NUM_OF_PRESETS:
+        case EQ_PARAM_BAND_LEVEL:
+        case EQ_PARAM_GET_BAND:
+            if (*vsize < sizeof(int16_t))
+                return -EINVAL;
+            *vsize = sizeof(int16_t);
+            break;
+        case EQ_PARAM_LEVEL_RANGE:
+            if (*vsize < 2 * sizeof(int16_t))
+                return -EINVAL;
+            *vsize = 2 * sizeof(int16_t);
+            break;
+        case EQ_PARAM_CENTER_FREQ:
+            if (*vsize < sizeof(int32_t))
+                return -EINVAL;
+            *vsize = sizeof(int32_t);
+            break;
+        case EQ_PARAM_BAND_FREQ_RANGE:
+            if (*vsize < 2 * sizeof(int32_t))
+                return -EINVAL;
+            *vsize = 2 * sizeof(int32_t);
+            break;
+        case EQ_PARAM_PROPERTIES:
+            if (*vsize < (2 + CODEC_EQ_BANDS) * sizeof(int16_t))
+                return -EINVAL;
+            *vsize = (2 + CODEC_EQ_BANDS) * sizeof(int16_t);
+            break;
+        default:
+            return -EINVAL;
+        }
+
+        if ((param[0] == EQ_PARAM_BAND_LEVEL || param[0] == EQ_PARAM_CENTER_FREQ ||
+                param[0] == EQ_PARAM_BAND_FREQ_RANGE) &&
+                (psize < 2 * sizeof(int32_t) || band < 0 || band >= CODEC_EQ_BANDS))
+            return -EINVAL;
+
+        switch (param[0]) {
+        case EQ_PARAM_NUM_BANDS:
+            *(uint16_t *)value = CODEC_EQ_BANDS;
+            break;
+        case EQ_PARAM_CUR_PRESET:
+            *(int16_t *)value = EQ_PRESET_CUSTOM;
+            break;
+        case EQ_PARAM_GET_NUM_OF_PRESETS:
+            *(uint16_t *)value = 0;
+            break;
+        case EQ_PARAM_LEVEL_RANGE:
+            ((int16_t *)value)[0] = EQ_LEVEL_MIN_MB;
+            ((int16_t *)value)[1] = EQ_LEVEL_MAX_MB;
+            break;
+        case EQ_PARAM_BAND_LEVEL:
+            *(int16_t *)value = fx->eq_levels_mb[band];
+            break;
+        case EQ_PARAM_CENTER_FREQ:
+            *(int32_t *)value = eq_band_freqs[band][1];
+            break;
+        case EQ_PARAM_BAND_FREQ_RANGE:
+            ((int32_t *)value)[0] = eq_band_freqs[band][0];
+            ((int32_t *)value)[1] = eq_band_freqs[band][2];
+            break;
+        case EQ_PARAM_GET_BAND:
+            if (psize < 2 * sizeof(int32_t))
+                return -EINVAL;
+            *(uint16_t *)value = eq_get_band((uint32_t)param[1]);
+            break;
+        case EQ_PARAM_PROPERTIES:
+            levels = value;
+            levels[0] = EQ_PRESET_CUSTOM;
+            levels[1] = CODEC_EQ_BANDS;
+            for (i = 0; i < CODEC_EQ_BANDS; i++)
+                levels[2 + i] = fx->eq_levels_mb[i];
+            break;
+        }
+        return 0;
+
+    case CODEC_FX_BASSBOOST:
+        switch (param[0]) {
+        case BASSBOOST_PARAM_STRENGTH_SUPPORTED:
+            if (*vsize < sizeof(uint32_t))
+                return -EINVAL;
+            *vsize = sizeof(uint32_t);
+            *(uint32_t *)value = 1;
+            return 0;
+        case BASSBOOST_PARAM_STRENGTH:
+            if (*vsize < sizeof(int16_t))
+                return -EINVAL;
+            *vsize = sizeof(int16_t);
+            *(int16_t *)value = fx->bassboost_strength;
+            return 0;
+        }
+        return -EINVAL;
+
+    case CODEC_FX_LOUDNESS:
+        if (param[0] != LOUDNESS_ENHANCER_PARAM_TARGET_GAIN_MB || *vsize < sizeof(int32_t))
+            return -EINVAL;
+        *vsize = sizeof(int32_t);
+        *(int32_t *)value = fx->loudness_gain_mb;
+        return 0;
+
+    default:
+        return -EINVAL;
+    }
+}
+
+/* Must be called with fx_lock held */
+static int codec_fx_set_param(struct codec_fx *fx, const int32_t *param, uint32_t psize,
+                              const void *value, uint32_t vsize)
+{
+    const int16_t *levels;
+    int level, i;
+
+    if (psize < sizeof(int32_t))
+        return -EINVAL;
+
+    switch (fx->type) {
+    case CODEC_FX_EQUALIZER:
+        switch (param[0]) {
+        case EQ_PARAM_BAND_LEVEL:
+            if (psize < 2 * sizeof(int32_t) || vsize < sizeof(int16_t) ||
+                    param[1] < 0 || param[1] >= CODEC_EQ_BANDS)
+                return -EINVAL;
+            level = *(const int16_t *)value;
+            if (level < EQ_LEVEL_MIN_MB || level > EQ_LEVEL_MAX_MB)
+                return -EINVAL;
+            fx->eq_levels_mb[param[1]] = level;
+            return 0;
+        case EQ_PARAM_PROPERTIES:
+            if (vsize < (2 + CODEC_EQ_BANDS) * sizeof(int16_t))
+                return -EINVAL;
+            levels = value;
+            if (levels[0] >= 0 || levels[1] != CODEC_EQ_BANDS)
+                return -EINVAL;
+            for (i = 0; i < CODEC_EQ_BANDS; i++) {
+                if (levels[2 + i] < EQ_LEVEL_MIN_MB || levels[2 + i] > EQ_LEVEL_MAX_MB)
+                    return -EINVAL;
+            }
+            for (i = 0; i < CODEC_EQ_BANDS; i++)
+                fx->eq_levels_mb[i] = levels[2 + i];
+            return 0;
+        }
+        /* presets are not supported */
+        return -EINVAL;
+
+    case CODEC_FX_BASSBOOST:
+        if (param[0] != BASSBOOST_PARAM_STRENGTH || vsize < sizeof(int16_t))
+            return -EINVAL;
+        level = *(const int16_t *)value;
+        if (level < 0 || level > CODEC_EQ_BASSBOOST_MAX_STRENGTH)
+            return -EINVAL;
+        fx->bassboost_strength = level;
+        return 0;
+
+    case CODEC_FX_LOUDNESS:
+        if (param[0] != LOUDNESS_ENHANCER_PARAM_TARGET_GAIN_MB || vsize < sizeof(int32_t))
+            return -EINVAL;
+        /* the codec only adds gain */
+        level = *(const int32_t *)value;
+        fx->loudness_gain_mb = level > 0 ? level : 0;
+        return 0;
+
+    default:
+        return -EINVAL;
+    }
+}
+
+/* effect_interface_s */
+
+/* the codec does the work, the audio is passed through */
+static int32_t codec_fx_process(effect_handle_t self, audio_buffer_t *in, audio_buffer_t *out)
+{
+    struct codec_fx *fx = (struct codec_fx *)self;
+    size_t samples, i;
+    int32_t sum;
+
+    if (!in || !out || !in->raw || !out->raw || in->frameCount != out->frameCount)
+        return -EINVAL;
+
+    samples = in->frameCount * audio_channel_count_from_out_mask(fx->config.inputCfg.channels);
+    if (fx->config.outputCfg.accessMode == EFFECT_BUFFER_ACCESS_ACCUMULATE) {
+        for (i = 0; i < samples; i++) {
+            sum = out->s16[i] + in->s16[i];
+            out->s16[i] = sum > INT16_MAX ? INT16_MAX : sum < INT16_MIN ? INT16_MIN : sum;
+        }
+    } else if (in->raw != out->raw) {
+        memcpy(out->raw, in->raw, samples * sizeof(int16_t));
+    }
+
+    return fx->enabled ? 0 : -ENODATA;
+}
+
+static int32_t codec_fx_command(effect_handle_t self, uint32_t cmd, uint32_t size,
+                                void *data, uint32_t *reply_size, void *reply)
+{
+    struct codec_fx *fx = (struct codec_fx *)self;
+    effect_param_t *p;
+    effect_config_t *config;
+    uint32_t voffset;
+    int ret = 0;
+
+    pthread_mutex_lock(&fx_lock);
+
+    switch (cmd) {
+    case EFFECT_CMD_INIT:
+        if (!reply || !reply_size || *reply_size != sizeof(int)) {
+            ret = -EINVAL;
+            break;
+        }
+        *(int *)reply = 0;
+        break;
+
+    case EFFECT_CMD_RESET:
+        break;
+
+    case EFFECT_CMD_SET_CONFIG:
+        if (!data || size != sizeof(effect_config_t) ||
+                !reply || !reply_size || *reply_size != sizeof(int)) {
+            ret = -EINVAL;
+            break;
+        }
+        config = data;
+        /* the audio is passed through unchanged */
+        if (config->inputCfg.samplingRate != config->outputCfg.samplingRate ||
+                config->inputCfg.channels != config->outputCfg.channels ||
+                config->inputCfg.format != AUDIO_FORMAT_PCM_16_BIT ||
+                config->outputCfg.format != AUDIO_FORMAT_PCM_16_BIT) {
+            *(int *)reply = -EINVAL;
+            break;
+        }
+        fx->config = *config;
+        *(int *)reply = 0;
+        break;
+
+    case EFFECT_CMD_GET_CONFIG:
+        if (!reply || !reply_size || *reply_size != sizeof(effect_config_t)) {
+            ret = -EINVAL;
+            break;
+        }
+        *(effect_config_t *)reply = fx->config;
+        break;
+
+    case EFFECT_CMD_ENABLE:
+    case EFFECT_CMD_DISABLE:
+        if (!reply || !reply_size || *reply_size != sizeof(int)) {
+            ret = -EINVAL;
+            break;
+        }
+        if (fx->enabled != (cmd == EFFECT_CMD_ENABLE)) {
+            fx->enabled = cmd == EFFECT_CMD_ENABLE;
+            if (fx->output == fx_output)
+                codec_fx_update_l();
+        }
+        *(int *)reply = 0;
+        break;
+
+    case EFFECT_CMD_GET_PARAM:
+        if (!data || size < sizeof(effect_param_t) + sizeof(int32_t) ||
+                !reply || !reply_size || *reply_size < sizeof(effect_param_t) + sizeof(int32_t)) {
+            ret = -EINVAL;
+            break;
+        }
+        p = data;
+        voffset = ((p->psize - 1) / sizeof(int32_t) + 1) * sizeof(int32_t);
+        if (size < sizeof(effect_param_t) + p->psize ||
+                *reply_size < sizeof(effect_param_t) + voffset) {
+            ret = -EINVAL;
+            break;
+        }
+        memcpy(reply, data, sizeof(effect_param_t) + p->psize);
+        p = reply;
+        p->vsize = *reply_size - sizeof(effect_param_t) - voffset;
+        p->status = codec_fx_get_param(fx, (int32_t *)p->data, p->psize,
+                                       p->data + voffset, &p->vsize);
+        *reply_size = sizeof(effect_param_t) + voffset + p->vsize;
+        break;
+
+    case EFFECT_CMD_SET_PARAM:
+        if (!data || size < sizeof(effect_param_t) + sizeof(int32_t) ||
+                !reply || !reply_size || *reply_size != sizeof(int32_t)) {
+            ret = -EINVAL;
+            break;
+        }
+        p = data;
+        voffset = ((p->psize - 1) / sizeof(int32_t) + 1) * sizeof(int32_t);
+        if (size < sizeof(effect_param_t) + voffset + p->vsize) {
+            ret = -EINVAL;
+            break;
+        }
+        *(int32_t *)reply = codec_fx_set_param(fx, (int32_t *)p->data, p->psize,
+                                               p->data + voffset, p->vsize);
+        if (*(int32_t *)reply == 0 && fx->enabled && fx->output == fx_output)
+            codec_fx_update_l();
+        break;
+
+    case EFFECT_CMD_SET_DEVICE:
+    case EFFECT_CMD_SET_VOLUME:
+    case EFFECT_CMD_SET_AUDIO_MODE:
+        break;
+
+    default:
+        ret = -EINVAL;
+        break;
+    }
+
+    pthread_mutex_unlock(&fx_lock);
+    return ret;
+}
+
+static int32_t codec_fx_get_descriptor(effect_handle_t self, effect_descriptor_t *descriptor)
+{
+    struct codec_fx *fx = (struct codec_fx *)self;
+
+    if (!descriptor)
+        return -EINVAL;
+    *descriptor = codec_fx_descriptors[fx->type];
+    return 0;
+}
+
+static const struct effect_interface_s codec_fx_interface = {
+    .process = codec_fx_process,
+    .command = codec_fx_command,
+    .get_descriptor = codec_fx_get_descriptor,
+    .process_reverse = NULL,
+};
+
+/* audio_effect_library_t */
+
+static int codec_fx_find(const effect_uuid_t *uuid)
+{
+    int i;
+
+    for (i = 0; i < CODEC_FX_TOTAL; i++) {
+        if (memcmp(uuid, &codec_fx_descriptors[i].uuid, sizeof(*uuid)) == 0)
+            return i;
+    }
+    return -1;
+}
+
+static int32_t codec_fx_lib_create(const effect_uuid_t *uuid, int32_t session, int32_t io,
+                                   effect_handle_t *handle)
+{
+    struct codec_fx *fx;
+    int type;
+
+    if (!uuid || !handle)
+        return -EINVAL;
+    type = codec_fx_find(uuid);
+    if (type < 0)
+        return -ENOENT;
+
+    fx = calloc(1, sizeof(*fx));
+    if (!fx)
+        return -ENOMEM;
+    fx->itfe = &codec_fx_interface;
+    fx->type = type;
+    fx->output = io;
+
+    pthread_mutex_lock(&fx_lock);
+    fx->next = fx_list;
+    fx_list = fx;
+    pthread_mutex_unlock(&fx_lock);
+
+    ALOGV("%s: %s on output %d session %d", __func__, codec_fx_descriptors[type].name,
+          io, session);
+    *handle = (effect_handle_t)fx;
+    return 0;
+}
+
+static int32_t codec_fx_lib_release(effect_handle_t handle)
+{
+    struct codec_fx *fx = (struct codec_fx *)handle;
+    struct codec_fx **p;
+
+    pthread_mutex_lock(&fx_lock);
+    for (p = &fx_list; *p; p = &(*p)->next) {
+        if (*p == fx)
+            break;
+    }
+    if (!*p) {
+        pthread_mutex_unlock(&fx_lock);
+        return -EINVAL;
+    }
+    *p = fx->next;
+    if (fx->enabled && fx->output == fx_output)
+        codec_fx_update_l();
+    pthread_mutex_unlock(&fx_lock);
+
+    free(fx);
+    return 0;
+}
+
+static int32_t codec_fx_lib_get_descriptor(const effect_uuid_t *uuid,
+                                           effect_descriptor_t *descriptor)
+{
+    int type;
+
+    if (!uuid || !descriptor)
+        return -EINVAL;
+    type = codec_fx_find(uuid);
+    if (type < 0)
+        return -EINVAL;
+    *descriptor = codec_fx_descriptors[type];
+    return 0;
+}
+
+__attribute__ ((visibility ("default")))
+audio_effect_library_t AUDIO_EFFECT_LIBRARY_INFO_SYM = {
+    .tag = AUDIO_EFFECT_LIBRARY_TAG,
+    .version = EFFECT_LIBRARY_API_VERSION,
+    .name = "Codec Effects Library",
+    .implementor = "The LineageOS Project",
+    .create_effect = codec_fx_lib_create,
+    .release_effect = codec_fx_lib_release,
+    .get_descriptor = codec_fx_lib_get_descriptor,
+};
+
+/* HAL interface, see codec_fx.h */
+
+__attribute__ ((visibility ("default")))
+int codec_fx_hal_start_output(audio_io_handle_t output, struct audio_stream *stream)
+{
+    pthread_mutex_lock(&fx_lock);
+    fx_output = output;
+    fx_stream = stream;
+    codec_fx_update_l();
+    pthread_mutex_unlock(&fx_lock);
+    return 0;
+}
+
+__attribute__ ((visibility ("default")))
+int codec_fx_hal_stop_output(audio_io_handle_t output)
+{
+    pthread_mutex_lock(&fx_lock);
+    if (fx_output == output) {
+        fx_output = AUDIO_IO_HANDLE_NONE;
+        fx_stream = NULL;
+    }
+    pthread_mutex_unlock(&fx_lock);
+    return 0;
+}
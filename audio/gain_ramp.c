@@ -0,0 +1,151 @@
+/*
+ * Copyright (C) 2017 The LineageOS Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define GAIN_RAMP_NEON
+#endif
+
+#include "gain_ramp.h"
+
+static int32_t gain_to_q24(float gain)
+{
+    if (gain <= 0.0f)
+        return 0;
+    if (gain >= 1.0f)
+        return GAIN_RAMP_UNITY;
+    return (int32_t)(gain * GAIN_RAMP_UNITY);
+}
+
+/* Q15 multiplier, 1.0 saturates to 32767 which is within 0.0003 dB */
+static int16_t q24_to_q15(int32_t gain)
+{
+    gain >>= 9;
+    return gain > INT16_MAX ? INT16_MAX : (int16_t)gain;
+}
+
+/* rounded like vqrdmulh, cannot overflow as the gain is below 1 */
+static inline int16_t mul_q15(int16_t sample, int16_t gain)
+{
+    return (int16_t)(((int32_t)sample * gain + (1 << 14)) >> 15);
+}
+
+static void apply_constant(int16_t *dst, const int16_t *src, size_t samples, int16_t gain)
+{
+    size_t i = 0;
+
+#ifdef GAIN_RAMP_NEON
+    for (; i + 8 <= samples; i += 8)
+        vst1q_s16(dst + i, vqrdmulhq_n_s16(vld1q_s16(src + i), gain));
+#endif
+    for (; i < samples; i++)
+        dst[i] = mul_q15(src[i], gain);
+}
+
+/* returns the gain after the last frame */
+static int32_t apply_ramp(int16_t *dst, const int16_t *src, size_t frames,
+                          unsigned int channels, int32_t gain, int32_t step)
+{
+    size_t i = 0;
+    unsigned int c;
+    int16_t g;
+
+#ifdef GAIN_RAMP_NEON
+    /* four stereo frames per pass, each gain duplicated for both channels */
+    if (channels == 2) {
+        int32x4_t g4 = { gain, gain + step, gain + 2 * step, gain + 3 * step };
+        int32x4_t inc = vdupq_n_s32(4 * step);
+        int16x4x2_t gz;
+        int16x4_t g16;
+
+        for (; i + 4 <= frames; i += 4) {
+            g16 = vqshrn_n_s32(g4, 9);
+            gz = vzip_s16(g16, g16);
+            vst1q_s16(dst + i * 2, vqrdmulhq_s16(vld1q_s16(src + i * 2),
+                                                 vcombine_s16(gz.val[0], gz.val[1])));
+            g4 = vaddq_s32(g4, inc);
+        }
+        gain += (int32_t)i * step;
+    }
+#endif
+    for (; i < frames; i++) {
+        g = q24_to_q15(gain);
+        for (c = 0; c < channels; c++)
+            dst[i * channels + c] = mul_q15(src[i * channels + c], g);
+        gain += step;
+    }
+    return gain;
+}
+
+void gain_ramp_init(struct gain_ramp *ramp, unsigned int channels, size_t ramp_frames,
+                    float gain)
+{
+    memset(ramp, 0, sizeof(*ramp));
+    ramp->channels = channels;
+    ramp->ramp_frames = ramp_frames > 0 ? ramp_frames : 1;
+    ramp->current = gain_to_q24(gain);
+    ramp->target = ramp->current;
+}
+
+/* start ramping from the current gain, whether a ramp was in progress or not */
+void gain_ramp_set(struct gain_ramp *ramp, float gain)
+{
+    int32_t target = gain_to_q24(gain);
+
+    if (target == ramp->target)
+        return;
+
+    ramp->target = target;
+    ramp->step = (target - ramp->current) / (int32_t)ramp->ramp_frames;
+    ramp->ramp_left = ramp->step != 0 ? ramp->ramp_frames : 0;
+    if (ramp->ramp_left == 0)
+        ramp->current = target;
+}
+
+bool gain_ramp_is_unity(const struct gain_ramp *ramp)
+{
+    return ramp->ramp_left == 0 && ramp->current == GAIN_RAMP_UNITY;
+}
+
+void gain_ramp_apply(struct gain_ramp *ramp, int16_t *dst, const int16_t *src, size_t frames)
+{
+    size_t n;
+
+    if (ramp->ramp_left > 0) {
+        n = frames < ramp->ramp_left ? frames : ramp->ramp_left;
+        ramp->current = apply_ramp(dst, src, n, ramp->channels, ramp->current, ramp->step);
+        ramp->ramp_left -= n;
+        if (ramp->ramp_left == 0)
+            ramp->current = ramp->target;
+        dst += n * ramp->channels;
+        src += n * ramp->channels;
+        frames -= n;
+    }
+
+    if (frames == 0)
+        return;
+
+    if (ramp->current == GAIN_RAMP_UNITY) {
+        if (dst != src)
+            memcpy(dst, src, frames * ramp->channels * sizeof(int16_t));
+    } else if (ramp->current == 0) {
+        memset(dst, 0, frames * ramp->channels * sizeof(int16_t));
+    } else {
+        apply_constant(dst, src, frames * ramp->channels, q24_to_q15(ramp->current));
+    }
+}
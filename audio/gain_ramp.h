@@ -0,0 +1,52 @@
+/*
+ * Copyright (C) 2017 The LineageOS Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef GAIN_RAMP_H
+#define GAIN_RAMP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* gains are Q8.24, only 0 to 1 is used */
+#define GAIN_RAMP_UNITY     (1 << 24)
+
+/*
+ * Gain stage for interleaved 16 bit frames.
+ *
+ * A new gain is reached with a linear ramp over ramp_frames frames so that
+ * volume and mute changes do not click. Once the ramp is over a gain of 1
+ * leaves the frames untouched and a gain of 0 clears them, any other gain
+ * costs one multiply per sample (NEON when available).
+ */
+struct gain_ramp {
+    int32_t current;
+    int32_t target;
+    int32_t step;               /* per frame while ramping */
+    size_t ramp_left;           /* frames until target is reached */
+    size_t ramp_frames;
+    unsigned int channels;
+};
+
+/* Function prototypes */
+void gain_ramp_init(struct gain_ramp *ramp, unsigned int channels, size_t ramp_frames,
+                    float gain);
+void gain_ramp_set(struct gain_ramp *ramp, float gain);
+bool gain_ramp_is_unity(const struct gain_ramp *ramp);
+
+/* dst may be src */
+void gain_ramp_apply(struct gain_ramp *ramp, int16_t *dst, const int16_t *src, size_t frames);
+#endif
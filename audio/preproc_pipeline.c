@@ -0,0 +1,201 @@
+/*
+ * Copyright (C) 2017 The LineageOS Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "audio_hw_primary"
+/*#define LOG_NDEBUG 0*/
+
+#include <errno.h>
+#include <string.h>
+
+#include <cutils/log.h>
+
+#include "preproc_pipeline.h"
+
+/* where the next stage reads from: the caller's buffer or a stage queue */
+struct preproc_source {
+    struct preproc_queue *queue;    /* NULL for the caller's input */
+    int16_t *ptr;
+    size_t frames;
+};
+
+size_t preproc_pipeline_storage_size(size_t capacity, unsigned int channels)
+{
+    return PREPROC_MAX_STAGES * capacity * channels * sizeof(int16_t);
+}
+
+/* storage must hold preproc_pipeline_storage_size() bytes for the largest
+ * channel count the pipeline will be initialized with */
+void preproc_pipeline_init(struct preproc_pipeline *p, int16_t *storage, size_t capacity,
+                           unsigned int channels)
+{
+    unsigned int i;
+
+    p->capacity = capacity;
+    p->channels = channels;
+    for (i = 0; i < PREPROC_MAX_STAGES; i++) {
+        p->queues[i].buf = storage + i * capacity * channels;
+        p->queues[i].rd = 0;
+        p->queues[i].frames = 0;
+    }
+}
+
+void preproc_pipeline_set_effects(struct preproc_pipeline *p, const effect_handle_t *effects,
+                                  unsigned int num_effects)
+{
+    unsigned int i;
+
+    if (num_effects > PREPROC_MAX_STAGES)
+        num_effects = PREPROC_MAX_STAGES;
+
+    for (i = 0; i < num_effects; i++)
+        p->effects[i] = effects[i];
+    p->num_stages = num_effects;
+    preproc_pipeline_flush(p);
+}
+
+void preproc_pipeline_flush(struct preproc_pipeline *p)
+{
+    unsigned int i;
+
+    for (i = 0; i < PREPROC_MAX_STAGES; i++) {
+        p->queues[i].rd = 0;
+        p->queues[i].frames = 0;
+    }
+}
+
+/* frames held inside the pipeline, used for latency estimation */
+size_t preproc_pipeline_queued(const struct preproc_pipeline *p)
+{
+    size_t frames = 0;
+    unsigned int i;
+
+    for (i = 0; i < p->num_stages; i++)
+        frames += p->queues[i].frames;
+    return frames;
+}
+
+static int16_t *queue_head(struct preproc_pipeline *p, struct preproc_queue *q)
+{
+    return q->buf + q->rd * p->channels;
+}
+
+/* return the free space at the tail of q, moving queued frames to the
+ * start of the queue only when the tail is too short */
+static size_t queue_tail(struct preproc_pipeline *p, struct preproc_queue *q, int16_t **tail)
+{
+    if (q->rd && q->rd + q->frames == p->capacity) {
+        memmove(q->buf, queue_head(p, q), q->frames * p->channels * sizeof(int16_t));
+        q->rd = 0;
+    } else if (q->frames == 0) {
+        q->rd = 0;
+    }
+    *tail = q->buf + (q->rd + q->frames) * p->channels;
+    return p->capacity - q->rd - q->frames;
+}
+
+static void source_consume(struct preproc_source *src, size_t frames, unsigned int channels,
+                           size_t *consumed)
+{
+    if (src->queue) {
+        src->queue->rd += frames;
+        src->queue->frames -= frames;
+    } else {
+        *consumed += frames;
+    }
+    src->ptr += frames * channels;
+    src->frames -= frames;
+}
+
+static void source_from_queue(struct preproc_pipeline *p, struct preproc_source *src,
+                              struct preproc_queue *q)
+{
+    src->queue = q;
+    src->ptr = queue_head(p, q);
+    src->frames = q->frames;
+}
+
+/*
+ * Same contract as the effect process() function: on return in->frameCount
+ * holds the number of frames consumed and out->frameCount the number of
+ * frames produced.
+ */
+int preproc_pipeline_process(struct preproc_pipeline *p, audio_buffer_t *in,
+                             audio_buffer_t *out)
+{
+    struct preproc_source src;
+    struct preproc_queue *q;
+    audio_buffer_t ibuf, obuf;
+    size_t consumed = 0;
+    size_t space, n;
+    unsigned int i;
+    int16_t *tail;
+    int ret;
+
+    src.queue = NULL;
+    src.ptr = in->s16;
+    src.frames = in->frameCount;
+
+    for (i = 0; i < p->num_stages; i++) {
+        q = &p->queues[i];
+        space = queue_tail(p, q, &tail);
+
+        if (space == 0) {
+            /* downstream is late, let it drain this stage first */
+            source_from_queue(p, &src, q);
+            continue;
+        }
+
+        ibuf.frameCount = src.frames;
+        ibuf.s16 = src.ptr;
+        obuf.frameCount = space;
+        obuf.s16 = tail;
+        ret = (*p->effects[i])->process(p->effects[i], &ibuf, &obuf);
+
+        if (ret == -ENODATA) {
+            /* skipped, keep frames queued by an earlier pass in order */
+            if (q->frames) {
+                n = src.frames < space ? src.frames : space;
+                memcpy(tail, src.ptr, n * p->channels * sizeof(int16_t));
+                q->frames += n;
+                source_consume(&src, n, p->channels, &consumed);
+                source_from_queue(p, &src, q);
+            }
+            continue;
+        }
+        if (ret != 0) {
+            ALOGE("%s: stage %u process error %d", __func__, i, ret);
+            in->frameCount = consumed;
+            out->frameCount = 0;
+            return ret;
+        }
+
+        ALOGV("%s: stage %u consumed %zu produced %zu", __func__, i,
+              ibuf.frameCount, obuf.frameCount);
+        source_consume(&src, ibuf.frameCount, p->channels, &consumed);
+        q->frames += obuf.frameCount;
+        source_from_queue(p, &src, q);
+    }
+
+    /* hand the output of the last active stage to the caller */
+    n = src.frames < out->frameCount ? src.frames : out->frameCount;
+    if (n && src.ptr != out->s16)
+        memcpy(out->s16, src.ptr, n * p->channels * sizeof(int16_t));
+    source_consume(&src, n, p->channels, &consumed);
+
+    in->frameCount = consumed;
+    out->frameCount = n;
+    return 0;
+}
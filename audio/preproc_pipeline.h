@@ -0,0 +1,62 @@
+/*
+ * Copyright (C) 2017 The LineageOS Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef PREPROC_PIPELINE_H
+#define PREPROC_PIPELINE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <hardware/audio_effect.h>
+
+#define PREPROC_MAX_STAGES 3
+
+/*
+ * Chain of capture pre-processing effects.
+ *
+ * Each stage reads the output of the closest upstream stage that produced
+ * data and writes into its own queue. A stage whose process() returns
+ * -ENODATA is disabled or deferring to another effect of the same session
+ * and is skipped: the next stage reads its input instead. Frames a stage
+ * does not consume stay queued for the next pass, so effects may consume
+ * and produce any number of frames.
+ */
+struct preproc_queue {
+    int16_t *buf;
+    size_t rd;              /* first queued frame */
+    size_t frames;          /* number of queued frames */
+};
+
+struct preproc_pipeline {
+    effect_handle_t effects[PREPROC_MAX_STAGES];
+    struct preproc_queue queues[PREPROC_MAX_STAGES];
+    unsigned int num_stages;
+    size_t capacity;        /* frames per queue */
+    unsigned int channels;
+};
+
+/* Function prototypes */
+size_t preproc_pipeline_storage_size(size_t capacity, unsigned int channels);
+void preproc_pipeline_init(struct preproc_pipeline *p, int16_t *storage, size_t capacity,
+                           unsigned int channels);
+void preproc_pipeline_set_effects(struct preproc_pipeline *p, const effect_handle_t *effects,
+                                  unsigned int num_effects);
+void preproc_pipeline_flush(struct preproc_pipeline *p);
+size_t preproc_pipeline_queued(const struct preproc_pipeline *p);
+int preproc_pipeline_process(struct preproc_pipeline *p, audio_buffer_t *in,
+                             audio_buffer_t *out);
+#endif
@@ -18,10 +18,17 @@
 /*#define ALOG_NDEBUG 0*/
 
 #include <dlfcn.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
 #include <utils/Log.h>
 #include <cutils/properties.h>
+#include <system/thread_defs.h>
+#include <thread_policy.h>
 
 #include "ril_interface.h"
 
@@ -86,17 +93,195 @@ static int ril_connect_if_required(struct ril_handle *ril)
     return 0;
 }
 
+static void ril_run_cmd(struct ril_handle *ril, const struct ril_cmd *cmd)
+{
+    int ret;
+
+    switch (cmd->type) {
+    case RIL_CMD_CALL_AUDIO_PATH:
+        ret = _ril_set_call_audio_path(ril->client, cmd->arg1);
+        break;
+    case RIL_CMD_CALL_CLOCK_SYNC:
+        ret = _ril_set_call_clock_sync(ril->client, cmd->arg1);
+        break;
+    case RIL_CMD_CALL_VOLUME:
+        ret = _ril_set_call_volume(ril->client, cmd->arg1, cmd->arg2);
+        break;
+    case RIL_CMD_TWO_MIC_CONTROL:
+        ret = _ril_set_two_mic_control(ril->client, cmd->arg1, cmd->arg2);
+        break;
+    case RIL_CMD_MIC_MUTE:
+        ret = _ril_set_mic_mute(ril->client, cmd->arg1);
+        break;
+    default:
+        return;
+    }
+
+    if (ret != RIL_CLIENT_ERR_SUCCESS) {
+        ALOGW("RIL command %d(%d, %d) failed: %d", cmd->type, cmd->arg1, cmd->arg2, ret);
+        audio_stats_inc(&ril->cmd_errors);
+    }
+}
+
+static int64_t elapsed_us(const struct timespec *start, const struct timespec *end)
+{
+    return (int64_t)(end->tv_sec - start->tv_sec) * 1000000 +
+            (end->tv_nsec - start->tv_nsec) / 1000;
+}
+
+/*
+ * All calls into the RIL client library happen on this thread so that a
+ * slow RIL socket never blocks an audio thread. The connection is opened
+ * once and kept, commands are only dropped when the worker exits.
+ */
+/* call audio commands wait behind nothing but other audio work */
+static const struct thread_policy ril_worker_policy = {
+    .name = "audio_ril",
+    .sched_policy = SCHED_OTHER,
+    .nice = ANDROID_PRIORITY_AUDIO,
+    .avoid_cpu0 = false,
+};
+
+static void *ril_worker(void *data)
+{
+    struct ril_handle *ril = (struct ril_handle *)data;
+    struct ril_cmd cmd;
+    struct timespec ts, sent, done;
+    bool connected;
+
+    pthread_mutex_lock(&ril->lock);
+    while (!ril->worker_exit) {
+        pthread_mutex_unlock(&ril->lock);
+        connected = ril_connect_if_required(ril) == 0;
+        pthread_mutex_lock(&ril->lock);
+
+        if (!connected) {
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_sec += RIL_RECONNECT_DELAY_MS / 1000;
+            ts.tv_nsec += (RIL_RECONNECT_DELAY_MS % 1000) * 1000000;
+            if (ts.tv_nsec >= 1000000000) {
+                ts.tv_sec++;
+                ts.tv_nsec -= 1000000000;
+            }
+            /* retry when there is something to send, the pending commands
+             * are kept, see ril_queue_cmd() */
+            if (ril->num_queued == 0)
+                pthread_cond_wait(&ril->cond, &ril->lock);
+            else
+                pthread_cond_timedwait(&ril->cond, &ril->lock, &ts);
+            continue;
+        }
+
+        if (ril->num_queued == 0) {
+            pthread_cond_wait(&ril->cond, &ril->lock);
+            continue;
+        }
+
+        cmd = ril->queue[0];
+        ril->num_queued--;
+        memmove(&ril->queue[0], &ril->queue[1], ril->num_queued * sizeof(ril->queue[0]));
+
+        pthread_mutex_unlock(&ril->lock);
+        clock_gettime(CLOCK_MONOTONIC, &sent);
+        ril_run_cmd(ril, &cmd);
+        clock_gettime(CLOCK_MONOTONIC, &done);
+        audio_stats_hist_record(&ril->cmd_wait, elapsed_us(&cmd.queued, &sent));
+        audio_stats_hist_record(&ril->cmd_time, elapsed_us(&sent, &done));
+        pthread_mutex_lock(&ril->lock);
+    }
+    pthread_mutex_unlock(&ril->lock);
+
+    return NULL;
+}
+
+/* Make room in a full queue, which only happens while the RIL cannot be
+ * reached: drop the oldest command superseded by a later one of the same
+ * type. There is one, as the queue is longer than the number of types.
+ * Must be called with ril->lock held */
+static void ril_drop_superseded(struct ril_handle *ril)
+{
+    unsigned int i, j;
+
+    for (i = 0; i < ril->num_queued; i++) {
+        for (j = i + 1; j < ril->num_queued; j++) {
+            if (ril->queue[j].type != ril->queue[i].type)
+                continue;
+
+            ALOGW("RIL queue full, dropping command %d", ril->queue[i].type);
+            audio_stats_inc(&ril->cmd_coalesced);
+            ril->num_queued--;
+            memmove(&ril->queue[i], &ril->queue[i + 1],
+                    (ril->num_queued - i) * sizeof(ril->queue[0]));
+            return;
+        }
+    }
+}
+
+/* Queue a command for the worker. Commands are sent in the order they were
+ * queued, as the modem expects e.g. the clock to be stopped around a path
+ * change or the mic to be muted after it: a command only replaces a pending
+ * one of the same type if nothing was queued after it */
+static int ril_queue_cmd(struct ril_handle *ril, enum ril_cmd_type type, int arg1, int arg2)
+{
+    struct ril_cmd *cmd;
+
+    if (!ril->worker_running)
+        return -1;
+
+    pthread_mutex_lock(&ril->lock);
+    if (ril->num_queued > 0 && ril->queue[ril->num_queued - 1].type == type) {
+        cmd = &ril->queue[ril->num_queued - 1];
+        ALOGV("RIL command %d coalesced", type);
+        audio_stats_inc(&ril->cmd_coalesced);
+    } else {
+        if (ril->num_queued == RIL_QUEUE_SIZE)
+            ril_drop_superseded(ril);
+        cmd = &ril->queue[ril->num_queued++];
+        cmd->type = type;
+        clock_gettime(CLOCK_MONOTONIC, &cmd->queued);
+    }
+    cmd->arg1 = arg1;
+    cmd->arg2 = arg2;
+    pthread_cond_signal(&ril->cond);
+    pthread_mutex_unlock(&ril->lock);
+
+    return 0;
+}
+
+/* Path of the RIL client library. Debuggable builds may load another build
+ * of the client library instead, e.g. libsecril-client-fake.so to exercise
+ * call flows without a modem. Only a library of the system library path
+ * can be named. */
+static void ril_get_client_libpath(char *path)
+{
+    char debuggable[PROPERTY_VALUE_MAX];
+
+    property_get("ro.debuggable", debuggable, "0");
+    if (strcmp(debuggable, "1") == 0 &&
+            property_get(RIL_CLIENT_LIBPATH_PROPERTY, path, "") > 0) {
+        if (strncmp(path, RIL_CLIENT_LIBNAME, strlen(RIL_CLIENT_LIBNAME)) == 0 &&
+                strchr(path, '/') == NULL) {
+            ALOGW("Using RIL client library '%s'", path);
+            return;
+        }
+        ALOGE("Ignoring RIL client library '%s'", path);
+    }
+    strcpy(path, RIL_CLIENT_LIBPATH);
+}
+
 int ril_open(struct ril_handle *ril)
 {
     char property[PROPERTY_VALUE_MAX];
+    char libpath[PROPERTY_VALUE_MAX];
 
     if (!ril)
         return -1;
 
-    ril->handle = dlopen(RIL_CLIENT_LIBPATH, RTLD_NOW);
+    ril_get_client_libpath(libpath);
+    ril->handle = dlopen(libpath, RTLD_NOW);
 
     if (!ril->handle) {
-        ALOGE("Cannot open '%s'", RIL_CLIENT_LIBPATH);
+        ALOGE("Cannot open '%s'", libpath);
         return -1;
     }
 
@@ -119,7 +304,7 @@ int ril_open(struct ril_handle *ril)
         !_ril_is_connected || !_ril_disconnect || !_ril_set_call_volume ||
         !_ril_set_call_audio_path || !_ril_set_two_mic_control || !_ril_set_mic_mute ||
         !_ril_set_call_clock_sync || !_ril_register_unsolicited_handler) {
-        ALOGE("Cannot get symbols from '%s'", RIL_CLIENT_LIBPATH);
+        ALOGE("Cannot get symbols from '%s'", libpath);
         dlclose(ril->handle);
         return -1;
     }
@@ -142,6 +327,18 @@ int ril_open(struct ril_handle *ril)
     if (ril->volume_steps_max == 0)
         ril->volume_steps_max = atoi(VOLUME_STEPS_DEFAULT);
 
+    pthread_mutex_init(&ril->lock, NULL);
+    pthread_cond_init(&ril->cond, NULL);
+    ril->worker_exit = false;
+    ril->num_queued = 0;
+    if (thread_policy_create(&ril->worker, &ril_worker_policy, ril_worker, ril) != 0) {
+        ALOGE("Cannot create RIL worker thread");
+        _ril_close_client(ril->client);
+        dlclose(ril->handle);
+        return -1;
+    }
+    ril->worker_running = true;
+
     return 0;
 }
 
@@ -150,6 +347,17 @@ int ril_close(struct ril_handle *ril)
     if (!ril || !ril->handle || !ril->client)
         return -1;
 
+    if (ril->worker_running) {
+        pthread_mutex_lock(&ril->lock);
+        ril->worker_exit = true;
+        pthread_cond_signal(&ril->cond);
+        pthread_mutex_unlock(&ril->lock);
+        pthread_join(ril->worker, NULL);
+        ril->worker_running = false;
+        pthread_cond_destroy(&ril->cond);
+        pthread_mutex_destroy(&ril->lock);
+    }
+
     if ((_ril_disconnect(ril->client) != RIL_CLIENT_ERR_SUCCESS) ||
         (_ril_close_client(ril->client) != RIL_CLIENT_ERR_SUCCESS)) {
         ALOGE("ril_disconnect() or ril_close_client() failed");
@@ -160,44 +368,42 @@ int ril_close(struct ril_handle *ril)
     return 0;
 }
 
+/* counters of the worker, safe to call at any time */
+void ril_dump(struct ril_handle *ril, int fd)
+{
+    dprintf(fd, "    RIL worker: %s\n", ril->worker_running ? "running" : "not started");
+    dprintf(fd, "      commands failed: %u, coalesced: %u\n",
+            atomic_load_explicit(&ril->cmd_errors, memory_order_relaxed),
+            atomic_load_explicit(&ril->cmd_coalesced, memory_order_relaxed));
+    audio_stats_hist_dump(&ril->cmd_wait, fd, "command wait");
+    audio_stats_hist_dump(&ril->cmd_time, fd, "command call");
+}
+
+/* The functions below return as soon as the command is queued */
+
 int ril_set_call_volume(struct ril_handle *ril, enum ril_sound_type sound_type,
                         float volume)
 {
-    if (ril_connect_if_required(ril))
-        return 0;
-
-    return _ril_set_call_volume(ril->client, sound_type,
-                                (int)(volume * ril->volume_steps_max));
+    return ril_queue_cmd(ril, RIL_CMD_CALL_VOLUME, sound_type,
+                         (int)(volume * ril->volume_steps_max));
 }
 
 int ril_set_call_audio_path(struct ril_handle *ril, enum ril_audio_path path)
 {
-    if (ril_connect_if_required(ril))
-        return 0;
-
-    return _ril_set_call_audio_path(ril->client, path);
+    return ril_queue_cmd(ril, RIL_CMD_CALL_AUDIO_PATH, path, 0);
 }
 
 int ril_set_call_clock_sync(struct ril_handle *ril, enum ril_clock_state state)
 {
-    if (ril_connect_if_required(ril))
-        return 0;
-
-    return _ril_set_call_clock_sync(ril->client, state);
+    return ril_queue_cmd(ril, RIL_CMD_CALL_CLOCK_SYNC, state, 0);
 }
 
 int ril_set_two_mic_control(struct ril_handle *ril, enum ril_two_mic_device device, enum ril_two_mic_state state)
 {
-    if (ril_connect_if_required(ril))
-        return 0;
-
-    return _ril_set_two_mic_control(ril->client, device, state);
+    return ril_queue_cmd(ril, RIL_CMD_TWO_MIC_CONTROL, device, state);
 }
 
 int ril_set_mic_mute(struct ril_handle *ril, enum ril_mic_mute state)
 {
-    if (ril_connect_if_required(ril))
-        return 0;
-
-    return _ril_set_mic_mute(ril->client, state);
+    return ril_queue_cmd(ril, RIL_CMD_MIC_MUTE, state, 0);
 }
@@ -17,7 +17,18 @@
 #ifndef RIL_INTERFACE_H
 #define RIL_INTERFACE_H
 
-#define RIL_CLIENT_LIBPATH "libsecril-client.so"
+#include <pthread.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include "audio_stats.h"
+
+#define RIL_CLIENT_LIBNAME "libsecril-client"
+#ifndef RIL_CLIENT_LIBPATH
+#define RIL_CLIENT_LIBPATH RIL_CLIENT_LIBNAME ".so"
+#endif
+/* another build of the client library, only honoured on debuggable builds */
+#define RIL_CLIENT_LIBPATH_PROPERTY "persist.audio.ril_client_lib"
 
 #define RIL_CLIENT_ERR_SUCCESS      0
 #define RIL_CLIENT_ERR_AGAIN        1
@@ -32,11 +43,50 @@
 #define RIL_UNSOL_WB_AMR_STATE \
     (RIL_OEM_UNSOL_RESPONSE_BASE + 17)    // RIL AMR state index
 
+/* retry interval when the RIL daemon cannot be reached */
+#define RIL_RECONNECT_DELAY_MS 500
+
+/* commands handed to the RIL worker thread */
+enum ril_cmd_type {
+    RIL_CMD_CALL_AUDIO_PATH,
+    RIL_CMD_CALL_CLOCK_SYNC,
+    RIL_CMD_CALL_VOLUME,
+    RIL_CMD_TWO_MIC_CONTROL,
+    RIL_CMD_MIC_MUTE,
+    RIL_CMD_TOTAL
+};
+
+/* commands kept while the RIL cannot be reached, more than RIL_CMD_TOTAL */
+#define RIL_QUEUE_SIZE 16
+
+struct ril_cmd {
+    enum ril_cmd_type type;
+    int arg1;
+    int arg2;
+    struct timespec queued;     /* CLOCK_MONOTONIC */
+};
+
 struct ril_handle
 {
     void *handle;
     void *client;
     int volume_steps_max;
+
+    /* worker thread talking to the RIL, see ril_worker() */
+    pthread_t worker;
+    bool worker_running;
+    bool worker_exit;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    /* pending commands in submission order, see ril_queue_cmd() */
+    struct ril_cmd queue[RIL_QUEUE_SIZE];
+    unsigned int num_queued;
+
+    /* see ril_dump() */
+    atomic_uint cmd_errors;
+    atomic_uint cmd_coalesced;
+    struct audio_stats_hist cmd_wait;   /* from queued to sent */
+    struct audio_stats_hist cmd_time;   /* RIL client call */
 };
 
 enum ril_sound_type {
@@ -78,6 +128,7 @@ enum ril_mic_mute {
 /* Function prototypes */
 int ril_open(struct ril_handle *ril);
 int ril_close(struct ril_handle *ril);
+void ril_dump(struct ril_handle *ril, int fd);
 int ril_set_call_volume(struct ril_handle *ril, enum ril_sound_type sound_type,
                         float volume);
 int ril_set_call_audio_path(struct ril_handle *ril, enum ril_audio_path path);
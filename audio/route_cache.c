@@ -0,0 +1,452 @@
+/*
+ * Copyright (C) 2017 The LineageOS Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "audio_hw_primary"
+/*#define LOG_NDEBUG 0*/
+
+/* dladdr() */
+#define _GNU_SOURCE
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <link.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <cutils/log.h>
+
+#include "route_cache.h"
+
+/*
+ * Cache file layout, all fields in native byte order:
+ *
+ *   struct cache_header
+ *   struct cache_path     [num_paths]
+ *   struct cache_setting  [num_settings]
+ *   char                  strings[strings_size]
+ *
+ * Strings are NUL terminated and referenced by their offset in the string
+ * table. The file is mapped read-only and the strings are used in place.
+ */
+
+#define CACHE_MAGIC   0x31435452 /* "RTC1" */
+#define CACHE_VERSION 3   /* off_value is -1 for an enum without "Off" */
+
+#define NO_STRING 0xffffffff
+
+struct cache_header {
+    uint32_t magic;
+    uint32_t version;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    uint64_t xml_size;
+    uint64_t xml_hash;
+    uint64_t hal_id;
+    uint32_t num_mixer_ctls;
+    uint32_t num_paths;
+    uint32_t num_settings;
+    uint32_t strings_size;
+};
+
+struct cache_path {
+    int32_t type;
+    int32_t device;
+    int32_t mask;
+    uint32_t first;
+    uint32_t len;
+};
+
+struct cache_setting {
+    uint32_t ctl_id;
+    int32_t intval;
+    int32_t on_value;
+    int32_t off_value;
+    uint32_t name;
+    uint32_t strval;
+};
+
+/* 64 bit FNV-1a */
+static uint64_t hash_buffer(const uint8_t *buf, size_t len)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        hash ^= buf[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+struct build_id_search {
+    uintptr_t addr;
+    uint64_t hash;
+    bool found;
+};
+
+/* hash of the GNU build id note of the object mapping s->addr */
+static int find_build_id(struct dl_phdr_info *info, size_t size, void *data)
+{
+    struct build_id_search *s = data;
+    const ElfW(Phdr) *ph;
+    const uint8_t *p, *end, *name, *desc;
+    const ElfW(Nhdr) *nh;
+    bool mapped = false;
+    int i;
+
+    for (i = 0; i < info->dlpi_phnum; i++) {
+        ph = &info->dlpi_phdr[i];
+        if (ph->p_type == PT_LOAD && s->addr >= info->dlpi_addr + ph->p_vaddr &&
+                s->addr < info->dlpi_addr + ph->p_vaddr + ph->p_memsz)
+            mapped = true;
+    }
+    if (!mapped)
+        return 0;
+
+    for (i = 0; i < info->dlpi_phnum; i++) {
+        ph = &info->dlpi_phdr[i];
+        if (ph->p_type != PT_NOTE)
+            continue;
+
+        p = (const uint8_t *)(info->dlpi_addr + ph->p_vaddr);
+        end = p + ph->p_memsz;
+        while (p + sizeof(*nh) <= end) {
+            nh = (const ElfW(Nhdr) *)p;
+            name = p + sizeof(*nh);
+            desc = name + ((nh->n_namesz + 3) & ~3);
+            if (desc + nh->n_descsz > end)
+                break;
+            if (nh->n_type == NT_GNU_BUILD_ID && nh->n_namesz == 4 &&
+                    memcmp(name, "GNU", 4) == 0) {
+                s->hash = hash_buffer(desc, nh->n_descsz);
+                s->found = true;
+                return 1;
+            }
+            p = desc + ((nh->n_descsz + 3) & ~3);
+        }
+    }
+    return 1;
+}
+
+/* Identify this build of the HAL by its build id, or by its file if it was
+ * linked without one */
+static int get_hal_id(uint64_t *hal_id)
+{
+    struct build_id_search s = { (uintptr_t)get_hal_id, 0, false };
+    struct stat st;
+    Dl_info info;
+    uint64_t id[2];
+
+    dl_iterate_phdr(find_build_id, &s);
+    if (s.found) {
+        *hal_id = s.hash;
+        return 0;
+    }
+
+    if (dladdr((void *)get_hal_id, &info) == 0 || !info.dli_fname ||
+            stat(info.dli_fname, &st) < 0)
+        return -ENOENT;
+    id[0] = st.st_mtim.tv_sec * 1000000000ULL + st.st_mtim.tv_nsec;
+    id[1] = st.st_size;
+    *hal_id = hash_buffer((const uint8_t *)id, sizeof(id));
+    return 0;
+}
+
+int route_cache_get_key(const char *xml_path, struct route_cache_key *key)
+{
+    struct stat st;
+    void *map;
+    int fd;
+
+    fd = open(xml_path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -errno;
+
+    if (fstat(fd, &st) < 0 || st.st_size == 0) {
+        close(fd);
+        return -EINVAL;
+    }
+
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return -ENOMEM;
+
+    if (get_hal_id(&key->hal_id) != 0) {
+        munmap(map, st.st_size);
+        return -ENOENT;
+    }
+    key->mtime_sec = st.st_mtim.tv_sec;
+    key->mtime_nsec = st.st_mtim.tv_nsec;
+    key->size = st.st_size;
+    key->hash = hash_buffer(map, st.st_size);
+
+    munmap(map, st.st_size);
+    return 0;
+}
+
+int route_cache_load(const char *cache_path, const struct route_cache_key *key,
+                     struct mixer *mixer, struct route_cache *cache)
+{
+    const struct cache_header *hdr;
+    const struct cache_path *cpaths;
+    const struct cache_setting *csettings;
+    const char *strings;
+    struct mixer_ctl *ctl;
+    struct stat st;
+    size_t remaining;
+    unsigned int i;
+    int fd;
+    int ret = -ESTALE;
+
+    memset(cache, 0, sizeof(*cache));
+
+    fd = open(cache_path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -errno;
+
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(*hdr)) {
+        close(fd);
+        return -EINVAL;
+    }
+
+    cache->map_size = st.st_size;
+    cache->map = mmap(NULL, cache->map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (cache->map == MAP_FAILED) {
+        cache->map = NULL;
+        return -ENOMEM;
+    }
+
+    hdr = cache->map;
+    if (hdr->magic != CACHE_MAGIC || hdr->version != CACHE_VERSION ||
+            hdr->mtime_sec != key->mtime_sec || hdr->mtime_nsec != key->mtime_nsec ||
+            hdr->xml_size != key->size || hdr->xml_hash != key->hash ||
+            hdr->hal_id != key->hal_id ||
+            hdr->num_mixer_ctls != mixer_get_num_ctls(mixer))
+        goto err;
+
+    /* bound each count by what is left of the file before using it, the
+     * sizes computed from the counts could wrap on 32 bit */
+    remaining = cache->map_size - sizeof(*hdr);
+    if (hdr->num_paths > remaining / sizeof(*cpaths))
+        goto err;
+    remaining -= hdr->num_paths * sizeof(*cpaths);
+    if (hdr->num_settings > remaining / sizeof(*csettings))
+        goto err;
+    remaining -= hdr->num_settings * sizeof(*csettings);
+    if (remaining != hdr->strings_size || hdr->strings_size == 0)
+        goto err;
+
+    cpaths = (const struct cache_path *)(hdr + 1);
+    csettings = (const struct cache_setting *)(cpaths + hdr->num_paths);
+    strings = (const char *)(csettings + hdr->num_settings);
+    if (strings[hdr->strings_size - 1] != '\0')
+        goto err;
+
+    cache->paths = calloc(hdr->num_paths, sizeof(*cache->paths));
+    cache->settings = calloc(hdr->num_settings, sizeof(*cache->settings));
+    if ((hdr->num_paths && !cache->paths) || (hdr->num_settings && !cache->settings)) {
+        ret = -ENOMEM;
+        goto err;
+    }
+
+    for (i = 0; i < hdr->num_settings; i++) {
+        const struct cache_setting *cs = &csettings[i];
+        struct route_setting *r = &cache->settings[i];
+
+        if (cs->name >= hdr->strings_size ||
+                (cs->strval != NO_STRING && cs->strval >= hdr->strings_size))
+            goto err;
+
+        /* the strings are never written through these pointers */
+        r->ctl_name = (char *)strings + cs->name;
+        r->strval = cs->strval == NO_STRING ? NULL : (char *)strings + cs->strval;
+        r->intval = cs->intval;
+
+        if (cs->ctl_id == ROUTE_CACHE_CTL_INVALID)
+            continue;
+
+        /* a control id is only trusted if it still names the same control */
+        ctl = mixer_get_ctl(mixer, cs->ctl_id);
+        if (!ctl || strcmp(mixer_ctl_get_name(ctl), r->ctl_name) != 0)
+            goto err;
+        r->compiled = true;
+        r->ctl_id = cs->ctl_id;
+        r->on_value = cs->on_value;
+        r->off_value = cs->off_value;
+    }
+
+    for (i = 0; i < hdr->num_paths; i++) {
+        const struct cache_path *cp = &cpaths[i];
+
+        if (cp->first > hdr->num_settings || cp->len > hdr->num_settings - cp->first)
+            goto err;
+
+        cache->paths[i].type = cp->type;
+        cache->paths[i].device = cp->device;
+        cache->paths[i].mask = cp->mask;
+        cache->paths[i].settings = cache->settings + cp->first;
+        cache->paths[i].len = cp->len;
+    }
+    cache->num_paths = hdr->num_paths;
+
+    ALOGV("%s: loaded %u paths, %u controls from %s", __func__,
+          hdr->num_paths, hdr->num_settings, cache_path);
+    return 0;
+
+err:
+    route_cache_release(cache);
+    return ret;
+}
+
+static int write_all(int fd, const void *buf, size_t len)
+{
+    const uint8_t *p = buf;
+
+    while (len) {
+        ssize_t ret = write(fd, p, len);
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            return -errno;
+        }
+        p += ret;
+        len -= ret;
+    }
+    return 0;
+}
+
+int route_cache_store(const char *cache_path, const struct route_cache_key *key,
+                      struct mixer *mixer, const struct route_cache_path *paths,
+                      unsigned int num_paths)
+{
+    struct cache_header hdr;
+    struct cache_path *cpaths = NULL;
+    struct cache_setting *csettings = NULL;
+    char *strings = NULL;
+    char tmp_path[PATH_MAX];
+    unsigned int i, j, n;
+    size_t num_settings = 0;
+    size_t strings_size = 0;
+    size_t off;
+    int fd;
+    int ret = -ENOMEM;
+
+    for (i = 0; i < num_paths; i++) {
+        num_settings += paths[i].len;
+        for (j = 0; j < paths[i].len; j++) {
+            strings_size += strlen(paths[i].settings[j].ctl_name) + 1;
+            if (paths[i].settings[j].strval)
+                strings_size += strlen(paths[i].settings[j].strval) + 1;
+        }
+    }
+
+    cpaths = calloc(num_paths ? num_paths : 1, sizeof(*cpaths));
+    csettings = calloc(num_settings ? num_settings : 1, sizeof(*csettings));
+    strings = malloc(strings_size ? strings_size : 1);
+    if (!cpaths || !csettings || !strings)
+        goto out;
+
+    off = 0;
+    for (i = 0, n = 0; i < num_paths; i++) {
+        cpaths[i].type = paths[i].type;
+        cpaths[i].device = paths[i].device;
+        cpaths[i].mask = paths[i].mask;
+        cpaths[i].first = n;
+        cpaths[i].len = paths[i].len;
+
+        for (j = 0; j < paths[i].len; j++, n++) {
+            const struct route_setting *r = &paths[i].settings[j];
+            struct cache_setting *cs = &csettings[n];
+
+            cs->ctl_id = r->compiled ? r->ctl_id : ROUTE_CACHE_CTL_INVALID;
+            cs->intval = r->intval;
+            cs->on_value = r->on_value;
+            cs->off_value = r->off_value;
+
+            cs->name = off;
+            strcpy(strings + off, r->ctl_name);
+            off += strlen(r->ctl_name) + 1;
+
+            cs->strval = NO_STRING;
+            if (r->strval) {
+                cs->strval = off;
+                strcpy(strings + off, r->strval);
+                off += strlen(r->strval) + 1;
+            }
+        }
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = CACHE_MAGIC;
+    hdr.version = CACHE_VERSION;
+    hdr.mtime_sec = key->mtime_sec;
+    hdr.mtime_nsec = key->mtime_nsec;
+    hdr.xml_size = key->size;
+    hdr.xml_hash = key->hash;
+    hdr.hal_id = key->hal_id;
+    hdr.num_mixer_ctls = mixer_get_num_ctls(mixer);
+    hdr.num_paths = num_paths;
+    hdr.num_settings = num_settings;
+    hdr.strings_size = strings_size;
+
+    /* write a temporary file and rename it so readers never see a partial cache */
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", cache_path);
+    fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        ret = -errno;
+        goto out;
+    }
+
+    ret = write_all(fd, &hdr, sizeof(hdr));
+    if (ret == 0)
+        ret = write_all(fd, cpaths, num_paths * sizeof(*cpaths));
+    if (ret == 0)
+        ret = write_all(fd, csettings, num_settings * sizeof(*csettings));
+    if (ret == 0)
+        ret = write_all(fd, strings, strings_size);
+    if (ret == 0 && fsync(fd) < 0)
+        ret = -errno;
+    close(fd);
+
+    if (ret == 0 && rename(tmp_path, cache_path) < 0)
+        ret = -errno;
+    if (ret != 0)
+        unlink(tmp_path);
+
+out:
+    free(cpaths);
+    free(csettings);
+    free(strings);
+    return ret;
+}
+
+void route_cache_release(struct route_cache *cache)
+{
+    free(cache->paths);
+    free(cache->settings);
+    if (cache->map)
+        munmap(cache->map, cache->map_size);
+    memset(cache, 0, sizeof(*cache));
+}
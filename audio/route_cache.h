@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2017 The LineageOS Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ROUTE_CACHE_H
+#define ROUTE_CACHE_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <tinyalsa/asoundlib.h>
+
+#include "audio_route.h"
+
+#ifndef ROUTE_CACHE_DIR
+#define ROUTE_CACHE_DIR "/data/misc/audioserver"
+#endif
+
+/* ctl_id of a route entry whose control could not be resolved */
+#define ROUTE_CACHE_CTL_INVALID 0xffffffff
+
+enum route_cache_path_type {
+    ROUTE_CACHE_PATH_DEFAULT,   /* applied once while loading the config */
+    ROUTE_CACHE_PATH_ON,        /* device enable sequence */
+    ROUTE_CACHE_PATH_OFF,       /* device disable sequence, also applied while loading */
+};
+
+/* identifies the XML configuration a cache was built from, and the HAL
+ * build that parsed it: the cache holds control ids, values and device
+ * masks as that build resolved them */
+struct route_cache_key {
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    uint64_t size;
+    uint64_t hash;
+    uint64_t hal_id;
+};
+
+/* one <path> of the configuration, in document order */
+struct route_cache_path {
+    int type;
+    int device;     /* index of the <device> in document order, -1 if none */
+    int mask;
+    struct route_setting *settings;
+    unsigned int len;
+};
+
+struct route_cache {
+    void *map;
+    size_t map_size;
+    struct route_cache_path *paths;
+    unsigned int num_paths;
+    struct route_setting *settings;
+};
+
+/* Function prototypes */
+int route_cache_get_key(const char *xml_path, struct route_cache_key *key);
+int route_cache_load(const char *cache_path, const struct route_cache_key *key,
+                     struct mixer *mixer, struct route_cache *cache);
+int route_cache_store(const char *cache_path, const struct route_cache_key *key,
+                      struct mixer *mixer, const struct route_cache_path *paths,
+                      unsigned int num_paths);
+void route_cache_release(struct route_cache *cache);
+#endif
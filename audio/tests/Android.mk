@@ -0,0 +1,346 @@
+# Copyright (C) 2017 The LineageOS Project
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#      http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+# Host build of the HAL against a fake tinyalsa, see fake_tinyalsa.h. These
+# modules are not part of the device build: build them with
+#   mmm device/samsung/i9300/audio/tests
+# and run them with run_host_tests.sh.
+
+LOCAL_PATH := $(call my-dir)
+
+audio_hw_host_c_includes := \
+	$(LOCAL_PATH)/.. \
+	external/tinyalsa/include \
+	external/expat/lib \
+	$(call include-path-for, audio-utils) \
+	$(call include-path-for, audio-effects)
+
+audio_hw_host_cflags := \
+	-DAUDIO_HW_HOST \
+	-DFAKE_TINYALSA_CONFIG=\"$(LOCAL_PATH)/../../configs/tiny_hw.xml\" \
+	-DRIL_CLIENT_LIBPATH=\"libsecril-client-fake.so\" \
+	-DCODEC_FX_LIBRARY_PATH=\"libcodecfx.so\"
+
+audio_hw_host_static_libraries := \
+	libaudio_hw_host \
+	libtinyalsa_fake \
+	libthreadpolicy \
+	libaudio_host_fake \
+	libexpat \
+	libcutils \
+	liblog
+
+audio_hw_host_shared_libraries := libsecril-client-fake libcodecfx
+
+audio_hw_host_ldlibs := -lpthread -lm -ldl
+
+# The RIL client without a modem, see fake_secril_client.h. The target build
+# is picked up through RIL_CLIENT_LIBPATH_PROPERTY on debuggable builds.
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := libsecril-client-fake
+LOCAL_MODULE_TAGS := optional
+LOCAL_SRC_FILES := fake_secril_client.c
+LOCAL_C_INCLUDES := $(LOCAL_PATH)/..
+LOCAL_SHARED_LIBRARIES := liblog libcutils
+
+include $(BUILD_SHARED_LIBRARY)
+
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := libsecril-client-fake
+LOCAL_MODULE_TAGS := optional
+LOCAL_SRC_FILES := fake_secril_client.c
+LOCAL_C_INCLUDES := $(LOCAL_PATH)/..
+LOCAL_STATIC_LIBRARIES := libaudio_host_fake
+LOCAL_SHARED_LIBRARIES := liblog libcutils
+
+include $(BUILD_HOST_SHARED_LIBRARY)
+
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := libcodecfx
+LOCAL_MODULE_TAGS := optional
+LOCAL_SRC_FILES := ../effects/codec_fx.c ../codec_eq.c
+LOCAL_C_INCLUDES := $(audio_hw_host_c_includes)
+LOCAL_CFLAGS := -fvisibility=hidden
+LOCAL_SHARED_LIBRARIES := liblog libcutils
+
+include $(BUILD_HOST_SHARED_LIBRARY)
+
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := libtinyalsa_fake
+LOCAL_MODULE_TAGS := optional
+LOCAL_SRC_FILES := fake_tinyalsa.c
+LOCAL_C_INCLUDES := $(audio_hw_host_c_includes)
+LOCAL_CFLAGS := $(audio_hw_host_cflags)
+
+include $(BUILD_HOST_STATIC_LIBRARY)
+
+# What the host libcutils and libaudioutils leave out: system properties,
+# the resampler and the echo reference, see fake_properties.c and
+# fake_audio_utils.c
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := libaudio_host_fake
+LOCAL_MODULE_TAGS := optional
+LOCAL_SRC_FILES := fake_audio_utils.c fake_properties.c
+LOCAL_C_INCLUDES := $(audio_hw_host_c_includes)
+LOCAL_CFLAGS := -fPIC
+
+include $(BUILD_HOST_STATIC_LIBRARY)
+
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := libaudio_hw_host
+LOCAL_MODULE_TAGS := optional
+LOCAL_SRC_FILES := \
+	../audio_hw.c ../ril_interface.c ../route_cache.c ../audio_ring.c \
+	../preproc_pipeline.c ../echo_delay.c ../capture_hub.c ../codec_eq.c \
+	../audio_stats.c ../gain_ramp.c ../voice_gate.c \
+	audio_hw_host.c
+LOCAL_C_INCLUDES := $(audio_hw_host_c_includes)
+LOCAL_CFLAGS := $(audio_hw_host_cflags)
+LOCAL_STATIC_LIBRARIES := libthreadpolicy
+
+include $(BUILD_HOST_STATIC_LIBRARY)
+
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := audio_hw_bench
+LOCAL_MODULE_TAGS := optional
+LOCAL_SRC_FILES := audio_hw_bench.c stub_effect.c
+LOCAL_C_INCLUDES := $(audio_hw_host_c_includes)
+LOCAL_CFLAGS := $(audio_hw_host_cflags)
+LOCAL_STATIC_LIBRARIES := $(audio_hw_host_static_libraries)
+LOCAL_SHARED_LIBRARIES := $(audio_hw_host_shared_libraries)
+LOCAL_LDLIBS := $(audio_hw_host_ldlibs)
+
+include $(BUILD_HOST_EXECUTABLE)
+
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := audio_hw_route_test
+LOCAL_MODULE_TAGS := tests
+LOCAL_SRC_FILES := audio_hw_route_test.c
+LOCAL_C_INCLUDES := $(audio_hw_host_c_includes)
+LOCAL_CFLAGS := $(audio_hw_host_cflags)
+LOCAL_STATIC_LIBRARIES := $(audio_hw_host_static_libraries)
+LOCAL_SHARED_LIBRARIES := $(audio_hw_host_shared_libraries)
+LOCAL_LDLIBS := $(audio_hw_host_ldlibs)
+LOCAL_GTEST := false
+
+include $(BUILD_HOST_NATIVE_TEST)
+
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := audio_hw_stress_test
+LOCAL_MODULE_TAGS := tests
+LOCAL_SRC_FILES := audio_hw_stress_test.c
+LOCAL_C_INCLUDES := $(audio_hw_host_c_includes)
+LOCAL_CFLAGS := $(audio_hw_host_cflags)
+LOCAL_STATIC_LIBRARIES := $(audio_hw_host_static_libraries)
+LOCAL_SHARED_LIBRARIES := $(audio_hw_host_shared_libraries)
+LOCAL_LDLIBS := $(audio_hw_host_ldlibs)
+LOCAL_GTEST := false
+
+include $(BUILD_HOST_NATIVE_TEST)
+
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := route_cache_test
+LOCAL_MODULE_TAGS := tests
+LOCAL_SRC_FILES := route_cache_test.c
+LOCAL_C_INCLUDES := $(audio_hw_host_c_includes)
+LOCAL_CFLAGS := $(audio_hw_host_cflags)
+LOCAL_STATIC_LIBRARIES := $(audio_hw_host_static_libraries)
+LOCAL_SHARED_LIBRARIES := $(audio_hw_host_shared_libraries)
+LOCAL_LDLIBS := $(audio_hw_host_ldlibs)
+LOCAL_GTEST := false
+
+include $(BUILD_HOST_NATIVE_TEST)
+
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := audio_hw_call_test
+LOCAL_MODULE_TAGS := tests
+LOCAL_SRC_FILES := audio_hw_call_test.c
+LOCAL_C_INCLUDES := $(audio_hw_host_c_includes)
+LOCAL_CFLAGS := $(audio_hw_host_cflags)
+LOCAL_STATIC_LIBRARIES := $(audio_hw_host_static_libraries)
+LOCAL_SHARED_LIBRARIES := $(audio_hw_host_shared_libraries)
+LOCAL_LDLIBS := $(audio_hw_host_ldlibs)
+LOCAL_GTEST := false
+
+include $(BUILD_HOST_NATIVE_TEST)
+
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := codec_fx_test
+LOCAL_MODULE_TAGS := tests
+LOCAL_SRC_FILES := codec_fx_test.c
+LOCAL_C_INCLUDES := $(audio_hw_host_c_includes)
+LOCAL_CFLAGS := $(audio_hw_host_cflags)
+LOCAL_STATIC_LIBRARIES := $(audio_hw_host_static_libraries)
+LOCAL_SHARED_LIBRARIES := $(audio_hw_host_shared_libraries)
+LOCAL_LDLIBS := $(audio_hw_host_ldlibs)
+LOCAL_GTEST := false
+
+include $(BUILD_HOST_NATIVE_TEST)
+
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := codec_eq_test
+LOCAL_MODULE_TAGS := tests
+LOCAL_SRC_FILES := codec_eq_test.c
+LOCAL_C_INCLUDES := $(audio_hw_host_c_includes)
+LOCAL_CFLAGS := $(audio_hw_host_cflags)
+LOCAL_STATIC_LIBRARIES := $(audio_hw_host_static_libraries)
+LOCAL_SHARED_LIBRARIES := $(audio_hw_host_shared_libraries)
+LOCAL_LDLIBS := $(audio_hw_host_ldlibs)
+LOCAL_GTEST := false
+
+include $(BUILD_HOST_NATIVE_TEST)
+
+# gain_ramp alone, then its NEON code on the host through neon_shim: both
+# must match the model of the test bit for bit
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := gain_ramp_test
+LOCAL_MODULE_TAGS := tests
+LOCAL_SRC_FILES := gain_ramp_test.c ../gain_ramp.c
+LOCAL_C_INCLUDES := $(LOCAL_PATH)/..
+LOCAL_GTEST := false
+
+include $(BUILD_HOST_NATIVE_TEST)
+
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := gain_ramp_neon_test
+LOCAL_MODULE_TAGS := tests
+LOCAL_SRC_FILES := gain_ramp_test.c ../gain_ramp.c
+LOCAL_C_INCLUDES := $(LOCAL_PATH)/neon_shim $(LOCAL_PATH)/..
+LOCAL_CFLAGS := -D__ARM_NEON
+LOCAL_GTEST := false
+
+include $(BUILD_HOST_NATIVE_TEST)
+
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := voice_gate_test
+LOCAL_MODULE_TAGS := tests
+LOCAL_SRC_FILES := voice_gate_test.c ../voice_gate.c
+LOCAL_C_INCLUDES := $(LOCAL_PATH)/..
+LOCAL_LDLIBS := -lm
+LOCAL_GTEST := false
+
+include $(BUILD_HOST_NATIVE_TEST)
+
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := audio_ring_test
+LOCAL_MODULE_TAGS := tests
+LOCAL_SRC_FILES := audio_ring_test.c ../audio_ring.c
+LOCAL_C_INCLUDES := $(LOCAL_PATH)/..
+LOCAL_LDLIBS := -lpthread
+LOCAL_GTEST := false
+
+include $(BUILD_HOST_NATIVE_TEST)
+
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := audio_hw_capture_test
+LOCAL_MODULE_TAGS := tests
+LOCAL_SRC_FILES := audio_hw_capture_test.c
+LOCAL_C_INCLUDES := $(audio_hw_host_c_includes)
+LOCAL_CFLAGS := $(audio_hw_host_cflags)
+LOCAL_STATIC_LIBRARIES := $(audio_hw_host_static_libraries)
+LOCAL_SHARED_LIBRARIES := $(audio_hw_host_shared_libraries)
+LOCAL_LDLIBS := $(audio_hw_host_ldlibs)
+LOCAL_GTEST := false
+
+include $(BUILD_HOST_NATIVE_TEST)
+
+include $(CLEAR_VARS)
+
+# the allocator is wrapped to count the heap calls of the HAL
+LOCAL_MODULE := audio_hw_alloc_test
+LOCAL_MODULE_TAGS := tests
+LOCAL_SRC_FILES := audio_hw_alloc_test.c
+LOCAL_C_INCLUDES := $(audio_hw_host_c_includes)
+LOCAL_CFLAGS := $(audio_hw_host_cflags)
+LOCAL_LDFLAGS := -Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc
+LOCAL_STATIC_LIBRARIES := $(audio_hw_host_static_libraries)
+LOCAL_SHARED_LIBRARIES := $(audio_hw_host_shared_libraries)
+LOCAL_LDLIBS := $(audio_hw_host_ldlibs)
+LOCAL_GTEST := false
+
+include $(BUILD_HOST_NATIVE_TEST)
+
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := preproc_pipeline_test
+LOCAL_MODULE_TAGS := tests
+LOCAL_SRC_FILES := preproc_pipeline_test.c stub_effect.c
+LOCAL_C_INCLUDES := $(audio_hw_host_c_includes)
+LOCAL_CFLAGS := $(audio_hw_host_cflags)
+LOCAL_STATIC_LIBRARIES := $(audio_hw_host_static_libraries)
+LOCAL_SHARED_LIBRARIES := $(audio_hw_host_shared_libraries)
+LOCAL_LDLIBS := $(audio_hw_host_ldlibs)
+LOCAL_GTEST := false
+
+include $(BUILD_HOST_NATIVE_TEST)
+
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := echo_delay_test
+LOCAL_MODULE_TAGS := tests
+LOCAL_SRC_FILES := echo_delay_test.c
+LOCAL_C_INCLUDES := $(audio_hw_host_c_includes)
+LOCAL_CFLAGS := $(audio_hw_host_cflags)
+LOCAL_STATIC_LIBRARIES := $(audio_hw_host_static_libraries)
+LOCAL_SHARED_LIBRARIES := $(audio_hw_host_shared_libraries)
+LOCAL_LDLIBS := $(audio_hw_host_ldlibs)
+LOCAL_GTEST := false
+
+include $(BUILD_HOST_NATIVE_TEST)
+
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := audio_hw_position_test
+LOCAL_MODULE_TAGS := tests
+LOCAL_SRC_FILES := audio_hw_position_test.c
+LOCAL_C_INCLUDES := $(audio_hw_host_c_includes)
+LOCAL_CFLAGS := $(audio_hw_host_cflags)
+LOCAL_STATIC_LIBRARIES := $(audio_hw_host_static_libraries)
+LOCAL_SHARED_LIBRARIES := $(audio_hw_host_shared_libraries)
+LOCAL_LDLIBS := $(audio_hw_host_ldlibs)
+LOCAL_GTEST := false
+
+include $(BUILD_HOST_NATIVE_TEST)
+
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := audio_hw_hdmi_test
+LOCAL_MODULE_TAGS := tests
+LOCAL_SRC_FILES := audio_hw_hdmi_test.c
+LOCAL_C_INCLUDES := $(audio_hw_host_c_includes)
+LOCAL_CFLAGS := $(audio_hw_host_cflags)
+LOCAL_STATIC_LIBRARIES := $(audio_hw_host_static_libraries)
+LOCAL_SHARED_LIBRARIES := $(audio_hw_host_shared_libraries)
+LOCAL_LDLIBS := $(audio_hw_host_ldlibs)
+LOCAL_GTEST := false
+
+include $(BUILD_HOST_NATIVE_TEST)
@@ -0,0 +1,160 @@
+/*
+ * Copyright (C) 2017 The LineageOS Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * The capture path does not call into the heap once the input has left
+ * standby: all its buffers come from the arena allocated at open.
+ *
+ * The test is linked with -Wl,--wrap for the allocator, see Android.mk, so
+ * every malloc(), calloc() and realloc() of the HAL and of the libraries it
+ * is linked with statically goes through the counters below, from any
+ * thread. The capture thread is covered as well as in_read().
+ */
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "audio_hw_host.h"
+#include "audio_test.h"
+
+#define STEADY_MS       1000
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+static atomic_bool counting;
+static atomic_uint allocs;
+
+void *__wrap_malloc(size_t size)
+{
+    if (atomic_load(&counting))
+        atomic_fetch_add(&allocs, 1);
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size)
+{
+    if (atomic_load(&counting))
+        atomic_fetch_add(&allocs, 1);
+    return __real_calloc(nmemb, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+    if (atomic_load(&counting))
+        atomic_fetch_add(&allocs, 1);
+    return __real_realloc(ptr, size);
+}
+
+/* reads STEADY_MS of capture once the input is running, returns the number
+ * of allocations meanwhile */
+static unsigned int steady_state_allocs(unsigned int rate, const char *kvpairs)
+{
+    struct audio_config config = {
+        .sample_rate = rate,
+        .channel_mask = AUDIO_CHANNEL_IN_STEREO,
+        .format = AUDIO_FORMAT_PCM_16_BIT,
+    };
+    struct audio_hw_host_tone tone = { 440, 4000 };
+    struct audio_hw_device *dev;
+    struct audio_stream_in *in;
+    size_t bytes, frames, done;
+    void *buf;
+    unsigned int n = (unsigned int)-1;
+    int i;
+
+    if (audio_hw_host_open(&dev, false) != 0)
+        return n;
+    fake_pcm_set_source(HOST_CARD_DEFAULT, HOST_PORT_CAPTURE, audio_hw_host_tone_source, &tone);
+    if (dev->open_input_stream(dev, 0, AUDIO_DEVICE_IN_BUILTIN_MIC, &config, &in) != 0)
+        goto close_dev;
+    if (kvpairs != NULL)
+        in->common.set_parameters(&in->common, kvpairs);
+
+    bytes = in->common.get_buffer_size(&in->common);
+    frames = bytes / audio_stream_in_frame_size(&in->common);
+    buf = malloc(bytes);
+
+    /* leaving standby allocates, the resampler warms up on the first reads */
+    for (i = 0; i < 4; i++) {
+        if (in->read(in, buf, bytes) <= 0)
+            goto close_in;
+    }
+
+    atomic_store(&allocs, 0);
+    atomic_store(&counting, true);
+    for (done = 0; done < rate * STEADY_MS / 1000; done += frames) {
+        if (in->read(in, buf, bytes) <= 0)
+            break;
+        in->get_input_frames_lost(in);
+    }
+    atomic_store(&counting, false);
+    n = atomic_load(&allocs);
+
+close_in:
+    free(buf);
+    dev->close_input_stream(dev, in);
+close_dev:
+    audio_hw_host_close(dev);
+    return n;
+}
+
+static void test_capture(void)
+{
+    EXPECT_EQ(0, steady_state_allocs(44100, NULL));
+}
+
+/* through the resampler */
+static void test_capture_resampled(void)
+{
+    EXPECT_EQ(0, steady_state_allocs(16000, NULL));
+    EXPECT_EQ(0, steady_state_allocs(48000, NULL));
+}
+
+/* the echo reference and preprocessing staging rings */
+static void test_voice_communication(void)
+{
+    char kvpairs[32];
+
+    snprintf(kvpairs, sizeof(kvpairs), "%s=%d", AUDIO_PARAMETER_STREAM_INPUT_SOURCE,
+             AUDIO_SOURCE_VOICE_COMMUNICATION);
+    EXPECT_EQ(0, steady_state_allocs(16000, kvpairs));
+}
+
+/* the counters do count */
+static void test_wrap(void)
+{
+    void *p;
+
+    atomic_store(&allocs, 0);
+    atomic_store(&counting, true);
+    p = malloc(16);
+    p = realloc(p, 32);
+    atomic_store(&counting, false);
+    free(p);
+    EXPECT_EQ(2, atomic_load(&allocs));
+}
+
+int main(void)
+{
+    RUN_TEST(test_wrap);
+    RUN_TEST(test_capture);
+    RUN_TEST(test_capture_resampled);
+    RUN_TEST(test_voice_communication);
+    return TEST_RESULT();
+}
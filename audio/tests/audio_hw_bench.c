@@ -0,0 +1,429 @@
+/*
+ * Copyright (C) 2017 The LineageOS Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Runs the HAL on the fake tinyalsa with the cadence of AudioFlinger: one
+ * blocking write or read of the stream buffer size at a time, while the
+ * routing is switched from another thread, and reports
+ *  - the time adev_open() takes with and without route cache,
+ *  - the process CPU time per second of audio,
+ *  - the PCM transfers and the times they waited for the clock,
+ *  - a histogram of the time spent in write() and read(),
+ *  - the time and mixer writes of each route switch,
+ *  - the CPU time of VoIP capture through AEC and NS stub effects, with the
+ *    echo reference taken from a low latency output playing meanwhile.
+ *
+ * usage: audio_hw_bench [-t seconds] [-w us per mixer write] [-r switches per second]
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "audio_hw_host.h"
+#include "audio_test.h"
+#include "stub_effect.h"
+
+#define HIST_BUCKETS    10      /* 250 us, doubling, the last one open */
+
+struct latency_hist {
+    unsigned int count[HIST_BUCKETS];
+    unsigned int total;
+    int64_t sum_ns;
+    int64_t max_ns;
+};
+
+struct bench {
+    struct audio_hw_device *dev;
+    struct audio_stream_out *out;
+    double seconds;
+    size_t out_bytes;
+    unsigned int switch_hz;
+    bool stop;
+};
+
+static void hist_add(struct latency_hist *hist, int64_t ns)
+{
+    int64_t limit = 250000;
+    unsigned int i;
+
+    for (i = 0; i < HIST_BUCKETS - 1 && ns >= limit; i++)
+        limit *= 2;
+    hist->count[i]++;
+    hist->total++;
+    hist->sum_ns += ns;
+    if (ns > hist->max_ns)
+        hist->max_ns = ns;
+}
+
+static void hist_print(const char *name, const struct latency_hist *hist)
+{
+    int64_t limit = 250000;
+    unsigned int i;
+
+    if (!hist->total)
+        return;
+
+    printf("  %s: %u calls, mean %.3f ms, max %.3f ms\n", name, hist->total,
+           hist->sum_ns / 1e6 / hist->total, hist->max_ns / 1e6);
+    for (i = 0; i < HIST_BUCKETS; i++, limit *= 2) {
+        if (!hist->count[i])
+            continue;
+        if (i < HIST_BUCKETS - 1)
+            printf("    < %7.3f ms: %u\n", limit / 1e6, hist->count[i]);
+        else
+            printf("    >= %6.3f ms: %u\n", limit / 2e6, hist->count[i]);
+    }
+}
+
+/* prints the PCM statistics since the previous call */
+static void print_pcm(const char *name, unsigned int device, unsigned int flags,
+                      double seconds, struct fake_pcm_stats *last)
+{
+    struct fake_pcm_stats stats;
+
+    fake_pcm_get_stats(HOST_CARD_DEFAULT, device, flags, &stats);
+    printf("  %s PCM: %u opens, %u transfers, %.1f waits/s, %u xruns\n", name,
+           stats.opens - last->opens, stats.transfers - last->transfers,
+           (stats.wakeups - last->wakeups) / seconds, stats.xruns - last->xruns);
+    *last = stats;
+}
+
+static void bench_open(void)
+{
+    struct audio_hw_device *dev;
+    int64_t start;
+    int i;
+
+    printf("adev_open\n");
+    for (i = 0; i < 2; i++) {
+        start = test_now_ns();
+        if (audio_hw_host_open(&dev, i > 0) != 0) {
+            printf("  cannot open the HAL\n");
+            return;
+        }
+        printf("  %s route cache: %.3f ms, %u mixer writes\n", i ? "with" : "without",
+               (test_now_ns() - start) / 1e6, fake_mixer_get_num_writes());
+        audio_hw_host_close(dev);
+    }
+}
+
+static void *routing_thread(void *context)
+{
+    static const audio_devices_t routes[] = {
+        AUDIO_DEVICE_OUT_WIRED_HEADPHONE,
+        AUDIO_DEVICE_OUT_EARPIECE,
+        AUDIO_DEVICE_OUT_SPEAKER,
+    };
+    static const char * const names[] = { "headphone", "earpiece", "speaker" };
+    struct bench *b = context;
+    struct latency_hist hist[3];
+    unsigned int writes[3] = { 0 };
+    char kvpairs[32];
+    unsigned int i = 0, n;
+    int64_t start;
+
+    memset(hist, 0, sizeof(hist));
+    while (!__atomic_load_n(&b->stop, __ATOMIC_ACQUIRE)) {
+        usleep(1000000 / b->switch_hz);
+        snprintf(kvpairs, sizeof(kvpairs), "%s=%u", AUDIO_PARAMETER_STREAM_ROUTING, routes[i]);
+        n = fake_mixer_get_num_writes();
+        start = test_now_ns();
+        b->out->common.set_parameters(&b->out->common, kvpairs);
+        hist_add(&hist[i], test_now_ns() - start);
+        writes[i] += fake_mixer_get_num_writes() - n;
+        i = (i + 1) % 3;
+    }
+
+    for (i = 0; i < 3; i++) {
+        if (!hist[i].total)
+            continue;
+        printf("  switch to %s: %.1f mixer writes\n", names[i],
+               (double)writes[i] / hist[i].total);
+        hist_print("  set_parameters", &hist[i]);
+    }
+    return NULL;
+}
+
+static void bench_playback(struct bench *b, bool routing)
+{
+    struct audio_config config = { .sample_rate = 0, };
+    struct audio_stream_out *out;
+    struct latency_hist hist = { { 0 }, 0, 0, 0 };
+    struct audio_hw_host_tone tone = { 1000, 8000 };
+    struct fake_pcm_stats stats;
+    pthread_t thread;
+    int16_t *buf;
+    size_t bytes, frames;
+    uint64_t total = 0;
+    int64_t cpu, start;
+    double seconds;
+
+    printf("playback%s\n", routing ? " with route switches" : "");
+    if (b->dev->open_output_stream(b->dev, 0, AUDIO_DEVICE_OUT_SPEAKER,
+                                   AUDIO_OUTPUT_FLAG_PRIMARY | AUDIO_OUTPUT_FLAG_DEEP_BUFFER,
+                                   &config, &out) != 0) {
+        printf("  cannot open the output\n");
+        return;
+    }
+
+    bytes = out->common.get_buffer_size(&out->common);
+    frames = bytes / audio_stream_out_frame_size(&out->common);
+    buf = malloc(bytes);
+    audio_hw_host_tone_source(&tone, buf, frames, 2, config.sample_rate, 0);
+
+    fake_pcm_get_stats(HOST_CARD_DEFAULT, HOST_PORT_PLAYBACK, PCM_OUT, &stats);
+    if (routing) {
+        b->out = out;
+        b->stop = false;
+        pthread_create(&thread, NULL, routing_thread, b);
+    }
+
+    cpu = test_cpu_ns();
+    start = test_now_ns();
+    while (total < b->seconds * config.sample_rate) {
+        int64_t t = test_now_ns();
+
+        if (out->write(out, buf, bytes) < 0)
+            break;
+        hist_add(&hist, test_now_ns() - t);
+        total += frames;
+    }
+    cpu = test_cpu_ns() - cpu;
+    seconds = (test_now_ns() - start) / 1e9;
+
+    if (routing) {
+        __atomic_store_n(&b->stop, true, __ATOMIC_RELEASE);
+        pthread_join(thread, NULL);
+    }
+
+    printf("  %zu frames per write, %.2f s of audio in %.2f s\n", frames,
+           (double)total / config.sample_rate, seconds);
+    printf("  CPU: %.2f ms per second of audio\n", cpu / 1e6 / ((double)total / config.sample_rate));
+    print_pcm("playback", HOST_PORT_PLAYBACK, PCM_OUT, seconds, &stats);
+    hist_print("write", &hist);
+
+    b->dev->close_output_stream(b->dev, out);
+    free(buf);
+}
+
+static void bench_capture(struct bench *b, audio_source_t source, const char *name)
+{
+    struct audio_config config = {
+        .sample_rate = 16000,
+        .channel_mask = AUDIO_CHANNEL_IN_STEREO,
+        .format = AUDIO_FORMAT_PCM_16_BIT,
+    };
+    struct audio_hw_host_tone tone = { 440, 4000 };
+    struct latency_hist hist = { { 0 }, 0, 0, 0 };
+    struct audio_stream_in *in;
+    struct fake_pcm_stats stats;
+    char kvpairs[32];
+    int16_t *buf;
+    size_t bytes, frames;
+    uint64_t total = 0;
+    int64_t cpu, start;
+    double seconds;
+
+    printf("capture, %s\n", name);
+    fake_pcm_set_source(HOST_CARD_DEFAULT, HOST_PORT_CAPTURE, audio_hw_host_tone_source, &tone);
+    if (b->dev->open_input_stream(b->dev, 0, AUDIO_DEVICE_IN_BUILTIN_MIC, &config, &in) != 0) {
+        printf("  cannot open the input\n");
+        return;
+    }
+    snprintf(kvpairs, sizeof(kvpairs), "%s=%d", AUDIO_PARAMETER_STREAM_INPUT_SOURCE, source);
+    in->common.set_parameters(&in->common, kvpairs);
+
+    bytes = in->common.get_buffer_size(&in->common);
+    frames = bytes / audio_stream_in_frame_size(&in->common);
+    buf = malloc(bytes);
+
+    fake_pcm_get_stats(HOST_CARD_DEFAULT, HOST_PORT_CAPTURE, PCM_IN, &stats);
+    cpu = test_cpu_ns();
+    start = test_now_ns();
+    while (total < b->seconds * config.sample_rate) {
+        int64_t t = test_now_ns();
+
+        if (in->read(in, buf, bytes) < 0)
+            break;
+        hist_add(&hist, test_now_ns() - t);
+        total += frames;
+    }
+    cpu = test_cpu_ns() - cpu;
+    seconds = (test_now_ns() - start) / 1e9;
+
+    printf("  %zu frames per read at %u Hz, %.2f s of audio in %.2f s\n", frames,
+           config.sample_rate, (double)total / config.sample_rate, seconds);
+    printf("  CPU: %.2f ms per second of audio\n", cpu / 1e6 / ((double)total / config.sample_rate));
+    print_pcm("capture", HOST_PORT_CAPTURE, PCM_IN, seconds, &stats);
+    hist_print("read", &hist);
+
+    b->dev->close_input_stream(b->dev, in);
+    free(buf);
+}
+
+static void *playback_thread(void *context)
+{
+    struct bench *b = context;
+    struct audio_hw_host_tone tone = { 1000, 8000 };
+    size_t frames = b->out_bytes / audio_stream_out_frame_size(&b->out->common);
+    int16_t *buf = malloc(b->out_bytes);
+
+    audio_hw_host_tone_source(&tone, buf, frames, 2,
+                              b->out->common.get_sample_rate(&b->out->common), 0);
+    while (!__atomic_load_n(&b->stop, __ATOMIC_ACQUIRE)) {
+        if (b->out->write(b->out, buf, b->out_bytes) < 0)
+            break;
+    }
+    free(buf);
+    return NULL;
+}
+
+/* the preprocessing stubs cost next to nothing, what is measured is the HAL:
+ * capture, resampling, staging rings and echo reference */
+static void bench_voip(struct bench *b)
+{
+    struct audio_config out_config = { .sample_rate = 0, };
+    struct audio_config config = {
+        .sample_rate = 16000,
+        .channel_mask = AUDIO_CHANNEL_IN_STEREO,
+        .format = AUDIO_FORMAT_PCM_16_BIT,
+    };
+    struct audio_hw_host_tone tone = { 440, 4000 };
+    struct latency_hist hist = { { 0 }, 0, 0, 0 };
+    struct stub_effect aec, ns;
+    struct audio_stream_in *in;
+    char kvpairs[32];
+    pthread_t thread;
+    int16_t *buf;
+    size_t bytes, frames;
+    uint64_t total = 0;
+    int64_t cpu, start;
+    double seconds;
+
+    printf("capture, voice communication with AEC and NS\n");
+    if (b->dev->open_output_stream(b->dev, 0, AUDIO_DEVICE_OUT_SPEAKER,
+                                   AUDIO_OUTPUT_FLAG_PRIMARY, &out_config, &b->out) != 0) {
+        printf("  cannot open the output\n");
+        return;
+    }
+    b->out_bytes = b->out->common.get_buffer_size(&b->out->common);
+    b->stop = false;
+    pthread_create(&thread, NULL, playback_thread, b);
+    /* out of standby before the input asks for the echo reference */
+    usleep(50000);
+
+    fake_pcm_set_source(HOST_CARD_DEFAULT, HOST_PORT_CAPTURE, audio_hw_host_tone_source, &tone);
+    if (b->dev->open_input_stream(b->dev, 0, AUDIO_DEVICE_IN_BUILTIN_MIC, &config, &in) != 0) {
+        printf("  cannot open the input\n");
+        goto stop_playback;
+    }
+    snprintf(kvpairs, sizeof(kvpairs), "%s=%d", AUDIO_PARAMETER_STREAM_INPUT_SOURCE,
+             AUDIO_SOURCE_VOICE_COMMUNICATION);
+    in->common.set_parameters(&in->common, kvpairs);
+    stub_effect_init(&aec, FX_IID_AEC, 0, 2);
+    stub_effect_init(&ns, FX_IID_NS, 1, 2);
+    in->common.add_audio_effect(&in->common, stub_effect_handle(&aec));
+    in->common.add_audio_effect(&in->common, stub_effect_handle(&ns));
+
+    bytes = in->common.get_buffer_size(&in->common);
+    frames = bytes / audio_stream_in_frame_size(&in->common);
+    buf = malloc(bytes);
+
+    cpu = test_cpu_ns();
+    start = test_now_ns();
+    while (total < b->seconds * config.sample_rate) {
+        int64_t t = test_now_ns();
+
+        if (in->read(in, buf, bytes) < 0)
+            break;
+        hist_add(&hist, test_now_ns() - t);
+        total += frames;
+    }
+    cpu = test_cpu_ns() - cpu;
+    seconds = (test_now_ns() - start) / 1e9;
+
+    printf("  %zu frames per read at %u Hz, %.2f s of audio in %.2f s\n", frames,
+           config.sample_rate, (double)total / config.sample_rate, seconds);
+    printf("  CPU: %.2f ms per second of audio, playback included\n",
+           cpu / 1e6 / ((double)total / config.sample_rate));
+    printf("  AEC: %u process calls, %llu frames, %llu reference frames, "
+           "%u echo delay updates\n", aec.process_calls, (unsigned long long)aec.frames_out,
+           (unsigned long long)aec.reverse_frames, aec.set_param_calls);
+    printf("  NS: %u process calls, %llu frames\n", ns.process_calls,
+           (unsigned long long)ns.frames_out);
+    hist_print("read", &hist);
+
+    in->common.remove_audio_effect(&in->common, stub_effect_handle(&ns));
+    in->common.remove_audio_effect(&in->common, stub_effect_handle(&aec));
+    b->dev->close_input_stream(b->dev, in);
+    free(buf);
+
+stop_playback:
+    __atomic_store_n(&b->stop, true, __ATOMIC_RELEASE);
+    pthread_join(thread, NULL);
+    b->dev->close_output_stream(b->dev, b->out);
+}
+
+int main(int argc, char **argv)
+{
+    struct bench b = { .seconds = 2, .switch_hz = 10, };
+    unsigned int write_us = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "t:w:r:")) != -1) {
+        switch (opt) {
+        case 't':
+            b.seconds = atof(optarg);
+            break;
+        case 'w':
+            write_us = atoi(optarg);
+            break;
+        case 'r':
+            b.switch_hz = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-t seconds] [-w us per mixer write] "
+                    "[-r switches per second]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (b.seconds <= 0 || b.switch_hz == 0) {
+        fprintf(stderr, "%s: invalid duration or switch rate\n", argv[0]);
+        return 1;
+    }
+
+    bench_open();
+
+    if (audio_hw_host_open(&b.dev, true) != 0) {
+        fprintf(stderr, "%s: cannot open the HAL\n", argv[0]);
+        return 1;
+    }
+    fake_mixer_set_write_delay_us(write_us);
+
+    bench_playback(&b, false);
+    bench_playback(&b, true);
+    bench_capture(&b, AUDIO_SOURCE_MIC, "mic");
+    bench_capture(&b, AUDIO_SOURCE_VOICE_COMMUNICATION, "voice communication");
+    bench_voip(&b);
+
+    audio_hw_host_close(b.dev);
+    return 0;
+}
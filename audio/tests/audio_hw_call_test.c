@@ -0,0 +1,571 @@
+/*
+ * Copyright (C) 2017 The LineageOS Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Drives select_mode() through calls on the fake tinyalsa and the fake RIL
+ * client: the call audio setup, the commands the modem receives and their
+ * order, the wideband AMR switches the modem pushes and the audio gap they
+ * cause, and the recording of the call through the voice sources, which
+ * never share the capture PCM with a regular input.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "audio_hw_host.h"
+#include "audio_test.h"
+#include "fake_secril_client.h"
+
+#define RIL_SLOW_US         100000
+#define PCM_OPEN_US         10000   /* a slow driver, so that the gap shows */
+/* constant levels on the microphone and the modem downlink, so that the
+ * taps can be told apart after resampling */
+#define MIC_LEVEL           1000
+#define DOWNLINK_LEVEL      (-3000)
+
+static unsigned int ril_latency_us;
+
+struct call_test {
+    struct audio_hw_device *dev;
+    struct audio_stream_out *out;
+};
+
+static int call_test_open(struct call_test *t)
+{
+    struct audio_config config = { .sample_rate = 0, };
+
+    fake_secril_reset();
+    ril_latency_us = 0;
+    if (audio_hw_host_open(&t->dev, false) != 0)
+        return -1;
+    if (t->dev->open_output_stream(t->dev, 0, AUDIO_DEVICE_OUT_SPEAKER,
+                                   AUDIO_OUTPUT_FLAG_PRIMARY | AUDIO_OUTPUT_FLAG_DEEP_BUFFER,
+                                   &config, &t->out) != 0) {
+        audio_hw_host_close(t->dev);
+        return -1;
+    }
+    return 0;
+}
+
+static void call_test_close(struct call_test *t)
+{
+    t->dev->close_output_stream(t->dev, t->out);
+    audio_hw_host_close(t->dev);
+}
+
+static void set_routing(struct call_test *t, audio_devices_t device)
+{
+    char kvpairs[32];
+
+    snprintf(kvpairs, sizeof(kvpairs), "%s=%u", AUDIO_PARAMETER_STREAM_ROUTING, device);
+    t->out->common.set_parameters(&t->out->common, kvpairs);
+}
+
+static void set_ril_latency(unsigned int us)
+{
+    ril_latency_us = us;
+    fake_secril_set_latency_us(us);
+}
+
+/* wait until the RIL worker has sent everything */
+static void wait_ril_idle(void)
+{
+    unsigned int n, stable = 0;
+
+    n = fake_secril_get_num_calls();
+    while (stable < 3) {
+        usleep(ril_latency_us + 10000);
+        if (fake_secril_get_num_calls() == n) {
+            stable++;
+        } else {
+            n = fake_secril_get_num_calls();
+            stable = 0;
+        }
+    }
+}
+
+/* index of the first call of this type and first argument at or after
+ * from, -1 if none */
+static int find_call(enum ril_cmd_type type, int arg1, unsigned int from)
+{
+    struct fake_secril_call c;
+    unsigned int i;
+
+    for (i = from; fake_secril_get_call(i, &c); i++) {
+        if (c.type == type && c.arg1 == arg1)
+            return i;
+    }
+    return -1;
+}
+
+static unsigned int count_calls(enum ril_cmd_type type)
+{
+    struct fake_secril_call c;
+    unsigned int i, n = 0;
+
+    for (i = 0; fake_secril_get_call(i, &c); i++) {
+        if (c.type == type)
+            n++;
+    }
+    return n;
+}
+
+static void test_call_setup(void)
+{
+    struct call_test t;
+    struct fake_pcm_stats dl, ul;
+    int path, clock;
+
+    ASSERT_EQ(0, call_test_open(&t));
+    set_routing(&t, AUDIO_DEVICE_OUT_SPEAKER);
+    wait_ril_idle();
+    fake_secril_clear_calls();
+
+    t.dev->set_mode(t.dev, AUDIO_MODE_IN_CALL);
+    set_routing(&t, AUDIO_DEVICE_OUT_EARPIECE);
+    wait_ril_idle();
+
+    /* the speaker route of the ringtone is replaced by the earpiece */
+    EXPECT_EQ(0, fake_mixer_get_value("SPK Switch"));
+    EXPECT_EQ(1, fake_mixer_get_value("RCV Switch"));
+
+    fake_pcm_get_stats(HOST_CARD_DEFAULT, HOST_PORT_MODEM, PCM_OUT, &dl);
+    fake_pcm_get_stats(HOST_CARD_DEFAULT, HOST_PORT_MODEM, PCM_IN, &ul);
+    EXPECT_TRUE(dl.open);
+    EXPECT_TRUE(ul.open);
+    EXPECT_EQ(8000, dl.config.rate);
+
+    /* the modem gets the path before its clock is started */
+    path = find_call(RIL_CMD_CALL_AUDIO_PATH, SOUND_AUDIO_PATH_HANDSET, 0);
+    clock = find_call(RIL_CMD_CALL_CLOCK_SYNC, SOUND_CLOCK_START, 0);
+    EXPECT_TRUE(path >= 0);
+    EXPECT_TRUE(clock > path);
+    EXPECT_EQ(1, count_calls(RIL_CMD_CALL_VOLUME));
+
+    fake_secril_clear_calls();
+    t.dev->set_mode(t.dev, AUDIO_MODE_NORMAL);
+    wait_ril_idle();
+    EXPECT_TRUE(find_call(RIL_CMD_CALL_CLOCK_SYNC, SOUND_CLOCK_STOP, 0) >= 0);
+    fake_pcm_get_stats(HOST_CARD_DEFAULT, HOST_PORT_MODEM, PCM_OUT, &dl);
+    EXPECT_TRUE(!dl.open);
+
+    call_test_close(&t);
+}
+
+/* a slow RIL does not hold the mode change, and what is queued behind it
+ * reaches the modem in order */
+static void test_slow_ril(void)
+{
+    struct call_test t;
+    int64_t start, ns;
+    int to_speaker, mute, to_earpiece;
+    int i;
+
+    ASSERT_EQ(0, call_test_open(&t));
+    wait_ril_idle();
+    set_ril_latency(RIL_SLOW_US);
+    fake_secril_clear_calls();
+
+    start = test_now_ns();
+    t.dev->set_mode(t.dev, AUDIO_MODE_IN_CALL);
+    ns = test_now_ns() - start;
+    fprintf(stderr, "  call setup: %.3f ms with %u us RIL calls\n", ns / 1e6, RIL_SLOW_US);
+    EXPECT_TRUE(ns < RIL_SLOW_US * 1000LL);
+
+    set_routing(&t, AUDIO_DEVICE_OUT_SPEAKER);
+    t.dev->set_mic_mute(t.dev, true);
+    set_routing(&t, AUDIO_DEVICE_OUT_EARPIECE);
+    for (i = 1; i <= 10; i++)
+        t.dev->set_voice_volume(t.dev, i / 10.0f);
+    wait_ril_idle();
+
+    to_speaker = find_call(RIL_CMD_CALL_AUDIO_PATH, SOUND_AUDIO_PATH_SPEAKER, 0);
+    mute = find_call(RIL_CMD_MIC_MUTE, MIC_MUTE, 0);
+    to_earpiece = to_speaker >= 0 ?
+            find_call(RIL_CMD_CALL_AUDIO_PATH, SOUND_AUDIO_PATH_HANDSET, to_speaker) : -1;
+    EXPECT_TRUE(to_speaker >= 0);
+    EXPECT_TRUE(mute > to_speaker);
+    EXPECT_TRUE(to_earpiece > mute);
+
+    /* the volume steps queued back to back collapse, the last one wins */
+    EXPECT_TRUE(count_calls(RIL_CMD_CALL_VOLUME) < 5);
+
+    set_ril_latency(0);
+    t.dev->set_mode(t.dev, AUDIO_MODE_NORMAL);
+    wait_ril_idle();
+    call_test_close(&t);
+}
+
+/* the modem switches to wideband AMR during the call */
+static void test_wb_amr_switch(void)
+{
+    struct call_test t;
+    struct fake_pcm_stats dl;
+
+    ASSERT_EQ(0, call_test_open(&t));
+    t.dev->set_mode(t.dev, AUDIO_MODE_IN_CALL);
+    set_routing(&t, AUDIO_DEVICE_OUT_EARPIECE);
+    wait_ril_idle();
+
+    fake_pcm_get_stats(HOST_CARD_DEFAULT, HOST_PORT_MODEM, PCM_OUT, &dl);
+    EXPECT_EQ(8000, dl.config.rate);
+
+    ASSERT_EQ(0, fake_secril_send_wb_amr(1));
+    fake_pcm_get_stats(HOST_CARD_DEFAULT, HOST_PORT_MODEM, PCM_OUT, &dl);
+    EXPECT_TRUE(dl.open);
+    EXPECT_EQ(16000, dl.config.rate);
+
+    ASSERT_EQ(0, fake_secril_send_wb_amr(0));
+    fake_pcm_get_stats(HOST_CARD_DEFAULT, HOST_PORT_MODEM, PCM_OUT, &dl);
+    EXPECT_EQ(8000, dl.config.rate);
+
+    t.dev->set_mode(t.dev, AUDIO_MODE_NORMAL);
+    wait_ril_idle();
+    call_test_close(&t);
+}
+
+/* how long the PCM was stopped for by the last rate switch */
+static int64_t pcm_gap_us(unsigned int port, unsigned int flags)
+{
+    struct fake_pcm_stats stats;
+
+    fake_pcm_get_stats(HOST_CARD_DEFAULT, port, flags, &stats);
+    return ((stats.started.tv_sec - stats.stopped.tv_sec) * 1000000000LL +
+            stats.started.tv_nsec - stats.stopped.tv_nsec) / 1000;
+}
+
+static unsigned int pcm_opens(unsigned int port, unsigned int flags)
+{
+    struct fake_pcm_stats stats;
+
+    fake_pcm_get_stats(HOST_CARD_DEFAULT, port, flags, &stats);
+    return stats.opens;
+}
+
+/* a rate switch in the call only reopens the PCMs whose rate changed: the
+ * mixer and the modem are left alone, and the voice stops for about the time
+ * the driver takes to open the PCM pair */
+static void test_rate_switch_gap(void)
+{
+    struct call_test t;
+    struct fake_pcm_stats dl, bt;
+    unsigned int modem_opens, bt_opens;
+    int64_t gap;
+
+    ASSERT_EQ(0, call_test_open(&t));
+    fake_pcm_set_open_delay_us(HOST_CARD_DEFAULT, HOST_PORT_MODEM, PCM_OPEN_US);
+    fake_pcm_set_open_delay_us(HOST_CARD_DEFAULT, HOST_PORT_BT, PCM_OPEN_US);
+    t.dev->set_mode(t.dev, AUDIO_MODE_IN_CALL);
+    set_routing(&t, AUDIO_DEVICE_OUT_EARPIECE);
+    wait_ril_idle();
+
+    modem_opens = pcm_opens(HOST_PORT_MODEM, PCM_OUT);
+    fake_mixer_clear_writes();
+    fake_secril_clear_calls();
+    ASSERT_EQ(0, fake_secril_send_wb_amr(1));
+    wait_ril_idle();
+
+    fake_pcm_get_stats(HOST_CARD_DEFAULT, HOST_PORT_MODEM, PCM_OUT, &dl);
+    EXPECT_TRUE(dl.open);
+    EXPECT_EQ(16000, dl.config.rate);
+    EXPECT_EQ(modem_opens + 1, dl.opens);
+    EXPECT_EQ(modem_opens + 1, pcm_opens(HOST_PORT_MODEM, PCM_IN));
+    EXPECT_EQ(0, fake_mixer_get_num_writes());
+    EXPECT_EQ(0, fake_secril_get_num_calls());
+
+    gap = pcm_gap_us(HOST_PORT_MODEM, PCM_OUT);
+    if (pcm_gap_us(HOST_PORT_MODEM, PCM_IN) > gap)
+        gap = pcm_gap_us(HOST_PORT_MODEM, PCM_IN);
+    fprintf(stderr, "  modem gap: %lld us with %u us PCM opens\n", (long long)gap, PCM_OPEN_US);
+    EXPECT_TRUE(gap < 3 * PCM_OPEN_US);
+
+    /* on bluetooth the rate follows the headset, not the modem */
+    t.dev->set_mode(t.dev, AUDIO_MODE_NORMAL);
+    set_routing(&t, AUDIO_DEVICE_OUT_BLUETOOTH_SCO);
+    t.dev->set_mode(t.dev, AUDIO_MODE_IN_CALL);
+    wait_ril_idle();
+    fake_pcm_get_stats(HOST_CARD_DEFAULT, HOST_PORT_BT, PCM_OUT, &bt);
+    EXPECT_TRUE(bt.open);
+    EXPECT_EQ(8000, bt.config.rate);
+
+    modem_opens = pcm_opens(HOST_PORT_MODEM, PCM_OUT);
+    bt_opens = pcm_opens(HOST_PORT_BT, PCM_OUT);
+    fake_mixer_clear_writes();
+    ASSERT_EQ(0, fake_secril_send_wb_amr(0));
+    EXPECT_EQ(modem_opens, pcm_opens(HOST_PORT_MODEM, PCM_OUT));
+    EXPECT_EQ(bt_opens, pcm_opens(HOST_PORT_BT, PCM_OUT));
+
+    t.dev->set_parameters(t.dev, AUDIO_PARAMETER_KEY_BT_SCO_WB "=" AUDIO_PARAMETER_VALUE_ON);
+    fake_pcm_get_stats(HOST_CARD_DEFAULT, HOST_PORT_BT, PCM_OUT, &bt);
+    fake_pcm_get_stats(HOST_CARD_DEFAULT, HOST_PORT_MODEM, PCM_OUT, &dl);
+    EXPECT_EQ(16000, bt.config.rate);
+    EXPECT_EQ(16000, dl.config.rate);
+    EXPECT_EQ(bt_opens + 1, bt.opens);
+    EXPECT_EQ(modem_opens + 1, dl.opens);
+    EXPECT_EQ(0, fake_mixer_get_num_writes());
+
+    gap = pcm_gap_us(HOST_PORT_BT, PCM_OUT);
+    fprintf(stderr, "  bluetooth gap: %lld us\n", (long long)gap);
+    EXPECT_TRUE(gap < 3 * PCM_OPEN_US);
+
+    t.dev->set_parameters(t.dev, AUDIO_PARAMETER_KEY_BT_SCO_WB "=" AUDIO_PARAMETER_VALUE_OFF);
+    t.dev->set_mode(t.dev, AUDIO_MODE_NORMAL);
+    wait_ril_idle();
+    fake_pcm_set_open_delay_us(HOST_CARD_DEFAULT, HOST_PORT_MODEM, 0);
+    fake_pcm_set_open_delay_us(HOST_CARD_DEFAULT, HOST_PORT_BT, 0);
+    call_test_close(&t);
+}
+
+/* a call starting while the modem is already on wideband AMR */
+static void test_wb_amr_before_call(void)
+{
+    struct call_test t;
+    struct fake_pcm_stats dl;
+
+    ASSERT_EQ(0, call_test_open(&t));
+    ASSERT_EQ(0, fake_secril_send_wb_amr(1));
+    t.dev->set_mode(t.dev, AUDIO_MODE_IN_CALL);
+    wait_ril_idle();
+
+    fake_pcm_get_stats(HOST_CARD_DEFAULT, HOST_PORT_MODEM, PCM_OUT, &dl);
+    EXPECT_EQ(16000, dl.config.rate);
+
+    t.dev->set_mode(t.dev, AUDIO_MODE_NORMAL);
+    wait_ril_idle();
+    call_test_close(&t);
+}
+
+/* the AP capture interface of the codec: each AIF1ADC1 channel mixes the
+ * microphone and the AIF2 downlink from the modem as the mixer says */
+static void codec_capture_source(void *context, int16_t *buf, unsigned int frames,
+                                 unsigned int channels, unsigned int rate, uint64_t pos)
+{
+    static const char * const adc[] = {
+        "AIF1ADC1L Mixer ADC/DMIC Switch", "AIF1ADC1R Mixer ADC/DMIC Switch",
+    };
+    static const char * const aif2[] = {
+        "AIF1ADC1L Mixer AIF2 Switch", "AIF1ADC1R Mixer AIF2 Switch",
+    };
+    int16_t level[2];
+    unsigned int i, c;
+
+    for (c = 0; c < 2; c++) {
+        level[c] = (fake_mixer_peek(adc[c]) == 1 ? MIC_LEVEL : 0) +
+                   (fake_mixer_peek(aif2[c]) == 1 ? DOWNLINK_LEVEL : 0);
+    }
+    for (i = 0; i < frames; i++) {
+        for (c = 0; c < channels; c++)
+            *buf++ = level[c % 2];
+    }
+}
+
+static int open_source(struct call_test *t, audio_source_t source, unsigned int rate,
+                       struct audio_stream_in **in)
+{
+    struct audio_config config = {
+        .sample_rate = rate,
+        .channel_mask = AUDIO_CHANNEL_IN_STEREO,
+        .format = AUDIO_FORMAT_PCM_16_BIT,
+    };
+    char kvpairs[32];
+
+    if (t->dev->open_input_stream(t->dev, 0, AUDIO_DEVICE_IN_BUILTIN_MIC, &config, in) != 0)
+        return -1;
+    snprintf(kvpairs, sizeof(kvpairs), "%s=%d", AUDIO_PARAMETER_STREAM_INPUT_SOURCE, source);
+    (*in)->common.set_parameters(&(*in)->common, kvpairs);
+    return 0;
+}
+
+/* reads for duration_ms, returns the mean of each channel over the last
+ * read */
+static int read_mean(struct audio_stream_in *in, unsigned int duration_ms, int *left,
+                     int *right)
+{
+    unsigned int rate = in->common.get_sample_rate(&in->common);
+    size_t bytes = in->common.get_buffer_size(&in->common);
+    size_t frames = bytes / audio_stream_in_frame_size(&in->common);
+    int16_t *buf = malloc(bytes);
+    int64_t sum[2] = { 0, 0 };
+    size_t done, i;
+    int ret = 0;
+
+    for (done = 0; done < rate * duration_ms / 1000 && ret == 0; done += frames) {
+        if (in->read(in, buf, bytes) <= 0)
+            ret = -1;
+    }
+    for (i = 0; i < frames; i++) {
+        sum[0] += buf[i * 2];
+        sum[1] += buf[i * 2 + 1];
+    }
+    *left = (int)(sum[0] / (int64_t)frames);
+    *right = (int)(sum[1] / (int64_t)frames);
+
+    free(buf);
+    return ret;
+}
+
+/* records 300 ms from the source, returns the mean of each channel over the
+ * last read */
+static int record(struct call_test *t, audio_source_t source, unsigned int rate,
+                  int *left, int *right)
+{
+    struct audio_stream_in *in;
+    int ret;
+
+    if (open_source(t, source, rate, &in) != 0)
+        return -1;
+    ret = read_mean(in, 300, left, right);
+    t->dev->close_input_stream(t->dev, in);
+    return ret;
+}
+
+static bool near(int expected, int actual)
+{
+    return abs(actual - expected) <= abs(expected) / 20 + 10;
+}
+
+/* each voice source records its side of the call, or both, at 8 and 16 kHz,
+ * and the capture route is restored when the recording stops */
+static void test_voice_taps(void)
+{
+    static const struct {
+        audio_source_t source;
+        int level;
+    } taps[] = {
+        { AUDIO_SOURCE_VOICE_UPLINK, MIC_LEVEL },
+        { AUDIO_SOURCE_VOICE_DOWNLINK, DOWNLINK_LEVEL },
+        { AUDIO_SOURCE_VOICE_CALL, (MIC_LEVEL + DOWNLINK_LEVEL) / 2 },
+    };
+    static const unsigned int rates[] = { 8000, 16000 };
+    struct call_test t;
+    unsigned int i, r;
+    int left, right;
+
+    ASSERT_EQ(0, call_test_open(&t));
+    fake_pcm_set_source(HOST_CARD_DEFAULT, HOST_PORT_CAPTURE, codec_capture_source, NULL);
+    t.dev->set_mode(t.dev, AUDIO_MODE_IN_CALL);
+    set_routing(&t, AUDIO_DEVICE_OUT_EARPIECE);
+    wait_ril_idle();
+
+    for (i = 0; i < sizeof(taps) / sizeof(taps[0]); i++) {
+        for (r = 0; r < sizeof(rates) / sizeof(rates[0]); r++) {
+            ASSERT_EQ(0, record(&t, taps[i].source, rates[r], &left, &right));
+            if (!near(taps[i].level, left) || !near(taps[i].level, right))
+                fprintf(stderr, "  source %d at %u Hz: %d %d, expected %d\n",
+                        taps[i].source, rates[r], left, right, taps[i].level);
+            EXPECT_TRUE(near(taps[i].level, left));
+            EXPECT_TRUE(near(taps[i].level, right));
+
+            EXPECT_EQ(1, fake_mixer_get_value("AIF1ADC1R Mixer ADC/DMIC Switch"));
+            EXPECT_EQ(0, fake_mixer_get_value("AIF1ADC1R Mixer AIF2 Switch"));
+        }
+    }
+
+    t.dev->set_mode(t.dev, AUDIO_MODE_NORMAL);
+    wait_ril_idle();
+    call_test_close(&t);
+}
+
+/* other sources during a call, and the voice sources out of a call, leave
+ * the capture route alone and get the microphone */
+static void test_no_tap(void)
+{
+    struct fake_mixer_write w;
+    struct call_test t;
+    unsigned int i;
+    int left, right;
+
+    ASSERT_EQ(0, call_test_open(&t));
+    fake_pcm_set_source(HOST_CARD_DEFAULT, HOST_PORT_CAPTURE, codec_capture_source, NULL);
+    t.dev->set_mode(t.dev, AUDIO_MODE_IN_CALL);
+    set_routing(&t, AUDIO_DEVICE_OUT_EARPIECE);
+    wait_ril_idle();
+
+    fake_mixer_clear_writes();
+    ASSERT_EQ(0, record(&t, AUDIO_SOURCE_MIC, 16000, &left, &right));
+    EXPECT_TRUE(near(MIC_LEVEL, left));
+    EXPECT_TRUE(near(MIC_LEVEL, right));
+    t.dev->set_mode(t.dev, AUDIO_MODE_NORMAL);
+    wait_ril_idle();
+
+    ASSERT_EQ(0, record(&t, AUDIO_SOURCE_VOICE_DOWNLINK, 16000, &left, &right));
+    EXPECT_TRUE(near(MIC_LEVEL, left));
+    EXPECT_TRUE(near(MIC_LEVEL, right));
+    /* the tap takes the microphone off the right channel */
+    for (i = 0; fake_mixer_get_write(i, &w); i++)
+        EXPECT_TRUE(strcmp(w.name, "AIF1ADC1R Mixer ADC/DMIC Switch") != 0 || w.value == 1);
+
+    call_test_close(&t);
+}
+
+/* a tap and a regular input never run together: the one started last
+ * records silence and the capture route stays as the first one set it */
+static void test_tap_conflict(void)
+{
+    struct audio_stream_in *first;
+    struct call_test t;
+    int left, right;
+
+    ASSERT_EQ(0, call_test_open(&t));
+    fake_pcm_set_source(HOST_CARD_DEFAULT, HOST_PORT_CAPTURE, codec_capture_source, NULL);
+    t.dev->set_mode(t.dev, AUDIO_MODE_IN_CALL);
+    set_routing(&t, AUDIO_DEVICE_OUT_EARPIECE);
+    wait_ril_idle();
+
+    ASSERT_EQ(0, open_source(&t, AUDIO_SOURCE_MIC, 16000, &first));
+    ASSERT_EQ(0, read_mean(first, 100, &left, &right));
+    ASSERT_EQ(0, record(&t, AUDIO_SOURCE_VOICE_DOWNLINK, 16000, &left, &right));
+    EXPECT_EQ(0, left);
+    EXPECT_EQ(0, right);
+    EXPECT_EQ(0, fake_mixer_get_value("AIF1ADC1R Mixer AIF2 Switch"));
+    ASSERT_EQ(0, read_mean(first, 100, &left, &right));
+    EXPECT_TRUE(near(MIC_LEVEL, left));
+    EXPECT_TRUE(near(MIC_LEVEL, right));
+    t.dev->close_input_stream(t.dev, first);
+
+    ASSERT_EQ(0, open_source(&t, AUDIO_SOURCE_VOICE_DOWNLINK, 16000, &first));
+    ASSERT_EQ(0, read_mean(first, 100, &left, &right));
+    ASSERT_EQ(0, record(&t, AUDIO_SOURCE_MIC, 16000, &left, &right));
+    EXPECT_EQ(0, left);
+    EXPECT_EQ(0, right);
+    ASSERT_EQ(0, read_mean(first, 100, &left, &right));
+    EXPECT_TRUE(near(DOWNLINK_LEVEL, left));
+    EXPECT_TRUE(near(DOWNLINK_LEVEL, right));
+    t.dev->close_input_stream(t.dev, first);
+
+    /* the refused source starts once it is alone */
+    ASSERT_EQ(0, record(&t, AUDIO_SOURCE_MIC, 16000, &left, &right));
+    EXPECT_TRUE(near(MIC_LEVEL, left));
+
+    t.dev->set_mode(t.dev, AUDIO_MODE_NORMAL);
+    wait_ril_idle();
+    call_test_close(&t);
+}
+
+int main(void)
+{
+    RUN_TEST(test_call_setup);
+    RUN_TEST(test_slow_ril);
+    RUN_TEST(test_wb_amr_switch);
+    RUN_TEST(test_wb_amr_before_call);
+    RUN_TEST(test_rate_switch_gap);
+    RUN_TEST(test_voice_taps);
+    RUN_TEST(test_no_tap);
+    RUN_TEST(test_tap_conflict);
+    return TEST_RESULT();
+}
@@ -0,0 +1,436 @@
+/*
+ * Copyright (C) 2017 The LineageOS Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Capture through the capture thread and the ring of the input on the fake
+ * tinyalsa. The microphone produces a counter, so every frame read tells
+ * where it was captured: reads on time get every frame, a late reader
+ * loses exactly what get_input_frames_lost() reports, and the capture
+ * position follows the capture clock. Several inputs at different rates
+ * share the PCM, which is read once for all of them. A hotword input in
+ * silence returns silence at the pace of its buffers, so that its client
+ * can stop it, and a regular input taking the microphone over does not
+ * leave it waiting.
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "audio_hw_host.h"
+#include "audio_test.h"
+
+#define RATE            44100   /* the driver rate, no resampling */
+#define LATE_MS         500     /* more than the ring and the driver buffer */
+#define RING_FRAMES     8192    /* CAPTURE_RING_FRAMES */
+#define READERS_MS      1500
+#define HOTWORD_RATE    16000
+
+static void counter_source(void *context, int16_t *buf, unsigned int frames,
+                           unsigned int channels, unsigned int rate, uint64_t pos)
+{
+    unsigned int i, c;
+
+    for (i = 0; i < frames; i++) {
+        for (c = 0; c < channels; c++)
+            *buf++ = (int16_t)(pos + i);
+    }
+}
+
+struct capture_test {
+    struct audio_hw_device *dev;
+    struct audio_stream_in *in;
+    int16_t *buf;
+    size_t frames;              /* per read */
+    uint16_t next;              /* counter value expected next */
+    uint64_t read;              /* frames read */
+};
+
+static int capture_test_open(struct capture_test *t)
+{
+    struct audio_config config = {
+        .sample_rate = RATE,
+        .channel_mask = AUDIO_CHANNEL_IN_STEREO,
+        .format = AUDIO_FORMAT_PCM_16_BIT,
+    };
+
+    memset(t, 0, sizeof(*t));
+    if (audio_hw_host_open(&t->dev, false) != 0)
+        return -1;
+    fake_pcm_set_source(HOST_CARD_DEFAULT, HOST_PORT_CAPTURE, counter_source, NULL);
+    if (t->dev->open_input_stream(t->dev, 0, AUDIO_DEVICE_IN_BUILTIN_MIC, &config,
+                                  &t->in) != 0) {
+        audio_hw_host_close(t->dev);
+        return -1;
+    }
+    t->frames = t->in->common.get_buffer_size(&t->in->common) /
+                audio_stream_in_frame_size(&t->in->common);
+    t->buf = malloc(t->frames * 2 * sizeof(int16_t));
+    return 0;
+}
+
+static void capture_test_close(struct capture_test *t)
+{
+    t->dev->close_input_stream(t->dev, t->in);
+    audio_hw_host_close(t->dev);
+    free(t->buf);
+}
+
+/* frames skipped in the counter before this buffer, -1 if it is not a
+ * sequence of identical stereo frames */
+static int read_buffer(struct capture_test *t)
+{
+    uint16_t first;
+    size_t i;
+    int skipped;
+
+    if (t->in->read(t->in, t->buf, t->frames * 2 * sizeof(int16_t)) <= 0)
+        return -1;
+    first = (uint16_t)t->buf[0];
+    for (i = 0; i < t->frames; i++) {
+        if ((uint16_t)t->buf[i * 2] != (uint16_t)(first + i) ||
+                t->buf[i * 2 + 1] != t->buf[i * 2])
+            return -1;
+    }
+    skipped = t->read == 0 ? 0 : (uint16_t)(first - t->next);
+    t->next = first + t->frames;
+    t->read += t->frames;
+    return skipped;
+}
+
+/* a reader on time gets every frame */
+static void test_continuous(void)
+{
+    struct capture_test t;
+    unsigned int i, gaps = 0;
+
+    ASSERT_EQ(0, capture_test_open(&t));
+    for (i = 0; i < RATE / t.frames; i++) {
+        if (read_buffer(&t) != 0)
+            gaps++;
+    }
+    EXPECT_EQ(0, gaps);
+    EXPECT_EQ(0, t.in->get_input_frames_lost(t.in));
+    capture_test_close(&t);
+}
+
+/* the capture goes on while the reader is away: the ring keeps the oldest
+ * frames, the ones that did not fit are lost and counted */
+static void test_late_reader(void)
+{
+    struct capture_test t;
+    int ret, skipped = 0, gaps = 0;
+    unsigned int i;
+    uint32_t lost;
+
+    ASSERT_EQ(0, capture_test_open(&t));
+    ASSERT_EQ(0, read_buffer(&t));
+    ASSERT_EQ(0, read_buffer(&t));
+
+    usleep(LATE_MS * 1000);
+    lost = t.in->get_input_frames_lost(t.in);
+    /* what the ring held comes first, the gap follows */
+    for (i = 0; i < RING_FRAMES / t.frames + 2; i++) {
+        ret = read_buffer(&t);
+        ASSERT_TRUE(ret >= 0);
+        if (ret > 0)
+            gaps++;
+        skipped += ret;
+    }
+    fprintf(stderr, "  %d frames skipped, %u reported lost\n", skipped, lost);
+    EXPECT_EQ(1, gaps);
+    EXPECT_TRUE(skipped > 0);
+    EXPECT_EQ(skipped, lost);
+    EXPECT_TRUE(skipped < RATE * LATE_MS / 1000);
+
+    /* the losses are reported once */
+    EXPECT_EQ(0, read_buffer(&t));
+    EXPECT_EQ(0, t.in->get_input_frames_lost(t.in));
+    capture_test_close(&t);
+}
+
+/* the position counts the frames captured, read or not, on the capture clock */
+static void test_capture_position(void)
+{
+    struct capture_test t;
+    int64_t frames, time, first_frames = 0, first_time = 0, last_frames = -1, last_time = 0;
+    unsigned int i, backwards = 0;
+    double rate;
+
+    ASSERT_EQ(0, capture_test_open(&t));
+    ASSERT_EQ(0, read_buffer(&t));
+
+    for (i = 0; i < RATE / t.frames; i++) {
+        ASSERT_EQ(0, read_buffer(&t));
+        ASSERT_EQ(0, t.in->get_capture_position(t.in, &frames, &time));
+        if (frames < last_frames || time < last_time)
+            backwards++;
+        if (i == 0) {
+            first_frames = frames;
+            first_time = time;
+        }
+        EXPECT_TRUE(frames >= (int64_t)t.read);
+        last_frames = frames;
+        last_time = time;
+    }
+    EXPECT_TRUE(time <= test_now_ns());
+
+    rate = (double)(last_frames - first_frames) * 1e9 / (last_time - first_time);
+    fprintf(stderr, "  capture position at %.1f Hz\n", rate);
+    EXPECT_EQ(0, backwards);
+    EXPECT_TRUE(rate > RATE * 0.99 && rate < RATE * 1.01);
+    capture_test_close(&t);
+}
+
+struct reader {
+    struct capture_test t;
+    unsigned int rate;
+    int64_t end_ns;
+    unsigned int gaps;          /* in the counter, at the driver rate only */
+    unsigned int errors;
+    uint32_t lost;
+};
+
+static int reader_open(struct reader *r, struct audio_hw_device *dev, unsigned int rate)
+{
+    struct audio_config config = {
+        .sample_rate = rate,
+        .channel_mask = AUDIO_CHANNEL_IN_STEREO,
+        .format = AUDIO_FORMAT_PCM_16_BIT,
+    };
+
+    memset(r, 0, sizeof(*r));
+    r->rate = rate;
+    r->t.dev = dev;
+    if (dev->open_input_stream(dev, 0, AUDIO_DEVICE_IN_BUILTIN_MIC, &config, &r->t.in) != 0)
+        return -1;
+    r->t.frames = r->t.in->common.get_buffer_size(&r->t.in->common) /
+                  audio_stream_in_frame_size(&r->t.in->common);
+    r->t.buf = malloc(r->t.frames * 2 * sizeof(int16_t));
+    return 0;
+}
+
+static void reader_close(struct reader *r)
+{
+    r->t.dev->close_input_stream(r->t.dev, r->t.in);
+    free(r->t.buf);
+}
+
+static void *reader_thread(void *context)
+{
+    struct reader *r = context;
+    size_t bytes = r->t.frames * 2 * sizeof(int16_t);
+
+    while (test_now_ns() < r->end_ns) {
+        if (r->rate != RATE) {
+            if (r->t.in->read(r->t.in, r->t.buf, bytes) <= 0)
+                r->errors++;
+            else
+                r->t.read += r->t.frames;
+        } else {
+            switch (read_buffer(&r->t)) {
+            case 0:
+                break;
+            case -1:
+                r->errors++;
+                break;
+            default:
+                r->gaps++;
+                break;
+            }
+        }
+        r->lost += r->t.in->get_input_frames_lost(r->t.in);
+    }
+    return NULL;
+}
+
+/* readers at different rates on their own threads, and one coming and
+ * going: the PCM is opened and read once for all of them, and each one gets
+ * its frames at its rate without losing any */
+static void test_concurrent_readers(void)
+{
+    static const unsigned int rates[] = { RATE, 48000, 16000, 8000 };
+    const unsigned int num_readers = sizeof(rates) / sizeof(rates[0]);
+    struct reader readers[sizeof(rates) / sizeof(rates[0])], late;
+    pthread_t threads[sizeof(rates) / sizeof(rates[0])];
+    struct fake_pcm_stats before, after;
+    struct audio_hw_device *dev;
+    unsigned int i, n;
+    int64_t start, end, ms;
+
+    ASSERT_EQ(0, audio_hw_host_open(&dev, false));
+    fake_pcm_set_source(HOST_CARD_DEFAULT, HOST_PORT_CAPTURE, counter_source, NULL);
+    fake_pcm_get_stats(HOST_CARD_DEFAULT, HOST_PORT_CAPTURE, PCM_IN, &before);
+    for (n = 0; n < num_readers; n++) {
+        if (reader_open(&readers[n], dev, rates[n]) != 0)
+            break;
+    }
+    EXPECT_EQ(num_readers, n);
+
+    start = test_now_ns();
+    end = start + READERS_MS * 1000000LL;
+    for (i = 0; i < n; i++) {
+        readers[i].end_ns = end;
+        pthread_create(&threads[i], NULL, reader_thread, &readers[i]);
+    }
+
+    /* attached for a few reads at a time */
+    while (test_now_ns() < end - 300000000LL) {
+        usleep(100000);
+        if (reader_open(&late, dev, 16000) != 0) {
+            EXPECT_TRUE(false);
+            break;
+        }
+        late.end_ns = test_now_ns() + 100000000LL;
+        reader_thread(&late);
+        EXPECT_EQ(0, late.errors);
+        EXPECT_TRUE(late.t.read > 0);
+        reader_close(&late);
+    }
+
+    for (i = 0; i < n; i++)
+        pthread_join(threads[i], NULL);
+    ms = (test_now_ns() - start) / 1000000;
+    fake_pcm_get_stats(HOST_CARD_DEFAULT, HOST_PORT_CAPTURE, PCM_IN, &after);
+
+    for (i = 0; i < n; i++) {
+        fprintf(stderr, "  %u Hz: %llu frames in %lld ms, %u lost\n", readers[i].rate,
+                (unsigned long long)readers[i].t.read, (long long)ms, readers[i].lost);
+        EXPECT_EQ(0, readers[i].errors);
+        EXPECT_EQ(0, readers[i].gaps);
+        EXPECT_EQ(0, readers[i].lost);
+        /* the readers wait for the capture clock, less what was buffered */
+        EXPECT_TRUE(readers[i].t.read * 1000 > readers[i].rate * (uint64_t)(ms - 200));
+        EXPECT_TRUE(readers[i].t.read * 1000 < readers[i].rate * (uint64_t)(ms + 200));
+        reader_close(&readers[i]);
+    }
+
+    /* one open, and the frames of a single reader */
+    fprintf(stderr, "  PCM: %u opens, %llu frames\n", after.opens - before.opens,
+            (unsigned long long)(after.frames - before.frames));
+    EXPECT_EQ(1, after.opens - before.opens);
+    EXPECT_TRUE((after.frames - before.frames) * 1000 < RATE * (uint64_t)(ms + 200));
+    audio_hw_host_close(dev);
+}
+
+struct hotword_reader {
+    struct audio_stream_in *in;
+    int16_t *buf;
+    size_t bytes;
+    bool stop;
+    unsigned int reads;
+    unsigned int not_silent;    /* reads returning anything but zeros */
+    int64_t max_read_ns;
+};
+
+static void *hotword_thread(void *context)
+{
+    struct hotword_reader *r = context;
+    int64_t start, ns;
+    size_t i;
+
+    while (!__atomic_load_n(&r->stop, __ATOMIC_ACQUIRE)) {
+        memset(r->buf, 0x55, r->bytes);
+        start = test_now_ns();
+        if (r->in->read(r->in, r->buf, r->bytes) != (ssize_t)r->bytes)
+            break;
+        ns = test_now_ns() - start;
+        if (ns > r->max_read_ns)
+            r->max_read_ns = ns;
+        for (i = 0; i < r->bytes / sizeof(int16_t); i++) {
+            if (r->buf[i] != 0) {
+                r->not_silent++;
+                break;
+            }
+        }
+        r->reads++;
+    }
+    return NULL;
+}
+
+/* the gate of a hotword input never opens on silence: reads return zeros
+ * after about a buffer, and neither standby nor a regular input taking the
+ * microphone over is held up by the reader */
+static void test_hotword_silence(void)
+{
+    struct audio_config config = {
+        .sample_rate = HOTWORD_RATE,
+        .channel_mask = AUDIO_CHANNEL_IN_STEREO,
+        .format = AUDIO_FORMAT_PCM_16_BIT,
+    };
+    struct hotword_reader r;
+    struct capture_test t;
+    struct audio_hw_device *dev;
+    pthread_t thread;
+    int64_t buffer_ns, start;
+    unsigned int reads;
+    char kv[32];
+
+    ASSERT_EQ(0, audio_hw_host_open(&dev, false));
+    memset(&r, 0, sizeof(r));
+    ASSERT_EQ(0, dev->open_input_stream(dev, 0, AUDIO_DEVICE_IN_BUILTIN_MIC, &config, &r.in));
+    snprintf(kv, sizeof(kv), "%s=%d", AUDIO_PARAMETER_STREAM_INPUT_SOURCE,
+             AUDIO_SOURCE_HOTWORD);
+    r.in->common.set_parameters(&r.in->common, kv);
+    r.bytes = r.in->common.get_buffer_size(&r.in->common);
+    r.buf = malloc(r.bytes);
+    buffer_ns = (int64_t)r.bytes / audio_stream_in_frame_size(&r.in->common) *
+                1000000000LL / HOTWORD_RATE;
+    pthread_create(&thread, NULL, hotword_thread, &r);
+
+    usleep(300000);
+    reads = __atomic_load_n(&r.reads, __ATOMIC_ACQUIRE);
+    EXPECT_TRUE(reads > 0);
+
+    start = test_now_ns();
+    EXPECT_EQ(0, r.in->common.standby(&r.in->common));
+    EXPECT_TRUE(test_now_ns() - start < 2 * buffer_ns);
+
+    /* the microphone taken back at the default configuration */
+    config.sample_rate = RATE;
+    ASSERT_EQ(0, dev->open_input_stream(dev, 0, AUDIO_DEVICE_IN_BUILTIN_MIC, &config, &t.in));
+    t.frames = t.in->common.get_buffer_size(&t.in->common) /
+               audio_stream_in_frame_size(&t.in->common);
+    t.buf = malloc(t.frames * 2 * sizeof(int16_t));
+    EXPECT_EQ((ssize_t)(t.frames * 2 * sizeof(int16_t)),
+              t.in->read(t.in, t.buf, t.frames * 2 * sizeof(int16_t)));
+    usleep(300000);
+    EXPECT_TRUE(__atomic_load_n(&r.reads, __ATOMIC_ACQUIRE) > reads);
+
+    __atomic_store_n(&r.stop, true, __ATOMIC_RELEASE);
+    pthread_join(thread, NULL);
+    fprintf(stderr, "  %u reads, slowest %lld ms for a %lld ms buffer\n", r.reads,
+            (long long)(r.max_read_ns / 1000000), (long long)(buffer_ns / 1000000));
+    EXPECT_EQ(0, r.not_silent);
+    EXPECT_TRUE(r.max_read_ns < 3 * buffer_ns);
+
+    dev->close_input_stream(dev, t.in);
+    free(t.buf);
+    dev->close_input_stream(dev, r.in);
+    free(r.buf);
+    audio_hw_host_close(dev);
+}
+
+int main(void)
+{
+    RUN_TEST(test_continuous);
+    RUN_TEST(test_late_reader);
+    RUN_TEST(test_capture_position);
+    RUN_TEST(test_concurrent_readers);
+    RUN_TEST(test_hotword_silence);
+    return TEST_RESULT();
+}
@@ -0,0 +1,167 @@
+/*
+ * Copyright (C) 2017 The LineageOS Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * The direct HDMI output against a fake sink: the channel masks and rates
+ * it offers follow the range pcm_params reports for the HDMI PCM, configs
+ * outside of it are refused with one that fits, and an accepted config
+ * reaches the PCM untouched.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "audio_hw_host.h"
+#include "audio_test.h"
+
+static int open_hdmi(struct audio_hw_device *dev, struct audio_config *config,
+                     struct audio_stream_out **out)
+{
+    return dev->open_output_stream(dev, 0, AUDIO_DEVICE_OUT_AUX_DIGITAL,
+                                   AUDIO_OUTPUT_FLAG_DIRECT, config, out);
+}
+
+static void expect_param(struct audio_stream_out *out, const char *key, const char *expected)
+{
+    char *reply = out->common.get_parameters(&out->common, key);
+    char want[256];
+
+    snprintf(want, sizeof(want), "%s=%s", key, expected);
+    EXPECT_TRUE(reply != NULL && strcmp(reply, want) == 0);
+    if (reply != NULL && strcmp(reply, want) != 0)
+        fprintf(stderr, "  got '%s', expected '%s'\n", reply, want);
+    free(reply);
+}
+
+/* no sink, no HDMI PCM: the open fails and playback stays on the primary
+ * output */
+static void test_no_sink(void)
+{
+    struct audio_config config = { .sample_rate = 0, };
+    struct audio_hw_device *dev;
+    struct audio_stream_out *out = NULL;
+
+    ASSERT_EQ(0, audio_hw_host_open(&dev, false));
+    EXPECT_TRUE(open_hdmi(dev, &config, &out) != 0);
+    EXPECT_TRUE(out == NULL);
+    audio_hw_host_close(dev);
+}
+
+/* a 5.1 sink up to 48 kHz: an empty config gets stereo 48 kHz and the
+ * profile lists what the sink takes */
+static void test_caps_from_sink(void)
+{
+    struct audio_config config = { .sample_rate = 0, };
+    struct audio_hw_device *dev;
+    struct audio_stream_out *out;
+
+    ASSERT_EQ(0, audio_hw_host_open(&dev, false));
+    fake_pcm_set_params(HOST_CARD_HDMI, HOST_PORT_HDMI, PCM_OUT, 32000, 48000, 2, 6);
+    ASSERT_EQ(0, open_hdmi(dev, &config, &out));
+
+    EXPECT_EQ(AUDIO_CHANNEL_OUT_STEREO, config.channel_mask);
+    EXPECT_EQ(48000, config.sample_rate);
+    EXPECT_EQ(AUDIO_FORMAT_PCM_16_BIT, config.format);
+    EXPECT_EQ(48000, out->common.get_sample_rate(&out->common));
+    expect_param(out, AUDIO_PARAMETER_STREAM_SUP_CHANNELS,
+                 "AUDIO_CHANNEL_OUT_STEREO|AUDIO_CHANNEL_OUT_5POINT1");
+    expect_param(out, AUDIO_PARAMETER_STREAM_SUP_SAMPLING_RATES, "32000|44100|48000");
+
+    dev->close_output_stream(dev, out);
+    audio_hw_host_close(dev);
+}
+
+/* 7.1 at 96 kHz on the same sink: refused, with a config it takes */
+static void test_unsupported_config(void)
+{
+    struct audio_config config = {
+        .sample_rate = 96000,
+        .channel_mask = AUDIO_CHANNEL_OUT_7POINT1,
+        .format = AUDIO_FORMAT_PCM_16_BIT,
+    };
+    struct audio_hw_device *dev;
+    struct audio_stream_out *out = NULL;
+
+    ASSERT_EQ(0, audio_hw_host_open(&dev, false));
+    fake_pcm_set_params(HOST_CARD_HDMI, HOST_PORT_HDMI, PCM_OUT, 32000, 48000, 2, 6);
+    EXPECT_EQ(-EINVAL, open_hdmi(dev, &config, &out));
+    EXPECT_TRUE(out == NULL);
+    EXPECT_EQ(AUDIO_CHANNEL_OUT_STEREO, config.channel_mask);
+    EXPECT_EQ(32000, config.sample_rate);
+
+    /* the suggestion opens */
+    ASSERT_EQ(0, open_hdmi(dev, &config, &out));
+    dev->close_output_stream(dev, out);
+    audio_hw_host_close(dev);
+}
+
+/* 5.1 at 44.1 kHz goes to the HDMI PCM as is, the position counts frames
+ * of the stream rate */
+static void test_write_multichannel(void)
+{
+    struct audio_config config = {
+        .sample_rate = 44100,
+        .channel_mask = AUDIO_CHANNEL_OUT_5POINT1,
+        .format = AUDIO_FORMAT_PCM_16_BIT,
+    };
+    struct audio_hw_device *dev;
+    struct audio_stream_out *out;
+    struct fake_pcm_stats stats;
+    struct timespec ts;
+    uint64_t frames, written = 0;
+    size_t bytes, frame_size;
+    void *buf;
+    int i;
+
+    ASSERT_EQ(0, audio_hw_host_open(&dev, false));
+    fake_pcm_set_params(HOST_CARD_HDMI, HOST_PORT_HDMI, PCM_OUT, 32000, 192000, 2, 8);
+    ASSERT_EQ(0, open_hdmi(dev, &config, &out));
+
+    frame_size = audio_stream_out_frame_size(&out->common);
+    EXPECT_EQ(6 * sizeof(int16_t), frame_size);
+    bytes = out->common.get_buffer_size(&out->common);
+    buf = calloc(1, bytes);
+    ASSERT_TRUE(buf != NULL);
+    for (i = 0; i < 8; i++) {
+        EXPECT_EQ(bytes, out->write(out, buf, bytes));
+        written += bytes / frame_size;
+    }
+
+    ASSERT_EQ(0, fake_pcm_get_stats(HOST_CARD_HDMI, HOST_PORT_HDMI, PCM_OUT, &stats));
+    EXPECT_TRUE(stats.open);
+    EXPECT_EQ(6, stats.config.channels);
+    EXPECT_EQ(44100, stats.config.rate);
+    EXPECT_EQ(written, stats.frames);
+    EXPECT_EQ(0, stats.xruns);
+
+    ASSERT_EQ(0, out->get_presentation_position(out, &frames, &ts));
+    EXPECT_TRUE(frames > 0 && frames <= written);
+
+    free(buf);
+    dev->close_output_stream(dev, out);
+    audio_hw_host_close(dev);
+}
+
+int main(void)
+{
+    RUN_TEST(test_no_sink);
+    RUN_TEST(test_caps_from_sink);
+    RUN_TEST(test_unsupported_config);
+    RUN_TEST(test_write_multichannel);
+    return TEST_RESULT();
+}
@@ -0,0 +1,124 @@
+/*
+ * Copyright (C) 2017 The LineageOS Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "audio_hw_host"
+
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <cutils/log.h>
+
+#include "audio_hw_host.h"
+
+/* the name the HAL gives its configuration without ro.product.device */
+#define HOST_CONFIG_NAME "tiny_hw"
+
+static pthread_once_t dir_once = PTHREAD_ONCE_INIT;
+static char dir[PATH_MAX];
+
+static int copy_file(const char *from, const char *to)
+{
+    char buf[4096];
+    FILE *in, *out;
+    size_t len;
+    int ret = 0;
+
+    in = fopen(from, "r");
+    if (!in)
+        return -errno;
+    out = fopen(to, "w");
+    if (!out) {
+        ret = -errno;
+        fclose(in);
+        return ret;
+    }
+    while ((len = fread(buf, 1, sizeof(buf), in)) > 0) {
+        if (fwrite(buf, 1, len, out) != len) {
+            ret = -EIO;
+            break;
+        }
+    }
+    fclose(in);
+    if (fclose(out) != 0 && ret == 0)
+        ret = -errno;
+    return ret;
+}
+
+static void make_dir(void)
+{
+    const char *tmp = getenv("TMPDIR");
+    const char *config = getenv(FAKE_TINYALSA_CONFIG_ENV);
+    char path[PATH_MAX + sizeof(HOST_CONFIG_NAME) + 1];
+
+    snprintf(dir, sizeof(dir), "%s/audio_hw_host.XXXXXX", tmp ? tmp : "/tmp");
+    if (!mkdtemp(dir)) {
+        ALOGE("%s: cannot create %s: %s", __func__, dir, strerror(errno));
+        dir[0] = '\0';
+        return;
+    }
+
+    snprintf(path, sizeof(path), "%s/%s", dir, HOST_CONFIG_NAME);
+    if (copy_file(config ? config : FAKE_TINYALSA_CONFIG, path) != 0)
+        ALOGE("%s: cannot copy the configuration to %s", __func__, path);
+}
+
+const char *audio_hw_host_dir(void)
+{
+    pthread_once(&dir_once, make_dir);
+    return dir;
+}
+
+int audio_hw_host_open(struct audio_hw_device **dev, bool keep_cache)
+{
+    char path[PATH_MAX + 64];
+
+    if (!keep_cache) {
+        snprintf(path, sizeof(path), "%s/route_cache_%s.bin", audio_hw_host_dir(),
+                 HOST_CONFIG_NAME);
+        unlink(path);
+    }
+    fake_tinyalsa_reset();
+
+    return HAL_MODULE_INFO_SYM.common.methods->open(&HAL_MODULE_INFO_SYM.common,
+                                                    AUDIO_HARDWARE_INTERFACE,
+                                                    (struct hw_device_t **)dev);
+}
+
+void audio_hw_host_close(struct audio_hw_device *dev)
+{
+    dev->common.close(&dev->common);
+}
+
+void audio_hw_host_tone_source(void *context, int16_t *buf, unsigned int frames,
+                               unsigned int channels, unsigned int rate, uint64_t pos)
+{
+    const struct audio_hw_host_tone *tone = context;
+    unsigned int i, c;
+    int16_t s;
+
+    for (i = 0; i < frames; i++) {
+        s = (int16_t)(tone->amplitude *
+                      sin(2 * M_PI * tone->freq * (double)((pos + i) % rate) / rate));
+        for (c = 0; c < channels; c++)
+            *buf++ = s;
+    }
+}
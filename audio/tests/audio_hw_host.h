@@ -0,0 +1,57 @@
+/*
+ * Copyright (C) 2017 The LineageOS Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef AUDIO_HW_HOST_H
+#define AUDIO_HW_HOST_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <hardware/audio.h>
+
+#include "fake_tinyalsa.h"
+
+/* PCM devices of audio_hw.h, which defines the route tables and can only be
+ * included by audio_hw.c */
+#define HOST_CARD_DEFAULT       0
+#define HOST_PORT_PLAYBACK      0
+#define HOST_PORT_MODEM         1
+#define HOST_PORT_BT            2
+#define HOST_PORT_CAPTURE       3
+#define HOST_CARD_HDMI          1
+#define HOST_PORT_HDMI          0
+
+/* the HAL built with AUDIO_HW_HOST, see tests/Android.mk */
+extern struct audio_module HAL_MODULE_INFO_SYM;
+
+/* Function prototypes */
+
+/* Open the HAL on a fresh fake card, with the configuration copied to the
+ * scratch directory and without route cache unless keep_cache is set */
+int audio_hw_host_open(struct audio_hw_device **dev, bool keep_cache);
+void audio_hw_host_close(struct audio_hw_device *dev);
+/* scratch directory holding the configuration and the route cache */
+const char *audio_hw_host_dir(void);
+
+/* 16 bit stereo sine of the given amplitude, for fake_pcm_set_source() */
+struct audio_hw_host_tone {
+    unsigned int freq;
+    int16_t amplitude;
+};
+void audio_hw_host_tone_source(void *context, int16_t *buf, unsigned int frames,
+                               unsigned int channels, unsigned int rate, uint64_t pos);
+#endif
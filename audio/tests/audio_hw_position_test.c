@@ -0,0 +1,227 @@
+/*
+ * Copyright (C) 2017 The LineageOS Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * The presentation and render positions of the deep buffer output against
+ * what the fake PCM actually played: a sink on the playback PCM counts the
+ * frames its clock consumed, which is the position the HAL should report.
+ * Positions and timestamps must never go backwards, through underruns and
+ * standby too.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "audio_hw_host.h"
+#include "audio_test.h"
+
+#define RATE                44100
+#define ACCURACY_FRAMES     (RATE / 1000)
+#define TIMESTAMP_NS        2000000LL
+
+struct position_test {
+    struct audio_hw_device *dev;
+    struct audio_stream_out *out;
+    int16_t *buf;
+    size_t bytes;
+    size_t frames;
+
+    uint64_t played;            /* by the fake PCM, across reopens */
+    uint64_t written;
+
+    /* last position reported */
+    uint64_t frames_reported;
+    int64_t ns_reported;
+    unsigned int positions;
+    unsigned int errors;        /* backwards or off */
+};
+
+static void played_sink(void *context, const int16_t *buf, unsigned int frames, uint64_t pos)
+{
+    struct position_test *t = context;
+
+    t->played += frames;
+}
+
+static int position_test_open(struct position_test *t)
+{
+    struct audio_config config = { .sample_rate = 0, };
+    unsigned int i;
+
+    memset(t, 0, sizeof(*t));
+    if (audio_hw_host_open(&t->dev, false) != 0)
+        return -1;
+    fake_pcm_set_sink(HOST_CARD_DEFAULT, HOST_PORT_PLAYBACK, played_sink, t);
+    if (t->dev->open_output_stream(t->dev, 0, AUDIO_DEVICE_OUT_SPEAKER,
+                                   AUDIO_OUTPUT_FLAG_PRIMARY | AUDIO_OUTPUT_FLAG_DEEP_BUFFER,
+                                   &config, &t->out) != 0) {
+        audio_hw_host_close(t->dev);
+        return -1;
+    }
+    t->bytes = t->out->common.get_buffer_size(&t->out->common);
+    t->frames = t->bytes / audio_stream_out_frame_size(&t->out->common);
+    t->buf = malloc(t->bytes);
+    for (i = 0; i < t->frames * 2; i++)
+        t->buf[i] = (i / 2) % 100 < 50 ? 4000 : -4000;
+    return 0;
+}
+
+static void position_test_close(struct position_test *t)
+{
+    fake_pcm_set_sink(HOST_CARD_DEFAULT, HOST_PORT_PLAYBACK, NULL, NULL);
+    free(t->buf);
+    t->dev->close_output_stream(t->dev, t->out);
+    audio_hw_host_close(t->dev);
+}
+
+/* checks the position against the frames played, if there is one: the
+ * fake PCM gives no timestamp while it is stopped */
+static void check_position(struct position_test *t)
+{
+    struct timespec ts;
+    uint64_t frames;
+    int64_t ns, now;
+
+    if (t->out->get_presentation_position(t->out, &frames, &ts) != 0)
+        return;
+    now = test_now_ns();
+    ns = ts.tv_sec * 1000000000LL + ts.tv_nsec;
+
+    if (frames < t->frames_reported || ns < t->ns_reported || frames > t->written ||
+            llabs((long long)(frames - t->played)) > ACCURACY_FRAMES ||
+            ns > now || now - ns > TIMESTAMP_NS) {
+        fprintf(stderr, "  position %llu at %lld ns: played %llu, written %llu, "
+                "last %llu at %lld ns, now %lld ns\n",
+                (unsigned long long)frames, (long long)ns, (unsigned long long)t->played,
+                (unsigned long long)t->written, (unsigned long long)t->frames_reported,
+                (long long)t->ns_reported, (long long)now);
+        t->errors++;
+    }
+    t->frames_reported = frames;
+    t->ns_reported = ns;
+    t->positions++;
+}
+
+static void play(struct position_test *t, unsigned int ms)
+{
+    uint64_t end = t->written + (uint64_t)RATE * ms / 1000;
+
+    while (t->written < end) {
+        if (t->out->write(t->out, t->buf, t->bytes) != (ssize_t)t->bytes)
+            break;
+        t->written += t->frames;
+        check_position(t);
+    }
+}
+
+/* standby drops what the driver had queued, the HAL counts it as presented
+ * so that the position goes on from what was written */
+static void standby(struct position_test *t)
+{
+    t->out->common.standby(&t->out->common);
+    t->played = t->written;
+}
+
+/* let the driver run dry, querying the position meanwhile */
+static void starve(struct position_test *t, unsigned int ms)
+{
+    unsigned int i;
+
+    for (i = 0; i < ms / 10; i++) {
+        usleep(10000);
+        check_position(t);
+    }
+}
+
+/* steady playback: the position follows the clock of the PCM */
+static void test_steady(void)
+{
+    struct position_test t;
+    uint64_t frames;
+    int64_t ns;
+
+    ASSERT_EQ(0, position_test_open(&t));
+    play(&t, 200);
+    frames = t.frames_reported;
+    ns = t.ns_reported;
+    play(&t, 500);
+
+    EXPECT_TRUE(t.positions > 10);
+    EXPECT_EQ(0, t.errors);
+    /* frames against time, a drift here is what players resync on */
+    EXPECT_TRUE(llabs((long long)(t.frames_reported - frames) -
+                      (t.ns_reported - ns) * RATE / 1000000000LL) <= ACCURACY_FRAMES);
+    position_test_close(&t);
+}
+
+/* the driver underruns while the writer stalls: the position stops where
+ * the audio stopped and picks up from there */
+static void test_underrun(void)
+{
+    struct position_test t;
+    uint32_t dsp_frames;
+    unsigned int i;
+
+    ASSERT_EQ(0, position_test_open(&t));
+    for (i = 0; i < 3; i++) {
+        play(&t, 300);
+        starve(&t, 300);
+        EXPECT_EQ(t.written, t.played);
+    }
+    play(&t, 300);
+    EXPECT_EQ(0, t.errors);
+
+    /* underruns are no standby, the render position runs on */
+    ASSERT_EQ(0, t.out->get_render_position(t.out, &dsp_frames));
+    EXPECT_TRUE(dsp_frames >= t.frames_reported);
+    EXPECT_TRUE(dsp_frames <= t.played + ACCURACY_FRAMES);
+    position_test_close(&t);
+}
+
+/* the presentation position survives standby, the render position counts
+ * from the last exit from standby */
+static void test_standby(void)
+{
+    struct position_test t;
+    uint32_t dsp_frames;
+    uint64_t before;
+
+    ASSERT_EQ(0, position_test_open(&t));
+    play(&t, 300);
+    standby(&t);
+    before = t.written;
+
+    play(&t, 300);
+    EXPECT_EQ(0, t.errors);
+    EXPECT_TRUE(t.frames_reported > before);
+
+    ASSERT_EQ(0, t.out->get_render_position(t.out, &dsp_frames));
+    EXPECT_TRUE(dsp_frames <= t.written - before);
+    EXPECT_TRUE(llabs((long long)dsp_frames - (long long)(t.played - before)) <=
+                ACCURACY_FRAMES);
+    position_test_close(&t);
+}
+
+int main(void)
+{
+    RUN_TEST(test_steady);
+    RUN_TEST(test_underrun);
+    RUN_TEST(test_standby);
+    return TEST_RESULT();
+}
@@ -0,0 +1,303 @@
+/*
+ * Copyright (C) 2017 The LineageOS Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Checks the sequence of mixer writes the routes of tiny_hw.xml produce
+ * through the mixer transactions of audio_hw.c.
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "audio_hw_host.h"
+#include "audio_test.h"
+
+#define ADC_MUX_ADC     0
+#define ADC_MUX_DMIC    1
+
+/* index of the first write of value to the control at or after from, -1 if none */
+static int find_write(const char *name, int value, unsigned int from)
+{
+    struct fake_mixer_write w;
+    unsigned int i;
+
+    for (i = from; fake_mixer_get_write(i, &w); i++) {
+        if (strcmp(w.name, name) == 0 && w.value == value)
+            return i;
+    }
+    return -1;
+}
+
+static void expect_adc_mux_toggle(const char *name)
+{
+    int dmic = find_write(name, ADC_MUX_DMIC, 0);
+
+    EXPECT_TRUE(dmic >= 0);
+    if (dmic >= 0)
+        EXPECT_TRUE(find_write(name, ADC_MUX_ADC, dmic + 1) > dmic);
+    EXPECT_EQ(ADC_MUX_ADC, fake_mixer_get_value(name));
+}
+
+/* "Work around core issue": the path writes the ADC muxes to DMIC and
+ * back, both writes must reach the codec */
+static void test_open_keeps_toggle(void)
+{
+    struct audio_hw_device *dev;
+    int i;
+
+    for (i = 0; i < 2; i++) {
+        ASSERT_EQ(0, audio_hw_host_open(&dev, i > 0));
+        expect_adc_mux_toggle("ADCL Mux");
+        expect_adc_mux_toggle("ADCR Mux");
+        audio_hw_host_close(dev);
+    }
+}
+
+static struct audio_stream_out *open_output(struct audio_hw_device *dev)
+{
+    struct audio_config config = { .sample_rate = 0, };
+    struct audio_stream_out *out;
+
+    if (dev->open_output_stream(dev, 0, AUDIO_DEVICE_OUT_SPEAKER,
+                                AUDIO_OUTPUT_FLAG_PRIMARY | AUDIO_OUTPUT_FLAG_DEEP_BUFFER,
+                                &config, &out) != 0)
+        return NULL;
+    return out;
+}
+
+static void set_routing(struct audio_stream_out *out, audio_devices_t device)
+{
+    char kvpairs[32];
+
+    snprintf(kvpairs, sizeof(kvpairs), "%s=%u", AUDIO_PARAMETER_STREAM_ROUTING, device);
+    out->common.set_parameters(&out->common, kvpairs);
+}
+
+/* the new device is turned on before the old one is turned off */
+static void test_switch_order(void)
+{
+    struct audio_hw_device *dev;
+    struct audio_stream_out *out;
+    int hp_on, spk_off;
+
+    ASSERT_EQ(0, audio_hw_host_open(&dev, false));
+    out = open_output(dev);
+    ASSERT_TRUE(out != NULL);
+
+    set_routing(out, AUDIO_DEVICE_OUT_SPEAKER);
+    EXPECT_EQ(1, fake_mixer_get_value("SPK Switch"));
+
+    fake_mixer_clear_writes();
+    set_routing(out, AUDIO_DEVICE_OUT_WIRED_HEADPHONE);
+    hp_on = find_write("HP Switch", 1, 0);
+    spk_off = find_write("SPK Switch", 0, 0);
+    EXPECT_TRUE(hp_on >= 0);
+    EXPECT_TRUE(spk_off >= 0);
+    EXPECT_TRUE(hp_on < spk_off);
+
+    /* and each control is written once by the switch */
+    EXPECT_EQ(-1, find_write("HP Switch", 1, hp_on + 1));
+    EXPECT_EQ(-1, find_write("SPK Switch", 0, spk_off + 1));
+
+    dev->close_output_stream(dev, out);
+    audio_hw_host_close(dev);
+}
+
+/* writing the current route again is free */
+static void test_same_route(void)
+{
+    struct audio_hw_device *dev;
+    struct audio_stream_out *out;
+
+    ASSERT_EQ(0, audio_hw_host_open(&dev, false));
+    out = open_output(dev);
+    ASSERT_TRUE(out != NULL);
+
+    set_routing(out, AUDIO_DEVICE_OUT_SPEAKER);
+    fake_mixer_clear_writes();
+    set_routing(out, AUDIO_DEVICE_OUT_SPEAKER);
+    EXPECT_EQ(0, fake_mixer_get_num_writes());
+
+    dev->close_output_stream(dev, out);
+    audio_hw_host_close(dev);
+}
+
+/* "AIF1DAC1 Volume" is 96 on both the speaker and the headphone routes */
+#define SHARED_CTL          "AIF1DAC1 Volume"
+#define SHARED_CTL_VALUE    96
+
+static void start_output(struct audio_stream_out *out)
+{
+    size_t bytes = out->common.get_buffer_size(&out->common);
+    void *buf = calloc(1, bytes);
+
+    out->write(out, buf, bytes);
+    free(buf);
+}
+
+/* while streaming the HAL trusts what it wrote last */
+static void test_shadow_while_streaming(void)
+{
+    struct audio_hw_device *dev;
+    struct audio_stream_out *out;
+
+    ASSERT_EQ(0, audio_hw_host_open(&dev, false));
+    out = open_output(dev);
+    ASSERT_TRUE(out != NULL);
+    set_routing(out, AUDIO_DEVICE_OUT_SPEAKER);
+    start_output(out);
+
+    fake_mixer_poke(SHARED_CTL, 0);
+    set_routing(out, AUDIO_DEVICE_OUT_WIRED_HEADPHONE);
+    EXPECT_EQ(0, fake_mixer_get_value(SHARED_CTL));
+
+    dev->close_output_stream(dev, out);
+    audio_hw_host_close(dev);
+}
+
+/* once idle, the controls may have been changed behind the HAL back. The
+ * deep buffer output keeps its route for a grace period after standby, the
+ * input goes idle right away */
+static void test_shadow_after_standby(void)
+{
+    struct audio_config config = {
+        .sample_rate = 16000,
+        .channel_mask = AUDIO_CHANNEL_IN_STEREO,
+        .format = AUDIO_FORMAT_PCM_16_BIT,
+    };
+    struct audio_hw_device *dev;
+    struct audio_stream_out *out;
+    struct audio_stream_in *in;
+    size_t bytes;
+    void *buf;
+
+    ASSERT_EQ(0, audio_hw_host_open(&dev, false));
+    out = open_output(dev);
+    ASSERT_TRUE(out != NULL);
+    set_routing(out, AUDIO_DEVICE_OUT_SPEAKER);
+    ASSERT_EQ(0, dev->open_input_stream(dev, 0, AUDIO_DEVICE_IN_BUILTIN_MIC, &config, &in));
+
+    bytes = in->common.get_buffer_size(&in->common);
+    buf = malloc(bytes);
+    EXPECT_TRUE(in->read(in, buf, bytes) > 0);
+    in->common.standby(&in->common);
+    free(buf);
+
+    fake_mixer_poke(SHARED_CTL, 0);
+    set_routing(out, AUDIO_DEVICE_OUT_WIRED_HEADPHONE);
+    EXPECT_EQ(SHARED_CTL_VALUE, fake_mixer_get_value(SHARED_CTL));
+
+    dev->close_input_stream(dev, in);
+    dev->close_output_stream(dev, out);
+    audio_hw_host_close(dev);
+}
+
+/* the modem firmware reprograms the codec on mode changes */
+static void test_shadow_after_mode_change(void)
+{
+    struct audio_hw_device *dev;
+    struct audio_stream_out *out;
+
+    ASSERT_EQ(0, audio_hw_host_open(&dev, false));
+    out = open_output(dev);
+    ASSERT_TRUE(out != NULL);
+    set_routing(out, AUDIO_DEVICE_OUT_SPEAKER);
+    start_output(out);
+
+    fake_mixer_poke(SHARED_CTL, 0);
+    dev->set_mode(dev, AUDIO_MODE_RINGTONE);
+    set_routing(out, AUDIO_DEVICE_OUT_WIRED_HEADPHONE);
+    EXPECT_EQ(SHARED_CTL_VALUE, fake_mixer_get_value(SHARED_CTL));
+
+    dev->close_output_stream(dev, out);
+    audio_hw_host_close(dev);
+}
+
+/* a route switch costs its mixer writes and nothing else noticeable */
+static void test_switch_time(void)
+{
+    static const unsigned int write_us = 500;
+    struct audio_hw_device *dev;
+    struct audio_stream_out *out;
+    unsigned int writes;
+    int64_t start, ns;
+
+    ASSERT_EQ(0, audio_hw_host_open(&dev, false));
+    out = open_output(dev);
+    ASSERT_TRUE(out != NULL);
+    set_routing(out, AUDIO_DEVICE_OUT_SPEAKER);
+    fake_mixer_set_write_delay_us(write_us);
+
+    fake_mixer_clear_writes();
+    start = test_now_ns();
+    set_routing(out, AUDIO_DEVICE_OUT_WIRED_HEADPHONE);
+    ns = test_now_ns() - start;
+    writes = fake_mixer_get_num_writes();
+
+    fprintf(stderr, "  speaker => headphone: %.3f ms, %u mixer writes of %u us\n",
+            ns / 1e6, writes, write_us);
+    EXPECT_TRUE(writes > 0);
+    EXPECT_TRUE(ns >= writes * write_us * 1000LL);
+    EXPECT_TRUE(ns < (writes + 10) * write_us * 1000LL);
+
+    dev->close_output_stream(dev, out);
+    audio_hw_host_close(dev);
+}
+
+/* a configuration that cannot be read or parsed fails the open with its
+ * own error */
+static void test_open_errors(void)
+{
+    static const char truncated[] = "<tinyhal>\n<path>\n<ctl name=\"SPK Switch\" val=\"1\"/>\n";
+    struct audio_hw_device *dev = NULL;
+    char path[PATH_MAX], saved[PATH_MAX + 8];
+    FILE *f;
+
+    snprintf(path, sizeof(path), "%s/tiny_hw", audio_hw_host_dir());
+    snprintf(saved, sizeof(saved), "%s.saved", path);
+    ASSERT_EQ(0, rename(path, saved));
+
+    EXPECT_EQ(-ENODEV, audio_hw_host_open(&dev, false));
+    EXPECT_TRUE(dev == NULL);
+
+    f = fopen(path, "w");
+    if (f != NULL) {
+        fputs(truncated, f);
+        fclose(f);
+    }
+    EXPECT_EQ(-EINVAL, audio_hw_host_open(&dev, false));
+    EXPECT_TRUE(dev == NULL);
+
+    ASSERT_EQ(0, rename(saved, path));
+    ASSERT_EQ(0, audio_hw_host_open(&dev, false));
+    audio_hw_host_close(dev);
+}
+
+int main(void)
+{
+    RUN_TEST(test_open_keeps_toggle);
+    RUN_TEST(test_switch_order);
+    RUN_TEST(test_same_route);
+    RUN_TEST(test_shadow_while_streaming);
+    RUN_TEST(test_shadow_after_standby);
+    RUN_TEST(test_shadow_after_mode_change);
+    RUN_TEST(test_switch_time);
+    RUN_TEST(test_open_errors);
+    return TEST_RESULT();
+}
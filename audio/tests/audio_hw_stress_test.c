@@ -0,0 +1,212 @@
+/*
+ * Copyright (C) 2017 The LineageOS Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Plays on the deep buffer output while another thread switches the
+ * routing as fast as it can, and checks that neither side starves the
+ * other: a route switch waits for at most the write in progress, and the
+ * writes keep the PCM fed. Dumps taken meanwhile neither block nor hold up
+ * the writes.
+ */
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "audio_hw_host.h"
+#include "audio_test.h"
+
+#define STRESS_SECONDS      2
+#define MIXER_WRITE_US      200     /* an I2C write on the target */
+#define DUMP_MAX_NS         100000000LL /* when the HAL gives up on a mutex */
+
+struct stress {
+    struct audio_stream_out *out;
+    bool stop;
+    unsigned int switches;
+    int64_t max_switch_ns;
+};
+
+static void *routing_thread(void *context)
+{
+    static const audio_devices_t routes[] = {
+        AUDIO_DEVICE_OUT_WIRED_HEADPHONE,
+        AUDIO_DEVICE_OUT_SPEAKER,
+    };
+    struct stress *s = context;
+    char kvpairs[32];
+    int64_t start, ns;
+
+    while (!__atomic_load_n(&s->stop, __ATOMIC_ACQUIRE)) {
+        snprintf(kvpairs, sizeof(kvpairs), "%s=%u", AUDIO_PARAMETER_STREAM_ROUTING,
+                 routes[s->switches % 2]);
+        start = test_now_ns();
+        s->out->common.set_parameters(&s->out->common, kvpairs);
+        ns = test_now_ns() - start;
+        if (ns > s->max_switch_ns)
+            s->max_switch_ns = ns;
+        s->switches++;
+    }
+    return NULL;
+}
+
+static void test_write_under_routing_churn(void)
+{
+    struct audio_config config = { .sample_rate = 0, };
+    struct audio_hw_host_tone tone = { 1000, 8000 };
+    struct stress s = { .stop = false, };
+    struct audio_hw_device *dev;
+    struct fake_pcm_stats before, after;
+    pthread_t thread;
+    int16_t *buf;
+    size_t bytes, frames;
+    uint64_t total = 0;
+    int64_t write_ns, max_write_ns = 0, t;
+
+    ASSERT_EQ(0, audio_hw_host_open(&dev, false));
+    fake_mixer_set_write_delay_us(MIXER_WRITE_US);
+    ASSERT_EQ(0, dev->open_output_stream(dev, 0, AUDIO_DEVICE_OUT_SPEAKER,
+                                         AUDIO_OUTPUT_FLAG_PRIMARY |
+                                         AUDIO_OUTPUT_FLAG_DEEP_BUFFER,
+                                         &config, &s.out));
+
+    bytes = s.out->common.get_buffer_size(&s.out->common);
+    frames = bytes / audio_stream_out_frame_size(&s.out->common);
+    write_ns = frames * 1000000000LL / config.sample_rate;
+    buf = malloc(bytes);
+    audio_hw_host_tone_source(&tone, buf, frames, 2, config.sample_rate, 0);
+
+    /* leave standby first, the start is not part of the steady state */
+    ASSERT_TRUE(s.out->write(s.out, buf, bytes) > 0);
+    fake_pcm_get_stats(HOST_CARD_DEFAULT, HOST_PORT_PLAYBACK, PCM_OUT, &before);
+
+    pthread_create(&thread, NULL, routing_thread, &s);
+    while (total < (uint64_t)STRESS_SECONDS * config.sample_rate) {
+        t = test_now_ns();
+        if (s.out->write(s.out, buf, bytes) < 0)
+            break;
+        t = test_now_ns() - t;
+        if (t > max_write_ns)
+            max_write_ns = t;
+        total += frames;
+    }
+    __atomic_store_n(&s.stop, true, __ATOMIC_RELEASE);
+    pthread_join(thread, NULL);
+
+    fake_pcm_get_stats(HOST_CARD_DEFAULT, HOST_PORT_PLAYBACK, PCM_OUT, &after);
+    fprintf(stderr, "  %u switches, max %.3f ms; write of %.3f ms, max %.3f ms\n",
+            s.switches, s.max_switch_ns / 1e6, write_ns / 1e6, max_write_ns / 1e6);
+
+    EXPECT_TRUE(total >= (uint64_t)STRESS_SECONDS * config.sample_rate);
+    /* a switch is not starved by back to back writes: it waits for the
+     * write in progress only, about three without the pre lock */
+    EXPECT_TRUE(s.switches >= STRESS_SECONDS * 1000000000LL / write_ns / 2);
+    EXPECT_TRUE(s.max_switch_ns < write_ns * 2);
+    /* and the switches do not starve the PCM */
+    EXPECT_EQ(0, after.xruns - before.xruns);
+
+    dev->close_output_stream(dev, s.out);
+    audio_hw_host_close(dev);
+    free(buf);
+}
+
+struct writer {
+    struct audio_stream_out *out;
+    int16_t *buf;
+    size_t bytes;
+    bool stop;
+};
+
+static void *write_thread(void *context)
+{
+    struct writer *w = context;
+
+    while (!__atomic_load_n(&w->stop, __ATOMIC_ACQUIRE)) {
+        if (w->out->write(w->out, w->buf, w->bytes) < 0)
+            break;
+    }
+    return NULL;
+}
+
+static void test_dump_while_writing(void)
+{
+    struct audio_config config = { .sample_rate = 0, };
+    struct audio_hw_host_tone tone = { 1000, 8000 };
+    struct writer w = { .stop = false, };
+    struct audio_hw_device *dev;
+    struct fake_pcm_stats before, after;
+    pthread_t thread;
+    FILE *file;
+    char line[128];
+    unsigned int i, states = 0;
+    int64_t t, max_dump_ns = 0;
+
+    ASSERT_EQ(0, audio_hw_host_open(&dev, false));
+    ASSERT_EQ(0, dev->open_output_stream(dev, 0, AUDIO_DEVICE_OUT_SPEAKER,
+                                         AUDIO_OUTPUT_FLAG_PRIMARY |
+                                         AUDIO_OUTPUT_FLAG_DEEP_BUFFER,
+                                         &config, &w.out));
+    w.bytes = w.out->common.get_buffer_size(&w.out->common);
+    w.buf = malloc(w.bytes);
+    audio_hw_host_tone_source(&tone, w.buf, w.bytes / audio_stream_out_frame_size(&w.out->common),
+                              2, config.sample_rate, 0);
+    ASSERT_TRUE(w.out->write(w.out, w.buf, w.bytes) > 0);
+    fake_pcm_get_stats(HOST_CARD_DEFAULT, HOST_PORT_PLAYBACK, PCM_OUT, &before);
+    file = tmpfile();
+    ASSERT_TRUE(file != NULL);
+
+    pthread_create(&thread, NULL, write_thread, &w);
+    for (i = 0; i < 50; i++) {
+        t = test_now_ns();
+        dev->dump(dev, fileno(file));
+        w.out->common.dump(&w.out->common, fileno(file));
+        t = test_now_ns() - t;
+        if (t > max_dump_ns)
+            max_dump_ns = t;
+        usleep(10000);
+    }
+    __atomic_store_n(&w.stop, true, __ATOMIC_RELEASE);
+    pthread_join(thread, NULL);
+    fake_pcm_get_stats(HOST_CARD_DEFAULT, HOST_PORT_PLAYBACK, PCM_OUT, &after);
+
+    rewind(file);
+    while (fgets(line, sizeof(line), file) != NULL) {
+        if (strstr(line, "state: active, written: ") != NULL)
+            states++;
+    }
+    fclose(file);
+    fprintf(stderr, "  %u states dumped out of 100, max dump %.3f ms\n", states,
+            max_dump_ns / 1e6);
+
+    /* a dump waits for the write in progress at most */
+    EXPECT_TRUE(states > 0);
+    EXPECT_TRUE(max_dump_ns < DUMP_MAX_NS);
+    EXPECT_EQ(0, after.xruns - before.xruns);
+
+    dev->close_output_stream(dev, w.out);
+    audio_hw_host_close(dev);
+    free(w.buf);
+}
+
+int main(void)
+{
+    RUN_TEST(test_write_under_routing_churn);
+    RUN_TEST(test_dump_while_writing);
+    return TEST_RESULT();
+}
@@ -0,0 +1,225 @@
+/*
+ * Copyright (C) 2017 The LineageOS Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * audio_ring: capacity, wrap around of the storage and of the free running
+ * positions, the span accessors, and a producer and a consumer thread
+ * passing a sequence through it.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "audio_ring.h"
+#include "audio_test.h"
+
+#define THREAD_FRAMES   (1 << 20)
+
+static void fill_sequence(int16_t *buf, size_t frames, unsigned int channels, int16_t first)
+{
+    size_t i;
+    unsigned int c;
+
+    for (i = 0; i < frames; i++) {
+        for (c = 0; c < channels; c++)
+            buf[i * channels + c] = (int16_t)(first + i) * (c ? -1 : 1);
+    }
+}
+
+/* index of the first frame not following the sequence, -1 if none */
+static int check_sequence(const int16_t *buf, size_t frames, unsigned int channels,
+                          int16_t first)
+{
+    size_t i;
+    unsigned int c;
+
+    for (i = 0; i < frames; i++) {
+        for (c = 0; c < channels; c++) {
+            if (buf[i * channels + c] != (int16_t)((int16_t)(first + i) * (c ? -1 : 1)))
+                return (int)i;
+        }
+    }
+    return -1;
+}
+
+static void test_init(void)
+{
+    struct audio_ring ring;
+    int16_t storage[16];
+
+    EXPECT_EQ(1, audio_ring_round_frames(0));
+    EXPECT_EQ(1, audio_ring_round_frames(1));
+    EXPECT_EQ(4, audio_ring_round_frames(3));
+    EXPECT_EQ(4096, audio_ring_round_frames(4096));
+    EXPECT_EQ(8192, audio_ring_round_frames(4097));
+
+    EXPECT_EQ(-EINVAL, audio_ring_init(&ring, storage, 6, 2));
+    EXPECT_EQ(-EINVAL, audio_ring_init(&ring, NULL, 8, 2));
+    EXPECT_EQ(-EINVAL, audio_ring_init(&ring, storage, 8, 0));
+    EXPECT_EQ(-EINVAL, audio_ring_init(&ring, storage, 0, 2));
+    ASSERT_EQ(0, audio_ring_init(&ring, storage, 8, 2));
+    EXPECT_EQ(0, audio_ring_avail(&ring));
+    EXPECT_EQ(8, audio_ring_space(&ring));
+}
+
+/* the ring fills completely and the copies wrap around the storage */
+static void test_fill_and_wrap(void)
+{
+    struct audio_ring ring;
+    int16_t storage[8 * 2];
+    int16_t in[16 * 2], out[16 * 2];
+
+    ASSERT_EQ(0, audio_ring_init(&ring, storage, 8, 2));
+    fill_sequence(in, 16, 2, 100);
+
+    EXPECT_EQ(8, audio_ring_write(&ring, in, 10));
+    EXPECT_EQ(0, audio_ring_space(&ring));
+    EXPECT_EQ(0, audio_ring_write(&ring, in, 1));
+
+    EXPECT_EQ(5, audio_ring_read(&ring, out, 5));
+    EXPECT_EQ(-1, check_sequence(out, 5, 2, 100));
+    EXPECT_EQ(5, audio_ring_write(&ring, in + 8 * 2, 5));
+    EXPECT_EQ(8, audio_ring_avail(&ring));
+
+    EXPECT_EQ(8, audio_ring_read(&ring, out, 16));
+    EXPECT_EQ(-1, check_sequence(out, 8, 2, 105));
+    EXPECT_EQ(0, audio_ring_read(&ring, out, 1));
+
+    audio_ring_reset(&ring);
+    EXPECT_EQ(0, audio_ring_avail(&ring));
+    EXPECT_EQ(8, audio_ring_space(&ring));
+}
+
+/* spans stop at the end of the storage, what is left follows from the start */
+static void test_spans(void)
+{
+    struct audio_ring ring;
+    int16_t storage[8 * 2];
+    int16_t in[8 * 2];
+    int16_t *ptr;
+
+    ASSERT_EQ(0, audio_ring_init(&ring, storage, 8, 2));
+    fill_sequence(in, 8, 2, 0);
+    audio_ring_write(&ring, in, 6);
+    audio_ring_consume(&ring, 6);
+
+    EXPECT_EQ(2, audio_ring_write_span(&ring, &ptr));
+    EXPECT_TRUE(ptr == storage + 6 * 2);
+    memcpy(ptr, in, 2 * 2 * sizeof(int16_t));
+    audio_ring_produce(&ring, 2);
+    EXPECT_EQ(6, audio_ring_write_span(&ring, &ptr));
+    EXPECT_TRUE(ptr == storage);
+    memcpy(ptr, in + 2 * 2, 3 * 2 * sizeof(int16_t));
+    audio_ring_produce(&ring, 3);
+
+    EXPECT_EQ(2, audio_ring_read_span(&ring, &ptr));
+    EXPECT_EQ(-1, check_sequence(ptr, 2, 2, 0));
+    audio_ring_consume(&ring, 1);
+    EXPECT_EQ(1, audio_ring_read_span(&ring, &ptr));
+    audio_ring_consume(&ring, 1);
+    EXPECT_EQ(3, audio_ring_read_span(&ring, &ptr));
+    EXPECT_EQ(-1, check_sequence(ptr, 3, 2, 2));
+    audio_ring_consume(&ring, 3);
+    EXPECT_EQ(0, audio_ring_read_span(&ring, &ptr));
+}
+
+/* the positions are free running and may overflow */
+static void test_position_wrap(void)
+{
+    struct audio_ring ring;
+    int16_t storage[8];
+    int16_t in[8], out[8];
+    int i;
+
+    ASSERT_EQ(0, audio_ring_init(&ring, storage, 8, 1));
+    atomic_store(&ring.rd, SIZE_MAX - 2);
+    atomic_store(&ring.wr, SIZE_MAX - 2);
+
+    for (i = 0; i < 4; i++) {
+        fill_sequence(in, 7, 1, i * 7);
+        EXPECT_EQ(7, audio_ring_write(&ring, in, 7));
+        EXPECT_EQ(7, audio_ring_avail(&ring));
+        EXPECT_EQ(1, audio_ring_space(&ring));
+        EXPECT_EQ(7, audio_ring_read(&ring, out, 8));
+        EXPECT_EQ(-1, check_sequence(out, 7, 1, i * 7));
+    }
+}
+
+struct thread_test {
+    struct audio_ring ring;
+    bool stop;                  /* the consumer gave up */
+};
+
+static void *producer(void *context)
+{
+    struct thread_test *t = context;
+    int16_t buf[97 * 2];
+    size_t done = 0, n, i = 0;
+
+    while (done < THREAD_FRAMES && !__atomic_load_n(&t->stop, __ATOMIC_ACQUIRE)) {
+        n = (i++ * 31) % 97 + 1;
+        if (n > THREAD_FRAMES - done)
+            n = THREAD_FRAMES - done;
+        fill_sequence(buf, n, 2, (int16_t)done);
+        n = audio_ring_write(&t->ring, buf, n);
+        if (n == 0)
+            sched_yield();
+        done += n;
+    }
+    return NULL;
+}
+
+static void test_threads(void)
+{
+    static int16_t storage[256 * 2];
+    struct thread_test t = { .stop = false, };
+    pthread_t thread;
+    int16_t buf[89 * 2];
+    size_t done = 0, n, i = 0;
+    int diff = -1;
+
+    ASSERT_EQ(0, audio_ring_init(&t.ring, storage, 256, 2));
+    pthread_create(&thread, NULL, producer, &t);
+
+    while (done < THREAD_FRAMES && diff < 0) {
+        n = (i++ * 17) % 89 + 1;
+        n = audio_ring_read(&t.ring, buf, n);
+        if (n == 0)
+            sched_yield();
+        diff = check_sequence(buf, n, 2, (int16_t)done);
+        done += n;
+    }
+    __atomic_store_n(&t.stop, true, __ATOMIC_RELEASE);
+    pthread_join(thread, NULL);
+
+    EXPECT_EQ(-1, diff);
+    EXPECT_EQ(THREAD_FRAMES, done);
+    EXPECT_EQ(0, audio_ring_avail(&t.ring));
+}
+
+int main(void)
+{
+    RUN_TEST(test_init);
+    RUN_TEST(test_fill_and_wrap);
+    RUN_TEST(test_spans);
+    RUN_TEST(test_position_wrap);
+    RUN_TEST(test_threads);
+    return TEST_RESULT();
+}
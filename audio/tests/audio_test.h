@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2017 The LineageOS Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef AUDIO_TEST_H
+#define AUDIO_TEST_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+/*
+ * Minimal test runner for the host tests: the HAL and its helpers are C11
+ * with <stdatomic.h>, which the gtest C++ toolchain cannot include.
+ *
+ *     static void test_something(void) { EXPECT_EQ(1, one()); }
+ *     int main(void) { RUN_TEST(test_something); return TEST_RESULT(); }
+ */
+
+static int test_failures __attribute__((unused));
+static int test_failed __attribute__((unused));
+
+#define EXPECT_TRUE(cond) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: %s: expected %s\n", __FILE__, __LINE__, __func__, #cond); \
+            test_failed = 1; \
+        } \
+    } while (0)
+
+#define EXPECT_EQ(expected, actual) \
+    do { \
+        long long e_ = (long long)(expected); \
+        long long a_ = (long long)(actual); \
+        if (e_ != a_) { \
+            fprintf(stderr, "%s:%d: %s: expected %s == %lld, got %lld\n", __FILE__, __LINE__, \
+                    __func__, #actual, e_, a_); \
+            test_failed = 1; \
+        } \
+    } while (0)
+
+/* stop the test case, for preconditions the rest depends on */
+#define ASSERT_TRUE(cond) \
+    do { \
+        EXPECT_TRUE(cond); \
+        if (test_failed) \
+            return; \
+    } while (0)
+
+#define ASSERT_EQ(expected, actual) \
+    do { \
+        EXPECT_EQ(expected, actual); \
+        if (test_failed) \
+            return; \
+    } while (0)
+
+#define RUN_TEST(test) \
+    do { \
+        test_failed = 0; \
+        fprintf(stderr, "[ RUN      ] %s\n", #test); \
+        test(); \
+        fprintf(stderr, "[ %s ] %s\n", test_failed ? " FAILED " : "      OK", #test); \
+        test_failures += test_failed; \
+    } while (0)
+
+#define TEST_RESULT() (test_failures ? 1 : 0)
+
+static inline int64_t test_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static inline int64_t test_cpu_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+#endif
@@ -0,0 +1,181 @@
+/*
+ * Copyright (C) 2017 The LineageOS Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * The CODEC_EQ_PARAM_* parameters and their mapping to the codec EQ gains
+ * and switches.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "audio_test.h"
+#include "codec_eq.h"
+
+static const struct codec_eq_regs base = {
+    .band = { 9, 7, 10, 13, 12 },
+    .eq_switch = 0,
+    .drc_switch = 0,
+};
+
+static int set(struct codec_eq_params *params, const char *kvpairs)
+{
+    struct str_parms *parms = str_parms_create_str(kvpairs);
+    int ret = codec_eq_set_parameters(params, parms);
+
+    str_parms_destroy(parms);
+    return ret;
+}
+
+static bool has(const char *kvpairs)
+{
+    struct str_parms *parms = str_parms_create_str(kvpairs);
+    bool ret = codec_eq_has_parameters(parms);
+
+    str_parms_destroy(parms);
+    return ret;
+}
+
+static void test_parse(void)
+{
+    struct codec_eq_params params;
+
+    memset(&params, 0, sizeof(params));
+    EXPECT_EQ(0, set(&params, "routing=2"));
+    EXPECT_TRUE(!has("routing=2"));
+    EXPECT_TRUE(has("routing=2;hw_loudness_gain=100"));
+
+    EXPECT_EQ(1, set(&params, "hw_eq_enable=on;hw_eq_levels=100,-250,0,1200,-1200"));
+    EXPECT_TRUE(params.eq_enabled);
+    EXPECT_EQ(100, params.eq_levels_mb[0]);
+    EXPECT_EQ(-250, params.eq_levels_mb[1]);
+    EXPECT_EQ(-1200, params.eq_levels_mb[4]);
+    EXPECT_TRUE(codec_eq_active(&params));
+
+    /* keys not given are left alone */
+    EXPECT_EQ(1, set(&params, "hw_bassboost_strength=500"));
+    EXPECT_TRUE(params.eq_enabled);
+    EXPECT_TRUE(!params.bassboost_enabled);
+    EXPECT_EQ(500, params.bassboost_strength);
+
+    EXPECT_EQ(1, set(&params, "hw_eq_enable=off"));
+    EXPECT_TRUE(!codec_eq_active(&params));
+}
+
+static void test_malformed(void)
+{
+    struct codec_eq_params params;
+
+    memset(&params, 0, sizeof(params));
+    params.eq_levels_mb[0] = 42;
+    EXPECT_EQ(-EINVAL, set(&params, "hw_eq_levels=1,2,3,4"));
+    EXPECT_EQ(-EINVAL, set(&params, "hw_eq_levels=1,2,3,4,5,6"));
+    EXPECT_EQ(-EINVAL, set(&params, "hw_eq_levels=1,2,x,4,5"));
+    EXPECT_EQ(42, params.eq_levels_mb[0]);
+    EXPECT_EQ(-EINVAL, set(&params, "hw_bassboost_strength=1001"));
+    EXPECT_EQ(-EINVAL, set(&params, "hw_loudness_gain=-100"));
+}
+
+/* codec_eq_get_parameters() gives back what codec_eq_set_parameters() takes */
+static void test_round_trip(void)
+{
+    struct codec_eq_params params, copy;
+    struct str_parms *parms;
+    char *kvpairs;
+
+    memset(&params, 0, sizeof(params));
+    params.eq_enabled = true;
+    params.eq_levels_mb[0] = -300;
+    params.eq_levels_mb[4] = 1100;
+    params.bassboost_strength = 800;
+    params.loudness_enabled = true;
+    params.loudness_gain_mb = 250;
+
+    parms = str_parms_create();
+    codec_eq_get_parameters(&params, parms);
+    kvpairs = str_parms_to_str(parms);
+    str_parms_destroy(parms);
+
+    memset(&copy, 0, sizeof(copy));
+    copy.eq_levels_mb[2] = 700;
+    copy.bassboost_enabled = true;
+    EXPECT_EQ(1, set(&copy, kvpairs));
+    EXPECT_EQ(0, memcmp(&params, &copy, sizeof(params)));
+    free(kvpairs);
+}
+
+static void test_map(void)
+{
+    struct codec_eq_params params;
+    struct codec_eq_regs regs;
+    int i;
+
+    /* nothing enabled leaves the tuning */
+    memset(&params, 0, sizeof(params));
+    params.eq_levels_mb[0] = 600;
+    codec_eq_map(&params, &base, &regs);
+    EXPECT_EQ(0, memcmp(&base, &regs, sizeof(regs)));
+
+    /* levels are rounded to the 1 dB steps */
+    params.eq_enabled = true;
+    params.eq_levels_mb[0] = 249;
+    params.eq_levels_mb[1] = 250;
+    params.eq_levels_mb[2] = -250;
+    codec_eq_map(&params, &base, &regs);
+    EXPECT_EQ(11, regs.band[0]);
+    EXPECT_EQ(10, regs.band[1]);
+    EXPECT_EQ(7, regs.band[2]);
+    EXPECT_EQ(1, regs.eq_switch);
+    EXPECT_EQ(0, regs.drc_switch);
+
+    /* and clamped to the codec range */
+    params.eq_levels_mb[3] = 1200;
+    params.eq_levels_mb[2] = -1200;
+    codec_eq_map(&params, &base, &regs);
+    EXPECT_EQ(CODEC_EQ_GAIN_MAX, regs.band[3]);
+    EXPECT_EQ(CODEC_EQ_GAIN_MIN, regs.band[2]);
+
+    /* half strength bass boost: 5 dB and half of it */
+    memset(&params, 0, sizeof(params));
+    params.bassboost_enabled = true;
+    params.bassboost_strength = 500;
+    codec_eq_map(&params, &base, &regs);
+    EXPECT_EQ(base.band[0] + 5, regs.band[0]);
+    EXPECT_EQ(base.band[1] + 2, regs.band[1]);
+    for (i = 2; i < CODEC_EQ_BANDS; i++)
+        EXPECT_EQ(base.band[i], regs.band[i]);
+
+    /* loudness turns the DRC on only with some gain */
+    memset(&params, 0, sizeof(params));
+    params.loudness_enabled = true;
+    codec_eq_map(&params, &base, &regs);
+    EXPECT_EQ(0, regs.drc_switch);
+    params.loudness_gain_mb = 300;
+    codec_eq_map(&params, &base, &regs);
+    EXPECT_EQ(1, regs.drc_switch);
+    for (i = 0; i < CODEC_EQ_BANDS; i++)
+        EXPECT_EQ(base.band[i] + 3, regs.band[i]);
+}
+
+int main(void)
+{
+    RUN_TEST(test_parse);
+    RUN_TEST(test_malformed);
+    RUN_TEST(test_round_trip);
+    RUN_TEST(test_map);
+    return TEST_RESULT();
+}
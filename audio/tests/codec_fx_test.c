@@ -0,0 +1,369 @@
+/*
+ * Copyright (C) 2017 The LineageOS Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Drives the effects of libcodecfx like the framework does and checks the
+ * codec EQ and DRC controls the HAL writes on the fake mixer.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <hardware/audio_effect.h>
+#include <audio_effects/effect_bassboost.h>
+#include <audio_effects/effect_equalizer.h>
+#include <audio_effects/effect_loudnessenhancer.h>
+
+#include "audio_hw_host.h"
+#include "audio_test.h"
+#include "codec_fx.h"
+
+/* libcodecfx, linked by the test */
+extern audio_effect_library_t AUDIO_EFFECT_LIBRARY_INFO_SYM;
+
+#define DEEP_BUFFER_IO      13
+#define OTHER_IO            21
+
+/* what tiny_hw.xml leaves in the EQ, in 1 dB steps from -12 dB */
+static const int eq_base[5] = { 9, 7, 10, 13, 12 };
+
+static const effect_uuid_t eq_uuid = CODEC_FX_EQUALIZER_UUID;
+static const effect_uuid_t bassboost_uuid = CODEC_FX_BASSBOOST_UUID;
+static const effect_uuid_t loudness_uuid = CODEC_FX_LOUDNESS_UUID;
+
+struct fx_test {
+    struct audio_hw_device *dev;
+    struct audio_stream_out *out;
+};
+
+static int fx_test_open(struct fx_test *t)
+{
+    struct audio_config config = { .sample_rate = 0, };
+
+    if (audio_hw_host_open(&t->dev, false) != 0)
+        return -1;
+    if (t->dev->open_output_stream(t->dev, DEEP_BUFFER_IO, AUDIO_DEVICE_OUT_SPEAKER,
+                                   AUDIO_OUTPUT_FLAG_PRIMARY | AUDIO_OUTPUT_FLAG_DEEP_BUFFER,
+                                   &config, &t->out) != 0) {
+        audio_hw_host_close(t->dev);
+        return -1;
+    }
+    return 0;
+}
+
+static void fx_test_close(struct fx_test *t)
+{
+    t->dev->close_output_stream(t->dev, t->out);
+    audio_hw_host_close(t->dev);
+}
+
+static effect_handle_t fx_create(const effect_uuid_t *uuid, int io)
+{
+    effect_handle_t fx;
+    uint32_t size = sizeof(int);
+    int reply;
+
+    if (AUDIO_EFFECT_LIBRARY_INFO_SYM.create_effect(uuid, 0, io, &fx) != 0)
+        return NULL;
+    (*fx)->command(fx, EFFECT_CMD_INIT, 0, NULL, &size, &reply);
+    return fx;
+}
+
+static void fx_release(effect_handle_t fx)
+{
+    AUDIO_EFFECT_LIBRARY_INFO_SYM.release_effect(fx);
+}
+
+static int fx_enable(effect_handle_t fx, bool enable)
+{
+    uint32_t size = sizeof(int);
+    int reply = -1;
+
+    if ((*fx)->command(fx, enable ? EFFECT_CMD_ENABLE : EFFECT_CMD_DISABLE,
+                       0, NULL, &size, &reply) != 0)
+        return -1;
+    return reply;
+}
+
+/* one or two int32 parameters and a value of vsize bytes */
+static int fx_set_param(effect_handle_t fx, int32_t param, int32_t param2, bool two,
+                        const void *value, uint32_t vsize)
+{
+    uint32_t buf[8];
+    effect_param_t *p = (effect_param_t *)buf;
+    uint32_t size = sizeof(int);
+    int reply = -1;
+
+    p->psize = (two ? 2 : 1) * sizeof(int32_t);
+    p->vsize = vsize;
+    ((int32_t *)p->data)[0] = param;
+    ((int32_t *)p->data)[1] = param2;
+    memcpy(p->data + p->psize, value, vsize);
+    if ((*fx)->command(fx, EFFECT_CMD_SET_PARAM, sizeof(effect_param_t) + p->psize + vsize,
+                       p, &size, &reply) != 0)
+        return -1;
+    return reply;
+}
+
+static int fx_get_param(effect_handle_t fx, int32_t param, int32_t param2, bool two,
+                        void *value, uint32_t vsize)
+{
+    uint32_t buf[16];
+    effect_param_t *p = (effect_param_t *)buf;
+    uint32_t size = sizeof(buf);
+
+    p->psize = (two ? 2 : 1) * sizeof(int32_t);
+    p->vsize = vsize;
+    ((int32_t *)p->data)[0] = param;
+    ((int32_t *)p->data)[1] = param2;
+    if ((*fx)->command(fx, EFFECT_CMD_GET_PARAM, sizeof(effect_param_t) + p->psize,
+                       p, &size, p) != 0)
+        return -1;
+    if (p->status == 0)
+        memcpy(value, p->data + p->psize, p->vsize < vsize ? p->vsize : vsize);
+    return p->status;
+}
+
+static int set_band_level(effect_handle_t fx, int band, int16_t level_mb)
+{
+    return fx_set_param(fx, EQ_PARAM_BAND_LEVEL, band, true, &level_mb, sizeof(level_mb));
+}
+
+static int eq_band(int band)
+{
+    char name[32];
+
+    snprintf(name, sizeof(name), "AIF1DAC1 EQ%d Volume", band + 1);
+    return fake_mixer_get_value(name);
+}
+
+static void expect_eq(const int *expected)
+{
+    int i;
+
+    for (i = 0; i < 5; i++)
+        EXPECT_EQ(expected[i], eq_band(i));
+}
+
+static void test_equalizer(void)
+{
+    static const int16_t levels_mb[5] = { 300, 0, -200, 0, 600 };
+    const int expected[5] = { 12, 7, 8, 13, 18 };
+    struct fx_test t;
+    effect_handle_t eq;
+    int i;
+
+    ASSERT_EQ(0, fx_test_open(&t));
+    eq = fx_create(&eq_uuid, DEEP_BUFFER_IO);
+    ASSERT_TRUE(eq != NULL);
+
+    /* nothing is written before the effect is enabled */
+    fake_mixer_clear_writes();
+    for (i = 0; i < 5; i++)
+        EXPECT_EQ(0, set_band_level(eq, i, levels_mb[i]));
+    EXPECT_EQ(0, fake_mixer_get_num_writes());
+    expect_eq(eq_base);
+
+    EXPECT_EQ(0, fx_enable(eq, true));
+    expect_eq(expected);
+    EXPECT_EQ(1, fake_mixer_get_value("AIF1DAC1 EQ Switch"));
+
+    /* a level change while enabled only writes its band */
+    fake_mixer_clear_writes();
+    EXPECT_EQ(0, set_band_level(eq, 1, -700));
+    EXPECT_EQ(1, fake_mixer_get_num_writes());
+    EXPECT_EQ(0, eq_band(1));
+
+    EXPECT_EQ(0, fx_enable(eq, false));
+    expect_eq(eq_base);
+
+    fx_release(eq);
+    fx_test_close(&t);
+}
+
+static void test_bassboost_loudness(void)
+{
+    const int boosted[5] = { 18, 11, 10, 13, 12 };
+    const int louder[5] = { 24, 20, 19, 22, 21 };
+    struct fx_test t;
+    effect_handle_t bb, le;
+    int16_t strength = 1000;
+    int32_t gain_mb = 900;
+
+    ASSERT_EQ(0, fx_test_open(&t));
+    bb = fx_create(&bassboost_uuid, DEEP_BUFFER_IO);
+    le = fx_create(&loudness_uuid, DEEP_BUFFER_IO);
+    ASSERT_TRUE(bb != NULL && le != NULL);
+
+    /* +9 dB on the first band, half of it on the second */
+    EXPECT_EQ(0, fx_set_param(bb, BASSBOOST_PARAM_STRENGTH, 0, false,
+                              &strength, sizeof(strength)));
+    EXPECT_EQ(0, fx_enable(bb, true));
+    expect_eq(boosted);
+    EXPECT_EQ(0, fake_mixer_get_value("AIF1DAC1 DRC Switch"));
+
+    /* +9 dB everywhere, clamped at +12 dB, with the DRC on */
+    EXPECT_EQ(0, fx_set_param(le, LOUDNESS_ENHANCER_PARAM_TARGET_GAIN_MB, 0, false,
+                              &gain_mb, sizeof(gain_mb)));
+    EXPECT_EQ(0, fx_enable(le, true));
+    expect_eq(louder);
+    EXPECT_EQ(1, fake_mixer_get_value("AIF1DAC1 DRC Switch"));
+
+    /* releasing an enabled effect takes it off the codec */
+    fx_release(le);
+    expect_eq(boosted);
+    EXPECT_EQ(0, fake_mixer_get_value("AIF1DAC1 DRC Switch"));
+
+    fx_release(bb);
+    expect_eq(eq_base);
+    fx_test_close(&t);
+}
+
+/* the effects of another output do not reach the codec */
+static void test_other_output(void)
+{
+    struct fx_test t;
+    effect_handle_t eq;
+
+    ASSERT_EQ(0, fx_test_open(&t));
+    eq = fx_create(&eq_uuid, OTHER_IO);
+    ASSERT_TRUE(eq != NULL);
+
+    fake_mixer_clear_writes();
+    EXPECT_EQ(0, set_band_level(eq, 0, 1200));
+    EXPECT_EQ(0, fx_enable(eq, true));
+    EXPECT_EQ(0, fake_mixer_get_num_writes());
+    expect_eq(eq_base);
+
+    fx_release(eq);
+    fx_test_close(&t);
+}
+
+/* effects enabled before the output is opened apply once it is */
+static void test_enabled_before_open(void)
+{
+    const int expected[5] = { 9, 7, 10, 13, 0 };
+    struct fx_test t;
+    effect_handle_t eq;
+
+    eq = fx_create(&eq_uuid, DEEP_BUFFER_IO);
+    ASSERT_TRUE(eq != NULL);
+    EXPECT_EQ(0, set_band_level(eq, 4, -1200));
+    EXPECT_EQ(0, fx_enable(eq, true));
+
+    ASSERT_EQ(0, fx_test_open(&t));
+    expect_eq(expected);
+
+    /* the closed output is forgotten */
+    t.dev->close_output_stream(t.dev, t.out);
+    fake_mixer_clear_writes();
+    EXPECT_EQ(0, fx_enable(eq, false));
+    EXPECT_EQ(0, fake_mixer_get_num_writes());
+
+    audio_hw_host_close(t.dev);
+    fx_release(eq);
+}
+
+/* the parameters the framework queries */
+static void test_parameters(void)
+{
+    effect_handle_t eq, bb;
+    int16_t range[2], level;
+    int32_t freq, freqs[2];
+    uint16_t bands, band;
+    uint32_t supported;
+
+    eq = fx_create(&eq_uuid, DEEP_BUFFER_IO);
+    bb = fx_create(&bassboost_uuid, DEEP_BUFFER_IO);
+    ASSERT_TRUE(eq != NULL && bb != NULL);
+
+    EXPECT_EQ(0, fx_get_param(eq, EQ_PARAM_NUM_BANDS, 0, false, &bands, sizeof(bands)));
+    EXPECT_EQ(5, bands);
+    EXPECT_EQ(0, fx_get_param(eq, EQ_PARAM_LEVEL_RANGE, 0, false, range, sizeof(range)));
+    EXPECT_EQ(-1200, range[0]);
+    EXPECT_EQ(1200, range[1]);
+    EXPECT_EQ(0, fx_get_param(eq, EQ_PARAM_CENTER_FREQ, 2, true, &freq, sizeof(freq)));
+    EXPECT_EQ(875000, freq);
+    EXPECT_EQ(0, fx_get_param(eq, EQ_PARAM_BAND_FREQ_RANGE, 4, true, freqs, sizeof(freqs)));
+    EXPECT_TRUE(freqs[0] < 6900000 && freqs[1] > 6900000);
+    EXPECT_EQ(0, fx_get_param(eq, EQ_PARAM_GET_BAND, 1000000, true, &band, sizeof(band)));
+    EXPECT_EQ(2, band);
+
+    EXPECT_EQ(0, set_band_level(eq, 3, -500));
+    EXPECT_EQ(0, fx_get_param(eq, EQ_PARAM_BAND_LEVEL, 3, true, &level, sizeof(level)));
+    EXPECT_EQ(-500, level);
+    /* out of the codec range, or no such band */
+    EXPECT_TRUE(set_band_level(eq, 3, 1500) != 0);
+    EXPECT_TRUE(set_band_level(eq, 5, 0) != 0);
+
+    EXPECT_EQ(0, fx_get_param(bb, BASSBOOST_PARAM_STRENGTH_SUPPORTED, 0, false,
+                              &supported, sizeof(supported)));
+    EXPECT_EQ(1, supported);
+
+    fx_release(bb);
+    fx_release(eq);
+}
+
+/* the audio goes through untouched */
+static void test_process(void)
+{
+    effect_config_t config;
+    effect_handle_t eq;
+    audio_buffer_t in, out;
+    int16_t src[64], dst[64];
+    uint32_t size = sizeof(int);
+    int reply, i;
+
+    eq = fx_create(&eq_uuid, DEEP_BUFFER_IO);
+    ASSERT_TRUE(eq != NULL);
+
+    memset(&config, 0, sizeof(config));
+    config.inputCfg.samplingRate = config.outputCfg.samplingRate = 48000;
+    config.inputCfg.channels = config.outputCfg.channels = AUDIO_CHANNEL_OUT_STEREO;
+    config.inputCfg.format = config.outputCfg.format = AUDIO_FORMAT_PCM_16_BIT;
+    config.outputCfg.accessMode = EFFECT_BUFFER_ACCESS_WRITE;
+    EXPECT_EQ(0, (*eq)->command(eq, EFFECT_CMD_SET_CONFIG, sizeof(config), &config,
+                                &size, &reply));
+    EXPECT_EQ(0, reply);
+    EXPECT_EQ(0, fx_enable(eq, true));
+
+    for (i = 0; i < 64; i++)
+        src[i] = i * 1000 - 32000;
+    memset(dst, 0, sizeof(dst));
+    in.frameCount = out.frameCount = 32;
+    in.s16 = src;
+    out.s16 = dst;
+    EXPECT_EQ(0, (*eq)->process(eq, &in, &out));
+    EXPECT_EQ(0, memcmp(src, dst, sizeof(src)));
+
+    /* disabled, the framework may stop calling it */
+    EXPECT_EQ(0, fx_enable(eq, false));
+    EXPECT_EQ(-ENODATA, (*eq)->process(eq, &in, &out));
+
+    fx_release(eq);
+}
+
+int main(void)
+{
+    RUN_TEST(test_equalizer);
+    RUN_TEST(test_bassboost_loudness);
+    RUN_TEST(test_other_output);
+    RUN_TEST(test_enabled_before_open);
+    RUN_TEST(test_parameters);
+    RUN_TEST(test_process);
+    return TEST_RESULT();
+}
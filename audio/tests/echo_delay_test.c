@@ -0,0 +1,164 @@
+/*
+ * Copyright (C) 2017 The LineageOS Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * echo_delay on a synthetic loopback: the capture hears the playback after
+ * an echo path delay that drifts with the clocks, and each read measures it
+ * from timestamps taken at period granularity. The delay given to the AEC
+ * must stay aligned with the true one, and only be updated a few times.
+ */
+
+#include <stdlib.h>
+
+#include "audio_test.h"
+#include "echo_delay.h"
+
+#define READ_US         20000   /* one capture read */
+#define PERIOD_US       5000    /* timestamp granularity, a playback period */
+#define SETTLE_US       1000000
+
+struct loopback {
+    int32_t delay_us;           /* echo path delay at t = 0 */
+    int32_t drift_ppm;          /* of the capture clock against the playback clock */
+    int64_t t_us;
+    uint32_t seed;
+
+    /* worst misalignment once settled, AEC updates */
+    int32_t max_error_us;
+    unsigned int pushes;
+};
+
+static void loopback_init(struct loopback *l, int32_t delay_us, int32_t drift_ppm)
+{
+    l->delay_us = delay_us;
+    l->drift_ppm = drift_ppm;
+    l->t_us = 0;
+    l->seed = 1;
+    l->max_error_us = 0;
+    l->pushes = 0;
+}
+
+static int32_t true_delay(const struct loopback *l)
+{
+    return l->delay_us + (int32_t)(l->t_us * l->drift_ppm / 1000000);
+}
+
+/* what a read measures: the true delay plus the period quantization of
+ * the playback and capture timestamps */
+static int32_t measure(struct loopback *l)
+{
+    l->seed = l->seed * 1103515245 + 12345;
+    return true_delay(l) + (int32_t)((l->seed >> 16) % PERIOD_US) - PERIOD_US / 2;
+}
+
+static void run(struct echo_delay *ed, struct loopback *l, int64_t duration_us)
+{
+    int64_t end = l->t_us + duration_us;
+    int32_t error;
+
+    for (; l->t_us < end; l->t_us += READ_US) {
+        if (echo_delay_update(ed, measure(l), l->t_us * 1000))
+            l->pushes++;
+        if (l->t_us < SETTLE_US)
+            continue;
+        error = abs(echo_delay_get(ed) - true_delay(l));
+        if (error > l->max_error_us)
+            l->max_error_us = error;
+    }
+}
+
+/* the delay the AEC gets is aligned within the tolerance, and the AEC is
+ * not told on every read */
+static void test_steady(void)
+{
+    struct echo_delay ed;
+    struct loopback l;
+
+    echo_delay_reset(&ed);
+    EXPECT_EQ(0, echo_delay_get(&ed));
+    loopback_init(&l, 80000, 0);
+    run(&ed, &l, 10000000);
+    fprintf(stderr, "  max error %d us, %u updates in %u reads\n", l.max_error_us, l.pushes,
+            ed.num_samples);
+    EXPECT_TRUE(l.max_error_us <= ECHO_DELAY_TOLERANCE_US);
+    EXPECT_TRUE(l.pushes <= 10);
+    EXPECT_EQ(l.pushes, ed.num_pushes);
+}
+
+/* clocks 100 ppm apart move the echo by 6 ms a minute, the AEC follows in
+ * steps of about the tolerance */
+static void test_drift(void)
+{
+    struct echo_delay ed;
+    struct loopback l;
+
+    echo_delay_reset(&ed);
+    loopback_init(&l, 80000, 100);
+    run(&ed, &l, 60000000);
+    fprintf(stderr, "  max error %d us, %u updates, drift %d ppm\n", l.max_error_us, l.pushes,
+            ed.drift_ppm);
+    EXPECT_TRUE(l.max_error_us <= ECHO_DELAY_TOLERANCE_US + 1000);
+    EXPECT_TRUE(l.pushes >= 6000 / ECHO_DELAY_TOLERANCE_US);
+    EXPECT_TRUE(l.pushes <= 20);
+
+    /* the other way, faster */
+    echo_delay_reset(&ed);
+    loopback_init(&l, 80000, -1000);
+    run(&ed, &l, 30000000);
+    fprintf(stderr, "  max error %d us, %u updates, drift %d ppm\n", l.max_error_us, l.pushes,
+            ed.drift_ppm);
+    EXPECT_TRUE(l.max_error_us <= ECHO_DELAY_TOLERANCE_US + 1000);
+    EXPECT_TRUE(ed.drift_ppm < -500 && ed.drift_ppm > -1500);
+}
+
+/* one late read does not move the AEC, a lasting jump of the echo path
+ * (the playback re-aligned after an underrun) does within a few reads */
+static void test_path_change(void)
+{
+    struct echo_delay ed;
+    struct loopback l;
+    unsigned int i;
+
+    echo_delay_reset(&ed);
+    loopback_init(&l, 80000, 0);
+    run(&ed, &l, 2000000);
+
+    EXPECT_TRUE(!echo_delay_update(&ed, 80000 + 50000, l.t_us * 1000));
+    l.t_us += READ_US;
+    run(&ed, &l, 2000000);
+    EXPECT_TRUE(abs(echo_delay_get(&ed) - 80000) <= ECHO_DELAY_TOLERANCE_US);
+
+    l.delay_us = 120000;
+    for (i = 1; i <= ECHO_DELAY_OUTLIER_COUNT; i++) {
+        bool pushed = echo_delay_update(&ed, measure(&l), l.t_us * 1000);
+
+        EXPECT_EQ(i == ECHO_DELAY_OUTLIER_COUNT, pushed);
+        l.t_us += READ_US;
+    }
+    EXPECT_TRUE(abs(echo_delay_get(&ed) - 120000) <= PERIOD_US / 2);
+
+    l.max_error_us = 0;
+    run(&ed, &l, 5000000);
+    EXPECT_TRUE(l.max_error_us <= ECHO_DELAY_TOLERANCE_US);
+}
+
+int main(void)
+{
+    RUN_TEST(test_steady);
+    RUN_TEST(test_drift);
+    RUN_TEST(test_path_change);
+    return TEST_RESULT();
+}
@@ -0,0 +1,244 @@
+/*
+ * Copyright (C) 2017 The LineageOS Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Host replacement for the resampler and the echo reference of
+ * libaudioutils, which are only built for the target: the host
+ * libaudioutils has neither, and speex has no host resampler.
+ *
+ * The resampler interpolates linearly, which is all the tests need: they
+ * check frame counts and timing, not the quality of the conversion. The
+ * echo reference hands out silence with no delay.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <audio_utils/echo_reference.h>
+#include <audio_utils/resampler.h>
+
+#define FAKE_RESAMPLER_MAX_CHANNELS 8
+
+struct fake_resampler {
+    struct resampler_itfe itfe;
+    struct resampler_buffer_provider *provider;
+    uint32_t in_rate;
+    uint32_t out_rate;
+    uint32_t channels;
+    uint64_t phase;             /* position in the input, 32.32 fixed point */
+    int16_t last[FAKE_RESAMPLER_MAX_CHANNELS]; /* frame before the input */
+};
+
+static void fake_resampler_reset(struct resampler_itfe *resampler)
+{
+    struct fake_resampler *rsmp = (struct fake_resampler *)resampler;
+
+    rsmp->phase = 0;
+    memset(rsmp->last, 0, sizeof(rsmp->last));
+}
+
+static int32_t fake_resampler_delay_ns(struct resampler_itfe *resampler)
+{
+    return 0;
+}
+
+/* Produce up to *out_frames from the *in_frames of in. On return, *in_frames
+ * is the number of input frames consumed and *out_frames the number of
+ * output frames produced. */
+static void fake_resampler_run(struct fake_resampler *rsmp, const int16_t *in,
+                               size_t *in_frames, int16_t *out, size_t *out_frames)
+{
+    uint64_t step = ((uint64_t)rsmp->in_rate << 32) / rsmp->out_rate;
+    size_t produced = 0, used, i;
+    uint32_t frac, c;
+    int32_t a, b;
+
+    while (produced < *out_frames) {
+        i = (size_t)(rsmp->phase >> 32);
+        if (i >= *in_frames)
+            break;
+        frac = (uint32_t)rsmp->phase;
+        for (c = 0; c < rsmp->channels; c++) {
+            a = i == 0 ? rsmp->last[c] : in[(i - 1) * rsmp->channels + c];
+            b = in[i * rsmp->channels + c];
+            out[produced * rsmp->channels + c] =
+                    (int16_t)(a + (((int64_t)(b - a) * frac) >> 32));
+        }
+        produced++;
+        rsmp->phase += step;
+    }
+
+    used = (size_t)(rsmp->phase >> 32);
+    if (used > *in_frames)
+        used = *in_frames;
+    if (used > 0)
+        memcpy(rsmp->last, in + (used - 1) * rsmp->channels,
+               rsmp->channels * sizeof(int16_t));
+    rsmp->phase -= (uint64_t)used << 32;
+    *in_frames = used;
+    *out_frames = produced;
+}
+
+static int fake_resampler_resample_from_input(struct resampler_itfe *resampler, int16_t *in,
+                                              size_t *in_frames, int16_t *out,
+                                              size_t *out_frames)
+{
+    struct fake_resampler *rsmp = (struct fake_resampler *)resampler;
+    size_t consumed = 0, produced = 0, in_count, out_count;
+
+    while (produced < *out_frames && consumed < *in_frames) {
+        in_count = *in_frames - consumed;
+        out_count = *out_frames - produced;
+        fake_resampler_run(rsmp, in + consumed * rsmp->channels, &in_count,
+                           out + produced * rsmp->channels, &out_count);
+        consumed += in_count;
+        produced += out_count;
+        if (in_count == 0 && out_count == 0)
+            break;
+    }
+    *in_frames = consumed;
+    *out_frames = produced;
+    return 0;
+}
+
+static int fake_resampler_resample_from_provider(struct resampler_itfe *resampler,
+                                                 int16_t *out, size_t *out_frames)
+{
+    struct fake_resampler *rsmp = (struct fake_resampler *)resampler;
+    struct resampler_buffer buf;
+    size_t produced = 0, in_count, out_count;
+
+    if (rsmp->provider == NULL) {
+        *out_frames = 0;
+        return -ENOSYS;
+    }
+
+    while (produced < *out_frames) {
+        buf.frame_count = (*out_frames - produced) * rsmp->in_rate / rsmp->out_rate + 2;
+        rsmp->provider->get_next_buffer(rsmp->provider, &buf);
+        if (buf.raw == NULL || buf.frame_count == 0)
+            break;
+        in_count = buf.frame_count;
+        out_count = *out_frames - produced;
+        fake_resampler_run(rsmp, buf.i16, &in_count, out + produced * rsmp->channels,
+                           &out_count);
+        buf.frame_count = in_count;
+        rsmp->provider->release_buffer(rsmp->provider, &buf);
+        produced += out_count;
+        if (in_count == 0 && out_count == 0)
+            break;
+    }
+    *out_frames = produced;
+    return 0;
+}
+
+int create_resampler(uint32_t inSampleRate,
+                     uint32_t outSampleRate,
+                     uint32_t channelCount,
+                     uint32_t quality,
+                     struct resampler_buffer_provider *provider,
+                     struct resampler_itfe **resampler)
+{
+    struct fake_resampler *rsmp;
+
+    if (resampler == NULL)
+        return -EINVAL;
+    *resampler = NULL;
+    if (inSampleRate == 0 || outSampleRate == 0 || channelCount < 1 ||
+            channelCount > FAKE_RESAMPLER_MAX_CHANNELS)
+        return -EINVAL;
+
+    rsmp = (struct fake_resampler *)calloc(1, sizeof(struct fake_resampler));
+    if (rsmp == NULL)
+        return -ENOMEM;
+
+    rsmp->itfe.reset = fake_resampler_reset;
+    rsmp->itfe.resample_from_provider = fake_resampler_resample_from_provider;
+    rsmp->itfe.resample_from_input = fake_resampler_resample_from_input;
+    rsmp->itfe.delay_ns = fake_resampler_delay_ns;
+    rsmp->provider = provider;
+    rsmp->in_rate = inSampleRate;
+    rsmp->out_rate = outSampleRate;
+    rsmp->channels = channelCount;
+
+    *resampler = &rsmp->itfe;
+    return 0;
+}
+
+void release_resampler(struct resampler_itfe *resampler)
+{
+    free(resampler);
+}
+
+struct fake_echo_reference {
+    struct echo_reference_itfe itfe;
+    uint32_t rd_channel_count;
+};
+
+static int fake_echo_reference_write(struct echo_reference_itfe *echo_reference,
+                                     struct echo_reference_buffer *buffer)
+{
+    return 0;
+}
+
+/* a NULL buffer stops the reading side */
+static int fake_echo_reference_read(struct echo_reference_itfe *echo_reference,
+                                    struct echo_reference_buffer *buffer)
+{
+    struct fake_echo_reference *er = (struct fake_echo_reference *)echo_reference;
+
+    if (buffer == NULL)
+        return 0;
+    memset(buffer->raw, 0, buffer->frame_count * er->rd_channel_count * sizeof(int16_t));
+    buffer->delay_ns = 0;
+    return 0;
+}
+
+int create_echo_reference(audio_format_t rdFormat,
+                          uint32_t rdChannelCount,
+                          uint32_t rdSamplingRate,
+                          audio_format_t wrFormat,
+                          uint32_t wrChannelCount,
+                          uint32_t wrSamplingRate,
+                          struct echo_reference_itfe **echo_reference)
+{
+    struct fake_echo_reference *er;
+
+    if (echo_reference == NULL)
+        return -EINVAL;
+    *echo_reference = NULL;
+    if (rdFormat != AUDIO_FORMAT_PCM_16_BIT || rdFormat != wrFormat)
+        return -EINVAL;
+    if (rdChannelCount < 1 || rdChannelCount > 2 || wrChannelCount != 2)
+        return -EINVAL;
+
+    er = (struct fake_echo_reference *)calloc(1, sizeof(struct fake_echo_reference));
+    if (er == NULL)
+        return -ENOMEM;
+
+    er->itfe.read = fake_echo_reference_read;
+    er->itfe.write = fake_echo_reference_write;
+    er->rd_channel_count = rdChannelCount;
+
+    *echo_reference = &er->itfe;
+    return 0;
+}
+
+void release_echo_reference(struct echo_reference_itfe *echo_reference)
+{
+    free(echo_reference);
+}
@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) 2017 The LineageOS Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Host replacement for the system properties of libcutils, which the host
+ * libcutils does not build: a property is read from the environment
+ * variable of the same name. Shells cannot set names with dots, env(1) can:
+ *
+ *     env ro.debuggable=1 persist.audio.ril_client_lib=libsecril-client-fake.so \
+ *         audio_hw_call_test
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <cutils/properties.h>
+
+int property_get(const char *key, char *value, const char *default_value)
+{
+    const char *env = getenv(key);
+    int len;
+
+    if (env == NULL)
+        env = default_value;
+    if (env == NULL) {
+        value[0] = '\0';
+        return 0;
+    }
+    len = snprintf(value, PROPERTY_VALUE_MAX, "%s", env);
+    return len < PROPERTY_VALUE_MAX ? len : PROPERTY_VALUE_MAX - 1;
+}
+
+int8_t property_get_bool(const char *key, int8_t default_value)
+{
+    char value[PROPERTY_VALUE_MAX];
+
+    if (property_get(key, value, NULL) <= 0)
+        return default_value;
+    if (strcmp(value, "1") == 0 || strcmp(value, "y") == 0 || strcmp(value, "yes") == 0 ||
+            strcmp(value, "on") == 0 || strcmp(value, "true") == 0)
+        return true;
+    if (strcmp(value, "0") == 0 || strcmp(value, "n") == 0 || strcmp(value, "no") == 0 ||
+            strcmp(value, "off") == 0 || strcmp(value, "false") == 0)
+        return false;
+    return default_value;
+}
+
+int64_t property_get_int64(const char *key, int64_t default_value)
+{
+    char value[PROPERTY_VALUE_MAX];
+    char *end;
+    long long result;
+
+    if (property_get(key, value, NULL) <= 0)
+        return default_value;
+    result = strtoll(value, &end, 0);
+    if (end == value || *end != '\0')
+        return default_value;
+    return result;
+}
+
+int32_t property_get_int32(const char *key, int32_t default_value)
+{
+    int64_t result = property_get_int64(key, default_value);
+
+    if (result < INT32_MIN || result > INT32_MAX)
+        return default_value;
+    return (int32_t)result;
+}
@@ -0,0 +1,367 @@
+/*
+ * Copyright (C) 2017 The LineageOS Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "fake_secril_client"
+/*#define LOG_NDEBUG 0*/
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <cutils/log.h>
+#include <cutils/properties.h>
+
+#include "fake_secril_client.h"
+
+/*
+ * Implements the part of the libsecril-client.so API ril_interface.c uses.
+ * Every call succeeds after the configured latency and is logged. The only
+ * modem state is the wideband AMR flag, reported by GetWB_AMR() and pushed
+ * to the RIL_UNSOL_WB_AMR_STATE handler on demand or periodically.
+ */
+
+typedef int (*unsol_handler_t)(void *client, const void *data, size_t datalen);
+
+struct fake_client {
+    bool connected;
+
+    pthread_t toggle_thread;
+    bool toggle_running;
+    bool toggle_exit;
+    unsigned int toggle_ms;
+};
+
+static pthread_mutex_t fake_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t fake_cond = PTHREAD_COND_INITIALIZER;
+/* held from reading wb_amr to the return of the handler, so that a report
+ * cannot overtake a later one, like on the single RIL socket */
+static pthread_mutex_t report_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned int latency_us;
+static bool connect_error;
+static int wb_amr;
+static unsol_handler_t wb_amr_handler;
+static struct fake_client *wb_amr_client;
+static struct fake_secril_call *calls;
+static unsigned int num_calls;
+static unsigned int max_calls;
+
+static void fake_delay(void)
+{
+    unsigned int us;
+
+    pthread_mutex_lock(&fake_lock);
+    us = latency_us;
+    pthread_mutex_unlock(&fake_lock);
+    if (us)
+        usleep(us);
+}
+
+static int log_call(enum ril_cmd_type type, int arg1, int arg2)
+{
+    struct fake_secril_call *c;
+
+    fake_delay();
+
+    pthread_mutex_lock(&fake_lock);
+    if (num_calls == max_calls) {
+        c = realloc(calls, (max_calls ? max_calls * 2 : 64) * sizeof(*calls));
+        if (!c) {
+            pthread_mutex_unlock(&fake_lock);
+            return RIL_CLIENT_ERR_RESOURCE;
+        }
+        calls = c;
+        max_calls = max_calls ? max_calls * 2 : 64;
+    }
+    c = &calls[num_calls++];
+    c->type = type;
+    c->arg1 = arg1;
+    c->arg2 = arg2;
+    clock_gettime(CLOCK_MONOTONIC, &c->time);
+    pthread_mutex_unlock(&fake_lock);
+
+    ALOGV("%s: %d(%d, %d)", __func__, type, arg1, arg2);
+    return RIL_CLIENT_ERR_SUCCESS;
+}
+
+static int deliver_wb_amr(int enable)
+{
+    unsol_handler_t handler;
+    struct fake_client *client;
+
+    pthread_mutex_lock(&report_lock);
+    pthread_mutex_lock(&fake_lock);
+    wb_amr = enable;
+    handler = wb_amr_handler;
+    client = wb_amr_client;
+    pthread_mutex_unlock(&fake_lock);
+
+    if (handler)
+        handler(client, &enable, sizeof(enable));
+    pthread_mutex_unlock(&report_lock);
+    return handler ? 0 : -ENOENT;
+}
+
+/* unsolicited wideband AMR changes, as on a network handover */
+static void *toggle_thread(void *context)
+{
+    struct fake_client *client = context;
+    struct timespec ts;
+    int enable;
+
+    pthread_mutex_lock(&fake_lock);
+    while (!client->toggle_exit) {
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_sec += client->toggle_ms / 1000;
+        ts.tv_nsec += (client->toggle_ms % 1000) * 1000000;
+        if (ts.tv_nsec >= 1000000000) {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000;
+        }
+        if (pthread_cond_timedwait(&fake_cond, &fake_lock, &ts) != ETIMEDOUT)
+            continue;
+        if (!client->connected)
+            continue;
+
+        enable = !wb_amr;
+        pthread_mutex_unlock(&fake_lock);
+        ALOGI("%s: wideband AMR %s", __func__, enable ? "on" : "off");
+        deliver_wb_amr(enable);
+        pthread_mutex_lock(&fake_lock);
+    }
+    pthread_mutex_unlock(&fake_lock);
+    return NULL;
+}
+
+/* the properties only override what is set */
+static void read_properties(struct fake_client *client)
+{
+    int value;
+
+    value = property_get_int32(FAKE_SECRIL_LATENCY_PROPERTY, -1);
+    if (value >= 0)
+        latency_us = value;
+    value = property_get_int32(FAKE_SECRIL_WB_AMR_PROPERTY, -1);
+    if (value >= 0)
+        wb_amr = value != 0;
+    value = property_get_int32(FAKE_SECRIL_WB_AMR_TOGGLE_PROPERTY, 0);
+    if (value > 0)
+        client->toggle_ms = value;
+}
+
+/* libsecril-client API */
+
+void *OpenClient_RILD(void)
+{
+    struct fake_client *client = calloc(1, sizeof(*client));
+
+    if (!client)
+        return NULL;
+
+    pthread_mutex_lock(&fake_lock);
+    read_properties(client);
+    pthread_mutex_unlock(&fake_lock);
+
+    if (client->toggle_ms &&
+            pthread_create(&client->toggle_thread, NULL, toggle_thread, client) == 0)
+        client->toggle_running = true;
+
+    ALOGW("%s: fake RIL client, %u us per call", __func__, latency_us);
+    return client;
+}
+
+int CloseClient_RILD(void *data)
+{
+    struct fake_client *client = data;
+
+    if (client->toggle_running) {
+        pthread_mutex_lock(&fake_lock);
+        client->toggle_exit = true;
+        pthread_cond_broadcast(&fake_cond);
+        pthread_mutex_unlock(&fake_lock);
+        pthread_join(client->toggle_thread, NULL);
+    }
+
+    pthread_mutex_lock(&fake_lock);
+    if (wb_amr_client == client) {
+        wb_amr_handler = NULL;
+        wb_amr_client = NULL;
+    }
+    pthread_mutex_unlock(&fake_lock);
+
+    free(client);
+    return RIL_CLIENT_ERR_SUCCESS;
+}
+
+int Connect_RILD(void *data)
+{
+    struct fake_client *client = data;
+    int ret = RIL_CLIENT_ERR_SUCCESS;
+
+    fake_delay();
+
+    pthread_mutex_lock(&fake_lock);
+    if (connect_error)
+        ret = RIL_CLIENT_ERR_CONNECT;
+    else
+        client->connected = true;
+    pthread_mutex_unlock(&fake_lock);
+    return ret;
+}
+
+int isConnected_RILD(void *data)
+{
+    struct fake_client *client = data;
+    int connected;
+
+    pthread_mutex_lock(&fake_lock);
+    connected = client->connected;
+    pthread_mutex_unlock(&fake_lock);
+    return connected;
+}
+
+int Disconnect_RILD(void *data)
+{
+    struct fake_client *client = data;
+
+    pthread_mutex_lock(&fake_lock);
+    client->connected = false;
+    pthread_mutex_unlock(&fake_lock);
+    return RIL_CLIENT_ERR_SUCCESS;
+}
+
+int SetCallVolume(void *data, enum ril_sound_type type, int level)
+{
+    return log_call(RIL_CMD_CALL_VOLUME, type, level);
+}
+
+int SetCallAudioPath(void *data, enum ril_audio_path path)
+{
+    return log_call(RIL_CMD_CALL_AUDIO_PATH, path, 0);
+}
+
+int SetCallClockSync(void *data, enum ril_clock_state state)
+{
+    return log_call(RIL_CMD_CALL_CLOCK_SYNC, state, 0);
+}
+
+int SetTwoMicControl(void *data, enum ril_two_mic_device device, enum ril_two_mic_state state)
+{
+    return log_call(RIL_CMD_TWO_MIC_CONTROL, device, state);
+}
+
+int SetMute(void *data, enum ril_mic_mute state)
+{
+    return log_call(RIL_CMD_MIC_MUTE, state, 0);
+}
+
+int RegisterUnsolicitedHandler(void *data, int id, void *handler)
+{
+    if (id != RIL_UNSOL_WB_AMR_STATE)
+        return RIL_CLIENT_ERR_INVAL;
+
+    pthread_mutex_lock(&fake_lock);
+    wb_amr_handler = (unsol_handler_t)handler;
+    wb_amr_client = data;
+    pthread_mutex_unlock(&fake_lock);
+    return RIL_CLIENT_ERR_SUCCESS;
+}
+
+/* the response arrives right away rather than from the RIL socket */
+int GetWB_AMR(void *data, void *handler)
+{
+    int enable;
+
+    fake_delay();
+
+    pthread_mutex_lock(&report_lock);
+    pthread_mutex_lock(&fake_lock);
+    enable = wb_amr;
+    pthread_mutex_unlock(&fake_lock);
+
+    ((unsol_handler_t)handler)(data, &enable, sizeof(enable));
+    pthread_mutex_unlock(&report_lock);
+    return RIL_CLIENT_ERR_SUCCESS;
+}
+
+/* test interface, see fake_secril_client.h */
+
+void fake_secril_reset(void)
+{
+    pthread_mutex_lock(&fake_lock);
+    latency_us = 0;
+    connect_error = false;
+    wb_amr = 0;
+    num_calls = 0;
+    pthread_mutex_unlock(&fake_lock);
+}
+
+void fake_secril_set_latency_us(unsigned int us)
+{
+    pthread_mutex_lock(&fake_lock);
+    latency_us = us;
+    pthread_mutex_unlock(&fake_lock);
+}
+
+void fake_secril_set_connect_error(bool error)
+{
+    pthread_mutex_lock(&fake_lock);
+    connect_error = error;
+    pthread_mutex_unlock(&fake_lock);
+}
+
+void fake_secril_set_wb_amr(int enable)
+{
+    pthread_mutex_lock(&fake_lock);
+    wb_amr = enable;
+    pthread_mutex_unlock(&fake_lock);
+}
+
+int fake_secril_send_wb_amr(int enable)
+{
+    return deliver_wb_amr(enable);
+}
+
+unsigned int fake_secril_get_num_calls(void)
+{
+    unsigned int n;
+
+    pthread_mutex_lock(&fake_lock);
+    n = num_calls;
+    pthread_mutex_unlock(&fake_lock);
+    return n;
+}
+
+bool fake_secril_get_call(unsigned int index, struct fake_secril_call *call)
+{
+    bool found = false;
+
+    pthread_mutex_lock(&fake_lock);
+    if (index < num_calls) {
+        *call = calls[index];
+        found = true;
+    }
+    pthread_mutex_unlock(&fake_lock);
+    return found;
+}
+
+void fake_secril_clear_calls(void)
+{
+    pthread_mutex_lock(&fake_lock);
+    num_calls = 0;
+    pthread_mutex_unlock(&fake_lock);
+}
@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) 2017 The LineageOS Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FAKE_SECRIL_CLIENT_H
+#define FAKE_SECRIL_CLIENT_H
+
+#include <stdbool.h>
+#include <time.h>
+
+#include "ril_interface.h"
+
+/*
+ * libsecril-client-fake: the client API of libsecril-client.so without a
+ * modem, see fake_secril_client.c.
+ *
+ * On the target it is loaded through RIL_CLIENT_LIBPATH_PROPERTY on
+ * debuggable builds and configured with the properties below, read by
+ * OpenClient_RILD(). The host tests link it and drive it with the
+ * functions below.
+ */
+
+/* every client call takes this long, a slow RIL socket */
+#define FAKE_SECRIL_LATENCY_PROPERTY    "persist.audio.fake_ril.latency_us"
+/* wideband AMR state reported by GetWB_AMR() */
+#define FAKE_SECRIL_WB_AMR_PROPERTY     "persist.audio.fake_ril.wb_amr"
+/* toggle the wideband AMR state with an unsolicited response this often */
+#define FAKE_SECRIL_WB_AMR_TOGGLE_PROPERTY "persist.audio.fake_ril.wb_amr_toggle_ms"
+
+/* a call into the client API other than connection management */
+struct fake_secril_call {
+    enum ril_cmd_type type;
+    int arg1;
+    int arg2;
+    struct timespec time;       /* CLOCK_MONOTONIC, when it returned */
+};
+
+/* Function prototypes */
+
+/* forget the state, settings and calls */
+void fake_secril_reset(void);
+void fake_secril_set_latency_us(unsigned int us);
+/* Connect_RILD() fails while set, like with the RIL daemon down */
+void fake_secril_set_connect_error(bool error);
+void fake_secril_set_wb_amr(int enable);
+/* deliver the wideband AMR state like the modem does on a codec change,
+ * -ENOENT if no handler is registered */
+int fake_secril_send_wb_amr(int enable);
+
+unsigned int fake_secril_get_num_calls(void);
+/* returns false past the end of the log */
+bool fake_secril_get_call(unsigned int index, struct fake_secril_call *call);
+void fake_secril_clear_calls(void);
+#endif
@@ -0,0 +1,1229 @@
+/*
+ * Copyright (C) 2017 The LineageOS Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "fake_tinyalsa"
+/*#define LOG_NDEBUG 0*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <expat.h>
+
+#include <cutils/log.h>
+
+#include "fake_tinyalsa.h"
+
+#define FAKE_MAX_CARDS      2
+#define FAKE_MAX_DEVICES    4
+#define FAKE_MAX_VALUES     8
+#define FAKE_MAX_ENUMS      16
+
+#define NSEC_PER_SEC        1000000000LL
+
+struct pcm_params {
+    unsigned int min_rate;
+    unsigned int max_rate;
+    unsigned int min_channels;
+    unsigned int max_channels;
+};
+
+/* one direction of a PCM device */
+struct fake_dev {
+    struct fake_pcm_stats stats;
+    struct pcm *pcm;
+
+    fake_pcm_sink_t sink;
+    fake_pcm_source_t source;
+    void *context;
+
+    unsigned int open_delay_us;
+    bool open_error;
+
+    bool has_params;
+    struct pcm_params params;
+};
+
+struct pcm {
+    struct fake_dev *dev;
+    unsigned int flags;
+    struct pcm_config config;
+    unsigned int buffer_size;
+    unsigned int frame_size;
+    int16_t *buf;
+    int fd;
+    char error[128];
+
+    bool running;
+    struct timespec start;      /* clock origin, CLOCK_MONOTONIC */
+    int64_t hw_start;           /* hw at start */
+    int64_t hw;
+    int64_t appl;
+    uint64_t pos;               /* frames moved by the clock since the open */
+};
+
+struct mixer_ctl {
+    unsigned int id;
+    char *name;
+    enum mixer_ctl_type type;
+    unsigned int num_values;
+    int max;
+    const char *enums[FAKE_MAX_ENUMS];
+    unsigned int num_enums;
+    int value[FAKE_MAX_VALUES];
+};
+
+struct mixer {
+    unsigned int card;
+};
+
+/* WM1811 controls the configuration does not describe well enough: written
+ * by the HAL only, or with more than one value */
+struct fake_ctl_def {
+    const char *name;
+    enum mixer_ctl_type type;
+    unsigned int num_values;
+    int max;
+    const char *enums[FAKE_MAX_ENUMS];
+};
+
+static const struct fake_ctl_def wm1811_ctls[] = {
+    { "AIF1DAC1 Volume", MIXER_CTL_TYPE_INT, 2, 120, { NULL } },
+    { "AIF1DAC1 DRC Switch", MIXER_CTL_TYPE_BOOL, 1, 1, { NULL } },
+    { "AIF2ADCL DRC Switch", MIXER_CTL_TYPE_BOOL, 1, 1, { NULL } },
+    { "AIF2 Mode", MIXER_CTL_TYPE_INT, 1, 1, { NULL } },
+    { "AIF2DAC Mux", MIXER_CTL_TYPE_ENUM, 1, 1, { "AIF2DACDAT", "AIF3DACDAT", NULL } },
+    { "DAC1L Mixer AIF2 Switch", MIXER_CTL_TYPE_BOOL, 1, 1, { NULL } },
+    { "DAC1R Mixer AIF2 Switch", MIXER_CTL_TYPE_BOOL, 1, 1, { NULL } },
+    { "Headphone Volume", MIXER_CTL_TYPE_INT, 2, 63, { NULL } },
+    { "Speaker Volume", MIXER_CTL_TYPE_INT, 2, 63, { NULL } },
+    { "ADCL Mux", MIXER_CTL_TYPE_ENUM, 1, 1, { "ADC", "DMIC", NULL } },
+    { "ADCR Mux", MIXER_CTL_TYPE_ENUM, 1, 1, { "ADC", "DMIC", NULL } },
+};
+
+static pthread_mutex_t fake_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct fake_dev devs[FAKE_MAX_CARDS][FAKE_MAX_DEVICES][2];
+
+static struct mixer_ctl *ctls;
+static unsigned int num_ctls;
+static bool ctls_loaded;
+static unsigned int write_delay_us;
+static struct fake_mixer_write *writes;
+static unsigned int num_writes;
+static unsigned int max_writes;
+
+static struct pcm bad_pcm = {
+    .fd = -1,
+    .error = "no such device",
+};
+
+static int64_t ts_to_ns(const struct timespec *ts)
+{
+    return ts->tv_sec * NSEC_PER_SEC + ts->tv_nsec;
+}
+
+static struct timespec ns_to_ts(int64_t ns)
+{
+    struct timespec ts = { .tv_sec = ns / NSEC_PER_SEC, .tv_nsec = ns % NSEC_PER_SEC };
+    return ts;
+}
+
+static void sleep_ns(int64_t ns)
+{
+    struct timespec ts;
+
+    if (ns <= 0)
+        return;
+    ts = ns_to_ts(ns);
+    while (nanosleep(&ts, &ts) != 0 && errno == EINTR)
+        ;
+}
+
+static struct fake_dev *get_dev(unsigned int card, unsigned int device, unsigned int flags)
+{
+    if (card >= FAKE_MAX_CARDS || device >= FAKE_MAX_DEVICES)
+        return NULL;
+    return &devs[card][device][(flags & PCM_IN) ? 1 : 0];
+}
+
+/*
+ * PCM clock
+ */
+
+static bool is_capture(const struct pcm *pcm)
+{
+    return (pcm->flags & PCM_IN) != 0;
+}
+
+static int64_t pcm_avail(const struct pcm *pcm)
+{
+    if (is_capture(pcm))
+        return pcm->hw - pcm->appl;
+    return pcm->buffer_size - (pcm->appl - pcm->hw);
+}
+
+/* hand the frames between pcm->hw and hw to the sink, or get them from the
+ * source, then move pcm->hw there */
+static void pcm_move_hw(struct pcm *pcm, int64_t hw)
+{
+    struct fake_dev *dev = pcm->dev;
+    unsigned int offset, frames;
+
+    while (pcm->hw < hw) {
+        offset = pcm->hw % pcm->buffer_size;
+        frames = pcm->buffer_size - offset;
+        if (frames > hw - pcm->hw)
+            frames = hw - pcm->hw;
+
+        if (is_capture(pcm)) {
+            if (dev->source)
+                dev->source(dev->context, pcm->buf + offset * pcm->config.channels, frames,
+                            pcm->config.channels, pcm->config.rate, pcm->pos);
+            else
+                memset(pcm->buf + offset * pcm->config.channels, 0, frames * pcm->frame_size);
+        } else if (dev->sink) {
+            dev->sink(dev->context, pcm->buf + offset * pcm->config.channels, frames, pcm->pos);
+        }
+
+        pcm->hw += frames;
+        pcm->pos += frames;
+    }
+}
+
+/* run the clock up to now, stopping the PCM on an xrun.
+ * Returns true if an xrun happened */
+static bool pcm_update(struct pcm *pcm)
+{
+    struct timespec now;
+    int64_t hw, limit;
+
+    if (!pcm->running)
+        return false;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    hw = pcm->hw_start +
+            (ts_to_ns(&now) - ts_to_ns(&pcm->start)) * pcm->config.rate / NSEC_PER_SEC;
+
+    /* the driver stops once avail reaches the stop threshold */
+    if (is_capture(pcm))
+        limit = pcm->appl + pcm->config.stop_threshold;
+    else
+        limit = pcm->appl - pcm->buffer_size + pcm->config.stop_threshold;
+
+    if (hw < limit) {
+        pcm_move_hw(pcm, hw);
+        return false;
+    }
+
+    pcm_move_hw(pcm, limit);
+    pcm->running = false;
+    pcm->dev->stats.xruns++;
+    ALOGV("%s: xrun at %lld", __func__, (long long)pcm->hw);
+    return true;
+}
+
+static void pcm_run(struct pcm *pcm)
+{
+    clock_gettime(CLOCK_MONOTONIC, &pcm->start);
+    pcm->hw_start = pcm->hw;
+    pcm->running = true;
+}
+
+/* time until avail reaches frames, assuming the PCM is running */
+static int64_t pcm_wait_ns(const struct pcm *pcm, int64_t frames)
+{
+    int64_t missing = frames - pcm_avail(pcm);
+
+    if (missing <= 0)
+        return 0;
+    return (missing * NSEC_PER_SEC + pcm->config.rate - 1) / pcm->config.rate;
+}
+
+static int pcm_error(struct pcm *pcm, int err, const char *what)
+{
+    snprintf(pcm->error, sizeof(pcm->error), "%s: %s", what, strerror(err));
+    errno = err;
+    return -1;
+}
+
+/*
+ * libtinyalsa PCM interface
+ */
+
+struct pcm *pcm_open(unsigned int card, unsigned int device, unsigned int flags,
+                     struct pcm_config *config)
+{
+    struct fake_dev *dev;
+    struct pcm *pcm;
+
+    pthread_mutex_lock(&fake_lock);
+    dev = get_dev(card, device, flags);
+    if (!dev || !config || dev->open_error || dev->pcm) {
+        pthread_mutex_unlock(&fake_lock);
+        return &bad_pcm;
+    }
+    if (dev->open_delay_us) {
+        pthread_mutex_unlock(&fake_lock);
+        usleep(dev->open_delay_us);
+        pthread_mutex_lock(&fake_lock);
+    }
+
+    pcm = calloc(1, sizeof(struct pcm));
+    if (!pcm) {
+        pthread_mutex_unlock(&fake_lock);
+        return &bad_pcm;
+    }
+    pcm->dev = dev;
+    pcm->flags = flags;
+    pcm->config = *config;
+    pcm->buffer_size = config->period_size * config->period_count;
+    pcm->frame_size = config->channels * sizeof(int16_t);
+
+    /* the defaults of libtinyalsa */
+    if (!pcm->config.start_threshold)
+        pcm->config.start_threshold = is_capture(pcm) ? 1 : pcm->buffer_size / 2;
+    if (pcm->config.start_threshold > pcm->buffer_size)
+        pcm->config.start_threshold = pcm->buffer_size;
+    if (!pcm->config.stop_threshold)
+        pcm->config.stop_threshold = pcm->buffer_size;
+    if (!pcm->config.avail_min)
+        pcm->config.avail_min = config->period_size;
+
+    pcm->buf = calloc(pcm->buffer_size, pcm->frame_size);
+    pcm->fd = open("/dev/null", O_RDWR | O_CLOEXEC);
+    if (!pcm->buf || pcm->fd < 0 || pcm->buffer_size == 0 || config->rate == 0) {
+        if (pcm->fd >= 0)
+            close(pcm->fd);
+        free(pcm->buf);
+        free(pcm);
+        pthread_mutex_unlock(&fake_lock);
+        return &bad_pcm;
+    }
+
+    dev->pcm = pcm;
+    dev->stats.opens++;
+    dev->stats.open = true;
+    dev->stats.config = *config;
+    dev->stats.flags = flags;
+    pthread_mutex_unlock(&fake_lock);
+
+    return pcm;
+}
+
+int pcm_close(struct pcm *pcm)
+{
+    if (pcm == &bad_pcm)
+        return 0;
+
+    pthread_mutex_lock(&fake_lock);
+    pcm_update(pcm);
+    pcm->dev->stats.open = false;
+    pcm->dev->pcm = NULL;
+    pthread_mutex_unlock(&fake_lock);
+
+    close(pcm->fd);
+    free(pcm->buf);
+    free(pcm);
+    return 0;
+}
+
+int pcm_is_ready(struct pcm *pcm)
+{
+    return pcm->fd >= 0;
+}
+
+const char *pcm_get_error(struct pcm *pcm)
+{
+    return pcm->error;
+}
+
+int pcm_get_file_descriptor(struct pcm *pcm)
+{
+    return pcm->fd;
+}
+
+int pcm_get_poll_fd(struct pcm *pcm)
+{
+    return pcm->fd;
+}
+
+unsigned int pcm_get_buffer_size(struct pcm *pcm)
+{
+    return pcm->buffer_size;
+}
+
+unsigned int pcm_frames_to_bytes(struct pcm *pcm, unsigned int frames)
+{
+    return frames * pcm->frame_size;
+}
+
+unsigned int pcm_bytes_to_frames(struct pcm *pcm, unsigned int bytes)
+{
+    return bytes / pcm->frame_size;
+}
+
+int pcm_set_avail_min(struct pcm *pcm, int avail_min)
+{
+    pthread_mutex_lock(&fake_lock);
+    pcm->config.avail_min = avail_min;
+    pthread_mutex_unlock(&fake_lock);
+    return 0;
+}
+
+int pcm_prepare(struct pcm *pcm)
+{
+    if (!pcm_is_ready(pcm))
+        return -1;
+
+    pthread_mutex_lock(&fake_lock);
+    pcm_update(pcm);
+    pcm->running = false;
+    pcm->appl = pcm->hw;
+    pthread_mutex_unlock(&fake_lock);
+    return 0;
+}
+
+int pcm_start(struct pcm *pcm)
+{
+    if (!pcm_is_ready(pcm))
+        return -1;
+
+    pthread_mutex_lock(&fake_lock);
+    clock_gettime(CLOCK_MONOTONIC, &pcm->dev->stats.started);
+    if (!pcm->running)
+        pcm_run(pcm);
+    pthread_mutex_unlock(&fake_lock);
+    return 0;
+}
+
+int pcm_stop(struct pcm *pcm)
+{
+    if (!pcm_is_ready(pcm))
+        return -1;
+
+    pthread_mutex_lock(&fake_lock);
+    clock_gettime(CLOCK_MONOTONIC, &pcm->dev->stats.stopped);
+    pcm_update(pcm);
+    pcm->running = false;
+    pcm->appl = pcm->hw;
+    pthread_mutex_unlock(&fake_lock);
+    return 0;
+}
+
+/* copy frames in or out of the buffer at the application pointer */
+static void pcm_copy(struct pcm *pcm, char *data, unsigned int frames)
+{
+    unsigned int offset, n;
+
+    while (frames > 0) {
+        offset = pcm->appl % pcm->buffer_size;
+        n = pcm->buffer_size - offset;
+        if (n > frames)
+            n = frames;
+        if (is_capture(pcm))
+            memcpy(data, pcm->buf + offset * pcm->config.channels, n * pcm->frame_size);
+        else
+            memcpy(pcm->buf + offset * pcm->config.channels, data, n * pcm->frame_size);
+        pcm->appl += n;
+        data += n * pcm->frame_size;
+        frames -= n;
+    }
+}
+
+/* blocking transfer like SNDRV_PCM_IOCTL_WRITEI/READI_FRAMES with the
+ * restart on xrun of pcm_write() and pcm_read() */
+static int pcm_transfer(struct pcm *pcm, char *data, unsigned int count)
+{
+    unsigned int frames = count / pcm->frame_size;
+    unsigned int n;
+    int64_t avail, wait_ns;
+
+    if (!pcm_is_ready(pcm))
+        return pcm_error(pcm, EBADFD, "transfer");
+
+    pthread_mutex_lock(&fake_lock);
+    pcm->dev->stats.transfers++;
+
+    if (is_capture(pcm) && !pcm->running) {
+        pcm->appl = pcm->hw;
+        pcm_run(pcm);
+    }
+
+    while (frames > 0) {
+        if (pcm_update(pcm)) {
+            pcm->appl = pcm->hw;
+            if (pcm->flags & PCM_NORESTART) {
+                pthread_mutex_unlock(&fake_lock);
+                return -EPIPE;
+            }
+            if (is_capture(pcm))
+                pcm_run(pcm);
+        }
+
+        avail = pcm_avail(pcm);
+        if (avail <= 0 || (avail < frames && avail < pcm->config.avail_min)) {
+            /* a playback PCM which is not running yet has room */
+            wait_ns = pcm_wait_ns(pcm, frames < (unsigned int)pcm->config.avail_min ?
+                                            frames : (unsigned int)pcm->config.avail_min);
+            pcm->dev->stats.wakeups++;
+            pthread_mutex_unlock(&fake_lock);
+            sleep_ns(wait_ns);
+            pthread_mutex_lock(&fake_lock);
+            continue;
+        }
+
+        n = avail < frames ? avail : frames;
+        pcm_copy(pcm, data, n);
+        pcm->dev->stats.frames += n;
+        data += n * pcm->frame_size;
+        frames -= n;
+
+        if (!is_capture(pcm) && !pcm->running &&
+                pcm->appl - pcm->hw >= pcm->config.start_threshold)
+            pcm_run(pcm);
+    }
+
+    pthread_mutex_unlock(&fake_lock);
+    return 0;
+}
+
+int pcm_write(struct pcm *pcm, const void *data, unsigned int count)
+{
+    if (is_capture(pcm))
+        return pcm_error(pcm, EINVAL, "write");
+    return pcm_transfer(pcm, (char *)data, count);
+}
+
+int pcm_read(struct pcm *pcm, void *data, unsigned int count)
+{
+    if (!is_capture(pcm))
+        return pcm_error(pcm, EINVAL, "read");
+    return pcm_transfer(pcm, data, count);
+}
+
+int pcm_mmap_write(struct pcm *pcm, const void *data, unsigned int count)
+{
+    return pcm_write(pcm, data, count);
+}
+
+int pcm_mmap_read(struct pcm *pcm, void *data, unsigned int count)
+{
+    return pcm_read(pcm, data, count);
+}
+
+int pcm_mmap_avail(struct pcm *pcm)
+{
+    int avail;
+
+    pthread_mutex_lock(&fake_lock);
+    pcm_update(pcm);
+    avail = pcm_avail(pcm);
+    pthread_mutex_unlock(&fake_lock);
+    return avail;
+}
+
+int pcm_mmap_begin(struct pcm *pcm, void **areas, unsigned int *offset,
+                   unsigned int *frames)
+{
+    int64_t avail;
+    unsigned int n;
+
+    if (!pcm_is_ready(pcm) || !(pcm->flags & PCM_MMAP))
+        return pcm_error(pcm, EINVAL, "mmap_begin");
+
+    pthread_mutex_lock(&fake_lock);
+    pcm_update(pcm);
+    avail = pcm_avail(pcm);
+    if (avail < 0)
+        avail = 0;
+    if (avail > pcm->buffer_size)
+        avail = pcm->buffer_size;
+
+    *areas = pcm->buf;
+    *offset = pcm->appl % pcm->buffer_size;
+    n = pcm->buffer_size - *offset;
+    if (n > avail)
+        n = avail;
+    if (n > *frames)
+        n = *frames;
+    *frames = n;
+    pthread_mutex_unlock(&fake_lock);
+    return 0;
+}
+
+int pcm_mmap_commit(struct pcm *pcm, unsigned int offset, unsigned int frames)
+{
+    (void)offset;
+
+    pthread_mutex_lock(&fake_lock);
+    pcm->appl += frames;
+    pcm->dev->stats.frames += frames;
+    pcm->dev->stats.transfers++;
+    if (!is_capture(pcm) && !pcm->running &&
+            pcm->appl - pcm->hw >= pcm->config.start_threshold)
+        pcm_run(pcm);
+    pthread_mutex_unlock(&fake_lock);
+    return frames;
+}
+
+/* time at which the hardware pointer reached its current position */
+static struct timespec pcm_hw_time(const struct pcm *pcm, bool monotonic)
+{
+    struct timespec now_rt, now_mono;
+    int64_t ns;
+
+    ns = ts_to_ns(&pcm->start) +
+            (pcm->hw - pcm->hw_start) * NSEC_PER_SEC / pcm->config.rate;
+    if (!monotonic) {
+        clock_gettime(CLOCK_REALTIME, &now_rt);
+        clock_gettime(CLOCK_MONOTONIC, &now_mono);
+        ns += ts_to_ns(&now_rt) - ts_to_ns(&now_mono);
+    }
+    return ns_to_ts(ns);
+}
+
+int pcm_mmap_get_hw_ptr(struct pcm *pcm, unsigned int *hw_ptr, struct timespec *tstamp)
+{
+    if (!pcm_is_ready(pcm))
+        return pcm_error(pcm, EBADFD, "mmap_get_hw_ptr");
+
+    pthread_mutex_lock(&fake_lock);
+    pcm_update(pcm);
+    *hw_ptr = (unsigned int)pcm->hw;
+    *tstamp = pcm_hw_time(pcm, (pcm->flags & PCM_MONOTONIC) != 0);
+    pthread_mutex_unlock(&fake_lock);
+    return 0;
+}
+
+int pcm_get_htimestamp(struct pcm *pcm, unsigned int *avail, struct timespec *tstamp)
+{
+    int64_t frames;
+
+    if (!pcm_is_ready(pcm))
+        return -1;
+
+    pthread_mutex_lock(&fake_lock);
+    pcm_update(pcm);
+    if (!pcm->running) {
+        pthread_mutex_unlock(&fake_lock);
+        return -1;
+    }
+    frames = pcm_avail(pcm);
+    *avail = frames < 0 ? 0 : (unsigned int)frames;
+    *tstamp = pcm_hw_time(pcm, (pcm->flags & PCM_MONOTONIC) != 0);
+    pthread_mutex_unlock(&fake_lock);
+    return 0;
+}
+
+int pcm_wait(struct pcm *pcm, int timeout)
+{
+    int64_t wait_ns;
+
+    pthread_mutex_lock(&fake_lock);
+    pcm_update(pcm);
+    wait_ns = pcm->running ? pcm_wait_ns(pcm, pcm->config.avail_min) : 0;
+    pthread_mutex_unlock(&fake_lock);
+
+    if (timeout >= 0 && wait_ns > (int64_t)timeout * 1000000)
+        wait_ns = (int64_t)timeout * 1000000;
+    sleep_ns(wait_ns);
+    return 1;
+}
+
+struct pcm_params *pcm_params_get(unsigned int card, unsigned int device, unsigned int flags)
+{
+    struct fake_dev *dev;
+    struct pcm_params *params = NULL;
+
+    pthread_mutex_lock(&fake_lock);
+    dev = get_dev(card, device, flags);
+    if (dev && dev->has_params) {
+        params = malloc(sizeof(struct pcm_params));
+        if (params)
+            *params = dev->params;
+    }
+    pthread_mutex_unlock(&fake_lock);
+    return params;
+}
+
+void pcm_params_free(struct pcm_params *params)
+{
+    free(params);
+}
+
+unsigned int pcm_params_get_min(struct pcm_params *params, enum pcm_param param)
+{
+    switch (param) {
+    case PCM_PARAM_RATE:
+        return params->min_rate;
+    case PCM_PARAM_CHANNELS:
+        return params->min_channels;
+    default:
+        return 0;
+    }
+}
+
+unsigned int pcm_params_get_max(struct pcm_params *params, enum pcm_param param)
+{
+    switch (param) {
+    case PCM_PARAM_RATE:
+        return params->max_rate;
+    case PCM_PARAM_CHANNELS:
+        return params->max_channels;
+    default:
+        return 0;
+    }
+}
+
+/*
+ * Mixer controls of card 0
+ */
+
+static struct mixer_ctl *find_ctl(const char *name)
+{
+    unsigned int i;
+
+    for (i = 0; i < num_ctls; i++) {
+        if (strcmp(ctls[i].name, name) == 0)
+            return &ctls[i];
+    }
+    return NULL;
+}
+
+static struct mixer_ctl *add_ctl(const char *name)
+{
+    struct mixer_ctl *ctl = find_ctl(name);
+    struct mixer_ctl *new_ctls;
+
+    if (ctl)
+        return ctl;
+
+    new_ctls = realloc(ctls, (num_ctls + 1) * sizeof(struct mixer_ctl));
+    if (!new_ctls)
+        return NULL;
+    ctls = new_ctls;
+    ctl = &ctls[num_ctls];
+    memset(ctl, 0, sizeof(*ctl));
+    ctl->name = strdup(name);
+    if (!ctl->name)
+        return NULL;
+    ctl->id = num_ctls++;
+    ctl->type = MIXER_CTL_TYPE_UNKNOWN;
+    ctl->num_values = 1;
+    return ctl;
+}
+
+static void add_enum(struct mixer_ctl *ctl, const char *str)
+{
+    unsigned int i;
+
+    for (i = 0; i < ctl->num_enums; i++) {
+        if (strcmp(ctl->enums[i], str) == 0)
+            return;
+    }
+    if (ctl->num_enums < FAKE_MAX_ENUMS)
+        ctl->enums[ctl->num_enums++] = strdup(str);
+}
+
+static void config_start_tag(void *data, const XML_Char *tag_name, const XML_Char **attr)
+{
+    const XML_Char *name = NULL;
+    const XML_Char *val = NULL;
+    struct mixer_ctl *ctl;
+    char *end;
+    long value;
+    unsigned int i;
+
+    (void)data;
+
+    if (strcmp(tag_name, "ctl") != 0)
+        return;
+
+    for (i = 0; attr[i]; i += 2) {
+        if (strcmp(attr[i], "name") == 0)
+            name = attr[i + 1];
+        else if (strcmp(attr[i], "val") == 0)
+            val = attr[i + 1];
+    }
+    if (!name || !val)
+        return;
+
+    ctl = add_ctl(name);
+    if (!ctl)
+        return;
+
+    value = strtol(val, &end, 0);
+    if (end != val && *end == '\0') {
+        if (ctl->type == MIXER_CTL_TYPE_UNKNOWN)
+            ctl->type = MIXER_CTL_TYPE_INT;
+        if (value > ctl->max)
+            ctl->max = value;
+    } else {
+        ctl->type = MIXER_CTL_TYPE_ENUM;
+        add_enum(ctl, val);
+    }
+}
+
+static int load_config(const char *path)
+{
+    XML_Parser parser;
+    FILE *f;
+    char buf[1024];
+    size_t len;
+    int ret = 0;
+
+    f = fopen(path, "r");
+    if (!f) {
+        ALOGE("%s: cannot open %s: %s", __func__, path, strerror(errno));
+        return -errno;
+    }
+
+    parser = XML_ParserCreate(NULL);
+    if (!parser) {
+        fclose(f);
+        return -ENOMEM;
+    }
+    XML_SetElementHandler(parser, config_start_tag, NULL);
+
+    do {
+        len = fread(buf, 1, sizeof(buf), f);
+        if (XML_Parse(parser, buf, len, feof(f)) == XML_STATUS_ERROR) {
+            ALOGE("%s: %s:%u: %s", __func__, path,
+                  (unsigned int)XML_GetCurrentLineNumber(parser),
+                  XML_ErrorString(XML_GetErrorCode(parser)));
+            ret = -EINVAL;
+            break;
+        }
+    } while (!feof(f));
+
+    XML_ParserFree(parser);
+    fclose(f);
+    return ret;
+}
+
+/* must be called with fake_lock held */
+static int load_ctls(void)
+{
+    const struct fake_ctl_def *def;
+    const char *path = getenv(FAKE_TINYALSA_CONFIG_ENV);
+    struct mixer_ctl *ctl;
+    unsigned int i, j;
+    int ret;
+
+    if (ctls_loaded)
+        return 0;
+
+    ret = load_config(path ? path : FAKE_TINYALSA_CONFIG);
+    if (ret != 0)
+        return ret;
+
+    for (i = 0; i < sizeof(wm1811_ctls) / sizeof(wm1811_ctls[0]); i++) {
+        def = &wm1811_ctls[i];
+        ctl = add_ctl(def->name);
+        if (!ctl)
+            return -ENOMEM;
+        ctl->type = def->type;
+        ctl->num_values = def->num_values;
+        ctl->max = def->max;
+        /* in the order of the codec, not of the configuration */
+        if (def->enums[0]) {
+            for (j = 0; j < ctl->num_enums; j++)
+                free((char *)ctl->enums[j]);
+            ctl->num_enums = 0;
+        }
+        for (j = 0; def->enums[j]; j++)
+            add_enum(ctl, def->enums[j]);
+    }
+
+    for (i = 0; i < num_ctls; i++) {
+        ctl = &ctls[i];
+        /* single bit controls are switches */
+        if (ctl->type == MIXER_CTL_TYPE_INT && ctl->max <= 1 && strstr(ctl->name, "Switch")) {
+            ctl->type = MIXER_CTL_TYPE_BOOL;
+            ctl->max = 1;
+        } else if (ctl->type == MIXER_CTL_TYPE_INT && ctl->max < 255) {
+            ctl->max = 255;
+        } else if (ctl->type == MIXER_CTL_TYPE_ENUM) {
+            ctl->max = ctl->num_enums - 1;
+        }
+    }
+
+    ctls_loaded = true;
+    return 0;
+}
+
+static void log_write(struct mixer_ctl *ctl, int value)
+{
+    struct fake_mixer_write *w;
+
+    if (num_writes == max_writes) {
+        max_writes = max_writes ? max_writes * 2 : 256;
+        w = realloc(writes, max_writes * sizeof(*w));
+        if (!w)
+            return;
+        writes = w;
+    }
+    w = &writes[num_writes++];
+    w->ctl_id = ctl->id;
+    w->name = ctl->name;
+    w->value = value;
+    clock_gettime(CLOCK_MONOTONIC, &w->time);
+}
+
+struct mixer *mixer_open(unsigned int card)
+{
+    struct mixer *mixer;
+
+    if (card != 0)
+        return NULL;
+
+    pthread_mutex_lock(&fake_lock);
+    if (load_ctls() != 0) {
+        pthread_mutex_unlock(&fake_lock);
+        return NULL;
+    }
+    pthread_mutex_unlock(&fake_lock);
+
+    mixer = calloc(1, sizeof(struct mixer));
+    if (mixer)
+        mixer->card = card;
+    return mixer;
+}
+
+void mixer_close(struct mixer *mixer)
+{
+    free(mixer);
+}
+
+unsigned int mixer_get_num_ctls(struct mixer *mixer)
+{
+    (void)mixer;
+    return num_ctls;
+}
+
+struct mixer_ctl *mixer_get_ctl(struct mixer *mixer, unsigned int id)
+{
+    (void)mixer;
+    return id < num_ctls ? &ctls[id] : NULL;
+}
+
+struct mixer_ctl *mixer_get_ctl_by_name(struct mixer *mixer, const char *name)
+{
+    (void)mixer;
+    return find_ctl(name);
+}
+
+const char *mixer_ctl_get_name(struct mixer_ctl *ctl)
+{
+    return ctl->name;
+}
+
+enum mixer_ctl_type mixer_ctl_get_type(struct mixer_ctl *ctl)
+{
+    return ctl->type;
+}
+
+unsigned int mixer_ctl_get_num_values(struct mixer_ctl *ctl)
+{
+    return ctl->num_values;
+}
+
+unsigned int mixer_ctl_get_num_enums(struct mixer_ctl *ctl)
+{
+    return ctl->num_enums;
+}
+
+const char *mixer_ctl_get_enum_string(struct mixer_ctl *ctl, unsigned int enum_id)
+{
+    return enum_id < ctl->num_enums ? ctl->enums[enum_id] : NULL;
+}
+
+int mixer_ctl_get_range_min(struct mixer_ctl *ctl)
+{
+    (void)ctl;
+    return 0;
+}
+
+int mixer_ctl_get_range_max(struct mixer_ctl *ctl)
+{
+    return ctl->max;
+}
+
+int mixer_ctl_get_value(struct mixer_ctl *ctl, unsigned int id)
+{
+    int value;
+
+    if (id >= ctl->num_values)
+        return -EINVAL;
+
+    pthread_mutex_lock(&fake_lock);
+    value = ctl->value[id];
+    pthread_mutex_unlock(&fake_lock);
+    return value;
+}
+
+int mixer_ctl_get_array(struct mixer_ctl *ctl, void *array, size_t count)
+{
+    unsigned int i;
+
+    if (count > ctl->num_values || ctl->type == MIXER_CTL_TYPE_ENUM)
+        return -EINVAL;
+
+    pthread_mutex_lock(&fake_lock);
+    for (i = 0; i < count; i++)
+        ((long *)array)[i] = ctl->value[i];
+    pthread_mutex_unlock(&fake_lock);
+    return 0;
+}
+
+/* one element write of the driver */
+static int ctl_write(struct mixer_ctl *ctl, const int *values, unsigned int first,
+                     unsigned int count)
+{
+    unsigned int i;
+
+    for (i = 0; i < count; i++) {
+        if (values[i] < 0 || values[i] > ctl->max)
+            return -EINVAL;
+    }
+
+    if (write_delay_us)
+        usleep(write_delay_us);
+
+    pthread_mutex_lock(&fake_lock);
+    for (i = 0; i < count; i++)
+        ctl->value[first + i] = values[i];
+    log_write(ctl, values[0]);
+    pthread_mutex_unlock(&fake_lock);
+    return 0;
+}
+
+int mixer_ctl_set_value(struct mixer_ctl *ctl, unsigned int id, int value)
+{
+    if (id >= ctl->num_values)
+        return -EINVAL;
+    return ctl_write(ctl, &value, id, 1);
+}
+
+int mixer_ctl_set_array(struct mixer_ctl *ctl, const void *array, size_t count)
+{
+    int values[FAKE_MAX_VALUES];
+    unsigned int i;
+
+    if (count > ctl->num_values || count == 0 || ctl->type == MIXER_CTL_TYPE_ENUM)
+        return -EINVAL;
+
+    /* integer controls are passed as long like in struct snd_ctl_elem_value */
+    for (i = 0; i < count; i++)
+        values[i] = (int)((const long *)array)[i];
+    return ctl_write(ctl, values, 0, count);
+}
+
+int mixer_ctl_set_enum_by_string(struct mixer_ctl *ctl, const char *string)
+{
+    int i;
+
+    if (ctl->type != MIXER_CTL_TYPE_ENUM || !string)
+        return -EINVAL;
+
+    for (i = 0; i < (int)ctl->num_enums; i++) {
+        if (strcmp(ctl->enums[i], string) == 0)
+            return ctl_write(ctl, &i, 0, 1);
+    }
+    return -EINVAL;
+}
+
+/*
+ * Test interface
+ */
+
+void fake_tinyalsa_reset(void)
+{
+    unsigned int i, j;
+
+    pthread_mutex_lock(&fake_lock);
+    for (i = 0; i < num_ctls; i++) {
+        for (j = 0; j < ctls[i].num_enums; j++)
+            free((char *)ctls[i].enums[j]);
+        free(ctls[i].name);
+    }
+    free(ctls);
+    ctls = NULL;
+    num_ctls = 0;
+    ctls_loaded = false;
+
+    free(writes);
+    writes = NULL;
+    num_writes = 0;
+    max_writes = 0;
+    write_delay_us = 0;
+
+    for (i = 0; i < FAKE_MAX_CARDS; i++) {
+        for (j = 0; j < FAKE_MAX_DEVICES; j++) {
+            ALOGE_IF(devs[i][j][0].pcm || devs[i][j][1].pcm,
+                     "%s: PCM %u,%u still open", __func__, i, j);
+            memset(&devs[i][j][0], 0, sizeof(struct fake_dev));
+            memset(&devs[i][j][1], 0, sizeof(struct fake_dev));
+        }
+    }
+    pthread_mutex_unlock(&fake_lock);
+}
+
+void fake_pcm_set_sink(unsigned int card, unsigned int device, fake_pcm_sink_t sink,
+                       void *context)
+{
+    struct fake_dev *dev = get_dev(card, device, PCM_OUT);
+
+    pthread_mutex_lock(&fake_lock);
+    dev->sink = sink;
+    dev->context = context;
+    pthread_mutex_unlock(&fake_lock);
+}
+
+void fake_pcm_set_source(unsigned int card, unsigned int device, fake_pcm_source_t source,
+                         void *context)
+{
+    struct fake_dev *dev = get_dev(card, device, PCM_IN);
+
+    pthread_mutex_lock(&fake_lock);
+    dev->source = source;
+    dev->context = context;
+    pthread_mutex_unlock(&fake_lock);
+}
+
+void fake_pcm_set_open_delay_us(unsigned int card, unsigned int device, unsigned int us)
+{
+    pthread_mutex_lock(&fake_lock);
+    get_dev(card, device, PCM_OUT)->open_delay_us = us;
+    get_dev(card, device, PCM_IN)->open_delay_us = us;
+    pthread_mutex_unlock(&fake_lock);
+}
+
+void fake_pcm_set_open_error(unsigned int card, unsigned int device, bool error)
+{
+    pthread_mutex_lock(&fake_lock);
+    get_dev(card, device, PCM_OUT)->open_error = error;
+    get_dev(card, device, PCM_IN)->open_error = error;
+    pthread_mutex_unlock(&fake_lock);
+}
+
+void fake_pcm_set_params(unsigned int card, unsigned int device, unsigned int flags,
+                         unsigned int min_rate, unsigned int max_rate,
+                         unsigned int min_channels, unsigned int max_channels)
+{
+    struct fake_dev *dev = get_dev(card, device, flags);
+
+    pthread_mutex_lock(&fake_lock);
+    dev->has_params = true;
+    dev->params.min_rate = min_rate;
+    dev->params.max_rate = max_rate;
+    dev->params.min_channels = min_channels;
+    dev->params.max_channels = max_channels;
+    pthread_mutex_unlock(&fake_lock);
+}
+
+int fake_pcm_get_stats(unsigned int card, unsigned int device, unsigned int flags,
+                       struct fake_pcm_stats *stats)
+{
+    struct fake_dev *dev = get_dev(card, device, flags);
+
+    if (!dev)
+        return -EINVAL;
+
+    pthread_mutex_lock(&fake_lock);
+    if (dev->pcm)
+        pcm_update(dev->pcm);
+    *stats = dev->stats;
+    pthread_mutex_unlock(&fake_lock);
+    return 0;
+}
+
+void fake_mixer_set_write_delay_us(unsigned int us)
+{
+    pthread_mutex_lock(&fake_lock);
+    write_delay_us = us;
+    pthread_mutex_unlock(&fake_lock);
+}
+
+unsigned int fake_mixer_get_num_writes(void)
+{
+    unsigned int n;
+
+    pthread_mutex_lock(&fake_lock);
+    n = num_writes;
+    pthread_mutex_unlock(&fake_lock);
+    return n;
+}
+
+bool fake_mixer_get_write(unsigned int index, struct fake_mixer_write *write)
+{
+    bool found;
+
+    pthread_mutex_lock(&fake_lock);
+    found = index < num_writes;
+    if (found)
+        *write = writes[index];
+    pthread_mutex_unlock(&fake_lock);
+    return found;
+}
+
+void fake_mixer_clear_writes(void)
+{
+    pthread_mutex_lock(&fake_lock);
+    num_writes = 0;
+    pthread_mutex_unlock(&fake_lock);
+}
+
+int fake_mixer_get_value(const char *name)
+{
+    struct mixer_ctl *ctl;
+    int value = -ENOENT;
+
+    pthread_mutex_lock(&fake_lock);
+    ctl = find_ctl(name);
+    if (ctl)
+        value = ctl->value[0];
+    pthread_mutex_unlock(&fake_lock);
+    return value;
+}
+
+int fake_mixer_peek(const char *name)
+{
+    struct mixer_ctl *ctl = find_ctl(name);
+
+    return ctl ? ctl->value[0] : -ENOENT;
+}
+
+int fake_mixer_poke(const char *name, int value)
+{
+    struct mixer_ctl *ctl;
+    unsigned int i;
+    int ret = -ENOENT;
+
+    pthread_mutex_lock(&fake_lock);
+    ctl = find_ctl(name);
+    if (ctl) {
+        for (i = 0; i < ctl->num_values; i++)
+            ctl->value[i] = value;
+        ret = 0;
+    }
+    pthread_mutex_unlock(&fake_lock);
+    return ret;
+}
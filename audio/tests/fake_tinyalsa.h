@@ -0,0 +1,106 @@
+/*
+ * Copyright (C) 2017 The LineageOS Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef FAKE_TINYALSA_H
+#define FAKE_TINYALSA_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <tinyalsa/asoundlib.h>
+
+/*
+ * Host replacement for libtinyalsa, see fake_tinyalsa.c.
+ *
+ * PCMs are ring buffers drained or filled by a clock running at the PCM
+ * rate from pcm_start(): writes block while the buffer is full, reads while
+ * it is empty, and the hardware pointer running past the application
+ * pointer is an xrun like on the real driver. The mixer of card 0 is built
+ * from the controls the configuration file writes plus the few the HAL
+ * writes on its own, and logs every write.
+ */
+
+/* card 0 mixer configuration, FAKE_TINYALSA_CONFIG_ENV overrides it */
+#ifndef FAKE_TINYALSA_CONFIG
+#define FAKE_TINYALSA_CONFIG "device/samsung/i9300/configs/tiny_hw.xml"
+#endif
+#define FAKE_TINYALSA_CONFIG_ENV "FAKE_TINYALSA_CONFIG"
+
+/* Called with the frames a playback PCM consumed from the application, pos
+ * is the index of the first frame since the PCM was opened */
+typedef void (*fake_pcm_sink_t)(void *context, const int16_t *buf, unsigned int frames,
+                                uint64_t pos);
+/* Fills the frames a capture PCM produced, silence if not set */
+typedef void (*fake_pcm_source_t)(void *context, int16_t *buf, unsigned int frames,
+                                  unsigned int channels, unsigned int rate, uint64_t pos);
+
+/* per PCM device and direction, kept across pcm_close() */
+struct fake_pcm_stats {
+    unsigned int opens;
+    bool open;
+    struct pcm_config config;   /* of the last open */
+    unsigned int flags;
+    uint64_t frames;            /* written or read */
+    unsigned int xruns;
+    unsigned int transfers;     /* pcm_write()/pcm_read()/pcm_mmap_commit() calls */
+    unsigned int wakeups;       /* times a transfer had to wait for the clock */
+    struct timespec started;    /* of the last pcm_start(), CLOCK_MONOTONIC */
+    struct timespec stopped;    /* of the last pcm_stop() */
+};
+
+struct fake_mixer_write {
+    unsigned int ctl_id;
+    const char *name;
+    int value;                  /* first value, enum index for enums */
+    struct timespec time;       /* CLOCK_MONOTONIC */
+};
+
+/* Function prototypes */
+
+/* forget the state of all PCMs and controls, hooks and statistics */
+void fake_tinyalsa_reset(void);
+
+void fake_pcm_set_sink(unsigned int card, unsigned int device, fake_pcm_sink_t sink,
+                       void *context);
+void fake_pcm_set_source(unsigned int card, unsigned int device, fake_pcm_source_t source,
+                         void *context);
+/* pcm_open() of this device sleeps this long, to model a slow driver */
+void fake_pcm_set_open_delay_us(unsigned int card, unsigned int device, unsigned int us);
+/* pcm_open() of this device fails while set */
+void fake_pcm_set_open_error(unsigned int card, unsigned int device, bool error);
+/* the range reported by pcm_params_get(), no device has one by default */
+void fake_pcm_set_params(unsigned int card, unsigned int device, unsigned int flags,
+                         unsigned int min_rate, unsigned int max_rate,
+                         unsigned int min_channels, unsigned int max_channels);
+int fake_pcm_get_stats(unsigned int card, unsigned int device, unsigned int flags,
+                       struct fake_pcm_stats *stats);
+
+/* every mixer_ctl_set_*() is delayed this long, an I2C write on the target */
+void fake_mixer_set_write_delay_us(unsigned int us);
+unsigned int fake_mixer_get_num_writes(void);
+/* returns false past the end of the log */
+bool fake_mixer_get_write(unsigned int index, struct fake_mixer_write *write);
+void fake_mixer_clear_writes(void);
+/* first value of the control, -ENOENT if there is no such control */
+int fake_mixer_get_value(const char *name);
+/* the same from a source or a sink, which are called with the fake state
+ * locked: what the codec routes to a capture PCM can depend on the mixer */
+int fake_mixer_peek(const char *name);
+/* change a control behind the HAL back, like alsa_amixer or the modem
+ * firmware would, without logging it */
+int fake_mixer_poke(const char *name, int value);
+#endif
@@ -0,0 +1,285 @@
+/*
+ * Copyright (C) 2017 The LineageOS Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * gain_ramp against a sample by sample model of the gain it must apply.
+ *
+ * Built twice: gain_ramp_test runs the scalar code and gain_ramp_neon_test
+ * the NEON code on the host through tests/neon_shim, so both must give the
+ * model output bit for bit.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "audio_test.h"
+#include "gain_ramp.h"
+
+#define MAX_FRAMES  1024
+#define RAMP_FRAMES 96
+
+/* Q8.24 gain the ramp went through, as the HAL computes it */
+struct model {
+    int32_t current;
+    int32_t target;
+    int32_t step;
+    size_t left;
+    size_t ramp_frames;
+    unsigned int channels;
+};
+
+static uint32_t seed = 1;
+
+static int16_t random_sample(void)
+{
+    seed = seed * 1103515245 + 12345;
+    return (int16_t)(seed >> 16);
+}
+
+static void random_fill(int16_t *buf, size_t samples)
+{
+    size_t i;
+
+    for (i = 0; i < samples; i++)
+        buf[i] = random_sample();
+    /* the extremes always show up */
+    buf[0] = INT16_MIN;
+    if (samples > 1)
+        buf[samples - 1] = INT16_MAX;
+}
+
+static int16_t model_mul(int16_t sample, int32_t gain)
+{
+    int32_t g = gain >> 9;
+
+    if (g > INT16_MAX)
+        g = INT16_MAX;
+    return (int16_t)(((int32_t)sample * g + (1 << 14)) >> 15);
+}
+
+static int32_t to_q24(float gain)
+{
+    return gain >= 1.0f ? GAIN_RAMP_UNITY : gain <= 0.0f ? 0 : (int32_t)(gain * GAIN_RAMP_UNITY);
+}
+
+static void model_init(struct model *m, unsigned int channels, size_t ramp_frames, float gain)
+{
+    memset(m, 0, sizeof(*m));
+    m->channels = channels;
+    m->ramp_frames = ramp_frames;
+    m->current = to_q24(gain);
+    m->target = m->current;
+}
+
+static void model_set(struct model *m, float gain)
+{
+    int32_t target = to_q24(gain);
+
+    if (target == m->target)
+        return;
+    m->target = target;
+    m->step = (target - m->current) / (int32_t)m->ramp_frames;
+    m->left = m->step != 0 ? m->ramp_frames : 0;
+    if (m->left == 0)
+        m->current = target;
+}
+
+/* a ramp multiplies every frame, the final gain is exact: unity copies */
+static void model_apply(struct model *m, int16_t *dst, const int16_t *src, size_t frames)
+{
+    size_t i;
+    unsigned int c;
+
+    for (i = 0; i < frames; i++) {
+        for (c = 0; c < m->channels; c++) {
+            int16_t s = src[i * m->channels + c];
+
+            if (m->left > 0)
+                dst[i * m->channels + c] = model_mul(s, m->current);
+            else if (m->current == GAIN_RAMP_UNITY)
+                dst[i * m->channels + c] = s;
+            else
+                dst[i * m->channels + c] = model_mul(s, m->current);
+        }
+        if (m->left > 0) {
+            m->current += m->step;
+            if (--m->left == 0)
+                m->current = m->target;
+        }
+    }
+}
+
+static int16_t src[MAX_FRAMES * 2];
+static int16_t dst[MAX_FRAMES * 2];
+static int16_t expected[MAX_FRAMES * 2];
+
+static int first_difference(const int16_t *a, const int16_t *b, size_t samples)
+{
+    size_t i;
+
+    for (i = 0; i < samples; i++) {
+        if (a[i] != b[i])
+            return (int)i;
+    }
+    return -1;
+}
+
+static void test_unity_and_mute(void)
+{
+    struct gain_ramp ramp;
+    size_t i;
+
+    random_fill(src, MAX_FRAMES * 2);
+    gain_ramp_init(&ramp, 2, RAMP_FRAMES, 1.0f);
+    EXPECT_TRUE(gain_ramp_is_unity(&ramp));
+    gain_ramp_apply(&ramp, dst, src, MAX_FRAMES);
+    EXPECT_EQ(0, memcmp(dst, src, sizeof(src)));
+
+    gain_ramp_init(&ramp, 2, RAMP_FRAMES, 0.0f);
+    EXPECT_TRUE(!gain_ramp_is_unity(&ramp));
+    gain_ramp_apply(&ramp, dst, src, MAX_FRAMES);
+    for (i = 0; i < MAX_FRAMES * 2; i++)
+        EXPECT_EQ(0, dst[i]);
+}
+
+/* a mute ramps down over RAMP_FRAMES and an unmute ramps back to unity,
+ * whatever the size of the writes */
+static void test_ramp(void)
+{
+    struct gain_ramp ramp;
+    int32_t last = INT32_MAX;
+    size_t i, n;
+
+    for (i = 0; i < MAX_FRAMES; i++) {
+        src[i * 2] = INT16_MAX;
+        src[i * 2 + 1] = INT16_MIN + 1;
+    }
+    gain_ramp_init(&ramp, 2, RAMP_FRAMES, 1.0f);
+    gain_ramp_set(&ramp, 0.0f);
+    EXPECT_TRUE(!gain_ramp_is_unity(&ramp));
+
+    for (i = 0; i < RAMP_FRAMES + 10; i += n) {
+        n = i % 7 + 1;
+        gain_ramp_apply(&ramp, dst + i * 2, src + i * 2, n);
+    }
+    for (i = 0; i < RAMP_FRAMES; i++) {
+        EXPECT_TRUE(dst[i * 2] < last);
+        EXPECT_TRUE(dst[i * 2 + 1] <= 0);
+        last = dst[i * 2];
+    }
+    EXPECT_TRUE(dst[0] > INT16_MAX - 2);
+    EXPECT_TRUE(dst[(RAMP_FRAMES - 1) * 2] < INT16_MAX / RAMP_FRAMES + 2);
+    EXPECT_EQ(0, dst[RAMP_FRAMES * 2]);
+
+    gain_ramp_set(&ramp, 1.0f);
+    gain_ramp_apply(&ramp, dst, src, RAMP_FRAMES / 2);
+    EXPECT_TRUE(!gain_ramp_is_unity(&ramp));
+    /* setting the same target again does not restart the ramp */
+    gain_ramp_set(&ramp, 1.0f);
+    gain_ramp_apply(&ramp, dst, src, RAMP_FRAMES / 2);
+    EXPECT_TRUE(gain_ramp_is_unity(&ramp));
+}
+
+/* every length, channel count and gain gives the model output, which
+ * covers the vector loops and their scalar tails */
+static void test_constant_bit_exact(void)
+{
+    static const float gains[] = { 0.0001f, 0.1f, 0.25f, 0.5f, 0.7071f, 0.9999f };
+    struct gain_ramp ramp;
+    struct model m;
+    unsigned int channels, g;
+    size_t frames;
+    int diff;
+
+    for (channels = 1; channels <= 2; channels++) {
+        for (g = 0; g < sizeof(gains) / sizeof(gains[0]); g++) {
+            for (frames = 1; frames <= 40; frames++) {
+                random_fill(src, frames * channels);
+                gain_ramp_init(&ramp, channels, RAMP_FRAMES, gains[g]);
+                model_init(&m, channels, RAMP_FRAMES, gains[g]);
+                gain_ramp_apply(&ramp, dst, src, frames);
+                model_apply(&m, expected, src, frames);
+                diff = first_difference(expected, dst, frames * channels);
+                if (diff >= 0)
+                    fprintf(stderr, "  %u channels, gain %f, %zu frames: sample %d\n",
+                            channels, gains[g], frames, diff);
+                EXPECT_EQ(-1, diff);
+            }
+        }
+    }
+}
+
+static void test_ramp_bit_exact(void)
+{
+    static const float targets[] = { 0.0f, 0.3f, 1.0f, 0.05f, 0.8f, 1.0f };
+    struct gain_ramp ramp;
+    struct model m;
+    unsigned int channels, t;
+    size_t done, n;
+    int diff;
+
+    for (channels = 1; channels <= 2; channels++) {
+        random_fill(src, MAX_FRAMES * channels);
+        gain_ramp_init(&ramp, channels, RAMP_FRAMES, 1.0f);
+        model_init(&m, channels, RAMP_FRAMES, 1.0f);
+
+        /* targets change mid ramp, writes are not multiples of the vectors */
+        for (done = 0, t = 0; done < MAX_FRAMES; done += n, t++) {
+            n = (t * 37) % 61 + 1;
+            if (n > MAX_FRAMES - done)
+                n = MAX_FRAMES - done;
+            if (t % 3 == 0) {
+                gain_ramp_set(&ramp, targets[(t / 3) % 6]);
+                model_set(&m, targets[(t / 3) % 6]);
+            }
+            gain_ramp_apply(&ramp, dst + done * channels, src + done * channels, n);
+            model_apply(&m, expected + done * channels, src + done * channels, n);
+        }
+        diff = first_difference(expected, dst, MAX_FRAMES * channels);
+        if (diff >= 0)
+            fprintf(stderr, "  %u channels: sample %d\n", channels, diff);
+        EXPECT_EQ(-1, diff);
+    }
+}
+
+static void test_in_place(void)
+{
+    struct gain_ramp ramp;
+    struct model m;
+
+    random_fill(src, MAX_FRAMES * 2);
+    memcpy(dst, src, sizeof(src));
+    gain_ramp_init(&ramp, 2, RAMP_FRAMES, 1.0f);
+    model_init(&m, 2, RAMP_FRAMES, 1.0f);
+    gain_ramp_set(&ramp, 0.5f);
+    model_set(&m, 0.5f);
+    gain_ramp_apply(&ramp, dst, dst, MAX_FRAMES);
+    model_apply(&m, expected, src, MAX_FRAMES);
+    EXPECT_EQ(-1, first_difference(expected, dst, MAX_FRAMES * 2));
+}
+
+int main(void)
+{
+#ifdef __ARM_NEON
+    fprintf(stderr, "NEON path\n");
+#endif
+    RUN_TEST(test_unity_and_mute);
+    RUN_TEST(test_ramp);
+    RUN_TEST(test_constant_bit_exact);
+    RUN_TEST(test_ramp_bit_exact);
+    RUN_TEST(test_in_place);
+    return TEST_RESULT();
+}
@@ -0,0 +1,117 @@
+/*
+ * Copyright (C) 2017 The LineageOS Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef NEON_SHIM_ARM_NEON_H
+#define NEON_SHIM_ARM_NEON_H
+
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * Plain C stand-in for the few <arm_neon.h> intrinsics used by the HAL, so
+ * that its NEON paths can be built and run on the host. Each intrinsic
+ * follows the lane by lane definition of the ARM architecture manual, not
+ * the scalar code of the HAL it is compared with.
+ *
+ * Only built with -D__ARM_NEON and this directory first in the include path.
+ */
+
+typedef int16_t int16x4_t __attribute__((vector_size(8)));
+typedef int16_t int16x8_t __attribute__((vector_size(16)));
+typedef int32_t int32x4_t __attribute__((vector_size(16)));
+
+typedef struct {
+    int16x4_t val[2];
+} int16x4x2_t;
+
+static inline int16_t neon_shim_sat16(int64_t v)
+{
+    return v > INT16_MAX ? INT16_MAX : v < INT16_MIN ? INT16_MIN : (int16_t)v;
+}
+
+static inline int16x8_t vld1q_s16(const int16_t *p)
+{
+    int16x8_t v;
+
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline void vst1q_s16(int16_t *p, int16x8_t v)
+{
+    memcpy(p, &v, sizeof(v));
+}
+
+/* saturating rounding doubling multiply returning the high half */
+static inline int16x8_t vqrdmulhq_s16(int16x8_t a, int16x8_t b)
+{
+    int16x8_t r;
+    int i;
+
+    for (i = 0; i < 8; i++)
+        r[i] = neon_shim_sat16((2 * (int64_t)a[i] * b[i] + (1 << 15)) >> 16);
+    return r;
+}
+
+static inline int16x8_t vqrdmulhq_n_s16(int16x8_t a, int16_t b)
+{
+    int16x8_t bv = { b, b, b, b, b, b, b, b };
+
+    return vqrdmulhq_s16(a, bv);
+}
+
+/* saturating shift right and narrow */
+static inline int16x4_t neon_shim_vqshrn_s32(int32x4_t a, int n)
+{
+    int16x4_t r;
+    int i;
+
+    for (i = 0; i < 4; i++)
+        r[i] = neon_shim_sat16(a[i] >> n);
+    return r;
+}
+#define vqshrn_n_s32(a, n) neon_shim_vqshrn_s32((a), (n))
+
+static inline int16x4x2_t vzip_s16(int16x4_t a, int16x4_t b)
+{
+    int16x4x2_t r;
+
+    r.val[0] = (int16x4_t){ a[0], b[0], a[1], b[1] };
+    r.val[1] = (int16x4_t){ a[2], b[2], a[3], b[3] };
+    return r;
+}
+
+static inline int16x8_t vcombine_s16(int16x4_t lo, int16x4_t hi)
+{
+    return (int16x8_t){ lo[0], lo[1], lo[2], lo[3], hi[0], hi[1], hi[2], hi[3] };
+}
+
+static inline int32x4_t vdupq_n_s32(int32_t v)
+{
+    return (int32x4_t){ v, v, v, v };
+}
+
+static inline int32x4_t vaddq_s32(int32x4_t a, int32x4_t b)
+{
+    int32x4_t r;
+    int i;
+
+    /* wraps like the instruction */
+    for (i = 0; i < 4; i++)
+        r[i] = (int32_t)((uint32_t)a[i] + (uint32_t)b[i]);
+    return r;
+}
+#endif
@@ -0,0 +1,343 @@
+/*
+ * Copyright (C) 2017 The LineageOS Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * preproc_pipeline with stub effects: the stages run in order, skipped
+ * stages are bypassed, and every frame comes out once and in order however
+ * the effects and the caller split the work. The input is a counter and
+ * each stub adds its own constant, so the output tells which stages a
+ * frame went through.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "audio_test.h"
+#include "preproc_pipeline.h"
+#include "stub_effect.h"
+
+#define CHANNELS        2
+#define CAPACITY        256     /* frames per stage queue */
+#define TOTAL_FRAMES    20000
+
+/* FX_IID_AGC of audio_effects/effect_agc.h, which the HAL does not include */
+static const effect_uuid_t agc_type =
+        { 0x0a8abfe0, 0x654c, 0x11e0, 0xba26, { 0x00, 0x02, 0xa5, 0xd5, 0xc5, 0x1b } };
+
+static int16_t storage[PREPROC_MAX_STAGES * CAPACITY * CHANNELS];
+
+struct pipeline_test {
+    struct preproc_pipeline p;
+    struct stub_effect stubs[PREPROC_MAX_STAGES];
+    struct stub_effect_log log;
+    unsigned int num_stages;
+    int16_t add;                /* sum over the stages that are not skipped */
+};
+
+static void pipeline_test_init(struct pipeline_test *t, unsigned int num_stages)
+{
+    static const int16_t adds[PREPROC_MAX_STAGES] = { 1, 10, 100 };
+    const effect_uuid_t *types[PREPROC_MAX_STAGES] = { FX_IID_AEC, FX_IID_NS, &agc_type };
+    effect_handle_t handles[PREPROC_MAX_STAGES];
+    unsigned int i;
+
+    memset(t, 0, sizeof(*t));
+    preproc_pipeline_init(&t->p, storage, CAPACITY, CHANNELS);
+    for (i = 0; i < num_stages; i++) {
+        stub_effect_init(&t->stubs[i], types[i], i, CHANNELS);
+        t->stubs[i].add = adds[i];
+        t->stubs[i].log = &t->log;
+        handles[i] = stub_effect_handle(&t->stubs[i]);
+    }
+    t->num_stages = num_stages;
+    preproc_pipeline_set_effects(&t->p, handles, num_stages);
+}
+
+/* call after changing which stubs are skipped */
+static void pipeline_test_update_add(struct pipeline_test *t)
+{
+    unsigned int i;
+
+    t->add = 0;
+    for (i = 0; i < t->num_stages; i++) {
+        if (!t->stubs[i].skip)
+            t->add += t->stubs[i].add;
+    }
+}
+
+/* frames held by the stubs, waiting for a whole block */
+static size_t held_frames(const struct pipeline_test *t)
+{
+    size_t frames = 0;
+    unsigned int i;
+
+    for (i = 0; i < t->num_stages; i++)
+        frames += t->stubs[i].held_frames;
+    return frames;
+}
+
+/*
+ * Pushes TOTAL_FRAMES of counter through the pipeline the way process_frames()
+ * does: on call i, offers in_step(i) frames from the first one not consumed
+ * yet and asks for out_step(i) frames, then keeps reading until the stage
+ * queues are empty. After every call the frames consumed must be the frames
+ * produced plus the frames still inside. Returns the index of the first
+ * output frame that is not the next counter value plus t->add, -1 if all
+ * are, less than -1 on other errors.
+ */
+static int run(struct pipeline_test *t, size_t (*in_step)(unsigned int),
+               size_t (*out_step)(unsigned int), uint64_t *produced)
+{
+    static int16_t in[TOTAL_FRAMES * CHANNELS];
+    static int16_t out[TOTAL_FRAMES * CHANNELS];
+    audio_buffer_t ibuf, obuf;
+    size_t consumed = 0, avail = 0, i, n;
+    unsigned int call, c;
+    int ret;
+
+    for (i = 0; i < TOTAL_FRAMES; i++) {
+        for (c = 0; c < CHANNELS; c++)
+            in[i * CHANNELS + c] = (int16_t)i;
+    }
+
+    *produced = 0;
+    for (call = 0; (consumed < TOTAL_FRAMES || preproc_pipeline_queued(&t->p) > 0) &&
+            call < TOTAL_FRAMES * 4; call++) {
+        n = in_step(call);
+        avail = consumed + n < TOTAL_FRAMES ? n : TOTAL_FRAMES - consumed;
+        ibuf.frameCount = avail;
+        ibuf.s16 = in + consumed * CHANNELS;
+        obuf.frameCount = out_step(call);
+        if (obuf.frameCount > TOTAL_FRAMES - *produced)
+            obuf.frameCount = TOTAL_FRAMES - *produced;
+        obuf.s16 = out + *produced * CHANNELS;
+
+        ret = preproc_pipeline_process(&t->p, &ibuf, &obuf);
+        if (ret != 0)
+            return -2;
+        if (ibuf.frameCount > avail)
+            return -3;
+        consumed += ibuf.frameCount;
+        *produced += obuf.frameCount;
+        if (consumed != *produced + preproc_pipeline_queued(&t->p) + held_frames(t))
+            return -4;
+    }
+
+    if (consumed != TOTAL_FRAMES || preproc_pipeline_queued(&t->p) > 0)
+        return -5;
+
+    for (i = 0; i < *produced; i++) {
+        for (c = 0; c < CHANNELS; c++) {
+            if (out[i * CHANNELS + c] != (int16_t)(i + t->add))
+                return (int)i;
+        }
+    }
+    return -1;
+}
+
+static size_t step_256(unsigned int call)
+{
+    return 256;
+}
+
+static size_t step_odd(unsigned int call)
+{
+    return (call * 37) % 211 + 1;
+}
+
+static size_t step_small(unsigned int call)
+{
+    return (call * 13) % 29 + 1;
+}
+
+static void test_no_stages(void)
+{
+    struct pipeline_test t;
+    uint64_t produced;
+
+    EXPECT_EQ(sizeof(storage), preproc_pipeline_storage_size(CAPACITY, CHANNELS));
+    pipeline_test_init(&t, 0);
+    pipeline_test_update_add(&t);
+    EXPECT_EQ(-1, run(&t, step_odd, step_256, &produced));
+    EXPECT_EQ(TOTAL_FRAMES, produced);
+}
+
+/* every stage runs once per pass, in order, on the output of the previous */
+static void test_order(void)
+{
+    struct pipeline_test t;
+    audio_buffer_t ibuf, obuf;
+    int16_t in[64 * CHANNELS], out[64 * CHANNELS];
+    unsigned int i;
+
+    pipeline_test_init(&t, 3);
+    memset(in, 0, sizeof(in));
+    ibuf.frameCount = 64;
+    ibuf.s16 = in;
+    obuf.frameCount = 64;
+    obuf.s16 = out;
+    ASSERT_EQ(0, preproc_pipeline_process(&t.p, &ibuf, &obuf));
+    EXPECT_EQ(64, ibuf.frameCount);
+    EXPECT_EQ(64, obuf.frameCount);
+    EXPECT_EQ(111, out[0]);
+    EXPECT_EQ(111, out[64 * CHANNELS - 1]);
+
+    ASSERT_EQ(0, preproc_pipeline_process(&t.p, &ibuf, &obuf));
+    ASSERT_EQ(6, t.log.len);
+    for (i = 0; i < 6; i++)
+        EXPECT_EQ(i % 3, t.log.ids[i]);
+}
+
+/* a skipped stage is called, its input goes on to the next stage */
+static void test_skip(void)
+{
+    struct pipeline_test t;
+    uint64_t produced;
+    unsigned int i;
+
+    for (i = 0; i < 3; i++) {
+        pipeline_test_init(&t, 3);
+        t.stubs[i].skip = true;
+        pipeline_test_update_add(&t);
+        EXPECT_EQ(-1, run(&t, step_odd, step_256, &produced));
+        EXPECT_EQ(TOTAL_FRAMES, produced);
+        EXPECT_EQ(0, t.stubs[i].frames_in);
+        EXPECT_TRUE(t.stubs[i].process_calls > 0);
+    }
+
+    /* all of them: a copy */
+    pipeline_test_init(&t, 3);
+    for (i = 0; i < 3; i++)
+        t.stubs[i].skip = true;
+    pipeline_test_update_add(&t);
+    EXPECT_EQ(-1, run(&t, step_odd, step_256, &produced));
+    EXPECT_EQ(TOTAL_FRAMES, produced);
+}
+
+/* stages consuming part of what they are offered leave the rest queued */
+static void test_partial_consumption(void)
+{
+    struct pipeline_test t;
+    uint64_t produced;
+
+    pipeline_test_init(&t, 3);
+    t.stubs[0].max_consume = 37;
+    t.stubs[2].max_consume = 100;
+    pipeline_test_update_add(&t);
+    EXPECT_EQ(-1, run(&t, step_odd, step_256, &produced));
+    EXPECT_EQ(TOTAL_FRAMES, t.stubs[0].frames_in);
+    EXPECT_EQ(TOTAL_FRAMES, produced);
+}
+
+/* 10 ms blocks at 16 kHz and 8 kHz, the caller asking for less than a block */
+static void test_blocks(void)
+{
+    struct pipeline_test t;
+    uint64_t produced;
+
+    pipeline_test_init(&t, 3);
+    t.stubs[0].block = 160;
+    t.stubs[1].block = 80;
+    pipeline_test_update_add(&t);
+    EXPECT_EQ(-1, run(&t, step_odd, step_small, &produced));
+    /* what is left of the last blocks stays in the effects */
+    EXPECT_EQ(TOTAL_FRAMES - held_frames(&t), produced);
+    EXPECT_TRUE(held_frames(&t) < 160 + 80);
+
+    /* a block stage behind a skipped one */
+    pipeline_test_init(&t, 3);
+    t.stubs[0].skip = true;
+    t.stubs[1].block = 160;
+    t.stubs[2].max_consume = 50;
+    pipeline_test_update_add(&t);
+    EXPECT_EQ(-1, run(&t, step_small, step_odd, &produced));
+    EXPECT_EQ(TOTAL_FRAMES - held_frames(&t), produced);
+}
+
+/* a stage turning skipped mid stream, as an effect being disabled, loses
+ * nothing: the frames it left upstream come out next, then those it had
+ * produced and the caller did not read yet, then the new ones */
+static void test_skip_mid_stream(void)
+{
+    struct pipeline_test t;
+    audio_buffer_t ibuf, obuf;
+    int16_t in[200 * CHANNELS], out[200 * CHANNELS];
+    size_t i;
+
+    pipeline_test_init(&t, 2);
+    t.stubs[1].max_consume = 50;
+    for (i = 0; i < 200 * CHANNELS; i++)
+        in[i] = (int16_t)(i / CHANNELS);
+
+    /* stage 0 queues 100, stage 1 takes 50 and the caller reads 20 */
+    ibuf.frameCount = 100;
+    ibuf.s16 = in;
+    obuf.frameCount = 20;
+    obuf.s16 = out;
+    ASSERT_EQ(0, preproc_pipeline_process(&t.p, &ibuf, &obuf));
+    EXPECT_EQ(100, ibuf.frameCount);
+    EXPECT_EQ(20, obuf.frameCount);
+    EXPECT_EQ(50 + 30, preproc_pipeline_queued(&t.p));
+
+    t.stubs[1].skip = true;
+    ibuf.frameCount = 100;
+    ibuf.s16 = in + 100 * CHANNELS;
+    obuf.frameCount = 180;
+    obuf.s16 = out + 20 * CHANNELS;
+    ASSERT_EQ(0, preproc_pipeline_process(&t.p, &ibuf, &obuf));
+    EXPECT_EQ(100, ibuf.frameCount);
+    EXPECT_EQ(180, obuf.frameCount);
+    EXPECT_EQ(0, preproc_pipeline_queued(&t.p));
+    /* the first 50 went through both stages */
+    for (i = 0; i < 200; i++) {
+        if (out[i * CHANNELS] != (int16_t)(i + (i < 50 ? 11 : 1))) {
+            fprintf(stderr, "  frame %zu: %d\n", i, out[i * CHANNELS]);
+            EXPECT_EQ(i + (i < 50 ? 11 : 1), out[i * CHANNELS]);
+            break;
+        }
+    }
+}
+
+static void test_flush(void)
+{
+    struct pipeline_test t;
+    audio_buffer_t ibuf, obuf;
+    int16_t in[100 * CHANNELS], out[100 * CHANNELS];
+
+    pipeline_test_init(&t, 2);
+    t.stubs[1].max_consume = 10;
+    memset(in, 0, sizeof(in));
+    ibuf.frameCount = 100;
+    ibuf.s16 = in;
+    obuf.frameCount = 100;
+    obuf.s16 = out;
+    ASSERT_EQ(0, preproc_pipeline_process(&t.p, &ibuf, &obuf));
+    EXPECT_TRUE(preproc_pipeline_queued(&t.p) > 0);
+    preproc_pipeline_flush(&t.p);
+    EXPECT_EQ(0, preproc_pipeline_queued(&t.p));
+}
+
+int main(void)
+{
+    RUN_TEST(test_no_stages);
+    RUN_TEST(test_order);
+    RUN_TEST(test_skip);
+    RUN_TEST(test_partial_consumption);
+    RUN_TEST(test_blocks);
+    RUN_TEST(test_skip_mid_stream);
+    RUN_TEST(test_flush);
+    return TEST_RESULT();
+}
@@ -0,0 +1,190 @@
+/*
+ * Copyright (C) 2017 The LineageOS Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Stores and loads route caches against the fake mixer, and checks that a
+ * cache from another configuration or HAL build, or with counts that do not
+ * fit the file, is rejected.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "audio_hw_host.h"
+#include "audio_test.h"
+#include "route_cache.h"
+
+/* offsets in the version 3 header, see route_cache.c */
+#define HDR_NUM_PATHS       52
+#define HDR_NUM_SETTINGS    56
+#define HDR_STRINGS_SIZE    60
+
+static struct route_setting on_settings[] = {
+    { .ctl_name = "SPK Switch", .intval = 1 },
+    { .ctl_name = "Speaker Volume", .intval = 57 },
+};
+
+static struct route_setting off_settings[] = {
+    { .ctl_name = "SPK Switch", .intval = 0 },
+    { .ctl_name = "No Such Control", .intval = 3, .strval = "Three" },
+};
+
+static struct route_cache_path paths[] = {
+    { ROUTE_CACHE_PATH_ON, 0, AUDIO_DEVICE_OUT_SPEAKER, on_settings, 2 },
+    { ROUTE_CACHE_PATH_OFF, 0, AUDIO_DEVICE_OUT_SPEAKER, off_settings, 2 },
+};
+
+static struct mixer *mixer;
+static char cache_path[PATH_MAX];
+
+static void resolve(struct route_setting *r, unsigned int len)
+{
+    unsigned int i, j;
+
+    for (i = 0; i < len; i++) {
+        for (j = 0; j < mixer_get_num_ctls(mixer); j++) {
+            if (strcmp(mixer_ctl_get_name(mixer_get_ctl(mixer, j)), r[i].ctl_name) == 0) {
+                r[i].compiled = true;
+                r[i].ctl_id = j;
+                r[i].on_value = r[i].intval;
+            }
+        }
+    }
+}
+
+static int store(struct route_cache_key *key)
+{
+    if (route_cache_get_key(FAKE_TINYALSA_CONFIG, key) != 0)
+        return -1;
+    return route_cache_store(cache_path, key, mixer, paths, 2);
+}
+
+static void patch_u32(off_t offset, uint32_t value)
+{
+    int fd = open(cache_path, O_WRONLY);
+
+    pwrite(fd, &value, sizeof(value), offset);
+    close(fd);
+}
+
+static uint32_t read_u32(off_t offset)
+{
+    uint32_t value = 0;
+    int fd = open(cache_path, O_RDONLY);
+
+    pread(fd, &value, sizeof(value), offset);
+    close(fd);
+    return value;
+}
+
+static void test_round_trip(void)
+{
+    struct route_cache_key key;
+    struct route_cache cache;
+
+    ASSERT_EQ(0, store(&key));
+    ASSERT_EQ(0, route_cache_load(cache_path, &key, mixer, &cache));
+
+    ASSERT_EQ(2, cache.num_paths);
+    EXPECT_EQ(ROUTE_CACHE_PATH_OFF, cache.paths[1].type);
+    EXPECT_EQ(2, cache.paths[0].len);
+    EXPECT_TRUE(strcmp(cache.paths[0].settings[1].ctl_name, "Speaker Volume") == 0);
+    EXPECT_TRUE(cache.paths[0].settings[1].compiled);
+    EXPECT_EQ(on_settings[1].ctl_id, cache.paths[0].settings[1].ctl_id);
+    EXPECT_EQ(57, cache.paths[0].settings[1].on_value);
+    /* unresolved controls are kept by name, to be reported again */
+    EXPECT_TRUE(!cache.paths[1].settings[1].compiled);
+    EXPECT_TRUE(strcmp(cache.paths[1].settings[1].strval, "Three") == 0);
+
+    route_cache_release(&cache);
+}
+
+static void test_key_mismatch(void)
+{
+    struct route_cache_key key, other;
+    struct route_cache cache;
+
+    ASSERT_EQ(0, store(&key));
+
+    /* the same HAL gets the same id */
+    ASSERT_EQ(0, route_cache_get_key(FAKE_TINYALSA_CONFIG, &other));
+    EXPECT_EQ(key.hal_id, other.hal_id);
+
+    other = key;
+    other.hal_id++;
+    EXPECT_EQ(-ESTALE, route_cache_load(cache_path, &other, mixer, &cache));
+    other = key;
+    other.hash++;
+    EXPECT_EQ(-ESTALE, route_cache_load(cache_path, &other, mixer, &cache));
+}
+
+/* counts whose sizes wrap to the file size on 32 bit */
+static void test_wrapping_counts(void)
+{
+    struct route_cache_key key;
+    struct route_cache cache;
+    uint32_t num_settings, strings_size;
+
+    ASSERT_EQ(0, store(&key));
+    num_settings = read_u32(HDR_NUM_SETTINGS);
+    strings_size = read_u32(HDR_STRINGS_SIZE);
+    ASSERT_TRUE(strings_size > 8);
+
+    /* 0x0aaaaaab settings of 24 bytes are 8 bytes more than 4 GiB */
+    patch_u32(HDR_NUM_SETTINGS, num_settings + 0x0aaaaaab);
+    patch_u32(HDR_STRINGS_SIZE, strings_size - 8);
+    EXPECT_EQ(-ESTALE, route_cache_load(cache_path, &key, mixer, &cache));
+
+    ASSERT_EQ(0, store(&key));
+    patch_u32(HDR_NUM_PATHS, 0xffffffff);
+    EXPECT_EQ(-ESTALE, route_cache_load(cache_path, &key, mixer, &cache));
+}
+
+static void test_truncated(void)
+{
+    struct route_cache_key key;
+    struct route_cache cache;
+
+    ASSERT_EQ(0, store(&key));
+    ASSERT_EQ(0, truncate(cache_path, 40));
+    EXPECT_TRUE(route_cache_load(cache_path, &key, mixer, &cache) < 0);
+}
+
+int main(void)
+{
+    fake_tinyalsa_reset();
+    mixer = mixer_open(0);
+    if (!mixer) {
+        fprintf(stderr, "cannot open the fake mixer\n");
+        return 1;
+    }
+    resolve(on_settings, 2);
+    resolve(off_settings, 2);
+    snprintf(cache_path, sizeof(cache_path), "%s/route_cache_test.bin", audio_hw_host_dir());
+
+    RUN_TEST(test_round_trip);
+    RUN_TEST(test_key_mismatch);
+    RUN_TEST(test_wrapping_counts);
+    RUN_TEST(test_truncated);
+
+    unlink(cache_path);
+    mixer_close(mixer);
+    return TEST_RESULT();
+}
@@ -0,0 +1,64 @@
+#!/bin/bash
+#
+# Copyright (C) 2017 The LineageOS Project
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#      http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+
+# Runs the host tests of the audio HAL, after
+#   mmm device/samsung/i9300/audio/tests
+# from a lunched tree. Tests can be named on the command line, all of them
+# run otherwise.
+
+if [ -z "$ANDROID_HOST_OUT" ]; then
+    echo "ANDROID_HOST_OUT is not set, lunch first" >&2
+    exit 1
+fi
+
+TESTS_DIR=$(cd "$(dirname "$0")" && pwd)
+
+export FAKE_TINYALSA_CONFIG="$TESTS_DIR/../../configs/tiny_hw.xml"
+export LD_LIBRARY_PATH="$ANDROID_HOST_OUT/lib64:$ANDROID_HOST_OUT/lib${LD_LIBRARY_PATH:+:$LD_LIBRARY_PATH}"
+
+TESTS="$@"
+if [ -z "$TESTS" ]; then
+    TESTS=$(sed -n 's/^LOCAL_MODULE := \(.*_test\)$/\1/p' "$TESTS_DIR/Android.mk")
+fi
+
+FAILED=""
+for t in $TESTS; do
+    bin=""
+    for dir in "$ANDROID_HOST_OUT"/nativetest64 "$ANDROID_HOST_OUT"/nativetest; do
+        if [ -x "$dir/$t/$t" ]; then
+            bin="$dir/$t/$t"
+            break
+        fi
+    done
+    if [ -z "$bin" ]; then
+        echo "$t: not built"
+        FAILED="$FAILED $t"
+        continue
+    fi
+    if "$bin"; then
+        echo "$t: passed"
+    else
+        echo "$t: FAILED"
+        FAILED="$FAILED $t"
+    fi
+done
+
+if [ -n "$FAILED" ]; then
+    echo "failed:$FAILED"
+    exit 1
+fi
+echo "all passed"
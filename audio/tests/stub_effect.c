@@ -0,0 +1,164 @@
+/*
+ * Copyright (C) 2017 The LineageOS Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "stub_effect.h"
+
+static struct stub_effect *stub_effect_from_handle(effect_handle_t handle)
+{
+    return (struct stub_effect *)handle;
+}
+
+static void copy_add(struct stub_effect *e, int16_t *dst, const int16_t *src, size_t frames)
+{
+    size_t i;
+
+    for (i = 0; i < frames * e->channels; i++)
+        dst[i] = src[i] + e->add;
+}
+
+static int32_t stub_effect_process(effect_handle_t handle, audio_buffer_t *in,
+                                   audio_buffer_t *out)
+{
+    struct stub_effect *e = stub_effect_from_handle(handle);
+    size_t offered = in->frameCount;
+    size_t consumed = 0, produced = 0, n;
+
+    if (e->log != NULL && e->log->len < STUB_EFFECT_LOG_MAX)
+        e->log->ids[e->log->len++] = e->id;
+    e->process_calls++;
+
+    if (e->skip)
+        return -ENODATA;
+
+    if (e->max_consume != 0 && offered > e->max_consume)
+        offered = e->max_consume;
+
+    if (e->block == 0) {
+        consumed = produced = offered < out->frameCount ? offered : out->frameCount;
+        copy_add(e, out->s16, in->s16, consumed);
+    } else {
+        /* fill the block, hand it over whole when there is room for it */
+        while (true) {
+            if (e->held_frames == e->block) {
+                if (out->frameCount - produced < e->block)
+                    break;
+                memcpy(out->s16 + produced * e->channels, e->held,
+                       e->block * e->channels * sizeof(int16_t));
+                produced += e->block;
+                e->held_frames = 0;
+            }
+            n = e->block - e->held_frames;
+            if (n > offered - consumed)
+                n = offered - consumed;
+            if (n == 0)
+                break;
+            copy_add(e, e->held + e->held_frames * e->channels,
+                     in->s16 + consumed * e->channels, n);
+            e->held_frames += n;
+            consumed += n;
+        }
+    }
+
+    in->frameCount = consumed;
+    out->frameCount = produced;
+    e->frames_in += consumed;
+    e->frames_out += produced;
+    return 0;
+}
+
+static int32_t stub_effect_process_reverse(effect_handle_t handle, audio_buffer_t *in,
+                                           audio_buffer_t *out)
+{
+    struct stub_effect *e = stub_effect_from_handle(handle);
+
+    e->reverse_frames += in->frameCount;
+    return 0;
+}
+
+static int32_t stub_effect_command(effect_handle_t handle, uint32_t cmd, uint32_t size,
+                                   void *data, uint32_t *reply_size, void *reply)
+{
+    struct stub_effect *e = stub_effect_from_handle(handle);
+    effect_param_t *param = data;
+
+    switch (cmd) {
+    case EFFECT_CMD_GET_FEATURE_SUPPORTED_CONFIGS:
+        /* main channels only */
+        return -EINVAL;
+    case EFFECT_CMD_GET_CONFIG:
+        if (reply == NULL || *reply_size < sizeof(effect_config_t))
+            return -EINVAL;
+        memset(reply, 0, sizeof(effect_config_t));
+        return 0;
+    case EFFECT_CMD_SET_PARAM:
+        if (size < sizeof(effect_param_t) + 2 * sizeof(int32_t) ||
+                param->psize != sizeof(int32_t))
+            return -EINVAL;
+        e->set_param_calls++;
+        e->param_value = *((int32_t *)param->data + 1);
+        break;
+    default:
+        break;
+    }
+    if (reply != NULL && reply_size != NULL && *reply_size >= sizeof(int32_t))
+        *(int32_t *)reply = 0;
+    return 0;
+}
+
+static int32_t stub_effect_get_descriptor(effect_handle_t handle, effect_descriptor_t *desc)
+{
+    *desc = stub_effect_from_handle(handle)->desc;
+    return 0;
+}
+
+static const struct effect_interface_s stub_effect_interface = {
+    .process = stub_effect_process,
+    .command = stub_effect_command,
+    .get_descriptor = stub_effect_get_descriptor,
+};
+
+/* only the echo canceller takes the echo reference */
+static const struct effect_interface_s stub_aec_interface = {
+    .process = stub_effect_process,
+    .command = stub_effect_command,
+    .get_descriptor = stub_effect_get_descriptor,
+    .process_reverse = stub_effect_process_reverse,
+};
+
+void stub_effect_init(struct stub_effect *e, const effect_uuid_t *type, unsigned int id,
+                      unsigned int channels)
+{
+    memset(e, 0, sizeof(*e));
+    if (memcmp(type, FX_IID_AEC, sizeof(*type)) == 0)
+        e->itfe = &stub_aec_interface;
+    else
+        e->itfe = &stub_effect_interface;
+    e->desc.type = *type;
+    e->desc.apiVersion = EFFECT_CONTROL_API_VERSION;
+    snprintf(e->desc.name, sizeof(e->desc.name), "stub %u", id);
+    snprintf(e->desc.implementor, sizeof(e->desc.implementor), "The LineageOS Project");
+    e->id = id;
+    e->channels = channels;
+}
+
+effect_handle_t stub_effect_handle(struct stub_effect *e)
+{
+    return (effect_handle_t)&e->itfe;
+}
@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2017 The LineageOS Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef STUB_EFFECT_H
+#define STUB_EFFECT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <hardware/audio_effect.h>
+
+/*
+ * Pre-processing effect for the host tests, handed to the HAL with
+ * add_audio_effect() or to a preproc_pipeline directly.
+ *
+ * process() adds a constant to every sample it copies, so the output tells
+ * which stages a frame went through, and can consume fewer frames than
+ * offered or hold them back until a whole block is in, as the webrtc
+ * effects do with their 10 ms blocks. Everything it is asked is counted.
+ */
+
+/* defined by audio_effects/effect_aec.h and effect_ns.h, included by the
+ * HAL: including them again would define the pointers twice */
+extern const effect_uuid_t * const FX_IID_AEC;
+extern const effect_uuid_t * const FX_IID_NS;
+
+#define STUB_EFFECT_MAX_BLOCK   1024    /* frames */
+#define STUB_EFFECT_MAX_CHANNELS 2
+#define STUB_EFFECT_LOG_MAX     64
+
+/* ids of the stubs in the order their process() was called */
+struct stub_effect_log {
+    unsigned int ids[STUB_EFFECT_LOG_MAX];
+    size_t len;
+};
+
+struct stub_effect {
+    const struct effect_interface_s *itfe;     /* the effect_handle_t points here */
+    effect_descriptor_t desc;
+    unsigned int channels;
+
+    /* behaviour */
+    int16_t add;                /* added to every sample */
+    bool skip;                  /* process() returns -ENODATA */
+    size_t max_consume;         /* frames consumed per call, 0 for no limit */
+    size_t block;               /* frames produced in whole blocks only, 0 for none */
+
+    /* call order, shared by the stubs of a chain, may be NULL */
+    unsigned int id;
+    struct stub_effect_log *log;
+
+    /* counters */
+    unsigned int process_calls;
+    uint64_t frames_in;
+    uint64_t frames_out;
+    uint64_t reverse_frames;
+    unsigned int set_param_calls;
+    int32_t param_value;        /* of the last EFFECT_CMD_SET_PARAM */
+
+    /* frames consumed but not produced yet, block mode */
+    int16_t held[STUB_EFFECT_MAX_BLOCK * STUB_EFFECT_MAX_CHANNELS];
+    size_t held_frames;
+};
+
+/* Function prototypes */
+void stub_effect_init(struct stub_effect *e, const effect_uuid_t *type, unsigned int id,
+                      unsigned int channels);
+effect_handle_t stub_effect_handle(struct stub_effect *e);
+#endif
@@ -0,0 +1,216 @@
+/*
+ * Copyright (C) 2017 The LineageOS Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * voice_gate on synthetic input: a voiced signal over background noise
+ * must open the gate within the onset time and close it after the
+ * hangover, noise, clicks and steady tones must not keep it open.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "audio_test.h"
+#include "voice_gate.h"
+
+#define MAX_CHANNELS    2
+#define CHUNK_MS        5
+
+enum signal {
+    SILENCE,
+    NOISE,          /* white, background level */
+    LOUD_NOISE,     /* white, speech level */
+    VOICE,          /* harmonics of 150 Hz over background noise */
+    TONE,           /* 1 kHz */
+};
+
+struct source {
+    unsigned int rate;
+    unsigned int channels;
+    uint32_t seed;
+    uint64_t t;             /* frames generated */
+};
+
+static int16_t noise(struct source *s, int amplitude)
+{
+    s->seed = s->seed * 1103515245 + 12345;
+    return (int16_t)(((int32_t)(s->seed >> 16) - 32768) * amplitude / 32768);
+}
+
+static int16_t sample(struct source *s, enum signal signal)
+{
+    double t = (double)s->t / s->rate;
+    double v;
+
+    switch (signal) {
+    case SILENCE:
+        return 0;
+    case NOISE:
+        return noise(s, 60);
+    case LOUD_NOISE:
+        return noise(s, 8000);
+    case VOICE:
+        v = 4000 * sin(2 * M_PI * 150 * t) + 2000 * sin(2 * M_PI * 300 * t) +
+            1000 * sin(2 * M_PI * 450 * t);
+        return (int16_t)v + noise(s, 60);
+    case TONE:
+        return (int16_t)(4000 * sin(2 * M_PI * 1000 * t));
+    }
+    return 0;
+}
+
+/* feeds ms of signal in CHUNK_MS writes, returns the ms elapsed until the
+ * gate is open (or closed if !open), -1 if that never happened */
+static int feed(struct voice_gate *gate, struct source *s, enum signal signal, unsigned int ms,
+                bool open)
+{
+    int16_t buf[48 * CHUNK_MS * MAX_CHANNELS];
+    size_t frames = s->rate * CHUNK_MS / 1000;
+    unsigned int done, c;
+    size_t i;
+    int16_t v;
+
+    for (done = 0; done < ms; done += CHUNK_MS) {
+        for (i = 0; i < frames; i++, s->t++) {
+            v = sample(s, signal);
+            for (c = 0; c < s->channels; c++)
+                buf[i * s->channels + c] = v;
+        }
+        if (voice_gate_process(gate, buf, frames) == open)
+            return done + CHUNK_MS;
+    }
+    return -1;
+}
+
+static void source_init(struct source *s, unsigned int rate, unsigned int channels)
+{
+    memset(s, 0, sizeof(*s));
+    s->rate = rate;
+    s->channels = channels;
+    s->seed = 1;
+}
+
+/* background noise, then a word: open within the onset time, closed after
+ * the hangover */
+static void check_voice(unsigned int rate, unsigned int channels)
+{
+    struct voice_gate gate;
+    struct source s;
+    int ms;
+
+    source_init(&s, rate, channels);
+    voice_gate_init(&gate, rate, channels);
+
+    EXPECT_EQ(-1, feed(&gate, &s, NOISE, 1000, true));
+
+    ms = feed(&gate, &s, VOICE, 500, true);
+    EXPECT_TRUE(ms >= VOICE_GATE_ONSET_MS);
+    EXPECT_TRUE(ms <= VOICE_GATE_ONSET_MS + VOICE_GATE_BLOCK_MS);
+    EXPECT_EQ(-1, feed(&gate, &s, VOICE, 500, false));
+
+    ms = feed(&gate, &s, NOISE, 2000, false);
+    EXPECT_TRUE(ms >= VOICE_GATE_HANGOVER_MS);
+    EXPECT_TRUE(ms <= VOICE_GATE_HANGOVER_MS + 2 * VOICE_GATE_BLOCK_MS);
+}
+
+static void test_voice(void)
+{
+    check_voice(16000, 1);
+    check_voice(16000, 2);
+    check_voice(8000, 2);
+    check_voice(48000, 2);
+}
+
+static void test_silence_and_noise(void)
+{
+    struct voice_gate gate;
+    struct source s;
+
+    source_init(&s, 16000, 2);
+    voice_gate_init(&gate, 16000, 2);
+    EXPECT_EQ(-1, feed(&gate, &s, SILENCE, 1000, true));
+    EXPECT_EQ(-1, feed(&gate, &s, NOISE, 1000, true));
+    /* white noise crosses zero too often to be voice, however loud */
+    EXPECT_EQ(-1, feed(&gate, &s, LOUD_NOISE, 2000, true));
+    /* after silence a voice opens the gate right away */
+    feed(&gate, &s, SILENCE, 1000, true);
+    EXPECT_TRUE(feed(&gate, &s, VOICE, 100, true) > 0);
+}
+
+/* voice shorter than the onset time does not open the gate */
+static void test_click(void)
+{
+    struct voice_gate gate;
+    struct source s;
+    int i;
+
+    source_init(&s, 16000, 1);
+    voice_gate_init(&gate, 16000, 1);
+    feed(&gate, &s, NOISE, 1000, true);
+    for (i = 0; i < 10; i++) {
+        EXPECT_EQ(-1, feed(&gate, &s, VOICE, VOICE_GATE_ONSET_MS - VOICE_GATE_BLOCK_MS, true));
+        EXPECT_EQ(-1, feed(&gate, &s, NOISE, 200, true));
+    }
+}
+
+/* the noise floor catches up with a steady tone, which then closes the gate */
+static void test_steady_tone(void)
+{
+    struct voice_gate gate;
+    struct source s;
+
+    source_init(&s, 16000, 1);
+    voice_gate_init(&gate, 16000, 1);
+    feed(&gate, &s, NOISE, 1000, true);
+    EXPECT_TRUE(feed(&gate, &s, TONE, 100, true) > 0);
+    EXPECT_TRUE(feed(&gate, &s, TONE, 5000, false) > 0);
+    EXPECT_EQ(-1, feed(&gate, &s, TONE, 2000, true));
+}
+
+/* the decision does not depend on how frames are split across calls */
+static void test_chunking(void)
+{
+    static int16_t buf[16000 * 3];
+    struct voice_gate one, many;
+    struct source s;
+    size_t i, n, done;
+    bool open = false;
+
+    source_init(&s, 16000, 1);
+    for (i = 0; i < 16000 * 3; i++, s.t++)
+        buf[i] = sample(&s, i < 16000 ? NOISE : i < 32000 ? VOICE : NOISE);
+
+    voice_gate_init(&many, 16000, 1);
+    for (done = 0, n = 1; done < 16000 * 3; done += n, n = n * 7 % 173 + 1) {
+        if (n > 16000 * 3 - done)
+            n = 16000 * 3 - done;
+        open = voice_gate_process(&many, buf + done, n);
+    }
+    voice_gate_init(&one, 16000, 1);
+    EXPECT_EQ(voice_gate_process(&one, buf, 16000 * 3), open);
+    EXPECT_EQ(0, memcmp(&one, &many, sizeof(one)));
+}
+
+int main(void)
+{
+    RUN_TEST(test_voice);
+    RUN_TEST(test_silence_and_noise);
+    RUN_TEST(test_click);
+    RUN_TEST(test_steady_tone);
+    RUN_TEST(test_chunking);
+    return TEST_RESULT();
+}
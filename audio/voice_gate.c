@@ -0,0 +1,111 @@
+/*
+ * Copyright (C) 2017 The LineageOS Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+
+#include "voice_gate.h"
+
+/* noise floor time constants in blocks, as shifts: falling, rising in
+ * silence (~0.6 s) and rising during speech (~5 s) */
+#define NOISE_FALL_SHIFT        2
+#define NOISE_RISE_SHIFT        6
+#define NOISE_RISE_SPEECH_SHIFT 9
+
+static unsigned int ms_to_blocks(unsigned int ms)
+{
+    return (ms + VOICE_GATE_BLOCK_MS - 1) / VOICE_GATE_BLOCK_MS;
+}
+
+void voice_gate_init(struct voice_gate *gate, unsigned int rate, unsigned int channels)
+{
+    memset(gate, 0, sizeof(*gate));
+    gate->channels = channels;
+    gate->block_frames = rate * VOICE_GATE_BLOCK_MS / 1000;
+    if (gate->block_frames == 0)
+        gate->block_frames = 1;
+    gate->onset_blocks = ms_to_blocks(VOICE_GATE_ONSET_MS);
+    gate->hangover_blocks = ms_to_blocks(VOICE_GATE_HANGOVER_MS);
+}
+
+static void voice_gate_update_noise(struct voice_gate *gate, uint64_t energy, bool speech)
+{
+    if (gate->noise == 0)
+        gate->noise = energy > 0 ? energy : 1;
+    else if (energy < gate->noise)
+        gate->noise -= (gate->noise - energy) >> NOISE_FALL_SHIFT;
+    else
+        gate->noise += (energy - gate->noise) >>
+                (speech ? NOISE_RISE_SPEECH_SHIFT : NOISE_RISE_SHIFT);
+
+    /* digital silence must not make any sound look like speech */
+    if (gate->noise == 0)
+        gate->noise = 1;
+}
+
+static void voice_gate_end_block(struct voice_gate *gate)
+{
+    uint64_t energy = gate->energy / gate->block_frames;
+    bool speech;
+
+    /* above 40% zero crossings a block is rather noise than voice */
+    speech = gate->noise != 0 &&
+             energy > VOICE_GATE_MIN_ENERGY &&
+             energy > gate->noise * VOICE_GATE_SNR &&
+             gate->crossings * 5 < gate->block_frames * 2;
+
+    voice_gate_update_noise(gate, energy, speech);
+
+    if (speech) {
+        if (gate->speech_run < gate->onset_blocks)
+            gate->speech_run++;
+        if (gate->speech_run >= gate->onset_blocks) {
+            gate->open = true;
+            gate->hang_left = gate->hangover_blocks;
+        }
+    } else {
+        gate->speech_run = 0;
+        if (gate->hang_left > 0 && --gate->hang_left == 0)
+            gate->open = false;
+    }
+
+    gate->fill = 0;
+    gate->energy = 0;
+    gate->crossings = 0;
+}
+
+bool voice_gate_process(struct voice_gate *gate, const int16_t *buf, size_t frames)
+{
+    unsigned int channels = gate->channels;
+    unsigned int c;
+    int32_t s;
+
+    for (; frames > 0; frames--, buf += channels) {
+        s = buf[0];
+        for (c = 1; c < channels; c++)
+            s += buf[c];
+        s /= (int32_t)channels;
+
+        gate->energy += (uint64_t)((int64_t)s * s);
+        if ((s < 0) != (gate->last < 0))
+            gate->crossings++;
+        gate->last = s;
+
+        if (++gate->fill == gate->block_frames)
+            voice_gate_end_block(gate);
+    }
+
+    return gate->open;
+}
@@ -0,0 +1,69 @@
+/*
+ * Copyright (C) 2017 The LineageOS Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef VOICE_GATE_H
+#define VOICE_GATE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* the decision is taken on blocks of this duration */
+#define VOICE_GATE_BLOCK_MS     10
+/* speech must last this long to open the gate... */
+#define VOICE_GATE_ONSET_MS     30
+/* ...which closes after this much silence */
+#define VOICE_GATE_HANGOVER_MS  600
+/* a block is speech above the noise floor times this (9 dB)... */
+#define VOICE_GATE_SNR          8
+/* ...and above this mean square, about -50 dBFS */
+#define VOICE_GATE_MIN_ENERGY   10000
+
+/*
+ * Energy based voice activity gate for interleaved 16 bit frames.
+ *
+ * The channels are mixed down and each block is compared with a noise floor
+ * that follows the quietest blocks quickly and louder ones slowly, so that a
+ * steady noise is eventually ignored. Blocks crossing zero too often are not
+ * counted as speech, which keeps hiss and clicks from opening the gate.
+ *
+ * The gate costs one multiply-accumulate per frame and has no dependency
+ * besides the C library, so it can be run on recorded files on the host.
+ */
+struct voice_gate {
+    unsigned int channels;
+    size_t block_frames;
+    unsigned int onset_blocks;
+    unsigned int hangover_blocks;
+
+    /* block being accumulated */
+    size_t fill;
+    uint64_t energy;
+    unsigned int crossings;
+    int32_t last;
+
+    uint64_t noise;             /* mean square, 0 until the first block */
+    unsigned int speech_run;    /* consecutive speech blocks */
+    unsigned int hang_left;     /* blocks until the gate closes */
+    bool open;
+};
+
+/* Function prototypes */
+void voice_gate_init(struct voice_gate *gate, unsigned int rate, unsigned int channels);
+
+/* returns whether the gate is open after the last complete block */
+bool voice_gate_process(struct voice_gate *gate, const int16_t *buf, size_t frames);
+#endif
@@ -30,8 +30,12 @@ PRODUCT_COPY_FILES += \
 
 # Audio
 PRODUCT_COPY_FILES += \
+    $(LOCAL_PATH)/configs/audio_effects.conf:system/vendor/etc/audio_effects.conf \
     $(LOCAL_PATH)/configs/tiny_hw.xml:system/etc/sound/m0
 
+PRODUCT_PACKAGES += \
+    libcodecfx
+
 # Sensors
 PRODUCT_PACKAGES += \
     sensors.smdk4x12
@@ -0,0 +1,44 @@
+# Copyright (C) 2017 The LineageOS Project
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#      http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+LOCAL_PATH := $(call my-dir)
+
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := libthreadpolicy
+LOCAL_MODULE_TAGS := optional
+
+LOCAL_SRC_FILES := thread_policy.c
+
+LOCAL_C_INCLUDES := $(LOCAL_PATH)/include
+LOCAL_EXPORT_C_INCLUDE_DIRS := $(LOCAL_PATH)/include
+
+LOCAL_SHARED_LIBRARIES := liblog libcutils
+
+include $(BUILD_STATIC_LIBRARY)
+
+# for the audio HAL host tests
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := libthreadpolicy
+LOCAL_MODULE_TAGS := optional
+
+LOCAL_SRC_FILES := thread_policy.c
+
+LOCAL_C_INCLUDES := $(LOCAL_PATH)/include
+LOCAL_EXPORT_C_INCLUDE_DIRS := $(LOCAL_PATH)/include
+
+LOCAL_STATIC_LIBRARIES := liblog libcutils
+
+include $(BUILD_HOST_STATIC_LIBRARY)
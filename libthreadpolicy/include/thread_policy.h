@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) 2017 The LineageOS Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef THREAD_POLICY_H
+#define THREAD_POLICY_H
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* "thread_policy.<name>" overrides the scheduling of a thread, as
+ * "fifo:<priority>" or "nice:<level>" */
+#define THREAD_POLICY_PROPERTY_PREFIX "thread_policy."
+
+/* wake-up latency is reported over windows of this length... */
+#define THREAD_LATENCY_WINDOW_NS    (10 * 1000000000LL)
+/* ...as a warning if the worst case reached this */
+#define THREAD_LATENCY_WARN_US      5000
+/* how often a thread kept off core 0 checks that it still is */
+#define THREAD_AFFINITY_CHECK_NS    1000000000LL
+
+/*
+ * Scheduling of a worker thread.
+ *
+ * SCHED_FIFO needs CAP_SYS_NICE, which the process may not have: the thread
+ * then runs SCHED_OTHER at the given nice level instead. Core 0 takes most
+ * interrupts and is the only one online when the system is idle, so
+ * latency sensitive threads may ask to run on the other cores whenever one
+ * of them is online.
+ */
+struct thread_policy {
+    const char *name;           /* thread name, at most 15 characters */
+    int sched_policy;           /* SCHED_FIFO or SCHED_OTHER */
+    int rt_priority;            /* SCHED_FIFO priority */
+    int nice;                   /* SCHED_OTHER nice level, also the SCHED_FIFO fallback */
+    bool avoid_cpu0;
+};
+
+/* wake-up latency of a thread, reset at each report */
+struct thread_latency {
+    const struct thread_policy *policy;
+    uint32_t count;
+    int64_t sum_us;
+    int64_t max_us;
+    int64_t window_start_ns;
+    int64_t affinity_check_ns;
+};
+
+/* Function prototypes */
+int thread_policy_create(pthread_t *thread, const struct thread_policy *policy,
+                         void *(*start_routine)(void *), void *arg);
+int thread_policy_apply(const struct thread_policy *policy);
+int thread_policy_update_affinity(const struct thread_policy *policy);
+
+void thread_latency_init(struct thread_latency *lat, const struct thread_policy *policy);
+void thread_latency_record(struct thread_latency *lat, int64_t latency_us);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
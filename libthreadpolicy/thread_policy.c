@@ -0,0 +1,282 @@
+/*
+ * Copyright (C) 2017 The LineageOS Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define LOG_TAG "thread_policy"
+/*#define LOG_NDEBUG 0*/
+
+/* cpu_set_t, sched_setaffinity() and gettid() */
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/prctl.h>
+#include <sys/resource.h>
+#ifndef __BIONIC__
+#include <sys/syscall.h>
+#endif
+
+#include <cutils/log.h>
+#include <cutils/properties.h>
+
+#include "thread_policy.h"
+
+#ifndef __BIONIC__
+/* the host glibc only has gettid() since 2.30 */
+#define gettid() ((pid_t)syscall(SYS_gettid))
+#endif
+
+#define CPU_ONLINE_PATH   "/sys/devices/system/cpu/online"
+#define CPU_POSSIBLE_PATH "/sys/devices/system/cpu/possible"
+
+struct thread_start {
+    struct thread_policy policy;
+    void *(*start_routine)(void *);
+    void *arg;
+};
+
+/* parse a sysfs CPU list such as "0-1,3" */
+static int read_cpu_list(const char *path, cpu_set_t *set)
+{
+    char buf[64];
+    char *p, *end;
+    long first, last;
+    int fd, n;
+
+    CPU_ZERO(set);
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return -errno;
+    n = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (n <= 0)
+        return -EIO;
+    buf[n] = '\0';
+
+    p = buf;
+    while (*p != '\0' && *p != '\n') {
+        first = strtol(p, &end, 10);
+        if (end == p)
+            return -EINVAL;
+        last = first;
+        if (*end == '-') {
+            p = end + 1;
+            last = strtol(p, &end, 10);
+            if (end == p)
+                return -EINVAL;
+        }
+        for (; first <= last && first < CPU_SETSIZE; first++)
+            CPU_SET(first, set);
+        p = end;
+        if (*p == ',')
+            p++;
+    }
+    return 0;
+}
+
+/* the policy of the thread with its property override applied */
+static void get_policy(const struct thread_policy *policy, struct thread_policy *out)
+{
+    char key[PROPERTY_KEY_MAX];
+    char value[PROPERTY_VALUE_MAX];
+    int level;
+
+    *out = *policy;
+    if (policy->name == NULL)
+        return;
+
+    snprintf(key, sizeof(key), THREAD_POLICY_PROPERTY_PREFIX "%s", policy->name);
+    if (property_get(key, value, "") <= 0)
+        return;
+
+    if (sscanf(value, "fifo:%d", &level) == 1) {
+        out->sched_policy = SCHED_FIFO;
+        out->rt_priority = level;
+    } else if (sscanf(value, "nice:%d", &level) == 1) {
+        out->sched_policy = SCHED_OTHER;
+        out->nice = level;
+    } else {
+        ALOGW("%s: ignoring %s=%s", __func__, key, value);
+    }
+}
+
+/* Run the calling thread on the cores other than core 0. Cores currently
+ * offline are part of the mask so the thread moves to them once they are
+ * plugged in. If all of them go offline later, the kernel resets the
+ * affinity of the thread: calling this again restores it, which
+ * thread_latency_record() does. */
+int thread_policy_update_affinity(const struct thread_policy *policy)
+{
+    cpu_set_t possible, online, mask;
+    int cpu, num_online = 0;
+
+    if (!policy->avoid_cpu0)
+        return 0;
+
+    if (read_cpu_list(CPU_POSSIBLE_PATH, &possible) != 0 ||
+            read_cpu_list(CPU_ONLINE_PATH, &online) != 0)
+        return -ENODEV;
+
+    CPU_ZERO(&mask);
+    for (cpu = 1; cpu < CPU_SETSIZE; cpu++) {
+        if (!CPU_ISSET(cpu, &possible))
+            continue;
+        CPU_SET(cpu, &mask);
+        if (CPU_ISSET(cpu, &online))
+            num_online++;
+    }
+
+    /* only core 0 is online, the thread has to run there */
+    if (num_online == 0)
+        return -EAGAIN;
+
+    if (sched_setaffinity(0, sizeof(mask), &mask) != 0) {
+        ALOGW("%s: %s: cannot set affinity: %s", __func__, policy->name, strerror(errno));
+        return -errno;
+    }
+    return 0;
+}
+
+/* apply policy to the calling thread, which keeps its name: the name of the
+ * policy only selects the property override. Returns the first error, or
+ * -EAGAIN if the thread could not leave core 0 yet: thread_latency_record()
+ * retries then. */
+int thread_policy_apply(const struct thread_policy *policy)
+{
+    struct thread_policy p;
+    struct sched_param param;
+    int ret = 0, aff;
+
+    get_policy(policy, &p);
+
+    if (p.sched_policy == SCHED_FIFO) {
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = p.rt_priority;
+        if (sched_setscheduler(0, SCHED_FIFO, &param) == 0) {
+            ALOGV("%s: %s: SCHED_FIFO %d", __func__, p.name, p.rt_priority);
+            goto affinity;
+        }
+        ALOGW("%s: %s: SCHED_FIFO %d denied (%s), using nice %d", __func__, p.name,
+              p.rt_priority, strerror(errno), p.nice);
+    }
+
+    if (setpriority(PRIO_PROCESS, gettid(), p.nice) != 0) {
+        ret = -errno;
+        ALOGW("%s: %s: cannot set nice %d: %s", __func__, p.name, p.nice, strerror(errno));
+    }
+
+affinity:
+    aff = thread_policy_update_affinity(&p);
+    if (aff != 0) {
+        ALOGV("%s: %s: affinity not set: %d", __func__, p.name, aff);
+        if (ret == 0)
+            ret = aff;
+    }
+    return ret;
+}
+
+static void *thread_policy_start(void *context)
+{
+    struct thread_start start = *(struct thread_start *)context;
+
+    free(context);
+    if (start.policy.name != NULL)
+        prctl(PR_SET_NAME, (unsigned long)start.policy.name, 0, 0, 0);
+    thread_policy_apply(&start.policy);
+    return start.start_routine(start.arg);
+}
+
+/* pthread_create() for a thread running with policy, returns 0 or an errno */
+int thread_policy_create(pthread_t *thread, const struct thread_policy *policy,
+                         void *(*start_routine)(void *), void *arg)
+{
+    struct thread_start *start;
+    int ret;
+
+    start = malloc(sizeof(*start));
+    if (start == NULL)
+        return ENOMEM;
+
+    start->policy = *policy;
+    start->start_routine = start_routine;
+    start->arg = arg;
+
+    ret = pthread_create(thread, NULL, thread_policy_start, start);
+    if (ret != 0)
+        free(start);
+    return ret;
+}
+
+static int64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+void thread_latency_init(struct thread_latency *lat, const struct thread_policy *policy)
+{
+    memset(lat, 0, sizeof(*lat));
+    lat->policy = policy;
+    lat->window_start_ns = now_ns();
+    lat->affinity_check_ns = lat->window_start_ns + THREAD_AFFINITY_CHECK_NS;
+}
+
+/* Account for one wake-up, latency_us after the event the thread waited for.
+ * The average and worst case are logged once per window. A thread that
+ * avoids core 0 but runs there lost its affinity, which was never set or
+ * was reset when the other cores went offline: it is set again once they
+ * are back. */
+void thread_latency_record(struct thread_latency *lat, int64_t latency_us)
+{
+    const char *name = lat->policy->name;
+    int64_t now = now_ns();
+
+    if (lat->policy->avoid_cpu0 && now >= lat->affinity_check_ns) {
+        lat->affinity_check_ns = now + THREAD_AFFINITY_CHECK_NS;
+        if (sched_getcpu() == 0 && thread_policy_update_affinity(lat->policy) == 0)
+            ALOGV("%s: affinity restored", name);
+    }
+
+    if (latency_us < 0)
+        latency_us = 0;
+    lat->count++;
+    lat->sum_us += latency_us;
+    if (latency_us > lat->max_us)
+        lat->max_us = latency_us;
+
+    if (now - lat->window_start_ns < THREAD_LATENCY_WINDOW_NS)
+        return;
+
+    if (lat->max_us >= THREAD_LATENCY_WARN_US)
+        ALOGW("%s: wake-up latency avg %lld us max %lld us over %u wake-ups", name,
+              (long long)(lat->sum_us / lat->count), (long long)lat->max_us, lat->count);
+    else
+        ALOGV("%s: wake-up latency avg %lld us max %lld us over %u wake-ups", name,
+              (long long)(lat->sum_us / lat->count), (long long)lat->max_us, lat->count);
+
+    lat->count = 0;
+    lat->sum_us = 0;
+    lat->max_us = 0;
+    lat->window_start_ns = now;
+}